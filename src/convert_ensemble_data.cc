@@ -0,0 +1,83 @@
+#include <iostream>
+#include <fstream>
+#include <boost/program_options.hpp>
+#include "twpipe/logging.h"
+#include "twpipe/json.hpp"
+#include "twpipe/ensemble.h"
+
+namespace po = boost::program_options;
+
+void init_command_line(int argc, char* argv[], po::variables_map& conf) {
+  po::options_description generic_opts("Generic options");
+  generic_opts.add_options()
+    ("verbose,v", "Details logging.")
+    ("help,h", "show help information.")
+    ("input", po::value<std::string>(), "the path to the json lines ensemble data.")
+    ("output", po::value<std::string>(), "the path to the binary ensemble data.")
+    ("top-k", po::value<unsigned>()->default_value(0), "keep the top-k probabilities of each step, 0 keeps all of them in fp16.")
+    ;
+
+  po::options_description cmd("Usage: ./convert_ensemble_data --input [input] --output [output] [--top-k k]");
+  cmd.add(generic_opts);
+
+  po::store(po::parse_command_line(argc, argv, cmd), conf);
+  po::notify(conf);
+
+  if (conf.count("help")) {
+    std::cerr << cmd << std::endl;
+    exit(1);
+  }
+  twpipe::init_boost_log(conf.count("verbose") > 0);
+
+  if (!conf.count("input") || !conf.count("output")) {
+    std::cerr << "Please specify the input and the output." << std::endl;
+    exit(1);
+  }
+}
+
+int main(int argc, char* argv[]) {
+  po::variables_map conf;
+  init_command_line(argc, argv, conf);
+
+  std::string input = conf["input"].as<std::string>();
+  std::string output = conf["output"].as<std::string>();
+  unsigned top_k = conf["top-k"].as<unsigned>();
+
+  // the instances are converted one line at a time, so the json data is
+  // never held in memory as a whole.
+  std::ifstream ifs(input);
+  if (!ifs) {
+    _ERROR << "[convert] failed to open " << input;
+    return 1;
+  }
+  twpipe::EnsembleDataWriter writer;
+  std::string buffer;
+  unsigned n_instances = 0;
+  while (std::getline(ifs, buffer)) {
+    if (buffer.empty()) { continue; }
+    nlohmann::json payload = nlohmann::json::parse(buffer);
+    twpipe::EnsembleInstance instance;
+    instance.id = payload.at(twpipe::EnsembleInstance::id_name).get<unsigned>();
+    instance.categories = payload.at(twpipe::EnsembleInstance::category_name).get<std::vector<unsigned>>();
+    instance.probs = payload.at(twpipe::EnsembleInstance::prob_name).get<std::vector<std::vector<float>>>();
+    if (instance.probs.empty()) { continue; }
+
+    if (n_instances == 0 && !writer.open(output, instance.probs[0].size(), top_k)) {
+      _ERROR << "[convert] failed to open " << output;
+      return 1;
+    }
+    writer.write(instance);
+    n_instances++;
+  }
+  if (n_instances == 0) {
+    _ERROR << "[convert] no instance found in " << input;
+    return 1;
+  }
+  if (!writer.close()) {
+    _ERROR << "[convert] failed to write " << output;
+    return 1;
+  }
+  _INFO << "[convert] " << n_instances << " instances converted, with "
+    << (writer.top_k == 0 ? "dense fp16" : "top-" + std::to_string(writer.top_k)) << " probabilities.";
+  return 0;
+}
@@ -1,4 +1,5 @@
 #include "arceager.h"
+#include "oracle.h"
 #include "twpipe/logging.h"
 #include "twpipe/corpus.h"
 #include "twpipe/alphabet_collection.h"
@@ -18,6 +19,7 @@ ArcEager::ArcEager() : TransitionSystem() {
   for (const auto& action_name : action_names) {
     _INFO << "- " << action_name;
   }
+  build_mask_cache();
 }
 
 std::string ArcEager::name() const {
@@ -35,6 +37,8 @@ bool ArcEager::allow_nonprojective() const {
 
 unsigned ArcEager::num_actions() const { return n_actions; }
 
+unsigned ArcEager::num_structure_actions() const { return 4; }
+
 bool ArcEager::is_shift(const unsigned& action) { return action == 0; }
 bool ArcEager::is_reduce(const unsigned& action) { return action == 1; }
 bool ArcEager::is_left(const unsigned& action) { return (action > 1 && action % 2 == 0); }
@@ -54,8 +58,7 @@ void ArcEager::left_unsafe(State& state, const unsigned& deprel) const {
   unsigned mod = state.stack.back();
   unsigned hed = state.buffer.back();
   state.stack.pop_back();
-  state.heads[mod] = hed;
-  state.deprels[mod] = deprel;
+  state.add_arc(mod, hed, deprel);
 }
 
 void ArcEager::right_unsafe(State& state, const unsigned& deprel) const {
@@ -63,8 +66,7 @@ void ArcEager::right_unsafe(State& state, const unsigned& deprel) const {
   unsigned mod = state.buffer.back();
   state.stack.push_back(state.buffer.back());
   state.buffer.pop_back();
-  state.heads[mod] = hed;
-  state.deprels[mod] = deprel;
+  state.add_arc(mod, hed, deprel);
 }
 
 void ArcEager::reduce_unsafe(State& state) const {
@@ -76,10 +78,13 @@ float ArcEager::shift_dynamic_loss_unsafe(State& state,
                                           const std::vector<unsigned>& ref_deprels) const {
   float c = 0.;
   unsigned b = state.buffer.back();
-  for (unsigned i = 1; i < state.stack.size(); ++i) {
-    unsigned k = state.stack[i];
-    if (ref_heads[k] == b && state.heads[k] == Corpus::BAD_HED) { c += 1.; }
+  // the GUARD is at the bottom of the stack.
+  unsigned depth = 0;
+  for (unsigned k : state.stack) {
+    if (depth + 1 == state.stack.size()) { break; }
+    if (ref_heads[k] == b && state.head(k) == Corpus::BAD_HED) { c += 1.; }
     if (ref_heads[b] == k) { c += 1.; }
+    ++depth;
   }
   shift_unsafe(state);
   return c;
@@ -92,10 +97,15 @@ float ArcEager::left_dynamic_loss_unsafe(State& state,
   float c = 0.;
   unsigned s = state.stack.back();
   unsigned b = state.buffer.back();
-  for (unsigned i = 1; i < state.buffer.size() - 1; ++i) {
-    unsigned k = state.buffer[i];
-    if (ref_heads[k] == s) { c += 1.; }
-    if (ref_heads[s] == k) { c += 1.; }
+  // skip b on the top and the GUARD at the bottom of the buffer.
+  unsigned depth = 0;
+  for (unsigned k : state.buffer) {
+    if (depth + 1 == state.buffer.size()) { break; }
+    if (depth > 0) {
+      if (ref_heads[k] == s) { c += 1.; }
+      if (ref_heads[s] == k) { c += 1.; }
+    }
+    ++depth;
   }
   if (ref_heads[b] == s) { c += 1.; }
   if (ref_heads[s] == b && ref_deprels[s] != deprel) { c += 1.; }
@@ -110,12 +120,17 @@ float ArcEager::right_dynamic_loss_unsafe(State& state,
   float c = 0.;
   unsigned s = state.stack.back();
   unsigned b = state.buffer.back();
-  for (unsigned i = 1; i < state.stack.size() - 1; ++i) {
-    unsigned k = state.stack[i];
-    if (ref_heads[k] == b && state.heads[k] == Corpus::BAD_HED) { c += 1.; }
-    if (ref_heads[b] == k) { c += 1.; }
+  // skip s on the top and the GUARD at the bottom of the stack.
+  unsigned depth = 0;
+  for (unsigned k : state.stack) {
+    if (depth + 1 == state.stack.size()) { break; }
+    if (depth > 0) {
+      if (ref_heads[k] == b && state.head(k) == Corpus::BAD_HED) { c += 1.; }
+      if (ref_heads[b] == k) { c += 1.; }
+    }
+    ++depth;
   }
-  if (ref_heads[s] == b && state.heads[s] == Corpus::BAD_HED) { c += 1.; }
+  if (ref_heads[s] == b && state.head(s) == Corpus::BAD_HED) { c += 1.; }
 
   /*for (unsigned i = 1; i < state.buffer.size() - 1; ++i) {
     unsigned k = state.buffer[i];
@@ -132,54 +147,113 @@ float ArcEager::reduce_dynamic_loss_unsafe(State& state,
                                            const std::vector<unsigned>& ref_deprels) const {
   float c = 0.;
   unsigned s = state.stack.back();
-  for (unsigned i = 1; i < state.buffer.size(); ++i) {
-    unsigned k = state.buffer[i];
+  // the GUARD is at the bottom of the buffer.
+  unsigned depth = 0;
+  for (unsigned k : state.buffer) {
+    if (depth + 1 == state.buffer.size()) { break; }
     if (ref_heads[k] == s) { c += 1.; }
+    ++depth;
   }
   reduce_unsafe(state);
   return c;
 }
 
+unsigned ArcEager::shift_cost(const State& state, const OracleScratch& oracle) const {
+  // b loses its head and its unattached children on the stack.
+  unsigned b = state.buffer.back();
+  unsigned c = (oracle.in_stack(oracle.ref_heads[b]) ? 1 : 0);
+  for (const unsigned * d = oracle.children_begin(b); d != oracle.children_end(b); ++d) {
+    if (oracle.in_stack(*d) && !oracle.has_head(*d)) { c += 1; }
+  }
+  return c;
+}
+
+unsigned ArcEager::left_cost(const State& state, const OracleScratch& oracle) const {
+  // s loses its head and its children in \beta, and b as a child.
+  unsigned s = state.stack.back();
+  unsigned b = state.buffer.back();
+  unsigned h = oracle.ref_heads[s];
+  unsigned c = (oracle.in_buffer(h) && h != b ? 1 : 0);
+  for (const unsigned * d = oracle.children_begin(s); d != oracle.children_end(s); ++d) {
+    if (oracle.in_buffer(*d)) { c += 1; }
+  }
+  return c;
+}
+
+unsigned ArcEager::right_cost(const State& state, const OracleScratch& oracle) const {
+  // b loses its head on the stack below s, its unattached children on the
+  // stack and its head in \beta.
+  unsigned s = state.stack.back();
+  unsigned b = state.buffer.back();
+  unsigned h = oracle.ref_heads[b];
+  unsigned c = (oracle.in_stack(h) && h != s ? 1 : 0);
+  for (const unsigned * d = oracle.children_begin(b); d != oracle.children_end(b); ++d) {
+    if (oracle.in_stack(*d) && !oracle.has_head(*d)) { c += 1; }
+  }
+  if (h > b) { c += 1; }
+  return c;
+}
+
+unsigned ArcEager::reduce_cost(const State& state, const OracleScratch& oracle) const {
+  // s loses its children in {b} U \beta.
+  unsigned s = state.stack.back();
+  unsigned c = 0;
+  for (const unsigned * d = oracle.children_begin(s); d != oracle.children_end(s); ++d) {
+    if (oracle.in_buffer(*d)) { c += 1; }
+  }
+  return c;
+}
+
 void ArcEager::get_transition_costs(const State& state,
                                     const std::vector<unsigned>& actions,
                                     const std::vector<unsigned>& ref_heads,
                                     const std::vector<unsigned>& ref_deprels,
                                     std::vector<float>& rewards) {
-  float wrong_left = -1e8;
-  float wrong_right = -1e8;
+  OracleScratch & oracle = OracleScratch::get();
+  oracle.prepare(ref_heads);
+  oracle.load(state);
+  // the structural costs are shared by all the labels, -1 before computed.
+  float structure_costs[4] = { -1.f, -1.f, -1.f, -1.f };
   rewards.clear();
 
   for (unsigned act : actions) {
+    unsigned structure = get_structure_action(act);
+    if (structure_costs[structure] < 0.f) {
+      unsigned c = (structure == 0 ? shift_cost(state, oracle) :
+                    (structure == 1 ? reduce_cost(state, oracle) :
+                     (structure == 2 ? left_cost(state, oracle) : right_cost(state, oracle))));
+      structure_costs[structure] = static_cast<float>(c);
+    }
+    float c = structure_costs[structure];
+    if (structure > 1) {
+      unsigned s = state.stack.back(), b = state.buffer.back();
+      unsigned mod = (structure == 2 ? s : b), hed = (structure == 2 ? b : s);
+      if (ref_heads[mod] == hed && ref_deprels[mod] != parse_label(act)) { c += 1.f; }
+    }
+    rewards.push_back(-c);
+  }
+
+#ifdef TWPIPE_DEBUG_ORACLE
+  for (unsigned i = 0; i < actions.size(); ++i) {
     State next_state(state);
+    unsigned act = actions[i];
+    float reference = 0.f;
     if (is_shift(act)) {
-      rewards.push_back(-shift_dynamic_loss_unsafe(next_state, ref_heads, ref_deprels));
+      reference = -shift_dynamic_loss_unsafe(next_state, ref_heads, ref_deprels);
     } else if (is_left(act)) {
-      unsigned deprel = parse_label(act);
-      unsigned hed = state.buffer.back(), mod = state.stack.back();
-      if (ref_heads[mod] == hed && ref_deprels[mod] == deprel) {
-        // assume that actions are unique and there is only one correct left action.
-        rewards.push_back(-left_dynamic_loss_unsafe(next_state, deprel, ref_heads, ref_deprels));
-      } else if (wrong_left == -1e8) {
-        wrong_left = -left_dynamic_loss_unsafe(next_state, deprel, ref_heads, ref_deprels);
-        rewards.push_back(wrong_left);
-      } else {
-        rewards.push_back(wrong_left);
-      }
+      reference = -left_dynamic_loss_unsafe(next_state, parse_label(act), ref_heads, ref_deprels);
     } else if (is_right(act)) {
-      unsigned deprel = parse_label(act);
-      unsigned mod = state.stack.back(), hed = state.stack[state.stack.size() - 2];
-      if (ref_heads[mod] == hed && ref_deprels[mod] == deprel) {
-        rewards.push_back(-right_dynamic_loss_unsafe(next_state, deprel, ref_heads, ref_deprels));
-      } else if (wrong_right == -1e8) {
-        wrong_right = -right_dynamic_loss_unsafe(next_state, deprel, ref_heads, ref_deprels);
-        rewards.push_back(wrong_right);
-      } else {
-        rewards.push_back(wrong_right);
-      }
+      reference = -right_dynamic_loss_unsafe(next_state, parse_label(act), ref_heads, ref_deprels);
     } else {
-      rewards.push_back(-reduce_dynamic_loss_unsafe(next_state, ref_heads, ref_deprels));
+      reference = -reduce_dynamic_loss_unsafe(next_state, ref_heads, ref_deprels);
+    }
+    if (reference != rewards[i]) {
+      _ERROR << "[parse|arceager] cost of " << name(act) << " is " << rewards[i]
+        << ", the reference is " << reference;
+      BOOST_ASSERT_MSG(false, "[parse|arceager] the oracle differs from the reference.");
     }
   }
+#endif
 }
 
 void ArcEager::perform_action(State& state, const unsigned& action) {
@@ -194,51 +268,39 @@ void ArcEager::perform_action(State& state, const unsigned& action) {
   }
 }
 
-bool ArcEager::is_valid_action(const State & state, const unsigned & act) const {
-  return false;
-}
-
-void ArcEager::get_valid_actions(const State& state, std::vector<unsigned>& valid_actions) {
-  BOOST_ASSERT_MSG(false, "Unimplemented.");
-  valid_actions.clear();
-  unsigned root_id = state.heads.size() - 1;
-  unsigned b = state.buffer.back();
-
-  // count the empty heads
-  unsigned n_empty_heads = 0;
-  for (unsigned i = 1; i < state.stack.size(); ++i) {
-    unsigned s = state.stack[i];
-    if (state.heads[s] == Corpus::BAD_HED) { n_empty_heads++; }
+unsigned ArcEager::get_valid_structure_mask(const State& state) const {
+  // twpipe is left-rooted, the root is word 0 and is shifted first. The
+  // guards are at the bottom of the stack and the buffer.
+  unsigned mask = 0;
+  bool has_b = (state.buffer.size() > 1);
+  if (state.stack.size() == 1) {
+    if (has_b) { mask |= (1u << get_shift_id()); }
+    return mask;
   }
 
-  if (b < root_id - 1 ||
-    (b == root_id - 1 && n_empty_heads == 0) ||
-      (b == root_id && state.stack.size() == 1)) {
-    valid_actions.push_back(get_shift_id());
-  }
-
-  if (state.stack.size() > 1) {
-    unsigned s = state.stack.back();
-    if (state.heads[s] != Corpus::BAD_HED) {
-      valid_actions.push_back(get_reduce_id());
-    } else {
-      // try LeftArc
-      if (b < root_id) {
-        for (unsigned i = 0; i < num_deprels(); ++i) {
-          unsigned act = get_left_id(i);
-        }
-      } else {
-      }
-    }
-
-    // try RightArc
-    if (b < root_id - 1 || (b == root_id - 1 && n_empty_heads == 1)) {
-      for (unsigned i = 0; i < num_deprels(); ++i) {
-        unsigned act = get_right_id(i);
-      }
+  unsigned s = state.stack.back();
+  bool s_has_head = (state.head(s) != Corpus::BAD_HED);
+  if (s_has_head) { mask |= (1u << get_reduce_id()); }
+  if (!has_b) { return mask; }
+
+  // once the buffer runs out, a word on the stack without head never gets
+  // one, so the last word may only be attached by RIGHT and only when all
+  // the words below it, but the root, have their heads.
+  bool last_b = (state.buffer.size() == 2);
+  if (!last_b) { mask |= (1u << get_shift_id()); }
+  if (!s_has_head && s != 0) { mask |= (1u << 2); }
+
+  bool can_right = true;
+  if (last_b) {
+    unsigned depth = 0;
+    for (unsigned k : state.stack) {
+      if (depth + 1 == state.stack.size()) { break; }
+      if (k != 0 && state.head(k) == Corpus::BAD_HED) { can_right = false; break; }
+      ++depth;
     }
   }
-  BOOST_ASSERT_MSG(valid_actions.size() > 0, "There should be one or more valid action.");
+  if (can_right) { mask |= (1u << 3); }
+  return mask;
 }
 
 unsigned ArcEager::parse_label(const unsigned& action) {
@@ -259,8 +321,8 @@ void ArcEager::get_oracle_actions(const std::vector<unsigned>& ref_heads,
   }
 }
 
-unsigned ArcEager::get_structure_action(const unsigned & action) {
-  return (action < 3 ? action : (action % 2 == 1 ? 3 : 4));
+unsigned ArcEager::get_structure_action(const unsigned & action) const {
+  return (action < 2 ? action : (action % 2 == 0 ? 2 : 3));
 }
 
 void ArcEager::get_oracle_actions_onestep(const std::vector<unsigned>& ref_heads,
@@ -1,4 +1,5 @@
 #include "archybrid.h"
+#include "oracle.h"
 #include "twpipe/logging.h"
 #include "twpipe/corpus.h"
 #include "twpipe/alphabet_collection.h"
@@ -19,6 +20,7 @@ ArcHybrid::ArcHybrid() {
   for (const auto& action_name : action_names) {
     _INFO << "- " << action_name;
   }
+  build_mask_cache();
 }
 
 std::string ArcHybrid::name() const {
@@ -36,6 +38,8 @@ bool ArcHybrid::allow_nonprojective() const {
 
 unsigned ArcHybrid::num_actions() const { return n_actions; }
 
+unsigned ArcHybrid::num_structure_actions() const { return 3; }
+
 void ArcHybrid::shift_unsafe(State& state) const {
   state.stack.push_back(state.buffer.back());
   state.buffer.pop_back();
@@ -45,16 +49,14 @@ void ArcHybrid::left_unsafe(State& state, const unsigned& deprel) const {
   unsigned hed = state.buffer.back();
   unsigned mod = state.stack.back();
   state.stack.pop_back();
-  state.heads[mod] = hed;
-  state.deprels[mod] = deprel;
+  state.add_arc(mod, hed, deprel);
 }
 
 void ArcHybrid::right_unsafe(State& state, const unsigned& deprel) const {
   unsigned mod = state.stack.back();
   state.stack.pop_back();
   unsigned hed = state.stack.back();
-  state.heads[mod] = hed;
-  state.deprels[mod] = deprel;
+  state.add_arc(mod, hed, deprel);
 }
 
 float ArcHybrid::shift_dynamic_loss_unsafe(State& state,
@@ -62,22 +64,15 @@ float ArcHybrid::shift_dynamic_loss_unsafe(State& state,
                                            const std::vector<unsigned>& ref_deprels) const {
   float c = 0.;
   unsigned b = state.buffer.back();
-  // The H = {s_1} U \sigma part
-  // state.stack[0] = GUARD
-  unsigned i_end = ((state.stack.size() > 2) ? state.stack.size() - 2 : 0);
-  for (unsigned i = 1; i < i_end; ++i) {
-    unsigned h = state.stack[i];
-    if (ref_heads[b] == h) { c += 1.; }
-  }
-  if (i_end > 0) {
-    unsigned h = state.stack[i_end];
-    if (ref_heads[b] == h) { c += 1.; }
-  }
-  // The D = {s_1, s_0} U \sigma part
-  // state.stack[0] = GUARD
-  for (unsigned i = 1; i < state.stack.size(); ++i) {
-    unsigned d = state.stack[i];
-    if (ref_heads[d] == b) { c += 1.; }
+  // walk the stack from s_0, the GUARD is at the bottom.
+  unsigned depth = 0;
+  for (unsigned k : state.stack) {
+    if (depth + 1 == state.stack.size()) { break; }
+    // The H = {s_1} U \sigma part
+    if (depth > 0 && ref_heads[b] == k) { c += 1.; }
+    // The D = {s_1, s_0} U \sigma part
+    if (ref_heads[k] == b) { c += 1.; }
+    ++depth;
   }
   shift_unsafe(state);
   return c;
@@ -90,23 +85,20 @@ float ArcHybrid::left_dynamic_loss_unsafe(State& state,
   float c = 0.;
   unsigned s_0 = state.stack.back();
   unsigned b = state.buffer.back();
-  // The H = {s_1} U \beta part
-  // state.buffer[0] = GUARD
-  for (unsigned i = 1; i < state.buffer.size() - 1; ++i) {
-    unsigned h = state.buffer[i];
-    if (ref_heads[s_0] == h) { c += 1.; }
+  // walk the buffer from b, the GUARD is at the bottom.
+  unsigned depth = 0;
+  for (unsigned k : state.buffer) {
+    if (depth + 1 == state.buffer.size()) { break; }
+    // The H = {s_1} U \beta part
+    if (depth > 0 && ref_heads[s_0] == k) { c += 1.; }
+    // The D = {b} U \beta part
+    if (ref_heads[k] == s_0) { c += 1.; }
+    ++depth;
   }
-  unsigned i_end = ((state.stack.size() > 2) ? state.stack.size() - 2 : 0);
-  if (i_end > 0) {
-    unsigned h = state.stack[i_end];
+  if (state.stack.size() > 2) {
+    unsigned h = state.stack.top(1);
     if (ref_heads[s_0] == h) { c += 1.; }
   }
-  // The D = {b} U \beta part
-  // state.buffer[0] = GUARD
-  for (unsigned i = 1; i < state.buffer.size(); ++i) {
-    unsigned d = state.buffer[i];
-    if (ref_heads[d] == s_0) { c += 1.; }
-  }
   if (ref_heads[s_0] == b && ref_deprels[s_0] != deprel) { c += 1.; }
   left_unsafe(state, deprel);
   return c;
@@ -118,56 +110,96 @@ float ArcHybrid::right_dynamic_loss_unsafe(State& state,
                                            const std::vector<unsigned>& ref_deprels) const {
   float c = 0.;
   unsigned s_0 = state.stack.back();
-  unsigned s_1 = state.stack[state.stack.size() - 2];
-  // state.buffer[0] = GUARD
-  for (unsigned i = 1; i < state.buffer.size(); ++i) {
-    unsigned k = state.buffer[i];
+  unsigned s_1 = state.stack.top(1);
+  // the GUARD is at the bottom of the buffer.
+  unsigned depth = 0;
+  for (unsigned k : state.buffer) {
+    if (depth + 1 == state.buffer.size()) { break; }
     if (ref_heads[s_0] == k) { c += 1.; }
     if (ref_heads[k] == s_0) { c += 1.; }
+    ++depth;
   }
   if (ref_heads[s_0] == s_1 && ref_deprels[s_0] != deprel) { c += 1.; }
   right_unsafe(state, deprel);
   return c;
 }
 
+unsigned ArcHybrid::shift_cost(const State& state, const OracleScratch& oracle) const {
+  // b loses its head in {s_1} U \sigma and its children in {s_0, s_1} U \sigma.
+  unsigned b = state.buffer.back();
+  unsigned s_0 = state.stack.back();
+  unsigned h = oracle.ref_heads[b];
+  unsigned c = (oracle.in_stack(h) && h != s_0 ? 1 : 0);
+  for (const unsigned * d = oracle.children_begin(b); d != oracle.children_end(b); ++d) {
+    if (oracle.in_stack(*d)) { c += 1; }
+  }
+  return c;
+}
+
+unsigned ArcHybrid::left_cost(const State& state, const OracleScratch& oracle) const {
+  // s_0 loses its head in {s_1} U \beta and its children in {b} U \beta.
+  unsigned s_0 = state.stack.back();
+  unsigned b = state.buffer.back();
+  unsigned h = oracle.ref_heads[s_0];
+  unsigned c = (oracle.in_buffer(h) && h != b ? 1 : 0);
+  if (state.stack.size() > 2 && h == state.stack.top(1)) { c += 1; }
+  for (const unsigned * d = oracle.children_begin(s_0); d != oracle.children_end(s_0); ++d) {
+    if (oracle.in_buffer(*d)) { c += 1; }
+  }
+  return c;
+}
+
+unsigned ArcHybrid::right_cost(const State& state, const OracleScratch& oracle) const {
+  // s_0 loses its head and its children in {b} U \beta.
+  unsigned s_0 = state.stack.back();
+  unsigned c = (oracle.in_buffer(oracle.ref_heads[s_0]) ? 1 : 0);
+  for (const unsigned * d = oracle.children_begin(s_0); d != oracle.children_end(s_0); ++d) {
+    if (oracle.in_buffer(*d)) { c += 1; }
+  }
+  return c;
+}
+
 void ArcHybrid::get_transition_costs(const State & state,
                                      const std::vector<unsigned>& actions,
                                      const std::vector<unsigned>& ref_heads,
                                      const std::vector<unsigned>& ref_deprels,
                                      std::vector<float> & costs) {
-  float wrong_left = -1e8;
-  float wrong_right = -1e8;
+  OracleScratch & oracle = OracleScratch::get();
+  oracle.prepare(ref_heads);
+  oracle.load(state);
+  // the structural costs are shared by all the labels, -1 before computed.
+  float structure_costs[3] = { -1.f, -1.f, -1.f };
   costs.clear();
 
   for (unsigned act : actions) {
+    unsigned structure = get_structure_action(act);
+    if (structure_costs[structure] < 0.f) {
+      structure_costs[structure] = static_cast<float>(structure == 0 ? shift_cost(state, oracle) :
+        (structure == 1 ? left_cost(state, oracle) : right_cost(state, oracle)));
+    }
+    float c = structure_costs[structure];
+    if (structure > 0) {
+      unsigned mod = state.stack.back();
+      unsigned hed = (structure == 1 ? state.buffer.back() : state.stack.top(1));
+      if (ref_heads[mod] == hed && ref_deprels[mod] != parse_label(act)) { c += 1.f; }
+    }
+    costs.push_back(-c);
+  }
+
+#ifdef TWPIPE_DEBUG_ORACLE
+  for (unsigned i = 0; i < actions.size(); ++i) {
     State next_state(state);
-    if (is_shift(act)) {
-      costs.push_back(-shift_dynamic_loss_unsafe(next_state, ref_heads, ref_deprels));
-    } else if (is_left(act)) {
-      unsigned deprel = parse_label(act);
-      unsigned hed = state.buffer.back(), mod = state.stack.back();
-      if (ref_heads[mod] == hed && ref_deprels[mod] == deprel) {
-        // assume that actions are unique and there is only one correct left action.
-        costs.push_back(-left_dynamic_loss_unsafe(next_state, deprel, ref_heads, ref_deprels));
-      } else if (wrong_left == -1e8) {
-        wrong_left = -left_dynamic_loss_unsafe(next_state, deprel, ref_heads, ref_deprels);
-        costs.push_back(wrong_left);
-      } else {
-        costs.push_back(wrong_left);
-      }
-    } else {
-      unsigned deprel = parse_label(act);
-      unsigned mod = state.stack.back(), hed = state.stack[state.stack.size() - 2];
-      if (ref_heads[mod] == hed && ref_deprels[mod] == deprel) {
-        costs.push_back(-right_dynamic_loss_unsafe(next_state, deprel, ref_heads, ref_deprels));
-      } else if (wrong_right == -1e8) {
-        wrong_right = -right_dynamic_loss_unsafe(next_state, deprel, ref_heads, ref_deprels);
-        costs.push_back(wrong_right);
-      } else {
-        costs.push_back(wrong_right);
-      }
+    unsigned act = actions[i];
+    float reference = -(is_shift(act) ? shift_dynamic_loss_unsafe(next_state, ref_heads, ref_deprels) :
+      (is_left(act) ? left_dynamic_loss_unsafe(next_state, parse_label(act), ref_heads, ref_deprels) :
+       right_dynamic_loss_unsafe(next_state, parse_label(act), ref_heads, ref_deprels)));
+    if (reference != costs[i]) {
+      _ERROR << "[parse|archybrid] cost of " << name(act) << " is " << costs[i]
+        << ", the reference is " << reference;
+      BOOST_ASSERT_MSG(false, "[parse|archybrid] the oracle differs from the reference.");
     }
   }
+#endif
 }
 
 void ArcHybrid::perform_action(State & state, const unsigned& action) {
@@ -188,28 +220,17 @@ bool ArcHybrid::is_shift(const unsigned & action) { return action == 0; }
 bool ArcHybrid::is_left(const unsigned & action) { return (action % 2 == 1); }
 bool ArcHybrid::is_right(const unsigned & action) { return (action > 0 && action % 2 == 0); }
 
-bool ArcHybrid::is_valid_action(const State& state, const unsigned& act) const {
-  if (is_shift(act)) {
-    /// guard should not be shifted.
-    if (state.buffer.size() <= 1) { return false; }
-  } else if (is_left(act)) {
+unsigned ArcHybrid::get_valid_structure_mask(const State& state) const {
+  unsigned mask = 0;
+  /// guard should not be shifted.
+  if (state.buffer.size() > 1) { mask |= (1u << 0); }
+  /// pseduo root should not be reduced.
+  if (state.stack.size() >= 3) {
     /// guard not should not be head.
-    if (state.buffer.size() < 2) { return false; }
-    /// pseduo root should not be reduced.
-    if (state.stack.size() < 3) { return false; }
-  } else {
-    if (state.stack.size() < 3) { return false; }
-  }
-  return true;
-}
-
-void ArcHybrid::get_valid_actions(const State& state, std::vector<unsigned>& valid_actions) {
-  valid_actions.clear();
-  for (unsigned a = 0; a < n_actions; ++a) {
-    if (!is_valid_action(state, a)) { continue; }
-    valid_actions.push_back(a);
+    if (state.buffer.size() >= 2) { mask |= (1u << 1); }
+    mask |= (1u << 2);
   }
-  BOOST_ASSERT_MSG(valid_actions.size() > 0, "There should be one or more valid action.");
+  return mask;
 }
 
 unsigned ArcHybrid::parse_label(const unsigned& action) {
@@ -231,7 +252,7 @@ void ArcHybrid::get_oracle_actions(const std::vector<unsigned>& heads,
   }
 }
 
-unsigned ArcHybrid::get_structure_action(const unsigned & action) {
+unsigned ArcHybrid::get_structure_action(const unsigned & action) const {
   return (action == 0 ? action : (action % 2 == 1 ? 1 : 2));
 }
 
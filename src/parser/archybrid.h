@@ -5,6 +5,8 @@
 
 namespace twpipe {
 
+struct OracleScratch;
+
 struct ArcHybrid : public TransitionSystem {
   unsigned n_actions;
   std::vector<std::string> action_names;
@@ -19,6 +21,8 @@ struct ArcHybrid : public TransitionSystem {
 
   unsigned num_actions() const override;
 
+  unsigned num_structure_actions() const override;
+
   void get_transition_costs(const State & state,
                             const std::vector<unsigned> & actions,
                             const std::vector<unsigned> & ref_heads,
@@ -27,16 +31,14 @@ struct ArcHybrid : public TransitionSystem {
 
   void perform_action(State & state, const unsigned& action) override;
 
-  bool is_valid_action(const State& state, const unsigned& act) const override;
 
-  void get_valid_actions(const State& state,
-                         std::vector<unsigned>& valid_actions) override;
+  unsigned get_valid_structure_mask(const State& state) const override;
 
   void get_oracle_actions(const std::vector<unsigned>& heads,
                           const std::vector<unsigned>& deprels,
                           std::vector<unsigned>& actions) override;
 
-  unsigned get_structure_action(const unsigned & action) override;
+  unsigned get_structure_action(const unsigned & action) const override;
 
   void shift_unsafe(State& state) const;
   void left_unsafe(State& state, const unsigned& deprel) const;
@@ -56,6 +58,13 @@ struct ArcHybrid : public TransitionSystem {
                                   const std::vector<unsigned>& heads,
                                   const std::vector<unsigned>& deprels) const;
 
+  /// The structural part of the dynamic oracle costs, i.e. the number of
+  /// reachable gold arcs lost by the transition, regardless of the label.
+  /// The state and the gold tree are read from the loaded oracle.
+  unsigned shift_cost(const State& state, const OracleScratch& oracle) const;
+  unsigned left_cost(const State& state, const OracleScratch& oracle) const;
+  unsigned right_cost(const State& state, const OracleScratch& oracle) const;
+
   static bool is_shift(const unsigned& action);
   static bool is_left(const unsigned& action);
   static bool is_right(const unsigned& action);
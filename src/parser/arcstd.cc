@@ -21,6 +21,7 @@ ArcStandard::ArcStandard() {
   for (const auto& action_name : action_names) {
     _INFO << "- " << action_name;
   }
+  build_mask_cache();
 }
 
 std::string twpipe::ArcStandard::name() const {
@@ -38,6 +39,8 @@ bool ArcStandard::allow_nonprojective() const {
 
 unsigned ArcStandard::num_actions() const { return n_actions; }
 
+unsigned ArcStandard::num_structure_actions() const { return 3; }
+
 void ArcStandard::shift_unsafe(State& state) const {
   state.stack.push_back(state.buffer.back());
   state.buffer.pop_back();
@@ -46,31 +49,243 @@ void ArcStandard::shift_unsafe(State& state) const {
 void ArcStandard::left_unsafe(State& state,
                               const unsigned& deprel) const {
   unsigned hed = state.stack.back(); state.stack.pop_back();
-  unsigned mod = state.stack.back(); state.stack.back() = hed;
-  state.heads[mod] = hed;
-  state.deprels[mod] = deprel;
+  unsigned mod = state.stack.back(); state.stack.pop_back();
+  state.stack.push_back(hed);
+  state.add_arc(mod, hed, deprel);
 }
 
 void ArcStandard::right_unsafe(State& state,
                                const unsigned& deprel) const {
   unsigned mod = state.stack.back(); state.stack.pop_back();
   unsigned hed = state.stack.back();
-  state.heads[mod] = hed;
-  state.deprels[mod] = deprel;
+  state.add_arc(mod, hed, deprel);
 }
 
-unsigned ArcStandard::cost(const State& state,
-                           const std::vector<unsigned>& ref_heads,
-                           const std::vector<unsigned>& ref_deprels) const {
+/// The scratch of the dynamic oracle. The gold tree is built once per
+/// sentence, and the buffers are reused across the calls.
+struct ArcStandardOracle {
+  static const unsigned kInf = 100000;
+
+  std::vector<unsigned> ref_heads;
+  std::vector<std::vector<unsigned>> tree;
+  unsigned root;
+
+  // the configuration being scored. The stack and the buffer are kept in
+  // step with the persistent stacks of the last state loaded, along with
+  // the node of each element, so the next state of the same sentence only
+  // copies the elements it doesn't share with it. The arcs are read from
+  // the state, which must outlive the calls on it.
+  std::weak_ptr<State::Storage> storage;
+  std::vector<unsigned> stack, buffer, stack_nodes, buffer_nodes;
+  const State::Tree * arcs;
+
+  std::vector<unsigned> sigma_l, sigma_r, items;
+  std::vector<int> position;
+  std::vector<unsigned> table;
+  /// The tree cost after each structure action, kInf + 1 before computed.
+  unsigned tree_costs[3];
+  /// The penalty of the loaded arcs, kInf + 1 before computed.
+  unsigned arc_penalty;
+
+  void prepare(const std::vector<unsigned> & gold_heads) {
+    if (gold_heads == ref_heads) { return; }
+    ref_heads = gold_heads;
+    unsigned len = ref_heads.size();
+    tree.assign(len, std::vector<unsigned>());
+    root = 0;
+    for (unsigned i = 0; i < len; ++i) {
+      unsigned h = ref_heads[i];
+      if (h != Corpus::BAD_HED) { tree[h].push_back(i); } else { root = i; }
+    }
+    position.assign(len, -1);
+  }
+
+  /// Bring the elements (and their nodes) in step with the persistent
+  /// stack. The nodes are never modified, so the elements below the first
+  /// node both have at the same depth are the same and are kept.
+  static void sync(const PersistentStack<unsigned> & s,
+                   std::vector<unsigned> & values,
+                   std::vector<unsigned> & nodes) {
+    const std::vector<PersistentStack<unsigned>::Node> & arena = s.arena->nodes;
+    unsigned depth = s.size();
+    unsigned node = s.top_node;
+    while (depth > nodes.size()) { node = arena[node].below; --depth; }
+    while (depth > 0 && nodes[depth - 1] != node) { node = arena[node].below; --depth; }
+
+    values.resize(s.size());
+    nodes.resize(s.size());
+    node = s.top_node;
+    for (unsigned i = s.size(); i > depth; --i) {
+      values[i - 1] = arena[node].value;
+      nodes[i - 1] = node;
+      node = arena[node].below;
+    }
+  }
+
+  void load(const State & state) {
+    if (storage.lock() != state.storage) {
+      // another sentence, nothing to share.
+      storage = state.storage;
+      stack_nodes.clear();
+      buffer_nodes.clear();
+    }
+    sync(state.stack, stack, stack_nodes);
+    sync(state.buffer, buffer, buffer_nodes);
+    arcs = state.tree.get();
+    tree_costs[0] = tree_costs[1] = tree_costs[2] = kInf + 1;
+    arc_penalty = kInf + 1;
+  }
+
+  /// The cost of the configuration, see ArcStandard::cost.
+  unsigned cost(const std::vector<unsigned> & ref_deprels, unsigned structure) {
+    if (stack.size() == 1) { return 0; }
+    if (arc_penalty > kInf) { arc_penalty = penalty(ref_deprels); }
+    if (structure > 2) { return tree_cost() + arc_penalty; }
+    if (tree_costs[structure] > kInf) { tree_costs[structure] = tree_cost(); }
+    return tree_costs[structure] + arc_penalty;
+  }
+
+  /// The cost after performing a structure action (0 shift, 1 left, 2 right)
+  /// with the deprel, the configuration is restored afterwards. The tree part
+  /// doesn't depend on the deprel, so it is computed once per structure. The
+  /// modifier has no head yet, so the new arc only adds its own penalty.
+  unsigned cost_after(unsigned structure, unsigned deprel, const std::vector<unsigned> & ref_deprels) {
+    unsigned ret = 0;
+    if (structure == 0) {
+      stack.push_back(buffer.back());
+      buffer.pop_back();
+      ret = cost(ref_deprels, structure);
+      buffer.push_back(stack.back());
+      stack.pop_back();
+    } else {
+      unsigned n = stack.size();
+      unsigned hed = (structure == 1 ? stack[n - 1] : stack[n - 2]);
+      unsigned mod = (structure == 1 ? stack[n - 2] : stack[n - 1]);
+      BOOST_ASSERT_MSG(arcs->heads[mod] == Corpus::BAD_HED, "[parse|arcstd] the modifier has a head.");
+      stack[n - 2] = hed;
+      stack.pop_back();
+      ret = cost(ref_deprels, structure);
+      if (hed != ref_heads[mod] || deprel != ref_deprels[mod]) { ret += 1; }
+      stack.back() = (structure == 1 ? mod : hed);
+      stack.push_back(structure == 1 ? hed : mod);
+    }
+    return ret;
+  }
+
+  unsigned penalty(const std::vector<unsigned> & ref_deprels) const {
+    const std::vector<unsigned> & heads = arcs->heads;
+    const std::vector<unsigned> & deprels = arcs->deprels;
+    unsigned len = ref_heads.size();
+    unsigned end = std::min(buffer.back(), len);
+    unsigned ret = 0;
+    for (unsigned i = 0; i < end; ++i) {
+      if (heads[i] != Corpus::BAD_HED &&
+          (heads[i] != ref_heads[i] || deprels[i] != ref_deprels[i])) {
+        ret += 1;
+      }
+    }
+    return ret;
+  }
+
+  /// The DP of the original cost function, with the head dimension remapped
+  /// from the sentence to the words in sigma_l and sigma_r.
+  unsigned tree_cost() {
+    sigma_l.clear();
+    for (unsigned i = stack.size() - 1; i > 0; --i) { sigma_l.push_back(stack[i]); }
+    sigma_r.clear();
+    sigma_r.push_back(sigma_l.back());
+
+    std::bitset<State::MAX_N_WORDS> sigma_l_mask;
+    std::bitset<State::MAX_N_WORDS> sigma_r_mask;
+    for (auto s : sigma_l) { sigma_l_mask.set(s); }
+
+    unsigned buffer_front = buffer.back();
+    for (unsigned i = buffer.size() - 1; i > 0; --i) {
+      unsigned id = buffer[i];
+      if (ref_heads[id] < buffer_front || ref_heads[id] == Corpus::BAD_HED) {
+        sigma_r.push_back(id); sigma_r_mask.set(id); continue;
+      }
+      for (auto d : tree[id]) {
+        if (sigma_l_mask.test(d) || sigma_r_mask.test(d)) {
+          sigma_r.push_back(id); sigma_r_mask.set(id); break;
+        }
+      }
+    }
+
+    items.clear();
+    for (auto s : sigma_l) {
+      if (position[s] < 0) { position[s] = items.size(); items.push_back(s); }
+    }
+    for (auto s : sigma_r) {
+      if (position[s] < 0) { position[s] = items.size(); items.push_back(s); }
+    }
+
+    int len_l = static_cast<int>(sigma_l.size());
+    int len_r = static_cast<int>(sigma_r.size());
+    unsigned n_items = items.size();
+    table.assign(len_l * len_r * n_items, kInf);
+    auto T = [&](int i, int j, unsigned word) -> unsigned & {
+      return table[(i * len_r + j) * n_items + position[word]];
+    };
+
+    T(0, 0, sigma_l[0]) = 0;
+    for (int d = 1; d <= len_l + len_r - 1; ++d) {
+      for (int j = std::max(0, d - len_l); j < std::min(d, len_r); ++j) {
+        int i = d - j - 1;
+        if (i < len_l - 1) {
+          unsigned i_1 = sigma_l[i + 1];
+          for (int rank = 0; rank <= i; ++rank) {
+            unsigned h = sigma_l[rank];
+            T(i + 1, j, h) = std::min(T(i + 1, j, h), T(i, j, h) + (ref_heads[i_1] == h ? 0 : 1));
+            T(i + 1, j, i_1) = std::min(T(i + 1, j, i_1), T(i, j, h) + (ref_heads[h] == i_1 ? 0 : 1));
+          }
+          for (int rank = 0; rank <= j; ++rank) {
+            unsigned h = sigma_r[rank];
+            T(i + 1, j, h) = std::min(T(i + 1, j, h), T(i, j, h) + (ref_heads[i_1] == h ? 0 : 1));
+            T(i + 1, j, i_1) = std::min(T(i + 1, j, i_1), T(i, j, h) + (ref_heads[h] == i_1 ? 0 : 1));
+          }
+        }
+
+        if (j < len_r - 1) {
+          unsigned j_1 = sigma_r[j + 1];
+          for (int rank = 0; rank <= i; ++rank) {
+            unsigned h = sigma_l[rank];
+            T(i, j + 1, h) = std::min(T(i, j + 1, h), T(i, j, h) + (ref_heads[j_1] == h ? 0 : 1));
+            T(i, j + 1, j_1) = std::min(T(i, j + 1, j_1), T(i, j, h) + (ref_heads[h] == j_1 ? 0 : 1));
+          }
+          for (int rank = 0; rank <= j; ++rank) {
+            unsigned h = sigma_r[rank];
+            T(i, j + 1, h) = std::min(T(i, j + 1, h), T(i, j, h) + (ref_heads[j_1] == h ? 0 : 1));
+            T(i, j + 1, j_1) = std::min(T(i, j + 1, j_1), T(i, j, h) + (ref_heads[h] == j_1 ? 0 : 1));
+          }
+        }
+      }
+    }
+    // note, ROOT is not zero but last one.
+    unsigned ret = (position[root] < 0 ? kInf : T(len_l - 1, len_r - 1, root));
+    for (auto s : items) { position[s] = -1; }
+    return ret;
+  }
+};
+
+const unsigned ArcStandardOracle::kInf;
+
+static thread_local ArcStandardOracle oracle;
+
+unsigned ArcStandard::reference_cost(const State& state,
+                                     const std::vector<unsigned>& ref_heads,
+                                     const std::vector<unsigned>& ref_deprels) const {
   // TODO: since twpipe left-rooted, we need re-write the cost function, but it's yet be done.
   // handling the initial state.
   // ref_heads is counted as [0, ... , N], the index of the first legal word is 0.
   // there is a guard in state.stack and state.buffer and the indices in the state
   // is counted as [0, ..., N], N is the root.
-  const std::vector<unsigned>& stack = state.stack;
-  const std::vector<unsigned>& buffer = state.buffer;
+  if (state.stack.size() == 1) { return 0; }
+  std::vector<unsigned> stack, buffer, heads, deprels;
+  state.stack.to_vector(stack);
+  state.buffer.to_vector(buffer);
+  state.get_tree(heads, deprels);
 
-  if (stack.size() == 1) { return 0; }
   std::vector< std::vector<unsigned> > tree(ref_heads.size());
 
   unsigned root = 0;
@@ -152,8 +367,8 @@ unsigned ArcStandard::cost(const State& state,
   }
   auto penalty = 0;
   for (unsigned i = 0; i < std::min(buffer_front, len); ++i) {
-    if (state.heads[i] != Corpus::BAD_HED) {
-      if (state.heads[i] != ref_heads[i] || state.deprels[i] != ref_deprels[i]) {
+    if (heads[i] != Corpus::BAD_HED) {
+      if (heads[i] != ref_heads[i] || deprels[i] != ref_deprels[i]) {
         penalty += 1;
       }
     }
@@ -162,29 +377,44 @@ unsigned ArcStandard::cost(const State& state,
   return T[len_l - 1][len_r - 1][root] + penalty;
 }
 
+unsigned ArcStandard::cost(const State& state,
+                           const std::vector<unsigned>& ref_heads,
+                           const std::vector<unsigned>& ref_deprels) const {
+  // ref_heads is counted as [0, ... , N], the index of the first legal word is 0.
+  // there is a guard in state.stack and state.buffer and the indices in the state
+  // is counted as [0, ..., N], N is the root.
+  if (state.stack.size() == 1) { return 0; }
+  oracle.prepare(ref_heads);
+  oracle.load(state);
+  unsigned ret = oracle.cost(ref_deprels, 3);
+#ifdef TWPIPE_DEBUG_ORACLE
+  BOOST_ASSERT_MSG(ret == reference_cost(state, ref_heads, ref_deprels),
+                   "[parse|arcstd] the oracle differs from the reference.");
+#endif
+  return ret;
+}
+
 void ArcStandard::get_transition_costs(const State & state,
                                        const std::vector<unsigned>& actions,
                                        const std::vector<unsigned>& ref_heads,
                                        const std::vector<unsigned>& ref_deprels,
                                        std::vector<float>& costs) {
-  float c = static_cast<float>(cost(state, ref_heads, ref_deprels));
+  oracle.prepare(ref_heads);
+  oracle.load(state);
+  float c = static_cast<float>(oracle.cost(ref_deprels, 3));
   float wrong_left = -1e8f, wrong_right = -1e8f;
   costs.clear();
 
   for (unsigned act : actions) {
     if (is_shift(act)) {
-      State next_state(state);
-      perform_action(next_state, act);
-      costs.push_back(c - cost(next_state, ref_heads, ref_deprels));
+      costs.push_back(c - oracle.cost_after(0, 0, ref_deprels));
     } else if (is_left(act)) {
       unsigned deprel = parse_label(act), hed = state.stack.back(), mod = state.stack[state.stack.size() - 2];
       if (ref_heads[mod] == hed && ref_deprels[mod] == deprel) {
         // assume that actions are unique and there is only one correct left action.
-        State next_state(state); perform_action(next_state, act);
-        costs.push_back(c - cost(next_state, ref_heads, ref_deprels));
+        costs.push_back(c - oracle.cost_after(1, deprel, ref_deprels));
       } else if (wrong_left == -1e8) {
-        State next_state(state); perform_action(next_state, act);
-        wrong_left = c - cost(next_state, ref_heads, ref_deprels);
+        wrong_left = c - oracle.cost_after(1, deprel, ref_deprels);
         costs.push_back(wrong_left);
       } else {
         costs.push_back(wrong_left);
@@ -192,20 +422,32 @@ void ArcStandard::get_transition_costs(const State & state,
     } else {
       unsigned deprel = parse_label(act), mod = state.stack.back(), hed = state.stack[state.stack.size() - 2];
       if (ref_heads[mod] == hed && ref_deprels[mod] == deprel) {
-        State next_state(state); perform_action(next_state, act);
-        costs.push_back(c - cost(next_state, ref_heads, ref_deprels));
+        costs.push_back(c - oracle.cost_after(2, deprel, ref_deprels));
       } else if (wrong_right == -1e8) {
-        State next_state(state); perform_action(next_state, act);
-        wrong_right = c - cost(next_state, ref_heads, ref_deprels);
+        wrong_right = c - oracle.cost_after(2, deprel, ref_deprels);
         costs.push_back(wrong_right);
       } else {
         costs.push_back(wrong_right);
       }
     }
   }
+
+#ifdef TWPIPE_DEBUG_ORACLE
+  float reference_c = static_cast<float>(reference_cost(state, ref_heads, ref_deprels));
+  for (unsigned i = 0; i < actions.size(); ++i) {
+    State next_state(state);
+    perform_action(next_state, actions[i]);
+    float reference = reference_c - reference_cost(next_state, ref_heads, ref_deprels);
+    if (reference != costs[i]) {
+      _ERROR << "[parse|arcstd] cost of " << name(actions[i]) << " is " << costs[i]
+        << ", the reference is " << reference;
+      BOOST_ASSERT_MSG(false, "[parse|arcstd] the oracle differs from the reference.");
+    }
+  }
+#endif
 }
 
-unsigned ArcStandard::get_structure_action(const unsigned & action) {
+unsigned ArcStandard::get_structure_action(const unsigned & action) const {
   return (action < 1 ? action : (action % 2 == 1 ? 1 : 2));
 }
 
@@ -232,25 +474,15 @@ bool ArcStandard::is_shift(const unsigned& action) { return action == 0; }
 bool ArcStandard::is_left(const unsigned& action) { return action % 2 == 1; }
 bool ArcStandard::is_right(const unsigned& action) { return (action > 1 && action % 2 == 0); }
 
-bool ArcStandard::is_valid_action(const State& state, const unsigned& act) const {
-  if (is_shift(act)) {
-    if (state.buffer.size() == 1) { return false; }
-  } else {
-    if (state.stack.size() < 3) { return false; }
+unsigned ArcStandard::get_valid_structure_mask(const State& state) const {
+  unsigned mask = 0;
+  if (state.buffer.size() > 1) { mask |= (1u << get_shift_id()); }
+  if (state.stack.size() >= 3) {
     /* should not left the root. */
-    if (is_left(act) && state.stack[state.stack.size() - 2] == 0) { return false; }
-  }
-  return true;
-}
-
-void ArcStandard::get_valid_actions(const State& state, std::vector<unsigned>& valid_actions) {
-  valid_actions.clear();
-  for (unsigned a = 0; a < n_actions; ++a) {
-    //if (!is_valid_action(state, action_names[a])) { continue; }
-    if (!is_valid_action(state, a)) { continue; }
-    valid_actions.push_back(a);
+    if (state.stack.top(1) != 0) { mask |= (1u << 1); }
+    mask |= (1u << 2);
   }
-  BOOST_ASSERT_MSG(valid_actions.size() > 0, "There should be one or more valid action.");
+  return mask;
 }
 
 unsigned ArcStandard::parse_label(const unsigned& action) const {
@@ -19,24 +19,30 @@ struct ArcStandard : public TransitionSystem {
 
   unsigned num_actions() const override;
 
+  unsigned num_structure_actions() const override;
+
   void get_transition_costs(const State & state,
                             const std::vector<unsigned>& actions,
                             const std::vector<unsigned>& ref_heads,
                             const std::vector<unsigned>& ref_deprels,
                             std::vector<float>& costs) override;
 
-  unsigned get_structure_action(const unsigned & action) override;
+  unsigned get_structure_action(const unsigned & action) const override;
 
   unsigned cost(const State& state,
                 const std::vector<unsigned>& ref_heads,
                 const std::vector<unsigned>& ref_deprels) const;
 
+  /// The original cost function, slow but straightforward, kept to check
+  /// the oracle against.
+  unsigned reference_cost(const State& state,
+                          const std::vector<unsigned>& ref_heads,
+                          const std::vector<unsigned>& ref_deprels) const;
+
   void perform_action(State & state, const unsigned& action) override;
 
-  bool is_valid_action(const State& state, const unsigned& act) const override;
 
-  void get_valid_actions(const State& state,
-                         std::vector<unsigned>& valid_actions) override;
+  unsigned get_valid_structure_mask(const State& state) const override;
 
   void get_oracle_actions(const std::vector<unsigned>& heads,
                           const std::vector<unsigned>& deprels,
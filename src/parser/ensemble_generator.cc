@@ -23,6 +23,7 @@ po::options_description EnsembleParseDataGenerator::get_options() {
 EnsembleParseDataGenerator::EnsembleParseDataGenerator(std::vector<ParseModel*>& engines,
                                                        const po::variables_map & conf) : engines(engines) {
   _INFO << "[twpipe|parser|ensemble_generator] number of ensembled parsers: " << engines.size();
+  ParseModel::prepare_ensemble(engines);
 
   n_samples = conf["ensemble-n-samples"].as<unsigned>();
   _INFO << "[twpipe|parser|ensemble_generator] generate " << n_samples << " for each instance.";
@@ -73,6 +74,7 @@ void EnsembleParseDataGenerator::generate(const std::vector<std::string>& words,
   engines[0]->initialize_state(input, state);
   for (unsigned i = 0; i < n_engines; ++i) {
     engines[i]->new_graph(cg);
+    engines[i]->reset_checkpoints();
     checkpoints[i] = engines[i]->get_initial_checkpoint();
     engines[i]->initialize_parser(cg, input, checkpoints[i]);
   }
@@ -85,7 +87,7 @@ void EnsembleParseDataGenerator::generate(const std::vector<std::string>& words,
   if (rollin_policy == kExpert) {
     if (!DependencyUtils::is_tree(heads) ||
       (!system.allow_nonprojective() && DependencyUtils::is_non_projective(heads))) {
-      for (unsigned i = 0; i < n_engines; ++i) { delete checkpoints[i]; }
+      for (unsigned i = 0; i < n_engines; ++i) { engines[i]->destropy_checkpoint(checkpoints[i]); }
       return;
     }
     std::vector<unsigned> numeric_deprels(deprels.size());
@@ -101,16 +103,8 @@ void EnsembleParseDataGenerator::generate(const std::vector<std::string>& words,
     std::vector<unsigned> valid_actions;
     system.get_valid_actions(state, valid_actions);
    
-    std::vector<float> ensemble_probs(system.num_actions(), 0.f);
-    for (unsigned i = 0; i < n_engines; ++i) {
-      dynet::Expression score_exprs = engines[i]->get_scores(checkpoints[i]);
-      std::vector<float> ensemble_score = dynet::as_vector(cg.get_value(score_exprs));
-      Math::softmax_inplace(ensemble_score);
-      for (unsigned c = 0; c < ensemble_score.size(); ++c) {
-        ensemble_probs[c] += ensemble_score[c];
-      }
-    }
-    for (auto & p : ensemble_probs) { p /= n_engines; }
+    std::vector<float> ensemble_probs;
+    ParseModel::get_ensemble_probs(cg, engines, checkpoints, ensemble_probs);
 
     unsigned action = UINT_MAX;
     if (rollin_policy == kExpert) {
@@ -149,7 +143,7 @@ void EnsembleParseDataGenerator::generate(const std::vector<std::string>& words,
     n_actions++;
   }
 
-  for (unsigned i = 0; i < n_engines; ++i) { delete checkpoints[i]; }
+  for (unsigned i = 0; i < n_engines; ++i) { engines[i]->destropy_checkpoint(checkpoints[i]); }
 }
 
 }
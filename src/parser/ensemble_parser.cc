@@ -0,0 +1,116 @@
+#include "ensemble_parser.h"
+#include "parse_model_builder.h"
+#include "twpipe/logging.h"
+#include "twpipe/model.h"
+#include "twpipe/corpus.h"
+#include "twpipe/alphabet_collection.h"
+
+namespace twpipe {
+
+/// Whether the two alphabets map the same ids to the same strings.
+static bool same_alphabet(const Alphabet & a, const Alphabet & b) {
+  if (a.size() != b.size()) { return false; }
+  for (unsigned i = 0; i < a.size(); ++i) {
+    if (a.contains(i) != b.contains(i)) { return false; }
+    if (a.contains(i) && a.get(i) != b.get(i)) { return false; }
+  }
+  return true;
+}
+
+EnsembleParser::EnsembleParser(const std::vector<std::string> & model_names,
+                               po::variables_map & conf) {
+  if (conf.count("parse-graph-free")) {
+    _ERROR << "[parse|ensemble] --parse-graph-free is not supported by the ensemble.";
+    exit(1);
+  }
+  if (conf.count("parse-scorer") && !conf["parse-scorer"].defaulted()) {
+    _ERROR << "[parse|ensemble] --parse-scorer doesn't apply to loaded parsers, each uses its own.";
+    exit(1);
+  }
+
+  // the inputs and the actions are encoded with the alphabets of --model.
+  AlphabetCollection * alphabets = AlphabetCollection::get();
+  for (const std::string & model_name : model_names) {
+    Model::get()->load(model_name);
+    if (!Model::get()->has_parser_model()) {
+      _ERROR << "[parse|ensemble] " << model_name << " doesn't have parser model!";
+      exit(1);
+    }
+    Alphabet word_map, pos_map, deprel_map;
+    Model::get()->from_json("word-map", word_map);
+    Model::get()->from_json("pos-map", pos_map);
+    Model::get()->from_json("deprel-map", deprel_map);
+    if (!same_alphabet(word_map, alphabets->word_map) ||
+        !same_alphabet(pos_map, alphabets->pos_map) ||
+        !same_alphabet(deprel_map, alphabets->deprel_map)) {
+      _ERROR << "[parse|ensemble] " << model_name << " has different alphabets from --model.";
+      exit(1);
+    }
+    ParseModelBuilder builder(conf);
+    models.push_back(new dynet::ParameterCollection);
+    engines.push_back(builder.from_json(*models.back()));
+
+    // the distributions are averaged over the actions of the first parser.
+    if (engines.back()->sys.name() != engines[0]->sys.name() ||
+        engines.back()->sys.num_actions() != engines[0]->sys.num_actions()) {
+      _ERROR << "[parse|ensemble] " << model_name << " uses a different transition system.";
+      exit(1);
+    }
+  }
+  _INFO << "[parse|ensemble] parse with the ensemble of " << engines.size() << " parsers.";
+  ParseModel::prepare_ensemble(engines);
+}
+
+EnsembleParser::~EnsembleParser() {
+  for (unsigned i = 0; i < engines.size(); ++i) {
+    // the transition system is built for the engine and owned by nobody else.
+    TransitionSystem * system = &engines[i]->sys;
+    delete engines[i];
+    delete system;
+    delete models[i];
+  }
+}
+
+void EnsembleParser::predict(const std::vector<std::string> & words,
+                             const std::vector<std::string> & postags,
+                             std::vector<unsigned> & heads,
+                             std::vector<std::string> & deprels) {
+  unsigned n_engines = engines.size();
+  dynet::ComputationGraph cg;
+
+  InputUnits input;
+  Corpus::vector_to_input_units(words, postags, input);
+  std::vector<ParseModel::StateCheckpoint *> checkpoints(n_engines, nullptr);
+
+  unsigned len = input.size();
+  State state(len);
+  engines[0]->initialize_state(input, state);
+  for (unsigned i = 0; i < n_engines; ++i) {
+    engines[i]->new_graph(cg);
+    engines[i]->reset_checkpoints();
+    checkpoints[i] = engines[i]->get_initial_checkpoint();
+    engines[i]->initialize_parser(cg, input, checkpoints[i]);
+  }
+
+  TransitionSystem & system = engines[0]->sys;
+  std::vector<float> probs;
+  while (!state.terminated()) {
+    unsigned mask = system.get_valid_structure_mask(state);
+    ParseModel::get_ensemble_probs(cg, engines, checkpoints, probs);
+    unsigned best_a = ParseModel::get_best_action_masked(probs, system.get_mask_penalty(mask)).first;
+
+    system.perform_action(state, best_a);
+    for (unsigned i = 0; i < n_engines; ++i) {
+      engines[i]->perform_action(best_a, state, cg, checkpoints[i]);
+    }
+  }
+  for (unsigned i = 0; i < n_engines; ++i) { engines[i]->destropy_checkpoint(checkpoints[i]); }
+
+  std::vector<unsigned> numeric_heads, numeric_deprels;
+  state.get_tree(numeric_heads, numeric_deprels);
+  ParseUnits result;
+  Corpus::vector_to_parse_units(numeric_heads, numeric_deprels, result);
+  Corpus::parse_units_to_vector(result, heads, deprels);
+}
+
+}
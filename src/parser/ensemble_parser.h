@@ -0,0 +1,39 @@
+#ifndef __TWPIPE_PARSER_ENSEMBLE_PARSER_H__
+#define __TWPIPE_PARSER_ENSEMBLE_PARSER_H__
+
+#include <vector>
+#include <boost/program_options.hpp>
+#include "parse_model.h"
+
+namespace po = boost::program_options;
+
+namespace twpipe {
+
+/// Greedy parsing with the averaged action distribution of several parsers.
+/// The engines are evaluated together in one graph per step, with their
+/// output layers stacked and dynet autobatching on (see
+/// ParseModel::get_ensemble_probs and prepare_ensemble). The decoding is
+/// greedy and goes through the graph: --parse-graph-free is rejected, and
+/// the output layer of each parser, flat or factored, is the one it was
+/// trained with.
+struct EnsembleParser {
+  std::vector<dynet::ParameterCollection *> models;
+  std::vector<ParseModel *> engines;
+
+  /// Load the parsers of the models. The alphabets should be loaded already,
+  /// the parsers are rejected if theirs differ, and the loaded model is
+  /// replaced by the last of the models.
+  EnsembleParser(const std::vector<std::string> & model_names,
+                 po::variables_map & conf);
+
+  ~EnsembleParser();
+
+  void predict(const std::vector<std::string> & words,
+               const std::vector<std::string> & postags,
+               std::vector<unsigned> & heads,
+               std::vector<std::string> & deprels);
+};
+
+}
+
+#endif  //  end for __TWPIPE_PARSER_ENSEMBLE_PARSER_H__
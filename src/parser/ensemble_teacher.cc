@@ -0,0 +1,320 @@
+#include "ensemble_teacher.h"
+#include "ensemble_generator.h"
+#include "parse_model_builder.h"
+#include "twpipe/logging.h"
+#include "twpipe/model.h"
+#include "twpipe/parallel.h"
+#include "twpipe/alphabet_collection.h"
+#include <numeric>
+#include <algorithm>
+#include <boost/algorithm/string.hpp>
+#ifndef _MSC_VER
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#endif
+
+namespace twpipe {
+
+po::options_description EnsembleTeacher::get_options() {
+  po::options_description cmd("Parser online distillation options");
+  cmd.add_options()
+    ("parse-ensemble-models", po::value<std::string>(), "The teacher parsers separated by comma, distill from them online instead of the ensemble data.")
+    ("parse-ensemble-workers", po::value<unsigned>()->default_value(1), "The number of teacher worker processes.")
+    ("parse-ensemble-queue-size", po::value<unsigned>()->default_value(64), "The number of teacher instances buffered ahead of the student.")
+    ;
+  cmd.add(EnsembleParseDataGenerator::get_options());
+  return cmd;
+}
+
+EnsembleTeacher::EnsembleTeacher(po::variables_map & conf) :
+  conf(conf),
+  epoch_size(0),
+  finished(true),
+  stopped(false),
+  failed(false),
+  n_expected(0),
+  n_received(0) {
+  std::string payload = conf["parse-ensemble-models"].as<std::string>();
+  boost::split(model_names, payload, boost::is_any_of(","));
+  n_workers = std::max(1u, conf["parse-ensemble-workers"].as<unsigned>());
+  queue_size = std::max(1u, conf["parse-ensemble-queue-size"].as<unsigned>());
+
+  _INFO << "[parse|ensemble|teacher] " << model_names.size() << " teachers run in "
+    << n_workers << " workers, " << queue_size << " instances buffered.";
+}
+
+EnsembleTeacher::~EnsembleTeacher() {
+  stop();
+}
+
+void EnsembleTeacher::start(Corpus & corpus, const std::vector<unsigned> & order, unsigned n_epochs) {
+  stop();
+  std::vector<unsigned> seeds(n_workers);
+  for (unsigned wid = 0; wid < n_workers; ++wid) { seeds[wid] = (*dynet::rndeng)(); }
+
+  queue.clear();
+  finished = false;
+  stopped = false;
+  failed = false;
+  epoch_size = order.size();
+  n_expected = order.size() * n_epochs;
+  n_received = 0;
+  quotas.resize(n_workers);
+  for (unsigned wid = 0; wid < n_workers; ++wid) {
+    std::pair<unsigned, unsigned> range = Parallel::shard(order.size(), n_workers, wid);
+    quotas[wid] = (range.second - range.first) * n_epochs;
+  }
+  // fork before the reader thread is started.
+  Parallel::spawn(n_workers, [&](unsigned wid, int fd) {
+    std::pair<unsigned, unsigned> range = Parallel::shard(order.size(), n_workers, wid);
+    std::vector<unsigned> sids(order.begin() + range.first, order.begin() + range.second);
+    return generate(corpus, sids, n_epochs, seeds[wid], fd);
+  }, pids, fds);
+  reader = std::thread(&EnsembleTeacher::read_instances, this);
+}
+
+bool EnsembleTeacher::generate(Corpus & corpus,
+                               std::vector<unsigned> sids,
+                               unsigned n_epochs,
+                               unsigned seed,
+                               int fd) {
+  dynet::rndeng->seed(seed);
+
+  // the sentences are read with the alphabets of the student, before those
+  // of the teachers are loaded.
+  unsigned n_sentences = sids.size();
+  std::vector<std::vector<std::string>> words(n_sentences), postags(n_sentences), deprels(n_sentences);
+  std::vector<std::vector<unsigned>> heads(n_sentences);
+  for (unsigned i = 0; i < n_sentences; ++i) {
+    const Instance & inst = corpus.training_data.at(sids[i]);
+    for (unsigned j = 1; j < inst.input_units.size(); ++j) {
+      words[i].push_back(inst.input_units[j].word);
+      postags[i].push_back(inst.input_units[j].postag);
+    }
+    Corpus::parse_units_to_vector(inst.parse_units, heads[i], deprels[i], true);
+  }
+
+  AlphabetCollection * alphabets = AlphabetCollection::get();
+  std::vector<std::string> deprel_names;
+  for (unsigned i = 0; i < alphabets->deprel_map.size(); ++i) {
+    deprel_names.push_back(alphabets->deprel_map.get(i));
+  }
+  alphabets->char_map = Alphabet();
+  alphabets->word_map = Alphabet();
+  alphabets->pos_map = Alphabet();
+  alphabets->deprel_map = Alphabet();
+
+  std::vector<dynet::ParameterCollection *> models;
+  std::vector<ParseModel *> engines;
+  for (unsigned i = 0; i < model_names.size(); ++i) {
+    Model::get()->load(model_names[i]);
+    if (i == 0) { alphabets->from_json(); }
+    if (!Model::get()->has_parser_model()) {
+      _ERROR << "[parse|ensemble|teacher] " << model_names[i] << " doesn't have parser model!";
+      return false;
+    }
+    ParseModelBuilder builder(conf);
+    models.push_back(new dynet::ParameterCollection);
+    engines.push_back(builder.from_json(*models.back()));
+  }
+
+  // the actions are sent as ids, the student and the teachers should agree on them.
+  bool same_deprels = (alphabets->deprel_map.size() == deprel_names.size());
+  for (unsigned i = 0; same_deprels && i < deprel_names.size(); ++i) {
+    same_deprels = (alphabets->deprel_map.contains(i) && alphabets->deprel_map.get(i) == deprel_names[i]);
+  }
+  if (!same_deprels) {
+    _ERROR << "[parse|ensemble|teacher] the teachers and the student have different relations.";
+    return false;
+  }
+
+  EnsembleParseDataGenerator generator(engines, conf);
+  std::vector<unsigned> index(n_sentences);
+  std::iota(index.begin(), index.end(), 0);
+  EnsembleInstance instance;
+  for (unsigned epoch = 0; epoch < n_epochs; ++epoch) {
+    std::shuffle(index.begin(), index.end(), (*dynet::rndeng));
+    for (unsigned i : index) {
+      instance.id = sids[i];
+      generator.generate(words[i], postags[i], heads[i], deprels[i], instance.categories, instance.probs);
+      if (!send(fd, instance, epoch)) { return false; }
+    }
+  }
+  return true;
+}
+
+bool EnsembleTeacher::send(int fd, const EnsembleInstance & instance, unsigned epoch) {
+  unsigned header[4] = {
+    instance.id,
+    static_cast<unsigned>(instance.categories.size()),
+    static_cast<unsigned>(instance.probs.empty() ? 0 : instance.probs[0].size()),
+    epoch
+  };
+  if (!Parallel::write_all(fd, header, sizeof(header)) ||
+      !Parallel::write_all(fd, instance.categories.data(), header[1] * sizeof(unsigned))) {
+    return false;
+  }
+  for (const std::vector<float> & prob : instance.probs) {
+    if (!Parallel::write_all(fd, prob.data(), header[2] * sizeof(float))) { return false; }
+  }
+  return true;
+}
+
+bool EnsembleTeacher::receive(int fd, EnsembleInstance & instance, unsigned & epoch) {
+  unsigned header[4];
+  if (!Parallel::read_all(fd, header, sizeof(header))) { return false; }
+  instance.id = header[0];
+  epoch = header[3];
+  instance.categories.resize(header[1]);
+  instance.probs.resize(header[1]);
+  if (!Parallel::read_all(fd, instance.categories.data(), header[1] * sizeof(unsigned))) { return false; }
+  for (std::vector<float> & prob : instance.probs) {
+    prob.resize(header[2]);
+    if (!Parallel::read_all(fd, prob.data(), header[2] * sizeof(float))) { return false; }
+  }
+  return true;
+}
+
+void EnsembleTeacher::read_instances() {
+#ifndef _MSC_VER
+  unsigned n = fds.size();
+  std::vector<bool> open(n, true), reaped(n, false), holding(n, false);
+  std::vector<unsigned> n_sent(n, 0);
+  // the first instance of the next epoch from each worker, held back with
+  // its worker until the current epoch is complete.
+  std::vector<EnsembleInstance> held(n);
+  unsigned epoch = 0, n_epoch = 0, n_open = n;
+  bool error = false;
+  while (n_open > 0) {
+    {
+      std::unique_lock<std::mutex> lock(mtx);
+      not_full.wait(lock, [this]() { return stopped || queue.size() < queue_size; });
+      if (stopped) { break; }
+      if (n_epoch == epoch_size && n_open > 0) {
+        epoch++;
+        n_epoch = 0;
+        for (unsigned i = 0; i < n; ++i) {
+          if (!holding[i]) { continue; }
+          queue.push_back(std::move(held[i]));
+          holding[i] = false;
+          n_epoch++;
+        }
+        not_empty.notify_one();
+      }
+    }
+
+    // a worker that dies without closing its pipe, or before sending all
+    // its instances, fails the training now rather than at the end.
+    for (unsigned i = 0; i < n && !error; ++i) {
+      bool ok = true;
+      if (!reaped[i] && Parallel::exited(pids[i], ok)) {
+        reaped[i] = true;
+        pids[i] = -1;
+        if (!ok) {
+          _ERROR << "[parse|ensemble|teacher] worker #" << i << " failed after sending "
+            << n_sent[i] << " of " << quotas[i] << " instances.";
+          error = true;
+        }
+      }
+    }
+    if (error) { break; }
+
+    std::vector<pollfd> polls;
+    std::vector<unsigned> workers;
+    for (unsigned i = 0; i < n; ++i) {
+      if (!open[i] || holding[i]) { continue; }
+      pollfd p;
+      p.fd = fds[i];
+      p.events = POLLIN;
+      p.revents = 0;
+      polls.push_back(p);
+      workers.push_back(i);
+    }
+    if (polls.empty()) {
+      // all the open workers wait for an epoch that won't be completed.
+      _ERROR << "[parse|ensemble|teacher] epoch #" << epoch + 1 << " stopped after "
+        << n_epoch << " of " << epoch_size << " instances.";
+      error = true;
+      break;
+    }
+    // time out to check whether the teacher is stopped and the workers alive.
+    if (poll(polls.data(), polls.size(), 100) <= 0) { continue; }
+    for (unsigned k = 0; k < polls.size() && !error; ++k) {
+      if (!(polls[k].revents & (POLLIN | POLLHUP | POLLERR))) { continue; }
+      unsigned i = workers[k];
+      EnsembleInstance instance;
+      unsigned instance_epoch = 0;
+      if (!receive(fds[i], instance, instance_epoch)) {
+        open[i] = false;
+        n_open--;
+        if (n_sent[i] < quotas[i]) {
+          _ERROR << "[parse|ensemble|teacher] worker #" << i << " stopped after sending "
+            << n_sent[i] << " of " << quotas[i] << " instances.";
+          error = true;
+        }
+        continue;
+      }
+      n_sent[i]++;
+      if (instance_epoch != epoch) {
+        held[i] = std::move(instance);
+        holding[i] = true;
+        continue;
+      }
+      std::lock_guard<std::mutex> lock(mtx);
+      queue.push_back(std::move(instance));
+      n_epoch++;
+      not_empty.notify_one();
+    }
+  }
+  std::lock_guard<std::mutex> lock(mtx);
+  failed = error;
+#else
+  std::lock_guard<std::mutex> lock(mtx);
+#endif
+  finished = true;
+  not_empty.notify_one();
+}
+
+const EnsembleInstance & EnsembleTeacher::next() {
+  std::unique_lock<std::mutex> lock(mtx);
+  // a failed worker stops the student at once, the queue is not drained.
+  not_empty.wait(lock, [this]() { return finished || !queue.empty(); });
+  if (failed || queue.empty()) {
+    _ERROR << "[parse|ensemble|teacher] the workers stopped after " << n_received
+      << " of " << n_expected << " instances.";
+    exit(1);
+  }
+  current = std::move(queue.front());
+  queue.pop_front();
+  n_received++;
+  not_full.notify_one();
+  return current;
+}
+
+void EnsembleTeacher::stop() {
+  {
+    std::lock_guard<std::mutex> lock(mtx);
+    stopped = true;
+    not_full.notify_one();
+  }
+  if (reader.joinable()) { reader.join(); }
+  if (pids.empty()) { return; }
+
+  bool early = (n_received < n_expected);
+#ifndef _MSC_VER
+  for (int fd : fds) { close(fd); }
+  if (early) {
+    for (int pid : pids) {
+      if (pid > 0) { kill(pid, SIGTERM); }
+    }
+  }
+#endif
+  if (!Parallel::join(pids) && !early) {
+    _WARN << "[parse|ensemble|teacher] a worker failed after sending all the instances.";
+  }
+  pids.clear();
+  fds.clear();
+}
+
+}
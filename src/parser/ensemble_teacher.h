@@ -0,0 +1,84 @@
+#ifndef __TWPIPE_PARSER_ENSEMBLE_TEACHER_H__
+#define __TWPIPE_PARSER_ENSEMBLE_TEACHER_H__
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <boost/program_options.hpp>
+#include "twpipe/corpus.h"
+#include "twpipe/ensemble.h"
+
+namespace po = boost::program_options;
+
+namespace twpipe {
+
+/// Distill from the parser ensemble online. The teacher parsers are loaded
+/// in forked worker processes (dynet allows a single computation graph per
+/// process), each generates the ensemble instances of its shard of the
+/// training sentences with a fresh roll-in every epoch, and sends them
+/// through a pipe, tagged with their epoch. A reader thread collects them
+/// into a bounded queue that the student consumes, so the workers run ahead
+/// of the student by about queue_size instances plus what the pipes buffer.
+/// The epochs are kept apart: a worker that reaches the next epoch is not
+/// read until the others have finished the current one, so each epoch of
+/// the student sees every sentence once. The workers are checked while
+/// reading, and a failed one stops the training.
+struct EnsembleTeacher {
+  po::variables_map & conf;
+  std::vector<std::string> model_names;
+  unsigned n_workers;
+  unsigned queue_size;
+
+  std::vector<int> pids;
+  std::vector<int> fds;
+  /// The number of instances each worker sends, over all the epochs.
+  std::vector<unsigned> quotas;
+  unsigned epoch_size;
+  std::thread reader;
+  std::mutex mtx;
+  std::condition_variable not_empty;
+  std::condition_variable not_full;
+  std::deque<EnsembleInstance> queue;
+  bool finished;
+  bool stopped;
+  bool failed;
+  unsigned n_expected;
+  unsigned n_received;
+  EnsembleInstance current;
+
+  static po::options_description get_options();
+
+  EnsembleTeacher(po::variables_map & conf);
+
+  ~EnsembleTeacher();
+
+  /// Start the workers on n_epochs passes over the sentences in order. Each
+  /// epoch sends order.size() instances, shuffled, all before those of the
+  /// next epoch; those the ensemble can't generate (e.g. a non-projective
+  /// tree under the expert roll-in) have no categories.
+  void start(Corpus & corpus, const std::vector<unsigned> & order, unsigned n_epochs);
+
+  /// The next instance, overwritten by the next call.
+  const EnsembleInstance & next();
+
+  void stop();
+
+  /// Run in a worker: load the teachers and generate the instances of sids.
+  bool generate(Corpus & corpus,
+                std::vector<unsigned> sids,
+                unsigned n_epochs,
+                unsigned seed,
+                int fd);
+
+  void read_instances();
+
+  static bool send(int fd, const EnsembleInstance & instance, unsigned epoch);
+
+  static bool receive(int fd, EnsembleInstance & instance, unsigned & epoch);
+};
+
+}
+
+#endif  //  end for __TWPIPE_PARSER_ENSEMBLE_TEACHER_H__
@@ -0,0 +1,67 @@
+#include "factored_scorer.h"
+#include <boost/assert.hpp>
+
+namespace twpipe {
+
+FactoredScorer::FactoredScorer(dynet::ParameterCollection & m,
+                               unsigned dim_hidden,
+                               TransitionSystem & system) :
+  structure_scorer(m, dim_hidden, system.num_structure_actions()),
+  label_scorer(m, dim_hidden, system.num_deprels()),
+  n_actions(system.num_actions()),
+  n_structures(system.num_structure_actions()),
+  n_labels(system.num_deprels()) {
+  structure_actions.resize(n_structures);
+  for (unsigned a = 0; a < n_actions; ++a) {
+    structure_actions[system.get_structure_action(a)].push_back(a);
+  }
+
+  structure_selection_values.assign(n_actions * n_structures, 0.);
+  label_selection_values.assign(n_actions * n_labels, 0.);
+  for (unsigned s = 0; s < n_structures; ++s) {
+    const std::vector<unsigned> & actions = structure_actions[s];
+    BOOST_ASSERT_MSG(actions.size() == 1 || actions.size() == n_labels,
+                     "[parse|factored_scorer] structural action without full labels.");
+    for (unsigned l = 0; l < actions.size(); ++l) {
+      structure_selection_values[s * n_actions + actions[l]] = 1.;
+      if (is_labeled(s)) { label_selection_values[l * n_actions + actions[l]] = 1.; }
+    }
+  }
+}
+
+void FactoredScorer::new_graph(dynet::ComputationGraph & cg) {
+  structure_scorer.new_graph(cg);
+  label_scorer.new_graph(cg);
+  structure_selection = dynet::input(cg, { n_actions, n_structures }, structure_selection_values);
+  label_selection = dynet::input(cg, { n_actions, n_labels }, label_selection_values);
+}
+
+dynet::Expression FactoredScorer::get_output(const dynet::Expression & hidden) {
+  return (structure_selection * dynet::log_softmax(get_structure_output(hidden)) +
+          label_selection * dynet::log_softmax(get_label_output(hidden)));
+}
+
+dynet::Expression FactoredScorer::get_structure_output(const dynet::Expression & hidden) {
+  return structure_scorer.get_output(hidden);
+}
+
+dynet::Expression FactoredScorer::get_label_output(const dynet::Expression & hidden) {
+  return label_scorer.get_output(hidden);
+}
+
+bool FactoredScorer::is_labeled(unsigned structure) const {
+  return structure_actions[structure].size() > 1;
+}
+
+unsigned FactoredScorer::get_action(unsigned structure, unsigned label) const {
+  return structure_actions[structure][is_labeled(structure) ? label : 0];
+}
+
+std::vector<dynet::Expression> FactoredScorer::get_params() {
+  std::vector<dynet::Expression> ret;
+  for (auto & e : structure_scorer.get_params()) { ret.push_back(e); }
+  for (auto & e : label_scorer.get_params()) { ret.push_back(e); }
+  return ret;
+}
+
+}
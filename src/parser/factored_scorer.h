@@ -0,0 +1,59 @@
+#ifndef __TWPIPE_PARSER_FACTORED_SCORER_H__
+#define __TWPIPE_PARSER_FACTORED_SCORER_H__
+
+#include "system.h"
+#include "dynet/expr.h"
+#include "dynet_layer/layer.h"
+#include <vector>
+
+namespace twpipe {
+
+/// An output layer in two stages. The structure head scores the structural
+/// actions (shift, left, right, ...) and the label head scores the deprels,
+/// which only matters when a labeled structural action is chosen. The score
+/// of an action is log p(structure) + log p(label), so the outputs over all
+/// the actions are still normalized.
+struct FactoredScorer {
+  DenseLayer structure_scorer;
+  DenseLayer label_scorer;
+
+  unsigned n_actions;
+  unsigned n_structures;
+  unsigned n_labels;
+
+  /// The actions of each structural action, ordered by their label. A
+  /// structural action with a single action doesn't take a label.
+  std::vector<std::vector<unsigned>> structure_actions;
+
+  /// The (n_actions, n_structures) and (n_actions, n_labels) 0/1 matrices
+  /// which spread the two heads over the actions, column major.
+  std::vector<float> structure_selection_values;
+  std::vector<float> label_selection_values;
+  dynet::Expression structure_selection;
+  dynet::Expression label_selection;
+
+  FactoredScorer(dynet::ParameterCollection & m,
+                 unsigned dim_hidden,
+                 TransitionSystem & system);
+
+  void new_graph(dynet::ComputationGraph & cg);
+
+  /// The log-probabilities of all the actions, works on batched hidden.
+  dynet::Expression get_output(const dynet::Expression & hidden);
+
+  /// The un-softmaxed scores of the structural actions.
+  dynet::Expression get_structure_output(const dynet::Expression & hidden);
+
+  /// The un-softmaxed scores of the labels.
+  dynet::Expression get_label_output(const dynet::Expression & hidden);
+
+  bool is_labeled(unsigned structure) const;
+
+  unsigned get_action(unsigned structure, unsigned label) const;
+
+  std::vector<dynet::Expression> get_params();
+};
+
+}
+
+#endif  //  end for __TWPIPE_PARSER_FACTORED_SCORER_H__
@@ -10,13 +10,36 @@
 #include "twpipe/corpus.h"
 #include "twpipe/json.hpp"
 #include "twpipe/ensemble.h"
+#include "twpipe/parallel.h"
+#include "twpipe/checkpoint.h"
 #include "parser/parse_model_builder.h"
 #include "parser/ensemble_generator.h"
+#include <algorithm>
+#include <cstdio>
+#include <set>
 #include <boost/algorithm/string.hpp>
 #include <boost/program_options.hpp>
 
 namespace po = boost::program_options;
 
+struct Sentence {
+  std::vector<std::string> tokens;
+  std::vector<std::string> postags;
+  std::vector<unsigned> heads;
+  std::vector<std::string> deprels;
+};
+
+/// A generated instance in a shard file. A sentence without actions is
+/// recorded by its id alone, so that it is not generated again on resume,
+/// and is left out of the output.
+struct ShardLine {
+  unsigned sid;
+  unsigned shard;
+  std::streamoff offset;
+  std::streamoff length;
+  bool empty;
+};
+
 void init_commnad_line(int argc, char* argv[], po::variables_map & conf) {
   po::options_description generic_opts("Generic options");
   generic_opts.add_options()
@@ -24,6 +47,8 @@ void init_commnad_line(int argc, char* argv[], po::variables_map & conf) {
     ("help,h", "show help information.")
     ("models", po::value<std::string>(), "the path to the models.")
     ("input-file", po::value<std::string>(), "the path to the input file.")
+    ("output", po::value<std::string>(), "the path to the output, write to stdout if not set.")
+    ("threads", po::value<unsigned>()->default_value(1), "the number of generating workers, requires --output.")
     ;
 
   po::options_description embed_opts = twpipe::WordEmbedding::get_options();
@@ -55,6 +80,116 @@ void init_commnad_line(int argc, char* argv[], po::variables_map & conf) {
     std::cerr << "Please specify input file." << std::endl;
     exit(1);
   }
+  if (conf["threads"].as<unsigned>() > 1 && !conf.count("output")) {
+    std::cerr << "Please specify the output when generating with several workers." << std::endl;
+    exit(1);
+  }
+}
+
+void load_sentences(const std::string & path, std::vector<Sentence> & sentences) {
+  std::ifstream ifs(path);
+  std::string buffer;
+  Sentence sentence;
+  sentence.heads.push_back(twpipe::Corpus::BAD_HED);
+  sentence.deprels.emplace_back(twpipe::Corpus::BAD0);
+  while (std::getline(ifs, buffer)) {
+    boost::algorithm::trim(buffer);
+    if (buffer.empty()) {
+      sentences.push_back(sentence);
+      sentence = Sentence();
+      sentence.heads.push_back(twpipe::Corpus::BAD_HED);
+      sentence.deprels.emplace_back(twpipe::Corpus::BAD0);
+    } else if (buffer[0] == '#') {
+      continue;
+    } else {
+      std::vector<std::string> data;
+      boost::algorithm::split(data, buffer, boost::is_any_of("\t "));
+      sentence.tokens.push_back(data[1]);
+      sentence.postags.push_back(data[3]);
+      if (data[6] == "_") {
+        sentence.heads.push_back(twpipe::Corpus::BAD_HED);
+        sentence.deprels.emplace_back(twpipe::Corpus::BAD0);
+      } else {
+        sentence.heads.push_back(boost::lexical_cast<unsigned>(data[6]));
+        sentence.deprels.push_back(data[7]);
+      }
+    }
+  }
+}
+
+std::string shard_path(const std::string & output, unsigned shard) {
+  return output + ".shard-" + std::to_string(shard);
+}
+
+/// Index the complete instances of a shard file. A worker that is killed
+/// leaves a partially written last line, the file is cut to its last
+/// complete instance so the generation can append to it.
+void scan_shard(const std::string & output, unsigned shard, std::vector<ShardLine> & lines) {
+  std::string path = shard_path(output, shard);
+  std::ifstream ifs(path, std::ios::binary);
+  std::string buffer;
+  std::streamoff offset = 0, valid = 0;
+  bool truncated = false;
+  while (std::getline(ifs, buffer)) {
+    std::streamoff length = static_cast<std::streamoff>(buffer.size()) + 1;
+    if (ifs.eof()) { truncated = true; break; }
+    try {
+      nlohmann::json payload = nlohmann::json::parse(buffer);
+      unsigned sid = payload.at(twpipe::EnsembleInstance::id_name).get<unsigned>();
+      bool empty = (payload.count(twpipe::EnsembleInstance::category_name) == 0);
+      lines.push_back(ShardLine{ sid, shard, offset, length, empty });
+      valid = offset + length;
+    } catch (...) {
+      truncated = true;
+      break;
+    }
+    offset += length;
+  }
+  ifs.close();
+
+  if (truncated) {
+    _INFO << "[twpipe|parse|generator] drop the incomplete tail of " << path;
+    std::string content(static_cast<size_t>(valid), '\0');
+    std::ifstream in(path, std::ios::binary);
+    if (valid > 0) { in.read(&content[0], valid); }
+    in.close();
+    twpipe::CheckpointWriter::write_atomic(path, [&content](std::ostream & os) {
+      os.write(content.data(), content.size());
+    });
+  }
+}
+
+/// Generate the instances of sentences ids[begin, end). When writing to a
+/// shard (record_empty), the sentences without actions are recorded by id.
+unsigned generate_instances(twpipe::EnsembleParseDataGenerator & generator,
+                            const std::vector<Sentence> & sentences,
+                            const std::vector<unsigned> & ids,
+                            unsigned begin,
+                            unsigned end,
+                            bool record_empty,
+                            std::ostream & os) {
+  std::vector<unsigned> actions;
+  std::vector<std::vector<float>> prob;
+  unsigned n_generated = 0;
+  for (unsigned i = begin; i < end; ++i) {
+    unsigned sid = ids[i];
+    const Sentence & sentence = sentences[sid];
+    generator.generate(sentence.tokens, sentence.postags, sentence.heads, sentence.deprels, actions, prob);
+
+    if (!actions.empty()) {
+      nlohmann::json output;
+      output = {{twpipe::EnsembleInstance::id_name,       sid},
+                {twpipe::EnsembleInstance::category_name, actions},
+                {twpipe::EnsembleInstance::prob_name,     prob}};
+      // flush each instance, a killed worker loses at most the one being written.
+      os << output << std::endl;
+      n_generated++;
+    } else if (record_empty) {
+      nlohmann::json output = {{twpipe::EnsembleInstance::id_name, sid}};
+      os << output << std::endl;
+    }
+  }
+  return n_generated;
 }
 
 int main(int argc, char* argv[]) {
@@ -65,14 +200,16 @@ int main(int argc, char* argv[]) {
 
   if (conf.count("embedding")) {
     twpipe::WordEmbedding::get()->load(conf["embedding"].as<std::string>(),
-                                       conf["embedding-dim"].as<unsigned>());
+                                       conf["embedding-dim"].as<unsigned>(),
+                                       conf.count("embedding-fp16") > 0);
   } else {
     twpipe::WordEmbedding::get()->empty(conf["embedding-dim"].as<unsigned>());
   }
 
   if (conf.count("elmo")) {
     twpipe::ELMo::get()->load(conf["elmo"].as<std::string>(),
-                              conf["elmo-dim"].as<unsigned>());
+                              conf["elmo-dim"].as<unsigned>(),
+                              conf.count("elmo-fp16") > 0);
   } else {
     twpipe::ELMo::get()->empty(conf["elmo-dim"].as<unsigned>());
   }
@@ -100,54 +237,75 @@ int main(int argc, char* argv[]) {
   }
 
   twpipe::EnsembleParseDataGenerator generator(engines, conf);
-  std::string buffer;
-  std::vector<std::string> tokens;
-  std::vector<std::string> postags;
-  std::vector<unsigned> heads;
-  std::vector<std::string> deprels;
-  heads.push_back(twpipe::Corpus::BAD_HED);
-  deprels.push_back(twpipe::Corpus::BAD0);
-  
-  std::vector<unsigned> actions;
-  std::vector<std::vector<float>> prob;
-  std::ifstream ifs(conf["input-file"].as<std::string>());
-                             
-  unsigned sid = 0;
-  while (std::getline(ifs, buffer)) {
-    boost::algorithm::trim(buffer);
-    if (buffer.empty()) {
-      generator.generate(tokens, postags, heads, deprels, actions, prob);
-
-      if (!actions.empty()) {
-        nlohmann::json output;
-        output = {{twpipe::EnsembleInstance::id_name,       sid},
-                  {twpipe::EnsembleInstance::category_name, actions},
-                  {twpipe::EnsembleInstance::prob_name,     prob}};
-        std::cout << output << std::endl;
-      }
-      tokens.clear();
-      postags.clear();
-      heads.clear();
-      deprels.clear();
-      heads.push_back(twpipe::Corpus::BAD_HED);
-      deprels.emplace_back(twpipe::Corpus::BAD0);
-      sid++;
-    } else if (buffer[0] == '#') {
-      continue;
-    } else {
-      std::vector<std::string> data;
-      boost::algorithm::split(data, buffer, boost::is_any_of("\t "));
-      tokens.push_back(data[1]);
-      postags.push_back(data[3]);
-      if (data[6] == "_") {
-        heads.push_back(twpipe::Corpus::BAD_HED);
-        deprels.emplace_back(twpipe::Corpus::BAD0);
-      } else {
-        heads.push_back(boost::lexical_cast<unsigned>(data[6]));
-        deprels.push_back(data[7]);
-      }
+  std::vector<Sentence> sentences;
+  load_sentences(conf["input-file"].as<std::string>(), sentences);
+
+  if (!conf.count("output")) {
+    std::vector<unsigned> ids(sentences.size());
+    for (unsigned sid = 0; sid < sentences.size(); ++sid) { ids[sid] = sid; }
+    unsigned n_generated = generate_instances(generator, sentences, ids, 0, ids.size(), false, std::cout);
+    _INFO << "[twpipe|parse|generator] generate " << n_generated << " instances.";
+    return 0;
+  }
+
+  // each worker appends to its own shard, the sentences found in the shards
+  // of a previous run are skipped.
+  std::string output = conf["output"].as<std::string>();
+  unsigned n_workers = conf["threads"].as<unsigned>();
+  std::vector<ShardLine> lines;
+  unsigned n_shards = 0;
+  while (std::ifstream(shard_path(output, n_shards)).good()) {
+    scan_shard(output, n_shards, lines);
+    n_shards++;
+  }
+  std::set<unsigned> done;
+  for (const ShardLine & line : lines) { done.insert(line.sid); }
+  std::vector<unsigned> ids;
+  for (unsigned sid = 0; sid < sentences.size(); ++sid) {
+    if (!done.count(sid)) { ids.push_back(sid); }
+  }
+  if (!done.empty()) {
+    _INFO << "[twpipe|parse|generator] resume, " << done.size() << " sentences were processed.";
+  }
+
+  std::vector<unsigned> seeds(n_workers);
+  for (unsigned wid = 0; wid < n_workers; ++wid) { seeds[wid] = (*dynet::rndeng)(); }
+  std::vector<std::vector<float>> results;
+  twpipe::Parallel::run(n_workers, [&](unsigned wid) {
+    dynet::rndeng->seed(seeds[wid]);
+    std::pair<unsigned, unsigned> range = twpipe::Parallel::shard(ids.size(), n_workers, wid);
+    std::ofstream ofs(shard_path(output, wid), std::ios::app | std::ios::binary);
+    unsigned n_generated = generate_instances(generator, sentences, ids, range.first, range.second, true, ofs);
+    return std::vector<float>{ static_cast<float>(n_generated) };
+  }, results);
+  n_shards = std::max(n_shards, n_workers);
+
+  // merge the shards in the order of the sentences.
+  lines.clear();
+  for (unsigned shard = 0; shard < n_shards; ++shard) { scan_shard(output, shard, lines); }
+  std::sort(lines.begin(), lines.end(), [](const ShardLine & a, const ShardLine & b) { return a.sid < b.sid; });
+  unsigned n_instances = 0;
+  bool ok = twpipe::CheckpointWriter::write_atomic(output, [&](std::ostream & os) {
+    std::vector<std::ifstream> shards(n_shards);
+    for (unsigned shard = 0; shard < n_shards; ++shard) {
+      shards[shard].open(shard_path(output, shard), std::ios::binary);
+    }
+    std::string buffer;
+    for (unsigned i = 0; i < lines.size(); ++i) {
+      const ShardLine & line = lines[i];
+      if ((i > 0 && lines[i - 1].sid == line.sid) || line.empty) { continue; }
+      buffer.resize(static_cast<size_t>(line.length));
+      shards[line.shard].seekg(line.offset);
+      shards[line.shard].read(&buffer[0], line.length);
+      os.write(buffer.data(), line.length);
+      n_instances++;
     }
+  });
+  if (!ok) {
+    _ERROR << "[twpipe|parse|generator] failed to write " << output << ", the shards are kept.";
+    exit(1);
   }
-  _INFO << "[twpipe|parse|generator] generate " << sid + 1 << " instances.";
+  for (unsigned shard = 0; shard < n_shards; ++shard) { std::remove(shard_path(output, shard).c_str()); }
+  _INFO << "[twpipe|parse|generator] generate " << n_instances << " instances.";
   return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,201 @@
+#include "oracle.h"
+#include "twpipe/logging.h"
+#include "twpipe/parallel.h"
+#include "twpipe/checkpoint.h"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <thread>
+#include <boost/assert.hpp>
+
+namespace twpipe {
+
+OracleScratch::OracleScratch() : tree(nullptr), stamp(0) {}
+
+OracleScratch & OracleScratch::get() {
+  static thread_local OracleScratch scratch;
+  return scratch;
+}
+
+void OracleScratch::prepare(const std::vector<unsigned> & gold_heads) {
+  if (gold_heads == ref_heads) { return; }
+  ref_heads = gold_heads;
+  unsigned len = ref_heads.size();
+  offsets.assign(len + 1, 0);
+  for (unsigned i = 0; i < len; ++i) {
+    if (ref_heads[i] < len) { offsets[ref_heads[i] + 1]++; }
+  }
+  for (unsigned h = 0; h < len; ++h) { offsets[h + 1] += offsets[h]; }
+  children.resize(offsets[len]);
+  std::vector<unsigned> cursor(offsets.begin(), offsets.end() - 1);
+  for (unsigned i = 0; i < len; ++i) {
+    if (ref_heads[i] < len) { children[cursor[ref_heads[i]]++] = i; }
+  }
+}
+
+void OracleScratch::load(const State & state) {
+  unsigned len = state.size();
+  if (stack_stamp.size() < len) {
+    stack_stamp.resize(len, 0);
+    buffer_stamp.resize(len, 0);
+  }
+  if (++stamp == 0) {
+    std::fill(stack_stamp.begin(), stack_stamp.end(), 0);
+    std::fill(buffer_stamp.begin(), buffer_stamp.end(), 0);
+    stamp = 1;
+  }
+
+  for (unsigned w : state.stack) {
+    if (w < len) { stack_stamp[w] = stamp; }
+  }
+  for (unsigned w : state.buffer) {
+    if (w < len) { buffer_stamp[w] = stamp; }
+  }
+  tree = state.tree.get();
+}
+
+const char* OracleCache::magic = "TWPIPE.ORACLE.1";
+
+OracleCache::OracleCache() : n_system_actions(0), fingerprint(0) {}
+
+unsigned long long OracleCache::get_fingerprint(Corpus & corpus) {
+  // FNV-1a over the heads and the deprels of the training sentences.
+  unsigned long long hash = 14695981039346656037ULL;
+  auto mix = [&hash](unsigned value) {
+    for (unsigned k = 0; k < 4; ++k) {
+      hash ^= ((value >> (k * 8)) & 0xff);
+      hash *= 1099511628211ULL;
+    }
+  };
+  for (unsigned sid = 0; sid < corpus.training_data.size(); ++sid) {
+    const ParseUnits & parse_units = corpus.training_data[sid].parse_units;
+    mix(parse_units.size());
+    for (const ParseUnit & unit : parse_units) {
+      mix(unit.head);
+      mix(unit.deprel);
+    }
+  }
+  return hash;
+}
+
+void OracleCache::build(Corpus & corpus,
+                        const std::vector<unsigned> & order,
+                        TransitionSystem & sys,
+                        unsigned n_threads) {
+  unsigned n = corpus.training_data.size();
+  n_threads = std::max(1u, std::min<unsigned>(n_threads, order.size()));
+  // the training data is only read by the workers, look up the instances
+  // beforehand since operator[] of the map may insert.
+  std::vector<const ParseUnits *> parses(order.size());
+  for (unsigned i = 0; i < order.size(); ++i) {
+    parses[i] = &corpus.training_data.at(order[i]).parse_units;
+  }
+
+  std::vector<std::vector<unsigned>> lengths(n_threads), shard_actions(n_threads);
+  auto worker = [&](unsigned wid) {
+    auto range = Parallel::shard(order.size(), n_threads, wid);
+    std::vector<unsigned> ref_heads, ref_deprels, output;
+    for (unsigned i = range.first; i < range.second; ++i) {
+      Corpus::parse_units_to_vector(*parses[i], ref_heads, ref_deprels);
+      // not every system clears the output.
+      output.clear();
+      sys.get_oracle_actions(ref_heads, ref_deprels, output);
+      lengths[wid].push_back(output.size());
+      shard_actions[wid].insert(shard_actions[wid].end(), output.begin(), output.end());
+    }
+  };
+  std::vector<std::thread> threads;
+  for (unsigned wid = 1; wid < n_threads; ++wid) { threads.emplace_back(worker, wid); }
+  if (!order.empty()) { worker(0); }
+  for (auto & thread : threads) { thread.join(); }
+
+  std::vector<unsigned> counts(n, 0);
+  for (unsigned wid = 0, i = 0; wid < n_threads; ++wid) {
+    for (unsigned length : lengths[wid]) { counts[order[i++]] = length; }
+  }
+  offsets.assign(n + 1, 0);
+  for (unsigned sid = 0; sid < n; ++sid) { offsets[sid + 1] = offsets[sid] + counts[sid]; }
+  actions.resize(offsets[n]);
+  for (unsigned wid = 0, i = 0; wid < n_threads; ++wid) {
+    const unsigned * source = shard_actions[wid].data();
+    for (unsigned length : lengths[wid]) {
+      std::copy(source, source + length, actions.begin() + offsets[order[i++]]);
+      source += length;
+    }
+  }
+
+  system_name = sys.name();
+  n_system_actions = sys.num_actions();
+  fingerprint = get_fingerprint(corpus);
+}
+
+void OracleCache::load_or_build(const std::string & path,
+                                Corpus & corpus,
+                                const std::vector<unsigned> & order,
+                                TransitionSystem & sys,
+                                unsigned n_threads) {
+  if (!path.empty()) {
+    std::ifstream ifs(path, std::ios::binary);
+    if (ifs && read(ifs) &&
+        system_name == sys.name() &&
+        n_system_actions == sys.num_actions() &&
+        offsets.size() == corpus.training_data.size() + 1 &&
+        fingerprint == get_fingerprint(corpus)) {
+      _INFO << "[parse|oracle] " << actions.size() << " oracle actions loaded from " << path;
+      return;
+    }
+  }
+
+  build(corpus, order, sys, n_threads);
+  _INFO << "[parse|oracle] " << actions.size() << " oracle actions of "
+    << order.size() << " sentences computed.";
+  if (!path.empty()) {
+    if (CheckpointWriter::write_atomic(path, [this](std::ostream & os) { write(os); })) {
+      _INFO << "[parse|oracle] oracle actions saved to " << path;
+    } else {
+      _WARN << "[parse|oracle] failed to write " << path;
+    }
+  }
+}
+
+void OracleCache::get(unsigned sid, std::vector<unsigned> & output) const {
+  BOOST_ASSERT_MSG(sid + 1 < offsets.size(), "[parse|oracle] sentence not cached.");
+  output.assign(actions.begin() + offsets[sid], actions.begin() + offsets[sid + 1]);
+}
+
+void OracleCache::write(std::ostream & os) const {
+  os.write(magic, strlen(magic));
+  unsigned len = system_name.size();
+  os.write(reinterpret_cast<const char *>(&len), sizeof(unsigned));
+  os.write(system_name.data(), len);
+  os.write(reinterpret_cast<const char *>(&n_system_actions), sizeof(unsigned));
+  os.write(reinterpret_cast<const char *>(&fingerprint), sizeof(unsigned long long));
+  unsigned n = offsets.size() - 1;
+  os.write(reinterpret_cast<const char *>(&n), sizeof(unsigned));
+  os.write(reinterpret_cast<const char *>(offsets.data()), offsets.size() * sizeof(unsigned));
+  os.write(reinterpret_cast<const char *>(actions.data()), actions.size() * sizeof(unsigned));
+}
+
+bool OracleCache::read(std::istream & is) {
+  std::string buffer(strlen(magic), '\0');
+  is.read(&buffer[0], buffer.size());
+  if (!is || buffer != magic) { return false; }
+
+  unsigned len = 0;
+  is.read(reinterpret_cast<char *>(&len), sizeof(unsigned));
+  system_name.resize(len);
+  if (len > 0) { is.read(&system_name[0], len); }
+  is.read(reinterpret_cast<char *>(&n_system_actions), sizeof(unsigned));
+  is.read(reinterpret_cast<char *>(&fingerprint), sizeof(unsigned long long));
+  unsigned n = 0;
+  is.read(reinterpret_cast<char *>(&n), sizeof(unsigned));
+  if (!is) { return false; }
+  offsets.resize(n + 1);
+  is.read(reinterpret_cast<char *>(offsets.data()), offsets.size() * sizeof(unsigned));
+  if (!is) { return false; }
+  actions.resize(offsets[n]);
+  is.read(reinterpret_cast<char *>(actions.data()), actions.size() * sizeof(unsigned));
+  return static_cast<bool>(is);
+}
+
+}
@@ -0,0 +1,96 @@
+#ifndef __TWPIPE_PARSER_ORACLE_H__
+#define __TWPIPE_PARSER_ORACLE_H__
+
+#include <vector>
+#include <string>
+#include "state.h"
+#include "system.h"
+#include "twpipe/corpus.h"
+
+namespace twpipe {
+
+/// The gold tree and the current configuration, laid out for the dynamic
+/// oracles of the arc-hybrid and arc-eager systems. The children lists are
+/// built once per sentence; loading a state stamps the words on the stack and
+/// the buffer, so the cost of a transition is a walk over a few children.
+/// The buffers are kept and reused, use get() for the scratch of the thread.
+struct OracleScratch {
+  std::vector<unsigned> ref_heads;
+  /// The gold children of word h are children[offsets[h], offsets[h + 1]).
+  std::vector<unsigned> children;
+  std::vector<unsigned> offsets;
+
+  /// The head index of the loaded state.
+  const State::Tree * tree;
+  std::vector<unsigned> stack_stamp;
+  std::vector<unsigned> buffer_stamp;
+  unsigned stamp;
+
+  OracleScratch();
+
+  static OracleScratch & get();
+
+  /// Build the gold children lists, a no-op for the same sentence.
+  void prepare(const std::vector<unsigned> & gold_heads);
+
+  /// Stamp the words of the state, its head index is referred to and should
+  /// outlive the scratch's use.
+  void load(const State & state);
+
+  /// Whether the word is on the stack or the buffer, the guards aren't.
+  bool in_stack(unsigned w) const { return w < stack_stamp.size() && stack_stamp[w] == stamp; }
+
+  bool in_buffer(unsigned w) const { return w < buffer_stamp.size() && buffer_stamp[w] == stamp; }
+
+  bool has_head(unsigned w) const { return tree->heads[w] != Corpus::BAD_HED; }
+
+  const unsigned * children_begin(unsigned h) const { return children.data() + offsets[h]; }
+
+  const unsigned * children_end(unsigned h) const { return children.data() + offsets[h + 1]; }
+};
+
+/// The static oracle actions of the training sentences, computed once per
+/// corpus and transition system instead of once per sentence and epoch. The
+/// actions of sentence sid are actions[offsets[sid], offsets[sid + 1]), the
+/// sentences not in the training order have none. The binary format is
+///   magic, system name length, system name, #actions of the system,
+///   fingerprint, #sentences, offsets, actions
+/// with native endianness.
+struct OracleCache {
+  static const char* magic;
+
+  std::string system_name;
+  unsigned n_system_actions;
+  /// A hash of the gold trees, a cache built on other data isn't loaded.
+  unsigned long long fingerprint;
+  std::vector<unsigned> offsets;
+  std::vector<unsigned> actions;
+
+  OracleCache();
+
+  static unsigned long long get_fingerprint(Corpus & corpus);
+
+  /// Compute the actions of the sentences in order, sharded over n_threads.
+  void build(Corpus & corpus,
+             const std::vector<unsigned> & order,
+             TransitionSystem & sys,
+             unsigned n_threads);
+
+  /// Load the cache from path if it is built on the same corpus and system,
+  /// otherwise build it and, if path is not empty, write it there.
+  void load_or_build(const std::string & path,
+                     Corpus & corpus,
+                     const std::vector<unsigned> & order,
+                     TransitionSystem & sys,
+                     unsigned n_threads);
+
+  void get(unsigned sid, std::vector<unsigned> & output) const;
+
+  void write(std::ostream & os) const;
+
+  bool read(std::istream & is);
+};
+
+}
+
+#endif  //  end for __TWPIPE_PARSER_ORACLE_H__
@@ -1,10 +1,15 @@
 #include "parse_model.h"
+#include "factored_scorer.h"
 #include "noisify.h"
 #include "dynet/expr.h"
+#include "dynet/globals.h"
 #include "twpipe/logging.h"
 #include "twpipe/alphabet_collection.h"
+#include "twpipe/math.h"
 #include <vector>
 #include <random>
+#include <algorithm>
+#include <boost/assert.hpp>
 
 namespace twpipe {
 
@@ -23,11 +28,63 @@ std::pair<unsigned, float> ParseModel::get_best_action(const std::vector<float>&
   return std::make_pair(best_a, best_score);
 }
 
+std::pair<unsigned, float> ParseModel::get_best_action_masked(const std::vector<float>& scores,
+                                                              const std::vector<float>& penalty) {
+  unsigned best_a = Math::masked_argmax(scores, penalty);
+  BOOST_ASSERT_MSG(penalty[best_a] == 0.f, "[parse] the best action is not valid.");
+  return std::make_pair(best_a, scores[best_a]);
+}
+
+void ParseModel::get_ensemble_probs(dynet::ComputationGraph & cg,
+                                    const std::vector<ParseModel *> & engines,
+                                    const std::vector<StateCheckpoint *> & checkpoints,
+                                    std::vector<float> & probs) {
+  unsigned n_engines = engines.size();
+  std::vector<dynet::Expression> weights(n_engines), biases(n_engines);
+  bool stacked = (n_engines > 1);
+  for (unsigned i = 0; stacked && i < n_engines; ++i) {
+    stacked = (engines[i]->get_output_layer(weights[i], biases[i]) &&
+               weights[i].dim() == weights[0].dim());
+  }
+
+  dynet::Expression probs_expr;
+  if (stacked) {
+    std::vector<dynet::Expression> hiddens(n_engines);
+    for (unsigned i = 0; i < n_engines; ++i) { hiddens[i] = engines[i]->get_hidden(checkpoints[i]); }
+    dynet::Expression scores = dynet::affine_transform({
+      dynet::concatenate_to_batch(biases),
+      dynet::concatenate_to_batch(weights),
+      dynet::concatenate_to_batch(hiddens)
+    });
+    probs_expr = dynet::sum_batches(dynet::softmax(scores)) / static_cast<float>(n_engines);
+  } else {
+    std::vector<dynet::Expression> engine_probs(n_engines);
+    for (unsigned i = 0; i < n_engines; ++i) {
+      engine_probs[i] = dynet::softmax(engines[i]->get_scores(checkpoints[i]));
+    }
+    probs_expr = (n_engines == 1 ? engine_probs[0] : dynet::average(engine_probs));
+  }
+  probs = dynet::as_vector(cg.get_value(probs_expr));
+}
+
+void ParseModel::prepare_ensemble(const std::vector<ParseModel *> & engines) {
+  if (engines.size() > 1 && dynet::autobatch_flag == 0) {
+    dynet::autobatch_flag = 1;
+    _INFO << "[parse|ensemble] dynet autobatching is turned on for " << engines.size() << " parsers.";
+  }
+}
+
+bool ParseModel::get_output_layer(dynet::Expression & weight, dynet::Expression & bias) {
+  return false;
+}
+
 po::options_description ParseModel::get_options() {
   po::options_description cmd("Parser settings.");
   cmd.add_options()
     ("parse-arch", po::value<std::string>()->default_value("b15"), "The architecture [dyer15, ballesteros15, kiperwasser16].")
     ("parse-system", po::value<std::string>()->default_value("archybrid"), "")
+    ("parse-scorer", po::value<std::string>()->default_value("flat"), "The output layer [flat, factored].")
+    ("parse-graph-free", "Greedy parsing without the computation graph, for a loaded model.")
     ("parse-n-layer", po::value<unsigned>()->default_value(2), "The number of layers in LSTM.")
     ("parse-char-dim", po::value<unsigned>()->default_value(16), "The dimension of char.")
     ("parse-word-dim", po::value<unsigned>()->default_value(32), "number of LSTM layers.")
@@ -41,6 +98,17 @@ po::options_description ParseModel::get_options() {
   return cmd;
 }
 
+dynet::Expression ParseModel::get_batch_scores(const std::vector<StateCheckpoint *> & checkpoints) {
+  std::vector<dynet::Expression> ret;
+  for (StateCheckpoint * checkpoint : checkpoints) { ret.push_back(get_scores(checkpoint)); }
+  return dynet::concatenate_to_batch(ret);
+}
+
+bool ParseModel::get_precomputed_scores(const std::vector<StateCheckpoint *> & checkpoints,
+                                        std::vector<float> & scores) {
+  return false;
+}
+
 void ParseModel::initialize(dynet::ComputationGraph & cg,
                         const InputUnits & input,
                         State & state,
@@ -51,15 +119,21 @@ void ParseModel::initialize(dynet::ComputationGraph & cg,
 
 void ParseModel::initialize_state(const InputUnits & input, State & state) {
   unsigned len = input.size();
-  state.buffer.resize(len + 1);
-  for (unsigned i = 0; i < len; ++i) { state.buffer[len - i] = i; }
-  state.buffer[0] = Corpus::BAD_HED;
+  state.stack.clear();
+  state.buffer.clear();
+  state.buffer.push_back(Corpus::BAD_HED);
+  for (unsigned i = len; i > 0; --i) { state.buffer.push_back(i - 1); }
   state.stack.push_back(Corpus::BAD_HED);
 }
 
 ParseModel::ParseModel(dynet::ParameterCollection & m,
                        TransitionSystem & s,
-                       EmbeddingType embedding_type) : model(m), sys(s), embedding_type_(embedding_type) {
+                       EmbeddingType embedding_type) :
+  model(m), sys(s), embedding_type_(embedding_type), factored_scorer(nullptr), graph_free(false), int8_kernels(false) {
+}
+
+ParseModel::~ParseModel() {
+  delete factored_scorer;
 }
 
 void ParseModel::predict(const std::vector<std::string>& words,
@@ -86,30 +160,67 @@ void ParseModel::label(const std::vector<std::string> & words,
 void ParseModel::predict(dynet::ComputationGraph& cg,
                          const InputUnits& input,
                          ParseUnits& parse) {
+  if (graph_free && predict_without_graph(cg, input, parse)) { return; }
+
   new_graph(cg);
 
   unsigned len = input.size();
   State state(len);
+  reset_checkpoints();
   StateCheckpoint * checkpoint = get_initial_checkpoint();
   initialize(cg, input, state, checkpoint);
 
   std::vector<unsigned> actions;
   while (!state.terminated()) {
-    // collect all valid actions.
-    std::vector<unsigned> valid_actions;
-    sys.get_valid_actions(state, valid_actions);
-
-    dynet::Expression score_exprs = get_scores(checkpoint);
-    std::vector<float> scores = dynet::as_vector(cg.get_value(score_exprs));
-
-    auto payload = get_best_action(scores, valid_actions);
-    unsigned best_a = payload.first;
+    unsigned mask = sys.get_valid_structure_mask(state);
+
+    unsigned best_a;
+    if (factored_scorer) {
+      best_a = get_best_factored_action(cg, checkpoint, mask);
+    } else {
+      std::vector<float> scores;
+      if (!get_precomputed_scores({ checkpoint }, scores)) {
+        scores = dynet::as_vector(cg.get_value(get_scores(checkpoint)));
+      }
+      best_a = get_best_action_masked(scores, sys.get_mask_penalty(mask)).first;
+    }
     actions.push_back(best_a);
     sys.perform_action(state, best_a);
     perform_action(best_a, state, cg, checkpoint);
   }
   destropy_checkpoint(checkpoint);
-  Corpus::vector_to_parse_units(state.heads, state.deprels, parse);
+  std::vector<unsigned> heads, deprels;
+  state.get_tree(heads, deprels);
+  Corpus::vector_to_parse_units(heads, deprels, parse);
+}
+
+bool ParseModel::predict_without_graph(dynet::ComputationGraph & cg,
+                                       const InputUnits & input,
+                                       ParseUnits & parse) {
+  return false;
+}
+
+unsigned ParseModel::get_best_factored_action(dynet::ComputationGraph & cg,
+                                              StateCheckpoint * checkpoint,
+                                              unsigned mask) {
+  dynet::Expression hidden = get_hidden(checkpoint);
+  std::vector<float> structure_scores =
+    dynet::as_vector(cg.get_value(factored_scorer->get_structure_output(hidden)));
+
+  unsigned best_s = UINT_MAX;
+  for (unsigned s = 0; s < structure_scores.size(); ++s) {
+    if (((mask >> s) & 1) == 0) { continue; }
+    if (best_s == UINT_MAX || structure_scores[best_s] < structure_scores[s]) { best_s = s; }
+  }
+  BOOST_ASSERT_MSG(best_s != UINT_MAX, "[parse|model] no valid structural action.");
+
+  unsigned best_l = 0;
+  if (factored_scorer->is_labeled(best_s)) {
+    std::vector<float> label_scores =
+      dynet::as_vector(cg.get_value(factored_scorer->get_label_output(hidden)));
+    best_l = std::max_element(label_scores.begin(), label_scores.end()) - label_scores.begin();
+  }
+  return factored_scorer->get_action(best_s, best_l);
 }
 
 void ParseModel::label(dynet::ComputationGraph & cg,
@@ -120,6 +231,7 @@ void ParseModel::label(dynet::ComputationGraph & cg,
 
   unsigned len = input.size();
   State state(len);
+  reset_checkpoints();
   StateCheckpoint * checkpoint = get_initial_checkpoint();
   initialize(cg, input, state, checkpoint);
 
@@ -129,10 +241,6 @@ void ParseModel::label(dynet::ComputationGraph & cg,
   sys.get_oracle_actions(ref_heads, ref_deprels, ref_actions);
   unsigned step = 0;
   while (!state.terminated()) {
-    // collect all valid actions.
-    std::vector<unsigned> valid_actions;
-    sys.get_valid_actions(state, valid_actions);
-
     dynet::Expression score_exprs = get_scores(checkpoint);
     std::vector<float> scores = dynet::as_vector(cg.get_value(score_exprs));
 
@@ -147,7 +255,9 @@ void ParseModel::label(dynet::ComputationGraph & cg,
     step++;
   }
   destropy_checkpoint(checkpoint);
-  Corpus::vector_to_parse_units(state.heads, state.deprels, output);
+  std::vector<unsigned> heads, deprels;
+  state.get_tree(heads, deprels);
+  Corpus::vector_to_parse_units(heads, deprels, output);
 }
 
 void ParseModel::beam_search(dynet::ComputationGraph & cg,
@@ -165,46 +275,53 @@ void ParseModel::beam_search(dynet::ComputationGraph & cg,
 
   states.push_back(State(len));
   scores.push_back(0.);
+  reset_checkpoints();
   StateCheckpoint * initial_checkpoint = get_initial_checkpoint();
   initialize(cg, input, states[0], initial_checkpoint);
   checkpoints.push_back(initial_checkpoint);
 
+  unsigned n_actions = sys.num_actions();
+  std::vector<Transition> transitions;
   unsigned curr = 0, next = 1;
   while (!states[curr].terminated()) {
-    std::vector<Transition> transitions;
-    for (unsigned i = curr; i < next; ++i) {
-      const State& state = states[i];
-      float score = scores[i];
-      StateCheckpoint * checkpoint = checkpoints[i];
-
-      std::vector<unsigned> valid_actions;
-      sys.get_valid_actions(state, valid_actions);
-
-      dynet::Expression score_exprs = get_scores(checkpoint);
+    // score the whole beam in one forward pass.
+    std::vector<StateCheckpoint *> beam(checkpoints.begin() + curr, checkpoints.begin() + next);
+    std::vector<float> s;
+    if (get_precomputed_scores(beam, s)) {
+      if (!structure_score) {
+        for (unsigned i = 0; i < beam.size(); ++i) { Math::log_softmax_inplace(s.data() + i * n_actions, n_actions); }
+      }
+    } else {
+      dynet::Expression score_exprs = get_batch_scores(beam);
       if (!structure_score) { score_exprs = dynet::log_softmax(score_exprs); }
-      std::vector<float> s = dynet::as_vector(cg.get_value(score_exprs));
+      s = dynet::as_vector(cg.get_value(score_exprs));
+    }
+
+    transitions.clear();
+    for (unsigned i = curr; i < next; ++i) {
+      const float * item_scores = s.data() + (i - curr) * n_actions;
+      const std::vector<unsigned> & valid_actions = sys.get_mask_actions(sys.get_valid_structure_mask(states[i]));
       for (unsigned a : valid_actions) {
-        transitions.push_back(std::make_tuple(i, a, score + s[a]));
+        transitions.push_back(std::make_tuple(i, a, scores[i] + item_scores[a]));
       }
     }
 
-    sort(transitions.begin(), transitions.end(),
-         [](const Transition& a, const Transition& b) { return std::get<2>(a) > std::get<2>(b); });
+    // only the top beam_size transitions are ordered and expanded.
+    unsigned n_survivors = std::min<unsigned>(beam_size, transitions.size());
+    std::partial_sort(transitions.begin(), transitions.begin() + n_survivors, transitions.end(),
+                      [](const Transition& a, const Transition& b) { return std::get<2>(a) > std::get<2>(b); });
     curr = next;
 
-    for (unsigned i = 0; i < transitions.size() && i < beam_size; ++i) {
+    for (unsigned i = 0; i < n_survivors; ++i) {
       unsigned cursor = std::get<0>(transitions[i]);
       unsigned action = std::get<1>(transitions[i]);
       float new_score = std::get<2>(transitions[i]);
 
-
-      State& state = states[cursor];
-      State new_state(state);
+      State new_state(states[cursor]);
       StateCheckpoint * new_checkpoint = copy_checkpoint(checkpoints[cursor]);
       sys.perform_action(new_state, action);
       perform_action(action, new_state, cg, new_checkpoint);
 
-      //      
       states.push_back(new_state);
       scores.push_back(new_score);
       checkpoints.push_back(new_checkpoint);
@@ -215,8 +332,10 @@ void ParseModel::beam_search(dynet::ComputationGraph & cg,
     destropy_checkpoint(checkpoint);
   }
   parses.resize(next - curr);
+  std::vector<unsigned> heads, deprels;
   for (unsigned i = curr; i < next; ++i) {
-    Corpus::vector_to_parse_units(states[i].heads, states[i].deprels, parses[i - curr]);
+    states[i].get_tree(heads, deprels);
+    Corpus::vector_to_parse_units(heads, deprels, parses[i - curr]);
   }
 }
 
@@ -13,6 +13,8 @@ namespace po = boost::program_options;
   
 namespace twpipe {
 
+struct FactoredScorer;
+
 struct ParseModel {
   typedef dynet::CoupledLSTMBuilder LSTMBuilderType;
 
@@ -25,11 +27,23 @@ struct ParseModel {
   dynet::ParameterCollection & model;
   TransitionSystem & sys;
   EmbeddingType embedding_type_;
+  /// The two-stage output layer, nullptr when the model scores the actions
+  /// with a single flat layer.
+  FactoredScorer * factored_scorer;
+  /// Run greedy decoding without the computation graph if the model can.
+  /// The model copies its weights out on the first use, so it is only for
+  /// inference.
+  bool graph_free;
+  /// Keep the weights of the fused kernels in int8, set when the model file
+  /// is int8.
+  bool int8_kernels;
 
   ParseModel(dynet::ParameterCollection & m,
              TransitionSystem& s,
              EmbeddingType embedding_type);
 
+  virtual ~ParseModel();
+
   void predict(const std::vector<std::string> & words,
                const std::vector<std::string> & postags,
                std::vector<unsigned> & heads,
@@ -62,21 +76,81 @@ struct ParseModel {
   static std::pair<unsigned, float> get_best_action(const std::vector<float>& scores,
                                                     const std::vector<unsigned>& valid_actions);
 
+  /// Get the best action with the invalid ones masked out by the penalty of
+  /// TransitionSystem::get_mask_penalty.
+  static std::pair<unsigned, float> get_best_action_masked(const std::vector<float>& scores,
+                                                           const std::vector<float>& penalty);
+
+  /// Average the action distributions of the engines at their checkpoints,
+  /// in one forward pass. When all the engines have flat output layers of
+  /// the same shape, the layers are stacked: their weights and the hidden
+  /// layers of the engines go into one batch, scored by a single batched
+  /// matrix multiply, and the softmaxes are averaged with sum_batches. The
+  /// layers below the output are still built per engine and left to the
+  /// autobatching of dynet, see prepare_ensemble.
+  static void get_ensemble_probs(dynet::ComputationGraph & cg,
+                                 const std::vector<ParseModel *> & engines,
+                                 const std::vector<StateCheckpoint *> & checkpoints,
+                                 std::vector<float> & probs);
+
+  /// Turn on the autobatching of dynet (as --dynet-autobatch 1 does) before
+  /// the graphs of an ensemble of more than one engine are built, so the
+  /// same-shaped operations of the engines are batched.
+  static void prepare_ensemble(const std::vector<ParseModel *> & engines);
+
+  /// The weight and the bias of the flat output layer in the current graph,
+  /// so that scores = weight * get_hidden() + bias. Return false with the
+  /// factored scorer.
+  virtual bool get_output_layer(dynet::Expression & weight, dynet::Expression & bias);
+
+  /// The checkpoints are owned by the model and destropy_checkpoint may not
+  /// release anything by itself. Reclaim all the checkpoints handed out so
+  /// far, call it before getting the initial checkpoint of a sentence once
+  /// the checkpoints of the previous one are no longer used.
+  virtual void reset_checkpoints() = 0;
+
   virtual StateCheckpoint * get_initial_checkpoint() = 0;
 
   virtual StateCheckpoint * copy_checkpoint(StateCheckpoint * checkpoint) = 0;
 
   virtual void destropy_checkpoint(StateCheckpoint * checkpoint) = 0;
 
-  /// Get the un-softmaxed scores from the LSTM-parser.
+  /// Get the hidden layer which the output layer is applied to.
+  virtual dynet::Expression get_hidden(StateCheckpoint * checkpoint) = 0;
+
+  /// Get the un-softmaxed scores from the LSTM-parser. With the factored
+  /// scorer, they are the log-probabilities of the actions.
   virtual dynet::Expression get_scores(StateCheckpoint * checkpoint) = 0;
 
+  /// Get the scores of several checkpoints as one batched expression, the
+  /// i-th batch element holds the scores of the i-th checkpoint. Models
+  /// override it to run the scoring layers once over the whole batch.
+  virtual dynet::Expression get_batch_scores(const std::vector<StateCheckpoint *> & checkpoints);
+
+  /// Compute the scores of the checkpoints (concatenated, in the layout of
+  /// get_batch_scores) without adding nodes to the graph. Return false if
+  /// the model can't, then the caller goes through get_batch_scores.
+  virtual bool get_precomputed_scores(const std::vector<StateCheckpoint *> & checkpoints,
+                                      std::vector<float> & scores);
+
   virtual dynet::Expression l2() = 0;
+
+  /// Choose the structural action among the valid ones first and score the
+  /// labels only when it takes one.
+  unsigned get_best_factored_action(dynet::ComputationGraph& cg,
+                                    StateCheckpoint * checkpoint,
+                                    unsigned mask);
   
   void predict(dynet::ComputationGraph& cg,
                const InputUnits& input,
                ParseUnits& parse);
 
+  /// The greedy decoding of graph_free. Return false if the model doesn't
+  /// support it.
+  virtual bool predict_without_graph(dynet::ComputationGraph& cg,
+                                     const InputUnits& input,
+                                     ParseUnits& parse);
+
   void label(dynet::ComputationGraph& cg,
              const InputUnits& input,
              const ParseUnits& parse,
@@ -4,6 +4,8 @@
 #include "parse_model.h"
 #include "state.h"
 #include "system.h"
+#include "persistent_stack.h"
+#include "stack_lstm_executor.h"
 #include "twpipe/corpus.h"
 #include "dynet_layer/layer.h"
 #include <vector>
@@ -20,8 +22,8 @@ struct Ballesteros15Model : public ParseModel {
     dynet::RNNPointer s_pointer;
     dynet::RNNPointer q_pointer;
     dynet::RNNPointer a_pointer;
-    std::vector<dynet::Expression> stack;
-    std::vector<dynet::Expression> buffer;
+    PersistentStack<dynet::Expression> stack;
+    PersistentStack<dynet::Expression> buffer;
   };
 
   struct TransitionSystemFunction {
@@ -101,7 +103,8 @@ struct Ballesteros15Model : public ParseModel {
   Merge3Layer merge_input;  // merge (2 * word, pos, preword)
   Merge3Layer merge;        // merge (s_lstm, q_lstm, a_lstm)
   Merge3Layer composer;     // compose (head, modifier, relation)
-  DenseLayer scorer;
+  /// The flat output layer, not built with the factored scorer.
+  DenseLayer * scorer;
 
   dynet::Parameter p_action_start;  // start of action
   dynet::Parameter p_buffer_guard;  // end of buffer
@@ -120,12 +123,19 @@ struct Ballesteros15Model : public ParseModel {
   dynet::RNNPointer s_pointer;
   dynet::RNNPointer q_pointer;
   dynet::RNNPointer a_pointer;
-  std::vector<dynet::Expression> stack;
   std::vector<dynet::Expression> buffer;
 
+  /// The checkpoints of the current sentence and the stack nodes they share,
+  /// both are reclaimed when the next sentence starts.
+  CheckpointPool<StateCheckpointImpl> checkpoint_pool;
+  PersistentStack<dynet::Expression>::Arena arena;
+
   /// The reference
   TransitionSystemFunction* sys_func;
 
+  /// The graph-free copy of the model for greedy inference.
+  StackLSTMExecutor executor;
+
   /// The Configurations: useful for other models.
   unsigned size_c, dim_c, dim_w, size_p, dim_p, dim_t, size_a, dim_a, dim_l;
   unsigned n_layers, dim_lstm_in, dim_hidden;
@@ -143,9 +153,12 @@ struct Ballesteros15Model : public ParseModel {
                               unsigned n_layers,
                               unsigned dim_lstm_in,
                               unsigned dim_hidden,
+                              bool factored,
                               TransitionSystem& system,
                               EmbeddingType embedding_type);
 
+  ~Ballesteros15Model();
+
   void new_graph(dynet::ComputationGraph& cg) override;
 
   void initialize_parser(dynet::ComputationGraph& cg,
@@ -157,16 +170,33 @@ struct Ballesteros15Model : public ParseModel {
                       dynet::ComputationGraph& cg,
                       StateCheckpoint * checkpoint) override;
 
+  void reset_checkpoints() override;
+
   StateCheckpoint * get_initial_checkpoint() override;
 
   StateCheckpoint * copy_checkpoint(StateCheckpoint * checkpoint) override;
 
   void destropy_checkpoint(StateCheckpoint * checkpoint) override;
 
+  dynet::Expression get_hidden(StateCheckpoint * checkpoint) override;
+
+  bool get_output_layer(dynet::Expression & weight, dynet::Expression & bias) override;
+
   /// Get the un-softmaxed scores from the LSTM-parser.
   dynet::Expression get_scores(StateCheckpoint * checkpoint) override;
 
+  dynet::Expression get_batch_scores(const std::vector<StateCheckpoint *> & checkpoints) override;
+
   dynet::Expression l2() override;
+
+  /// Build the inputs of the buffer, buffer[0] is the guard and buffer[len - i]
+  /// is the i-th word.
+  void build_buffer(const InputUnits & input,
+                    std::vector<dynet::Expression> & buffer);
+
+  bool predict_without_graph(dynet::ComputationGraph & cg,
+                             const InputUnits & input,
+                             ParseUnits & parse) override;
 };
 
 }
@@ -20,6 +20,11 @@ ParseModelBuilder::ParseModelBuilder(po::variables_map & conf) {
   arch_name = (conf.count("parse-system") ?
                conf["parse-arch"].as<std::string>() :
                std::string("b15"));
+  scorer_name = (conf.count("parse-scorer") ?
+                 conf["parse-scorer"].as<std::string>() :
+                 std::string("flat"));
+
+  graph_free = (conf.count("parse-graph-free") > 0);
 
   if (conf.count("embedding")) {
     embedding_type = kStaticEmbeddings;
@@ -59,6 +64,12 @@ ParseModel * ParseModelBuilder::build(dynet::ParameterCollection & model) {
   }
   _INFO << "[parse|model_builder] transition system: " << system_name;
 
+  if (scorer_name != "flat" && scorer_name != "factored") {
+    _ERROR << "[parse|model_builder] unknown scorer name: " << scorer_name;
+    exit(1);
+  }
+  bool factored = (scorer_name == "factored");
+
   ParseModel* parser = nullptr;
 
   if (arch_name == "dyer15" || arch_name == "d15") {
@@ -74,6 +85,7 @@ ParseModel * ParseModelBuilder::build(dynet::ParameterCollection & model) {
                              n_layers,
                              lstm_input_dim,
                              hidden_dim,
+                             factored,
                              (*system),
                              embedding_type);
 
@@ -91,6 +103,7 @@ ParseModel * ParseModelBuilder::build(dynet::ParameterCollection & model) {
                                     n_layers,
                                     lstm_input_dim,
                                     hidden_dim,
+                                    factored,
                                     (*system),
                                     embedding_type);
 
@@ -105,6 +118,7 @@ ParseModel * ParseModelBuilder::build(dynet::ParameterCollection & model) {
                                     n_layers,
                                     lstm_input_dim,
                                     hidden_dim,
+                                    factored,
                                     (*system),
                                     embedding_type);
   } else {
@@ -112,6 +126,8 @@ ParseModel * ParseModelBuilder::build(dynet::ParameterCollection & model) {
     exit(1);
   }
   _INFO << "[parse|model_builder] architecture: " << arch_name;
+
+  _INFO << "[parse|model_builder] scorer: " << scorer_name;
   return parser;
 }
 
@@ -119,6 +135,7 @@ void ParseModelBuilder::to_json() {
   Model::get()->to_json(Model::kParserName, {
     { "system", system_name },
     { "arch", arch_name },
+    { "scorer", scorer_name },
     { "pos-dim", boost::lexical_cast<std::string>(pos_dim) },
     { "n-postags", boost::lexical_cast<std::string>(pos_size) },
     { "lstm-input-dim", boost::lexical_cast<std::string>(lstm_input_dim) },
@@ -164,6 +181,9 @@ ParseModel * ParseModelBuilder::from_json(dynet::ParameterCollection & model) {
 
   _INFO << "[parse|model_builder] transition system: " << system_name;
   arch_name = globals->from_json(Model::kParserName, "arch");
+  scorer_name = globals->from_json(Model::kParserName, "scorer");
+  // models saved before the factored scorer use the flat one.
+  if (scorer_name == "__empty__") { scorer_name = "flat"; }
 
   unsigned temp_size;
   temp_size =
@@ -237,6 +257,9 @@ ParseModel * ParseModelBuilder::from_json(dynet::ParameterCollection & model) {
   }
   engine = build(model);
   globals->from_json(Model::kParserName, model);
+  // the weights are final once loaded, so the graph-free decoding is safe.
+  engine->graph_free = graph_free;
+  engine->int8_kernels = (globals->get_precision() == "int8");
   return engine;
 }
 
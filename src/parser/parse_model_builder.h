@@ -14,6 +14,7 @@ struct ParseModelBuilder {
   TransitionSystem * system;
   std::string system_name;
   std::string arch_name;
+  std::string scorer_name;
 
   unsigned char_size;
   unsigned char_dim;
@@ -29,6 +30,7 @@ struct ParseModelBuilder {
   unsigned lstm_input_dim;
   unsigned hidden_dim;
   EmbeddingType embedding_type;
+  bool graph_free;
 
   ParseModelBuilder(po::variables_map & conf);
 
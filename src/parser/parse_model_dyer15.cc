@@ -1,4 +1,5 @@
 #include "parse_model_dyer15.h"
+#include "factored_scorer.h"
 #include "dynet/expr.h"
 #include "arcstd.h"
 #include "archybrid.h"
@@ -88,10 +89,10 @@ void Dyer15Model::ArcStandardFunction::perform_action(const unsigned& action,
     dynet::Expression mod_expr, hed_expr;
     if (ArcStandard::is_left(action)) {
       hed_expr = cp.stack.back();
-      mod_expr = cp.stack[cp.stack.size() - 2];
+      mod_expr = cp.stack.top(1);
     } else {
       mod_expr = cp.stack.back();
-      hed_expr = cp.stack[cp.stack.size() - 2];
+      hed_expr = cp.stack.top(1);
     }
     cp.stack.pop_back(); cp.stack.pop_back();
     cp.s_pointer = s_lstm.get_head(cp.s_pointer);
@@ -135,7 +136,7 @@ void Dyer15Model::ArcHybridFunction::perform_action(const unsigned& action,
     cp.q_pointer = q_lstm.state();
   } else {
     dynet::Expression mod_expr, hed_expr;
-    hed_expr = cp.stack[cp.stack.size() - 2];
+    hed_expr = cp.stack.top(1);
     mod_expr = cp.stack.back();
 
     cp.stack.pop_back();
@@ -168,7 +169,7 @@ void Dyer15Model::SwapFunction::perform_action(const unsigned & action,
     cp.q_pointer = q_lstm.get_head(cp.q_pointer);
   } else if (Swap::is_swap(action)) {
     dynet::Expression j_expr = cp.stack.back();
-    dynet::Expression i_expr = cp.stack[cp.stack.size() - 2];
+    dynet::Expression i_expr = cp.stack.top(1);
 
     cp.stack.pop_back();
     cp.stack.pop_back();
@@ -184,11 +185,13 @@ void Dyer15Model::SwapFunction::perform_action(const unsigned & action,
     dynet::Expression mod_expr, hed_expr;
     if (Swap::is_left(action)) {
       hed_expr = cp.stack.back();
-      mod_expr = cp.stack[cp.stack.size() - 2];
+      mod_expr = cp.stack.top(1);
     } else {
-      hed_expr = cp.stack[cp.stack.size() - 2];
+      hed_expr = cp.stack.top(1);
       mod_expr = cp.stack.back();
     }
+    cp.stack.pop_back();
+    cp.stack.pop_back();
     cp.s_pointer = s_lstm.get_head(cp.s_pointer);
     cp.s_pointer = s_lstm.get_head(cp.s_pointer);
     cp.stack.push_back(dynet::tanh(composer.get_output(hed_expr, mod_expr, rel_expr)));
@@ -209,6 +212,7 @@ Dyer15Model::Dyer15Model(dynet::ParameterCollection & m,
                          unsigned n_layers,
                          unsigned dim_lstm_in,
                          unsigned dim_hidden,
+                         bool factored,
                          TransitionSystem& system,
                          EmbeddingType embedding_type) :
   ParseModel(m, system, embedding_type),
@@ -223,11 +227,12 @@ Dyer15Model::Dyer15Model(dynet::ParameterCollection & m,
   merge_input(m, dim_w, dim_p, dim_t, dim_lstm_in),
   merge(m, dim_hidden, dim_hidden, dim_hidden, dim_hidden),
   composer(m, dim_lstm_in, dim_lstm_in, dim_l, dim_lstm_in),
-  scorer(m, dim_hidden, size_a),
+  scorer(factored ? nullptr : new DenseLayer(m, dim_hidden, size_a)),
   p_action_start(m.add_parameters({ dim_a })),
   p_buffer_guard(m.add_parameters({ dim_lstm_in })),
   p_stack_guard(m.add_parameters({ dim_lstm_in })),
   sys_func(nullptr),
+  executor(system),
   size_w(size_w), dim_w(dim_w),
   size_p(size_p), dim_p(dim_p),
   dim_t(dim_t),
@@ -248,6 +253,12 @@ Dyer15Model::Dyer15Model(dynet::ParameterCollection & m,
     _ERROR << "Main:: Unknown transition system: " << system_name;
     exit(1);
   }
+  // the factored scorer is built last, so its parameters come after the model's.
+  if (factored) { factored_scorer = new FactoredScorer(m, dim_hidden, system); }
+}
+
+Dyer15Model::~Dyer15Model() {
+  delete scorer;
 }
 
 void Dyer15Model::perform_action(const unsigned& action,
@@ -260,32 +271,67 @@ void Dyer15Model::perform_action(const unsigned& action,
   sys_func->perform_action(action, cg, a_lstm, s_lstm, q_lstm, composer, *cp, act_repr, rel_repr);
 }
 
+void Dyer15Model::reset_checkpoints() {
+  checkpoint_pool.reset();
+  arena.reset();
+}
+
 Dyer15Model::StateCheckpoint * Dyer15Model::get_initial_checkpoint() {
-  return new StateCheckpointImpl();
+  auto * cp = checkpoint_pool.allocate();
+  *cp = StateCheckpointImpl();
+  cp->stack = PersistentStack<dynet::Expression>(&arena);
+  cp->buffer = PersistentStack<dynet::Expression>(&arena);
+  return cp;
 }
 
 ParseModel::StateCheckpoint * Dyer15Model::copy_checkpoint(StateCheckpoint * checkpoint) {
   auto * cp = dynamic_cast<StateCheckpointImpl *>(checkpoint);
-  auto * new_checkpoint = new StateCheckpointImpl();
-  new_checkpoint->s_pointer = cp->s_pointer;
-  new_checkpoint->q_pointer = cp->q_pointer;
-  new_checkpoint->a_pointer = cp->a_pointer;
-  new_checkpoint->stack = cp->stack;
-  new_checkpoint->buffer = cp->buffer;
+  auto * new_checkpoint = checkpoint_pool.allocate();
+  // the stacks share their nodes, so this is a constant-size copy.
+  *new_checkpoint = *cp;
   return new_checkpoint;
 }
 
 void Dyer15Model::destropy_checkpoint(StateCheckpoint * checkpoint) {
-  delete dynamic_cast<StateCheckpointImpl *>(checkpoint);
+  // reclaimed all at once by reset_checkpoints.
 }
 
-dynet::Expression Dyer15Model::get_scores(ParseModel::StateCheckpoint * checkpoint) {
+dynet::Expression Dyer15Model::get_hidden(ParseModel::StateCheckpoint * checkpoint) {
   auto * cp = dynamic_cast<StateCheckpointImpl *>(checkpoint);
-  return scorer.get_output(dynet::rectify(merge.get_output(
+  return dynet::rectify(merge.get_output(
     s_lstm.get_h(cp->s_pointer).back(),
     q_lstm.get_h(cp->q_pointer).back(),
     a_lstm.get_h(cp->a_pointer).back())
-  ));
+  );
+}
+
+bool Dyer15Model::get_output_layer(dynet::Expression & weight, dynet::Expression & bias) {
+  if (!scorer) { return false; }
+  weight = scorer->W;
+  bias = scorer->B;
+  return true;
+}
+
+dynet::Expression Dyer15Model::get_scores(ParseModel::StateCheckpoint * checkpoint) {
+  dynet::Expression hidden = get_hidden(checkpoint);
+  return (factored_scorer ? factored_scorer->get_output(hidden) : scorer->get_output(hidden));
+}
+
+dynet::Expression Dyer15Model::get_batch_scores(const std::vector<StateCheckpoint *> & checkpoints) {
+  std::vector<dynet::Expression> s, q, a;
+  for (StateCheckpoint * checkpoint : checkpoints) {
+    auto * cp = dynamic_cast<StateCheckpointImpl *>(checkpoint);
+    s.push_back(s_lstm.get_h(cp->s_pointer).back());
+    q.push_back(q_lstm.get_h(cp->q_pointer).back());
+    a.push_back(a_lstm.get_h(cp->a_pointer).back());
+  }
+  // the merge and scorer layers run once over the whole batch.
+  dynet::Expression hidden = dynet::rectify(merge.get_output(
+    dynet::concatenate_to_batch(s),
+    dynet::concatenate_to_batch(q),
+    dynet::concatenate_to_batch(a))
+  );
+  return (factored_scorer ? factored_scorer->get_output(hidden) : scorer->get_output(hidden));
 }
 
 dynet::Expression Dyer15Model::l2() {
@@ -296,7 +342,11 @@ dynet::Expression Dyer15Model::l2() {
   for (auto & e : merge_input.get_params()) { ret.push_back(dynet::squared_norm(e)); }
   for (auto & e : merge.get_params()) { ret.push_back(dynet::squared_norm(e)); }
   for (auto & e : composer.get_params()) { ret.push_back(dynet::squared_norm(e)); }
-  for (auto & e : scorer.get_params()) { ret.push_back(dynet::squared_norm(e)); }
+  if (factored_scorer) {
+    for (auto & e : factored_scorer->get_params()) { ret.push_back(dynet::squared_norm(e)); }
+  } else {
+    for (auto & e : scorer->get_params()) { ret.push_back(dynet::squared_norm(e)); }
+  }
   ret.push_back(dynet::squared_norm(buffer_guard));
   ret.push_back(dynet::squared_norm(stack_guard));
   ret.push_back(dynet::squared_norm(action_start));
@@ -317,18 +367,16 @@ void Dyer15Model::new_graph(dynet::ComputationGraph& cg) {
   merge_input.new_graph(cg);
   merge.new_graph(cg);
   composer.new_graph(cg);
-  scorer.new_graph(cg);
+  if (scorer) { scorer->new_graph(cg); }
+  if (factored_scorer) { factored_scorer->new_graph(cg); }
 
   action_start = dynet::parameter(cg, p_action_start);
   buffer_guard = dynet::parameter(cg, p_buffer_guard);
   stack_guard = dynet::parameter(cg, p_stack_guard);
 }
 
-void Dyer15Model::initialize_parser(dynet::ComputationGraph & cg,
-                                    const InputUnits & input,
-                                    ParseModel::StateCheckpoint * checkpoint) {
-  auto * cp = dynamic_cast<StateCheckpointImpl *>(checkpoint);
-  
+void Dyer15Model::build_buffer(const InputUnits & input,
+                               std::vector<dynet::Expression> & buffer) {
   std::vector<std::vector<float>> embeddings;
   unsigned len = input.size();
   // The first unit is pseduo root.
@@ -344,29 +392,40 @@ void Dyer15Model::initialize_parser(dynet::ComputationGraph & cg,
     ELMo::get()->render(words, embeddings);
   }
 
-  s_lstm.start_new_sequence();
-  q_lstm.start_new_sequence();
-  a_lstm.start_new_sequence();
-  a_lstm.add_input(action_start);
-
-  cp->stack.clear();
-  cp->buffer.resize(len + 1);
+  buffer.resize(len + 1);
 
   // Pay attention to this, if the guard word is handled here, there is no need
   // to insert it when loading the data.
-  cp->buffer[0] = buffer_guard;
+  buffer[0] = buffer_guard;
   for (unsigned i = 0; i < len; ++i) {
     unsigned wid = input[i].wid;
     unsigned pid = input[i].pid;
 
-    cp->buffer[len - i] = dynet::rectify(merge_input.get_output(
+    buffer[len - i] = dynet::rectify(merge_input.get_output(
       word_emb.embed(wid), pos_emb.embed(pid), pretrain_emb.get_output(embeddings[i])
     ));
   }
+}
+
+void Dyer15Model::initialize_parser(dynet::ComputationGraph & cg,
+                                    const InputUnits & input,
+                                    ParseModel::StateCheckpoint * checkpoint) {
+  auto * cp = dynamic_cast<StateCheckpointImpl *>(checkpoint);
+  
+  std::vector<dynet::Expression> buffer;
+  build_buffer(input, buffer);
+
+  s_lstm.start_new_sequence();
+  q_lstm.start_new_sequence();
+  a_lstm.start_new_sequence();
+  a_lstm.add_input(action_start);
 
+  cp->stack.clear();
+  cp->buffer.clear();
   // push word into buffer in reverse order, pay attention to (i == len).
-  for (unsigned i = 0; i <= len; ++i) {
-    q_lstm.add_input(cp->buffer[i]);
+  for (unsigned i = 0; i < buffer.size(); ++i) {
+    q_lstm.add_input(buffer[i]);
+    cp->buffer.push_back(buffer[i]);
   }
 
   s_lstm.add_input(stack_guard);
@@ -376,4 +435,31 @@ void Dyer15Model::initialize_parser(dynet::ComputationGraph & cg,
   cp->q_pointer = q_lstm.state();
 }
 
+bool Dyer15Model::predict_without_graph(dynet::ComputationGraph & cg,
+                                        const InputUnits & input,
+                                        ParseUnits & parse) {
+  if (factored_scorer) { return false; }
+  new_graph(cg);
+  if (!executor.loaded) {
+    executor.load(cg, s_lstm, q_lstm, a_lstm, act_emb, rel_emb, merge, composer, *scorer,
+                  action_start, stack_guard, size_a, int8_kernels);
+  }
+
+  // only the inputs of the buffer are computed in the graph.
+  std::vector<dynet::Expression> buffer;
+  build_buffer(input, buffer);
+  std::vector<std::vector<float>> buffer_values(buffer.size());
+  for (unsigned i = 0; i < buffer.size(); ++i) { buffer_values[i] = dynet::as_vector(cg.get_value(buffer[i])); }
+
+  State state(input.size());
+  initialize_state(input, state);
+  executor.initialize(buffer_values);
+  executor.predict(state);
+
+  std::vector<unsigned> heads, deprels;
+  state.get_tree(heads, deprels);
+  Corpus::vector_to_parse_units(heads, deprels, parse);
+  return true;
+}
+
 }
\ No newline at end of file
@@ -1,63 +1,57 @@
 #include "parse_model_kiperwasser16.h"
+#include "factored_scorer.h"
 #include "twpipe/logging.h"
 #include "twpipe/embedding.h"
 #include "twpipe/elmo.h"
+#include <cmath>
 
 namespace twpipe {
 
-void Kiperwasser16Model::ArcEagerFunction::extract_feature(std::vector<dynet::Expression>& encoded,
-                                                           dynet::Expression& empty,
-                                                           Kiperwasser16Model::StateCheckpointImpl & cp,
+void Kiperwasser16Model::ArcEagerFunction::extract_feature(Kiperwasser16Model::StateCheckpointImpl & cp,
                                                            const State& state) {
   // S1, S0, B0, B1
   // should do after sys.perform_action
   unsigned stack_size = state.stack.size();
-  if (stack_size > 2) { cp.f0 = encoded[state.stack[stack_size - 2]]; } else { cp.f0 = empty; }
-  if (stack_size > 1) { cp.f1 = encoded[state.stack[stack_size - 1]]; } else { cp.f1 = empty; }
+  if (stack_size > 2) { cp.slots[0] = state.stack[stack_size - 2]; } else { cp.slots[0] = EMPTY_SLOT; }
+  if (stack_size > 1) { cp.slots[1] = state.stack[stack_size - 1]; } else { cp.slots[1] = EMPTY_SLOT; }
 
   unsigned buffer_size = state.buffer.size();
-  if (buffer_size > 1) { cp.f2 = encoded[state.buffer[buffer_size - 1]]; } else { cp.f2 = empty; }
-  if (buffer_size > 2) { cp.f3 = encoded[state.buffer[buffer_size - 2]]; } else { cp.f3 = empty; }
+  if (buffer_size > 1) { cp.slots[2] = state.buffer[buffer_size - 1]; } else { cp.slots[2] = EMPTY_SLOT; }
+  if (buffer_size > 2) { cp.slots[3] = state.buffer[buffer_size - 2]; } else { cp.slots[3] = EMPTY_SLOT; }
 }
 
-void Kiperwasser16Model::ArcStandardFunction::extract_feature(std::vector<dynet::Expression> & encoded,
-                                                              dynet::Expression & empty,
-                                                              Kiperwasser16Model::StateCheckpointImpl & cp,
+void Kiperwasser16Model::ArcStandardFunction::extract_feature(Kiperwasser16Model::StateCheckpointImpl & cp,
                                                               const State& state) {
   // should considering the guard in state and buffer.
   unsigned stack_size = state.stack.size();
-  if (stack_size > 3) { cp.f0 = encoded[state.stack[stack_size - 3]]; } else { cp.f0 = empty; }
-  if (stack_size > 2) { cp.f1 = encoded[state.stack[stack_size - 2]]; } else { cp.f1 = empty; }
-  if (stack_size > 1) { cp.f2 = encoded[state.stack[stack_size - 1]]; } else { cp.f2 = empty; }
+  if (stack_size > 3) { cp.slots[0] = state.stack[stack_size - 3]; } else { cp.slots[0] = EMPTY_SLOT; }
+  if (stack_size > 2) { cp.slots[1] = state.stack[stack_size - 2]; } else { cp.slots[1] = EMPTY_SLOT; }
+  if (stack_size > 1) { cp.slots[2] = state.stack[stack_size - 1]; } else { cp.slots[2] = EMPTY_SLOT; }
 
   unsigned buffer_size = state.buffer.size();
-  if (buffer_size > 1) { cp.f3 = encoded[state.buffer[buffer_size - 1]]; } else { cp.f3 = empty; }
+  if (buffer_size > 1) { cp.slots[3] = state.buffer[buffer_size - 1]; } else { cp.slots[3] = EMPTY_SLOT; }
 }
 
-void Kiperwasser16Model::ArcHybridFunction::extract_feature(std::vector<dynet::Expression>& encoded,
-                                                            dynet::Expression & empty,
-                                                            Kiperwasser16Model::StateCheckpointImpl & cp,
+void Kiperwasser16Model::ArcHybridFunction::extract_feature(Kiperwasser16Model::StateCheckpointImpl & cp,
                                                             const State& state) {
   unsigned stack_size = state.stack.size();
-  if (stack_size > 3) { cp.f0 = encoded[state.stack[stack_size - 3]]; } else { cp.f0 = empty; }
-  if (stack_size > 2) { cp.f1 = encoded[state.stack[stack_size - 2]]; } else { cp.f1 = empty; }
-  if (stack_size > 1) { cp.f2 = encoded[state.stack[stack_size - 1]]; } else { cp.f2 = empty; }
+  if (stack_size > 3) { cp.slots[0] = state.stack[stack_size - 3]; } else { cp.slots[0] = EMPTY_SLOT; }
+  if (stack_size > 2) { cp.slots[1] = state.stack[stack_size - 2]; } else { cp.slots[1] = EMPTY_SLOT; }
+  if (stack_size > 1) { cp.slots[2] = state.stack[stack_size - 1]; } else { cp.slots[2] = EMPTY_SLOT; }
 
   unsigned buffer_size = state.buffer.size();
-  if (buffer_size > 1) { cp.f3 = encoded[state.buffer[buffer_size - 1]]; } else { cp.f3 = empty; }
+  if (buffer_size > 1) { cp.slots[3] = state.buffer[buffer_size - 1]; } else { cp.slots[3] = EMPTY_SLOT; }
 }
 
-void Kiperwasser16Model::SwapFunction::extract_feature(std::vector<dynet::Expression>& encoded,
-                                                       dynet::Expression& empty,
-                                                       Kiperwasser16Model::StateCheckpointImpl & cp,
+void Kiperwasser16Model::SwapFunction::extract_feature(Kiperwasser16Model::StateCheckpointImpl & cp,
                                                        const State& state) {
   unsigned stack_size = state.stack.size();
-  if (stack_size > 3) { cp.f0 = encoded[state.stack[stack_size - 3]]; } else { cp.f0 = empty; }
-  if (stack_size > 2) { cp.f1 = encoded[state.stack[stack_size - 2]]; } else { cp.f1 = empty; }
-  if (stack_size > 1) { cp.f2 = encoded[state.stack[stack_size - 1]]; } else { cp.f2 = empty; }
+  if (stack_size > 3) { cp.slots[0] = state.stack[stack_size - 3]; } else { cp.slots[0] = EMPTY_SLOT; }
+  if (stack_size > 2) { cp.slots[1] = state.stack[stack_size - 2]; } else { cp.slots[1] = EMPTY_SLOT; }
+  if (stack_size > 1) { cp.slots[2] = state.stack[stack_size - 1]; } else { cp.slots[2] = EMPTY_SLOT; }
 
   unsigned buffer_size = state.buffer.size();
-  if (buffer_size > 1) { cp.f3 = encoded[state.buffer[buffer_size - 1]]; } else { cp.f3 = empty; }
+  if (buffer_size > 1) { cp.slots[3] = state.buffer[buffer_size - 1]; } else { cp.slots[3] = EMPTY_SLOT; }
 }
 
 Kiperwasser16Model::Kiperwasser16Model(dynet::ParameterCollection & m,
@@ -70,6 +64,7 @@ Kiperwasser16Model::Kiperwasser16Model(dynet::ParameterCollection & m,
                                        unsigned n_layers,
                                        unsigned dim_lstm_in,
                                        unsigned dim_hidden,
+                                       bool factored,
                                        TransitionSystem & system,
                                        EmbeddingType embedding_type) :
   ParseModel(m, system, embedding_type),
@@ -80,11 +75,12 @@ Kiperwasser16Model::Kiperwasser16Model(dynet::ParameterCollection & m,
   pretrain_emb(dim_t),
   merge_input(m, dim_w, dim_p, dim_t, dim_lstm_in),
   merge(m, dim_hidden, dim_hidden, dim_hidden, dim_hidden, dim_hidden),
-  scorer(m, dim_hidden, size_a),
+  scorer(factored ? nullptr : new DenseLayer(m, dim_hidden, size_a)),
   p_empty(m.add_parameters({ dim_hidden })),
   p_fwd_guard(m.add_parameters({ dim_lstm_in })),
   p_bwd_guard(m.add_parameters({ dim_lstm_in })),
   sys_func(nullptr),
+  precomputed(false),
   size_w(size_w), dim_w(dim_w),
   size_p(size_p), dim_p(dim_p),
   dim_t(dim_t),
@@ -95,15 +91,21 @@ Kiperwasser16Model::Kiperwasser16Model(dynet::ParameterCollection & m,
   if (system_name == "arcstd") {
     sys_func = new ArcStandardFunction();
   } else if (system_name == "arceager") {
-    // sys_func = new ArcEagerFunction();
+    sys_func = new ArcEagerFunction();
   } else if (system_name == "archybrid") {
     sys_func = new ArcHybridFunction();
   } else if (system_name == "swap") {
-    // sys_func = new SwapFunction();
+    sys_func = new SwapFunction();
   } else {
     _ERROR << "Main:: Unknown transition system: " << system_name;
     exit(1);
   }
+  // the factored scorer is built last, so its parameters come after the model's.
+  if (factored) { factored_scorer = new FactoredScorer(m, dim_hidden, system); }
+}
+
+Kiperwasser16Model::~Kiperwasser16Model() {
+  delete scorer;
 }
 
 void Kiperwasser16Model::new_graph(dynet::ComputationGraph & cg) {
@@ -114,7 +116,8 @@ void Kiperwasser16Model::new_graph(dynet::ComputationGraph & cg) {
   pretrain_emb.new_graph(cg);
   merge_input.new_graph(cg);
   merge.new_graph(cg);
-  scorer.new_graph(cg);
+  if (scorer) { scorer->new_graph(cg); }
+  if (factored_scorer) { factored_scorer->new_graph(cg); }
 
   fwd_guard = dynet::parameter(cg, p_fwd_guard);
   bwd_guard = dynet::parameter(cg, p_bwd_guard);
@@ -168,9 +171,12 @@ void Kiperwasser16Model::initialize_parser(dynet::ComputationGraph & cg,
     encoded[i] = dynet::concatenate({ fwd_lstm_output[i], bwd_lstm_output[i] });
   }
 
+  precomputed = false;
+
   State state(len);
   initialize_state(input, state);
-  sys_func->extract_feature(encoded, empty, *cp, state);
+  sys_func->extract_feature(*cp, state);
+  set_features(*cp);
 }
 
 void Kiperwasser16Model::perform_action(const unsigned & action,
@@ -178,30 +184,109 @@ void Kiperwasser16Model::perform_action(const unsigned & action,
                                         dynet::ComputationGraph & cg,
                                         ParseModel::StateCheckpoint * checkpoint) {
   auto * cp = dynamic_cast<StateCheckpointImpl *>(checkpoint);
-  sys_func->extract_feature(encoded, empty, *cp, state);
+  sys_func->extract_feature(*cp, state);
+  set_features(*cp);
+}
+
+void Kiperwasser16Model::set_features(StateCheckpointImpl & cp) {
+  cp.f0 = (cp.slots[0] == EMPTY_SLOT ? empty : encoded[cp.slots[0]]);
+  cp.f1 = (cp.slots[1] == EMPTY_SLOT ? empty : encoded[cp.slots[1]]);
+  cp.f2 = (cp.slots[2] == EMPTY_SLOT ? empty : encoded[cp.slots[2]]);
+  cp.f3 = (cp.slots[3] == EMPTY_SLOT ? empty : encoded[cp.slots[3]]);
+}
+
+void Kiperwasser16Model::precompute() {
+  dynet::ComputationGraph & cg = *empty.pg;
+  // one column per token and the empty feature as the last column.
+  std::vector<dynet::Expression> columns(encoded);
+  columns.push_back(empty);
+  // the rows of the 4 slots are stacked, so one product covers all of them.
+  dynet::Expression weights = dynet::concatenate({ merge.W1, merge.W2, merge.W3, merge.W4 });
+  projected = dynet::as_vector(cg.get_value(weights * dynet::concatenate_cols(columns)));
+  merge_bias = dynet::as_vector(cg.get_value(merge.B));
+  // the weights of an int8 model file are final, so they are quantized once.
+  if (!int8_kernels || scorer_weight.rows == 0) { scorer_weight.load(cg, scorer->W, int8_kernels); }
+  scorer_bias = dynet::as_vector(cg.get_value(scorer->B));
+  precomputed = true;
+}
+
+bool Kiperwasser16Model::get_precomputed_scores(const std::vector<StateCheckpoint *> & checkpoints,
+                                                std::vector<float> & scores) {
+  if (factored_scorer) { return false; }
+  if (!precomputed) { precompute(); }
+
+  unsigned n_slots = 4;
+  unsigned n_columns = encoded.size() + 1;
+  std::vector<float> hidden(dim_hidden);
+  scores.resize(checkpoints.size() * size_a);
+  for (unsigned i = 0; i < checkpoints.size(); ++i) {
+    auto * cp = dynamic_cast<StateCheckpointImpl *>(checkpoints[i]);
+    hidden = merge_bias;
+    for (unsigned k = 0; k < n_slots; ++k) {
+      unsigned column = (cp->slots[k] == EMPTY_SLOT ? n_columns - 1 : cp->slots[k]);
+      const float * p = projected.data() + (column * n_slots + k) * dim_hidden;
+      for (unsigned r = 0; r < dim_hidden; ++r) { hidden[r] += p[r]; }
+    }
+    for (unsigned r = 0; r < dim_hidden; ++r) { hidden[r] = std::tanh(hidden[r]); }
+
+    float * output = scores.data() + i * size_a;
+    for (unsigned a = 0; a < size_a; ++a) { output[a] = scorer_bias[a]; }
+    scorer_weight.multiply_add(hidden.data(), output);
+  }
+  return true;
+}
+
+void Kiperwasser16Model::reset_checkpoints() {
+  checkpoint_pool.reset();
 }
 
 ParseModel::StateCheckpoint * Kiperwasser16Model::get_initial_checkpoint() {
-  return new StateCheckpointImpl();
+  auto * cp = checkpoint_pool.allocate();
+  *cp = StateCheckpointImpl();
+  return cp;
 }
 
 ParseModel::StateCheckpoint * Kiperwasser16Model::copy_checkpoint(StateCheckpoint * checkpoint) {
   auto * cp = dynamic_cast<StateCheckpointImpl *>(checkpoint);
-  auto * new_checkpoint = new StateCheckpointImpl();
-  new_checkpoint->f0 = cp->f0;
-  new_checkpoint->f1 = cp->f1;
-  new_checkpoint->f2 = cp->f2;
-  new_checkpoint->f3 = cp->f3;
+  auto * new_checkpoint = checkpoint_pool.allocate();
+  *new_checkpoint = *cp;
   return new_checkpoint;
 }
 
 void Kiperwasser16Model::destropy_checkpoint(StateCheckpoint * checkpoint) {
-  delete dynamic_cast<StateCheckpointImpl *>(checkpoint);
+  // reclaimed all at once by reset_checkpoints.
 }
 
-dynet::Expression Kiperwasser16Model::get_scores(ParseModel::StateCheckpoint * checkpoint) {
+dynet::Expression Kiperwasser16Model::get_hidden(ParseModel::StateCheckpoint * checkpoint) {
   auto * cp = dynamic_cast<StateCheckpointImpl *>(checkpoint);
-  return scorer.get_output(dynet::tanh(merge.get_output(cp->f0, cp->f1, cp->f2, cp->f3)));
+  return dynet::tanh(merge.get_output(cp->f0, cp->f1, cp->f2, cp->f3));
+}
+
+bool Kiperwasser16Model::get_output_layer(dynet::Expression & weight, dynet::Expression & bias) {
+  if (!scorer) { return false; }
+  weight = scorer->W;
+  bias = scorer->B;
+  return true;
+}
+
+dynet::Expression Kiperwasser16Model::get_scores(ParseModel::StateCheckpoint * checkpoint) {
+  dynet::Expression hidden = get_hidden(checkpoint);
+  return (factored_scorer ? factored_scorer->get_output(hidden) : scorer->get_output(hidden));
+}
+
+dynet::Expression Kiperwasser16Model::get_batch_scores(const std::vector<StateCheckpoint *> & checkpoints) {
+  std::vector<dynet::Expression> f0, f1, f2, f3;
+  for (StateCheckpoint * checkpoint : checkpoints) {
+    auto * cp = dynamic_cast<StateCheckpointImpl *>(checkpoint);
+    f0.push_back(cp->f0);
+    f1.push_back(cp->f1);
+    f2.push_back(cp->f2);
+    f3.push_back(cp->f3);
+  }
+  dynet::Expression hidden = dynet::tanh(merge.get_output(
+    dynet::concatenate_to_batch(f0), dynet::concatenate_to_batch(f1),
+    dynet::concatenate_to_batch(f2), dynet::concatenate_to_batch(f3)));
+  return (factored_scorer ? factored_scorer->get_output(hidden) : scorer->get_output(hidden));
 }
 
 dynet::Expression Kiperwasser16Model::l2() {
@@ -210,7 +295,11 @@ dynet::Expression Kiperwasser16Model::l2() {
   for (auto & layer : bwd_lstm.param_vars) { for (auto & e : layer) { ret.push_back(dynet::squared_norm(e)); } }
   for (auto & e : merge_input.get_params()) { ret.push_back(dynet::squared_norm(e)); }
   for (auto & e : merge.get_params()) { ret.push_back(dynet::squared_norm(e)); }
-  for (auto & e : scorer.get_params()) { ret.push_back(dynet::squared_norm(e)); }
+  if (factored_scorer) {
+    for (auto & e : factored_scorer->get_params()) { ret.push_back(dynet::squared_norm(e)); }
+  } else {
+    for (auto & e : scorer->get_params()) { ret.push_back(dynet::squared_norm(e)); }
+  }
   ret.push_back(dynet::squared_norm(empty));
   ret.push_back(dynet::squared_norm(fwd_guard));
   ret.push_back(dynet::squared_norm(bwd_guard));
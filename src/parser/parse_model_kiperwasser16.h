@@ -4,17 +4,25 @@
 #include "parse_model.h"
 #include "state.h"
 #include "system.h"
+#include "persistent_stack.h"
 #include "dynet_layer/layer.h"
+#include "twpipe/rnn_kernel.h"
 #include <vector>
 #include <unordered_map>
 
 namespace twpipe {
 
 struct Kiperwasser16Model : public ParseModel {
+  /// The slot of a feature which is out of the stack or the buffer.
+  static const unsigned EMPTY_SLOT = static_cast<unsigned>(-1);
+
   struct StateCheckpointImpl : public StateCheckpoint {
     /// state machine
     ~StateCheckpointImpl() {}
 
+    /// The token of each feature, or EMPTY_SLOT.
+    unsigned slots[4];
+
     dynet::Expression f0;
     dynet::Expression f1;
     dynet::Expression f2;
@@ -22,38 +30,28 @@ struct Kiperwasser16Model : public ParseModel {
   };
 
   struct TransitionSystemFunction {
-    virtual void extract_feature(std::vector<dynet::Expression>& encoded,
-                                 dynet::Expression & empty,
-                                 StateCheckpointImpl & checkpoint,
+    virtual void extract_feature(StateCheckpointImpl & checkpoint,
                                  const State & state) = 0;
   };
 
   struct ArcEagerFunction : public TransitionSystemFunction {
-    void extract_feature(std::vector<dynet::Expression>& encoded,
-                         dynet::Expression& empty,
-                         StateCheckpointImpl & checkpoint,
-                         const State& state) override;
+    void extract_feature(StateCheckpointImpl & checkpoint,
+                         const State & state) override;
   };
 
   struct ArcStandardFunction : public TransitionSystemFunction {
-    void extract_feature(std::vector<dynet::Expression>& encoded,
-                         dynet::Expression & empty,
-                         StateCheckpointImpl & checkpoint,
+    void extract_feature(StateCheckpointImpl & checkpoint,
                          const State & state) override;
   };
 
   struct ArcHybridFunction : public TransitionSystemFunction {
-    void extract_feature(std::vector<dynet::Expression>& encoded,
-                         dynet::Expression& empty,
-                         StateCheckpointImpl & checkpoint,
+    void extract_feature(StateCheckpointImpl & checkpoint,
                          const State & state) override;
   };
 
   struct SwapFunction : public TransitionSystemFunction {
-    void extract_feature(std::vector<dynet::Expression>& encoded,
-                         dynet::Expression& empty,
-                         StateCheckpointImpl & checkpoint,
-                         const State& state) override;
+    void extract_feature(StateCheckpointImpl & checkpoint,
+                         const State & state) override;
   };
 
   LSTMBuilderType fwd_lstm;
@@ -64,7 +62,8 @@ struct Kiperwasser16Model : public ParseModel {
 
   Merge3Layer merge_input;
   Merge4Layer merge;        // merge (s2, s1, s0, n0)
-  DenseLayer scorer;
+  /// The flat output layer, not built with the factored scorer.
+  DenseLayer * scorer;
   std::vector<dynet::Expression> encoded;
 
   dynet::Parameter p_empty;
@@ -74,8 +73,24 @@ struct Kiperwasser16Model : public ParseModel {
   dynet::Expression fwd_guard;
   dynet::Expression bwd_guard;
 
+  /// The checkpoints of the current sentence, reclaimed when the next
+  /// sentence starts.
+  CheckpointPool<StateCheckpointImpl> checkpoint_pool;
+
   TransitionSystemFunction* sys_func;
 
+  /// The first layer is linear in each slot, so at inference the slot
+  /// projections of all the tokens are computed once per sentence and a step
+  /// only adds 4 columns. projected is column major, the column of a token
+  /// holds its projections by the 4 slots and the last column is the empty
+  /// feature.
+  std::vector<float> projected;
+  std::vector<float> merge_bias;
+  /// The output layer, in int8 with int8_kernels.
+  KernelMatrix scorer_weight;
+  std::vector<float> scorer_bias;
+  bool precomputed;
+
   unsigned size_w, dim_w, size_p, dim_p, dim_t, size_a;
   unsigned n_layers, dim_lstm_in, dim_hidden;
 
@@ -89,9 +104,12 @@ struct Kiperwasser16Model : public ParseModel {
                                unsigned n_layers,
                                unsigned dim_lstm_in,
                                unsigned dim_hidden,
+                               bool factored,
                                TransitionSystem& system,
                                EmbeddingType embedding_type);
 
+  ~Kiperwasser16Model();
+
   void new_graph(dynet::ComputationGraph& cg) override;
 
   void initialize_parser(dynet::ComputationGraph& cg,
@@ -103,16 +121,31 @@ struct Kiperwasser16Model : public ParseModel {
                       dynet::ComputationGraph& cg,
                       StateCheckpoint * checkpoint) override;
 
+  void reset_checkpoints() override;
+
   StateCheckpoint * get_initial_checkpoint() override;
 
   StateCheckpoint * copy_checkpoint(StateCheckpoint * checkpoint) override;
 
   void destropy_checkpoint(StateCheckpoint * checkpoint) override;
 
+  dynet::Expression get_hidden(StateCheckpoint * checkpoint) override;
+
+  bool get_output_layer(dynet::Expression & weight, dynet::Expression & bias) override;
+
   /// Get the un-softmaxed scores from the LSTM-parser.
   dynet::Expression get_scores(StateCheckpoint * checkpoint) override;
 
+  dynet::Expression get_batch_scores(const std::vector<StateCheckpoint *> & checkpoints) override;
+
   dynet::Expression l2() override;
+
+  bool get_precomputed_scores(const std::vector<StateCheckpoint *> & checkpoints,
+                              std::vector<float> & scores) override;
+
+  void set_features(StateCheckpointImpl & checkpoint);
+
+  void precompute();
 };
 
 }
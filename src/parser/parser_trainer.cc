@@ -6,6 +6,8 @@
 #include "twpipe/json.hpp"
 #include <iostream>
 #include <fstream>
+#include <algorithm>
+#include <thread>
 
 namespace twpipe {
 
@@ -28,9 +30,8 @@ ParserTrainer::ParserTrainer(ParseModel & engine,
   singleton_dropout_prob = conf["parse-noisify-singleton-dropout-prob"].as<float>();
 }
 
-float ParserTrainer::evaluate(Corpus & corpus) {
-  float n_recall = 0.f, n_total = 0.f;
-  for (unsigned sid = 0; sid < corpus.n_devel; ++sid) {
+float ParserTrainer::evaluate(Corpus & corpus, bool full) {
+  std::vector<float> counts = evaluate_counts(corpus.n_devel, full, [&](unsigned sid) {
     const Instance & inst = corpus.devel_data.at(sid);
 
     unsigned len = inst.input_units.size();
@@ -45,6 +46,7 @@ float ParserTrainer::evaluate(Corpus & corpus) {
         inst.parse_units[i].deprel);
     }
     engine.predict(words, postags, pred_heads, pred_deprels);
+    float n_recall = 0.f, n_total = 0.f;
     for (unsigned i = 0; i < pred_heads.size(); ++i) {
       if (gold_heads[i] == pred_heads[i] &&
           gold_deprels[i] == pred_deprels[i]) {
@@ -52,8 +54,11 @@ float ParserTrainer::evaluate(Corpus & corpus) {
       }
       n_total += 1.;
     }
-  }
-  float las = n_recall / n_total;
+    return std::vector<float>{ n_recall, n_total };
+  });
+  if (counts.size() < 2) { return 0.f; }
+
+  float las = counts[0] / counts[1];
   return las;
 }
 
@@ -64,6 +69,7 @@ po::options_description SupervisedTrainer::get_options() {
     ("parse-supervised-objective", po::value<std::string>()->default_value("crossentropy"), "The learning objective [crossentropy|rank|bipartie_rank|structure]")
     ("parse-supervised-do-pretrain-iter", po::value<unsigned>()->default_value(1), "The number of pretrain iteration on dynamic oracle.")
     ("parse-supervised-do-explore-prob", po::value<float>()->default_value(0.9), "The probability of exploration.")
+    ("parse-oracle-cache", po::value<std::string>(), "The path to cache the oracle actions of the training data, reused when it matches.")
     ;
   return cmd;
 }
@@ -108,6 +114,9 @@ SupervisedTrainer::SupervisedTrainer(ParseModel & engine,
 
   beam_size = (conf.count("parse-beam-size") ? conf["parse-beam-size"].as<unsigned>() : 0);
   allow_nonprojective = (conf["parse-system"].as<std::string>() == "swap");
+  if (conf.count("parse-oracle-cache")) {
+    oracle_cache_path = conf["parse-oracle-cache"].as<std::string>();
+  }
 }
 
 void SupervisedTrainer::train(Corpus& corpus) {
@@ -118,46 +127,86 @@ void SupervisedTrainer::train(Corpus& corpus) {
 
   float llh = 0.f;
   float best_las = -1.f;
+  float best_las_sample = -1.f;
   unsigned n_processed = 0;
 
   std::vector<unsigned> order;
   get_orders(corpus, order, allow_nonprojective);
 
+  std::vector<unsigned> lengths(corpus.training_data.size());
+  for (unsigned sid : order) { lengths[sid] = corpus.training_data[sid].input_units.size(); }
+
+  // the static oracle is the same in every iteration, compute it only once.
+  if (oracle_type == kStatic || objective_type == kStructure) {
+    oracle_cache.load_or_build(oracle_cache_path, corpus, order, engine.sys,
+                               std::max(1u, std::thread::hardware_concurrency()));
+  }
+
   // bool use_beam_search = (beam_size > 1);
   _INFO << "[parse|train] will stop after " << max_iter << " iterations.";
-  
-  for (unsigned iter = 1; iter <= max_iter; ++iter) {
-    llh = 0;
-    _INFO << "[parse|train] start training iteration #" << iter << ", shuffled.";
-    std::shuffle(order.begin(), order.end(), (*dynet::rndeng));
-
-    for (unsigned sid : order) {
-      InputUnits& input_units = corpus.training_data[sid].input_units;
-      const ParseUnits& parse_units = corpus.training_data[sid].parse_units;
-
-      noisifier.noisify(input_units);
-      float lp;
-      if (objective_type == kStructure) {
-        lp = train_structure_full_tree(input_units, parse_units, trainer, beam_size);
-      } else {
-        lp = train_full_tree(input_units, parse_units, trainer, iter);
+  _INFO << "[parse|train] batch size = " << batch_size;
+
+  unsigned first_iter = 1;
+  unsigned cursor = 0;
+  if (resume) {
+    TrainingCheckpoint ckpt;
+    if (load_training_checkpoint(Model::kParserName, engine.model, trainer, ckpt)) {
+      first_iter = ckpt.iter;
+      cursor = ckpt.cursor;
+      n_processed = ckpt.n_processed;
+      best_las = ckpt.best_score;
+      llh = ckpt.loss;
+      if (!ckpt.order.empty()) { order = ckpt.order; }
+      if (first_iter > 1) { opt_builder.update(trainer, first_iter - 1); }
+    }
+  }
+
+  TrainingCheckpoint state;
+  for (unsigned iter = first_iter; iter <= max_iter; ++iter) {
+    if (cursor == 0) {
+      llh = 0;
+      _INFO << "[parse|train] start training iteration #" << iter << ", shuffled.";
+      shuffle(order, lengths);
+    }
+
+    while (cursor < order.size()) {
+      unsigned n = std::min(n_until_evaluate(order.size() - cursor, n_processed),
+                            n_until_checkpoint(order.size() - cursor, n_processed));
+      unsigned end = cursor + n;
+      for (; cursor < end; cursor += batch_size) {
+        unsigned batch_end = std::min(cursor + batch_size, end);
+        llh += train_batch(corpus, order, cursor, batch_end, noisifier, trainer, iter);
+        n_processed += (batch_end - cursor);
       }
-      llh += lp;
-      noisifier.denoisify(input_units);
-      
-      n_processed++;
+      cursor = end;
+
       if (need_evaluate(iter, n_processed)) {
-        float las = evaluate(corpus);
-        float prop = static_cast<float>(n_processed) / order.size();
-        if (las > best_las) {
+        float las = evaluate(corpus, false);
+        float prop = static_cast<float>(cursor) / order.size();
+        if (is_sampled(corpus.n_devel)) {
+          // scores on the subsample are not comparable with those of the full
+          // evaluations, track their best apart and leave the snapshot to the latter.
+          if (las > best_las_sample) {
+            best_las_sample = las;
+            _INFO << "[parse|train] " << prop << "% trained, LAS on heldout sample = " << las
+              << ", new best on the sample.";
+          } else {
+            _INFO << "[parse|train] " << prop << "% trained, LAS on heldout sample = " << las;
+          }
+        } else if (las > best_las) {
           _INFO << "[parse|train] " << prop << "% trained, LAS on heldout = " << las
             << ", new best achieved, saved.";
           best_las = las;
-          Model::get()->to_json(Model::kParserName, engine.model);
+          Model::get()->snapshot(Model::kParserName, engine.model);
         } else {
           _INFO << "[parse|train] " << prop << "% trained, LAS on heldout = " << las;
         }
       }
+      if (need_checkpoint(n_processed) && cursor < order.size()) {
+        state.iter = iter; state.cursor = cursor; state.n_processed = n_processed;
+        state.best_score = best_las; state.loss = llh; state.order = order;
+        save_training_checkpoint(Model::kParserName, engine.model, trainer, state);
+      }
     }
     
     _INFO << "[parse|train] end of iter #" << iter << " loss " << llh;
@@ -167,17 +216,80 @@ void SupervisedTrainer::train(Corpus& corpus) {
         best_las = las;
         _INFO << "[parse|train] end of iter #" << iter << ", LAS on heldout = " << las
           << ", new best achieved, saved.";
-        Model::get()->to_json(Model::kParserName, engine.model);
+        Model::get()->snapshot(Model::kParserName, engine.model);
       } else {
         _INFO << "[parse|train] end of iter #" << iter << ", LAS on heldout = " << las;
       }
     }
     opt_builder.update(trainer, iter);
+
+    // the next iteration shuffles this order with the saved engine, so both
+    // are needed to replay it.
+    cursor = 0;
+    state.iter = iter + 1; state.cursor = 0; state.n_processed = n_processed;
+    state.best_score = best_las; state.loss = 0.f; state.order = order;
+    save_training_checkpoint(Model::kParserName, engine.model, trainer, state);
   }
 
   delete trainer;
 }
 
+float SupervisedTrainer::train_batch(Corpus & corpus,
+                                     const std::vector<unsigned> & order,
+                                     unsigned begin,
+                                     unsigned end,
+                                     Noisifier & noisifier,
+                                     dynet::Trainer * trainer,
+                                     unsigned iter) {
+  dynet::ComputationGraph cg;
+  engine.new_graph(cg);
+
+  // with the static oracle and the crossentropy objective, the gold actions
+  // are followed regardless of the scores, so the scores of all the steps are
+  // collected and go through one batched loss.
+  bool teacher_forcing = (oracle_type == kStatic && objective_type == kCrossEntropy);
+  std::vector<dynet::Expression> loss;
+  std::vector<dynet::Expression> step_scores;
+  std::vector<unsigned> gold_actions, step_actions;
+  for (unsigned i = begin; i < end; ++i) {
+    unsigned sid = order[i];
+    InputUnits& input_units = corpus.training_data[sid].input_units;
+    const ParseUnits& parse_units = corpus.training_data[sid].parse_units;
+    if (oracle_type == kStatic || objective_type == kStructure) {
+      oracle_cache.get(sid, gold_actions);
+    }
+
+    // the word ids are copied into the graph, so denoisify right after building it.
+    noisifier.noisify(input_units);
+    if (objective_type == kStructure) {
+      add_structure_full_tree_loss(input_units, parse_units, gold_actions, cg, beam_size, loss);
+    } else if (teacher_forcing) {
+      add_teacher_forcing_scores(input_units, gold_actions, cg, step_scores, step_actions);
+    } else {
+      add_full_tree_loss(input_units, parse_units, gold_actions, cg, iter, loss);
+    }
+    noisifier.denoisify(input_units);
+  }
+
+  unsigned n_loss = loss.size() + step_actions.size();
+  if (!step_scores.empty()) {
+    loss.push_back(dynet::sum_batches(dynet::pickneglogsoftmax(
+      dynet::concatenate_to_batch(step_scores), step_actions)));
+  }
+
+  float ret = 0.f;
+  if (!loss.empty()) {
+    dynet::Expression l = dynet::sum(loss);
+    if (objective_type != kStructure && lambda_ > 0) {
+      l = l + (0.5f * lambda_ * n_loss) * engine.l2();
+    }
+    ret = dynet::as_scalar(cg.forward(l));
+    cg.backward(l);
+    trainer->update();
+  }
+  return ret;
+}
+
 void SupervisedTrainer::add_loss_one_step(dynet::Expression & score_expr,
                                           const unsigned & best_gold_action,
                                           const unsigned & worst_gold_action,
@@ -205,23 +317,44 @@ void SupervisedTrainer::add_loss_one_step(dynet::Expression & score_expr,
   }
 }
 
-float SupervisedTrainer::train_full_tree(const InputUnits& input_units,
-                                         const ParseUnits& parse_units,
-                                         dynet::Trainer* trainer,
-                                         unsigned iter) {
+void SupervisedTrainer::add_teacher_forcing_scores(const InputUnits & input_units,
+                                                   const std::vector<unsigned> & gold_actions,
+                                                   dynet::ComputationGraph & cg,
+                                                   std::vector<dynet::Expression> & scores,
+                                                   std::vector<unsigned> & actions) {
+  TransitionSystem & sys = engine.sys;
+
+  unsigned len = input_units.size();
+  State state(len);
+  engine.reset_checkpoints();
+  ParseModel::StateCheckpoint * checkpoint = engine.get_initial_checkpoint();
+  engine.initialize(cg, input_units, state, checkpoint);
+  unsigned n_actions = 0;
+  while (!state.terminated()) {
+    unsigned action = gold_actions[n_actions];
+    scores.push_back(engine.get_scores(checkpoint));
+    actions.push_back(action);
+    sys.perform_action(state, action);
+    engine.perform_action(action, state, cg, checkpoint);
+    n_actions++;
+  }
+  engine.destropy_checkpoint(checkpoint);
+}
+
+void SupervisedTrainer::add_full_tree_loss(const InputUnits& input_units,
+                                           const ParseUnits& parse_units,
+                                           const std::vector<unsigned> & gold_actions,
+                                           dynet::ComputationGraph & cg,
+                                           unsigned iter,
+                                           std::vector<dynet::Expression> & loss) {
   TransitionSystem & sys = engine.sys;
 
   std::vector<unsigned> ref_heads, ref_deprels;
   Corpus::parse_units_to_vector(parse_units, ref_heads, ref_deprels);
 
-  dynet::ComputationGraph cg;
-  engine.new_graph(cg);
-  std::vector<dynet::Expression> loss;
-  std::vector<unsigned> gold_actions;
-  sys.get_oracle_actions(ref_heads, ref_deprels, gold_actions);
-
   unsigned len = input_units.size();
   State state(len);
+  engine.reset_checkpoints();
   ParseModel::StateCheckpoint * checkpoint = engine.get_initial_checkpoint();
   engine.initialize(cg, input_units, state, checkpoint);
   unsigned illegal_action = sys.num_actions();
@@ -288,30 +421,18 @@ float SupervisedTrainer::train_full_tree(const InputUnits& input_units,
     n_actions++;
   }
   engine.destropy_checkpoint(checkpoint);
-  float ret = 0.f;
-  if (!loss.empty()) {
-    dynet::Expression l = dynet::sum(loss) + (0.5f * lambda_ * loss.size()) * engine.l2();
-    ret = dynet::as_scalar(cg.forward(l));
-    cg.backward(l);
-    trainer->update();
-  }
-  return ret;
 }
 
-float SupervisedTrainer::train_structure_full_tree(const InputUnits & input_units,
-                                                   const ParseUnits & parse_units,
-                                                   dynet::Trainer * trainer,
-                                                   unsigned beam_size) {
-  typedef std::tuple<unsigned, unsigned, float, dynet::Expression> Transition;
+void SupervisedTrainer::add_structure_full_tree_loss(const InputUnits & input_units,
+                                                     const ParseUnits & parse_units,
+                                                     const std::vector<unsigned> & gold_actions,
+                                                     dynet::ComputationGraph & cg,
+                                                     unsigned beam_size,
+                                                     std::vector<dynet::Expression> & loss) {
+  // (beam item, action, score, batch element of the item's scores)
+  typedef std::tuple<unsigned, unsigned, float, unsigned> Transition;
   TransitionSystem & sys = engine.sys;
 
-  dynet::ComputationGraph cg;
-  engine.new_graph(cg);
-
-  std::vector<unsigned> gold_heads, gold_deprels, gold_actions;
-  Corpus::parse_units_to_vector(parse_units, gold_heads, gold_deprels);
-  sys.get_oracle_actions(gold_heads, gold_deprels, gold_actions);
-
   unsigned len = input_units.size();
   std::vector<State> states;
   std::vector<float> scores;
@@ -321,6 +442,7 @@ float SupervisedTrainer::train_structure_full_tree(const InputUnits & input_unit
   states.push_back(State(len));
   scores.push_back(0.);
   scores_exprs.push_back(dynet::zeroes(cg, { 1 }));
+  engine.reset_checkpoints();
   checkpoints.push_back(engine.get_initial_checkpoint());
   engine.initialize(cg, input_units, states[0], checkpoints[0]);
 
@@ -330,51 +452,57 @@ float SupervisedTrainer::train_structure_full_tree(const InputUnits & input_unit
     unsigned gold_action = gold_actions[n_step];
     n_step++;
 
+    // score the live items of the beam in one forward pass.
+    std::vector<ParseModel::StateCheckpoint *> live;
+    for (unsigned i = curr; i < next; ++i) {
+      if (!states[i].terminated()) { live.push_back(checkpoints[i]); }
+    }
+    dynet::Expression transit_scores_expr;
+    std::vector<float> transit_scores;
+    if (!live.empty()) {
+      transit_scores_expr = engine.get_batch_scores(live);
+      transit_scores = dynet::as_vector(cg.get_value(transit_scores_expr));
+    }
+
     std::vector<Transition> transitions;
+    unsigned n_live = 0;
     for (unsigned i = curr; i < next; ++i) {
       const State& prev_state = states[i];
       float prev_score = scores[i];
-      dynet::Expression prev_score_expr = scores_exprs[i];
 
       if (prev_state.terminated()) {
-        transitions.push_back(std::make_tuple(
-          i, sys.num_actions(), prev_score, prev_score_expr
-        ));
+        transitions.push_back(std::make_tuple(i, sys.num_actions(), prev_score, 0u));
       } else {
-        ParseModel::StateCheckpoint * checkpoint = checkpoints[i];
-        std::vector<unsigned> valid_actions;
-        sys.get_valid_actions(prev_state, valid_actions);
-
-        dynet::Expression transit_scores_expr = engine.get_scores(checkpoint);
-        std::vector<float> transit_scores = dynet::as_vector(cg.get_value(transit_scores_expr));
+        const float * item_scores = transit_scores.data() + n_live * sys.num_actions();
+        const std::vector<unsigned> & valid_actions = sys.get_mask_actions(sys.get_valid_structure_mask(prev_state));
         for (unsigned a : valid_actions) {
-          transitions.push_back(std::make_tuple(
-            i, a, prev_score + transit_scores[a],
-            prev_score_expr + dynet::pick(transit_scores_expr, a)
-          ));
+          transitions.push_back(std::make_tuple(i, a, prev_score + item_scores[a], n_live));
         }
+        n_live++;
       }
     }
 
-    sort(transitions.begin(), transitions.end(),
-         [](const Transition& a, const Transition& b) { return std::get<2>(a) > std::get<2>(b); });
+    // only the top beam_size transitions are ordered and get their score expressions.
+    unsigned n_survivors = std::min<unsigned>(beam_size, transitions.size());
+    std::partial_sort(transitions.begin(), transitions.begin() + n_survivors, transitions.end(),
+                      [](const Transition& a, const Transition& b) { return std::get<2>(a) > std::get<2>(b); });
 
     unsigned new_corr = UINT_MAX, new_curr = next, new_next = next;
-    for (unsigned i = 0; i < transitions.size() && i < beam_size; ++i) {
+    for (unsigned i = 0; i < n_survivors; ++i) {
       unsigned cursor = std::get<0>(transitions[i]);
       unsigned action = std::get<1>(transitions[i]);
       float new_score = std::get<2>(transitions[i]);
-      dynet::Expression new_score_expr = std::get<3>(transitions[i]);
-      State& state = states[cursor];
 
-      State new_state(state);
+      State new_state(states[cursor]);
       ParseModel::StateCheckpoint * new_checkpoint = engine.copy_checkpoint(checkpoints[cursor]);
+      dynet::Expression new_score_expr = scores_exprs[cursor];
       if (action != sys.num_actions()) {
+        new_score_expr = new_score_expr + dynet::pick(
+          dynet::pick_batch_elem(transit_scores_expr, std::get<3>(transitions[i])), action);
         sys.perform_action(new_state, action);
         engine.perform_action(action, new_state, cg, new_checkpoint);
       }
 
-      //      
       states.push_back(new_state);
       scores.push_back(new_score);
       scores_exprs.push_back(new_score_expr);
@@ -397,15 +525,11 @@ float SupervisedTrainer::train_structure_full_tree(const InputUnits & input_unit
     engine.destropy_checkpoint(checkpoint);
   }
 
-  std::vector<dynet::Expression> loss;
+  std::vector<dynet::Expression> beam_scores;
   for (unsigned i = curr; i < next; ++i) {
-    loss.push_back(scores_exprs[i]);
+    beam_scores.push_back(scores_exprs[i]);
   }
-  dynet::Expression l = dynet::pickneglogsoftmax(dynet::concatenate(loss), corr - curr);
-  float ret = dynet::as_scalar(cg.forward(l));
-  cg.backward(l);
-  trainer->update();
-  return ret;
+  loss.push_back(dynet::pickneglogsoftmax(dynet::concatenate(beam_scores), corr - curr));
 }
 
 void SupervisedTrainer::get_orders(Corpus& corpus,
@@ -430,18 +554,28 @@ SupervisedEnsembleTrainer::SupervisedEnsembleTrainer(ParseModel & engine,
                                                      OptimizerBuilder & opt_builder,
                                                      const po::variables_map & conf) :
   ParserTrainer(engine, opt_builder, conf) {
+  streaming = conf["parse-ensemble-streaming"].as<bool>();
+  chunk_size = conf["parse-ensemble-chunk-size"].as<unsigned>();
+  window_size = conf["parse-ensemble-window-size"].as<unsigned>();
+  if (streaming) {
+    _INFO << "[parse|ensemble|train] stream the ensemble data in chunks of " << chunk_size
+      << " instances, shuffled in a window of " << window_size << " instances.";
+  }
 }
 
 po::options_description SupervisedEnsembleTrainer::get_options() {
   po::options_description cmd("Parser supervised ensemble learning options");
   cmd.add_options()
     ("parse-ensemble-data", po::value<std::string>(), "The path to the ensemble data.")
+    ("parse-ensemble-streaming", po::value<bool>()->default_value(false), "Read the ensemble data from disk during training instead of loading it.")
+    ("parse-ensemble-chunk-size", po::value<unsigned>()->default_value(256), "The number of consecutive instances read at once when streaming.")
+    ("parse-ensemble-window-size", po::value<unsigned>()->default_value(4096), "The number of instances shuffled together when streaming.")
     ;
   return cmd;
 }
 
 void SupervisedEnsembleTrainer::train(Corpus & corpus,
-                                      EnsembleInstances & ensemble_instances) {
+                                      EnsembleData & ensemble_data) {
   _INFO << "[parse|ensemble|train] start lstm-parser supervised training.";
   Noisifier noisifier(corpus, noisify_method_name, singleton_dropout_prob);
 
@@ -450,23 +584,30 @@ void SupervisedEnsembleTrainer::train(Corpus & corpus,
 
   std::vector<unsigned> order;
   // bool allow_nonprojective = engine.sys.allow_nonprojective();
-  for (unsigned i = 0; i < ensemble_instances.size(); ++i) {
-    unsigned id = ensemble_instances[i].id;
+  for (unsigned i = 0; i < ensemble_data.size(); ++i) {
+    unsigned id = ensemble_data.id(i);
     if (corpus.training_data.count(id) == 0) { continue; }
     order.push_back(i);
   }
 
+  EnsembleStream stream(ensemble_data, order, chunk_size, window_size);
+
   float llh = 0.f;
   float best_las = -1.f;
+  float best_las_sample = -1.f;
   unsigned n_processed = 0;
 
   _INFO << "[parse|ensemble|train] will stop after " << max_iter << " iterations.";
   for (unsigned iter = 1; iter <= max_iter; ++iter) {
     llh = 0.f;
-    std::shuffle(order.begin(), order.end(), (*dynet::rndeng));
+    if (streaming) {
+      stream.start((*dynet::rndeng)());
+    } else {
+      std::shuffle(order.begin(), order.end(), (*dynet::rndeng));
+    }
 
     for (unsigned id : order) {
-      const EnsembleInstance & inst = ensemble_instances.at(id);
+      const EnsembleInstance & inst = (streaming ? stream.next() : ensemble_data.get(id));
       unsigned sid = inst.id;
       InputUnits & units = corpus.training_data.at(sid).input_units;
 
@@ -477,13 +618,100 @@ void SupervisedEnsembleTrainer::train(Corpus & corpus,
     
       n_processed++;
       if (need_evaluate(iter, n_processed)) {
-        float las = evaluate(corpus);
+        float las = evaluate(corpus, false);
+        float prop = static_cast<float>(n_processed) / order.size();
+        if (is_sampled(corpus.n_devel)) {
+          // scores on the subsample are not comparable with those of the full
+          // evaluations, track their best apart and leave the snapshot to the latter.
+          if (las > best_las_sample) {
+            best_las_sample = las;
+            _INFO << "[parse|train] " << prop << "% trained, LAS on heldout sample = " << las
+              << ", new best on the sample.";
+          } else {
+            _INFO << "[parse|train] " << prop << "% trained, LAS on heldout sample = " << las;
+          }
+        } else if (las > best_las) {
+          _INFO << "[parse|train] " << prop << "% trained, LAS on heldout = " << las
+            << ", new best achieved, saved.";
+          best_las = las;
+          Model::get()->snapshot(Model::kParserName, engine.model);
+        } else {
+          _INFO << "[parse|train] " << prop << "% trained, LAS on heldout = " << las;
+        }
+      }
+    }
+
+    _INFO << "[parse|ensemble|train] end of iter #" << iter << ", loss = " << llh;
+    if (need_evaluate(iter)) {
+      float las = evaluate(corpus);
+      if (las > best_las) {
+        best_las = las;
+        _INFO << "[parse|train] end of iter #" << iter << ", LAS on heldout = " << las
+          << ", new best achieved, saved.";
+        Model::get()->snapshot(Model::kParserName, engine.model);
+      } else {
+        _INFO << "[parse|train] end of iter #" << iter << ", LAS on heldout = " << las;
+      }
+    }
+    opt_builder.update(trainer, iter);
+  }
+}
+
+void SupervisedEnsembleTrainer::train(Corpus & corpus,
+                                      EnsembleTeacher & teacher) {
+  _INFO << "[parse|ensemble|train] start lstm-parser online distillation.";
+  Noisifier noisifier(corpus, noisify_method_name, singleton_dropout_prob);
+
+  dynet::ParameterCollection & model = engine.model;
+  dynet::Trainer * trainer = opt_builder.build(model);
+
+  std::vector<unsigned> order;
+  for (unsigned sid = 0; sid < corpus.n_train; ++sid) {
+    if (corpus.training_data.count(sid) == 0) { continue; }
+    order.push_back(sid);
+  }
+  // the teachers generate all the epochs ahead, with a new roll-in each epoch.
+  teacher.start(corpus, order, max_iter);
+
+  float llh = 0.f;
+  float best_las = -1.f;
+  float best_las_sample = -1.f;
+  unsigned n_processed = 0;
+
+  _INFO << "[parse|ensemble|train] will stop after " << max_iter << " iterations.";
+  for (unsigned iter = 1; iter <= max_iter; ++iter) {
+    llh = 0.f;
+
+    for (unsigned i = 0; i < order.size(); ++i) {
+      const EnsembleInstance & inst = teacher.next();
+      if (inst.categories.empty()) { continue; }
+      unsigned sid = inst.id;
+      InputUnits & units = corpus.training_data.at(sid).input_units;
+
+      noisifier.noisify(units);
+      float lp = train_full_tree(units, inst, trainer);
+      llh += lp;
+      noisifier.denoisify(units);
+
+      n_processed++;
+      if (need_evaluate(iter, n_processed)) {
+        float las = evaluate(corpus, false);
         float prop = static_cast<float>(n_processed) / order.size();
-        if (las > best_las) {
+        if (is_sampled(corpus.n_devel)) {
+          // scores on the subsample are not comparable with those of the full
+          // evaluations, track their best apart and leave the snapshot to the latter.
+          if (las > best_las_sample) {
+            best_las_sample = las;
+            _INFO << "[parse|train] " << prop << "% trained, LAS on heldout sample = " << las
+              << ", new best on the sample.";
+          } else {
+            _INFO << "[parse|train] " << prop << "% trained, LAS on heldout sample = " << las;
+          }
+        } else if (las > best_las) {
           _INFO << "[parse|train] " << prop << "% trained, LAS on heldout = " << las
             << ", new best achieved, saved.";
           best_las = las;
-          Model::get()->to_json(Model::kParserName, engine.model);
+          Model::get()->snapshot(Model::kParserName, engine.model);
         } else {
           _INFO << "[parse|train] " << prop << "% trained, LAS on heldout = " << las;
         }
@@ -497,13 +725,14 @@ void SupervisedEnsembleTrainer::train(Corpus & corpus,
         best_las = las;
         _INFO << "[parse|train] end of iter #" << iter << ", LAS on heldout = " << las
           << ", new best achieved, saved.";
-        Model::get()->to_json(Model::kParserName, engine.model);
+        Model::get()->snapshot(Model::kParserName, engine.model);
       } else {
         _INFO << "[parse|train] end of iter #" << iter << ", LAS on heldout = " << las;
       }
     }
     opt_builder.update(trainer, iter);
   }
+  teacher.stop();
 }
 
 float SupervisedEnsembleTrainer::train_full_tree(const InputUnits & input_units,
@@ -518,6 +747,7 @@ float SupervisedEnsembleTrainer::train_full_tree(const InputUnits & input_units,
   unsigned len = input_units.size();
   State state(len);
 
+  engine.reset_checkpoints();
   ParseModel::StateCheckpoint * checkpoint = engine.get_initial_checkpoint();
   engine.initialize(cg, input_units, state, checkpoint);
 
@@ -526,9 +756,6 @@ float SupervisedEnsembleTrainer::train_full_tree(const InputUnits & input_units,
 
   unsigned n_actions = 0;
   while (!state.terminated()) {
-    std::vector<unsigned> valid_actions;
-    sys.get_valid_actions(state, valid_actions);
-
     dynet::Expression score_expr = engine.get_scores(checkpoint);
     unsigned action = actions[n_actions];
     const std::vector<float> & prob = probs[n_actions];
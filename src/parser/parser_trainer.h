@@ -7,6 +7,8 @@
 #include "dynet/training.h"
 #include "parse_model.h"
 #include "noisify.h"
+#include "oracle.h"
+#include "ensemble_teacher.h"
 #include "twpipe/trainer.h"
 #include "twpipe/optimizer_builder.h"
 #include "twpipe/ensemble.h"
@@ -27,7 +29,8 @@ struct ParserTrainer : public Trainer {
 
   static po::options_description get_options();
 
-  float evaluate(Corpus & corpus);
+  /* Return the LAS on the heldout data, or on its subsample when full is not set. */
+  float evaluate(Corpus & corpus, bool full = true);
 };
 
 struct SupervisedTrainer : public ParserTrainer {
@@ -39,6 +42,8 @@ struct SupervisedTrainer : public ParserTrainer {
   float do_explore_prob;
   unsigned beam_size;
   bool allow_nonprojective;
+  std::string oracle_cache_path;
+  OracleCache oracle_cache;
 
   static po::options_description get_options();
 
@@ -49,15 +54,35 @@ struct SupervisedTrainer : public ParserTrainer {
   /* Code for supervised pretraining. */
   void train(Corpus& corpus);
 
-  float train_full_tree(const InputUnits& input_units,
-                        const ParseUnits& parse_units,
-                        dynet::Trainer* trainer,
-                        unsigned iter);
-
-  float train_structure_full_tree(const InputUnits & input_units,
-                                  const ParseUnits & parse_units,
-                                  dynet::Trainer * trainer,
-                                  unsigned beam_size);
+  /* Sum the losses of order[begin, end) in one graph and perform one update. */
+  virtual float train_batch(Corpus & corpus,
+                    const std::vector<unsigned> & order,
+                    unsigned begin,
+                    unsigned end,
+                    Noisifier & noisifier,
+                    dynet::Trainer * trainer,
+                    unsigned iter);
+
+  /* Follow the gold actions and collect the score expression and the gold action of each step. */
+  void add_teacher_forcing_scores(const InputUnits & input_units,
+                                  const std::vector<unsigned> & gold_actions,
+                                  dynet::ComputationGraph & cg,
+                                  std::vector<dynet::Expression> & scores,
+                                  std::vector<unsigned> & actions);
+
+  void add_full_tree_loss(const InputUnits& input_units,
+                          const ParseUnits& parse_units,
+                          const std::vector<unsigned> & gold_actions,
+                          dynet::ComputationGraph & cg,
+                          unsigned iter,
+                          std::vector<dynet::Expression> & loss);
+
+  void add_structure_full_tree_loss(const InputUnits & input_units,
+                                    const ParseUnits & parse_units,
+                                    const std::vector<unsigned> & gold_actions,
+                                    dynet::ComputationGraph & cg,
+                                    unsigned beam_size,
+                                    std::vector<dynet::Expression> & loss);
 
   void add_loss_one_step(dynet::Expression & score_expr,
                          const unsigned & best_gold_action,
@@ -71,13 +96,20 @@ struct SupervisedTrainer : public ParserTrainer {
 };
 
 struct SupervisedEnsembleTrainer : public ParserTrainer {
+  bool streaming;
+  unsigned chunk_size;
+  unsigned window_size;
+
   SupervisedEnsembleTrainer(ParseModel & engine,
                             OptimizerBuilder & opt_builder,
                             const po::variables_map & conf);
 
   static po::options_description get_options();
  
-  void train(Corpus & corpus, EnsembleInstances & ensemble_instances);
+  void train(Corpus & corpus, EnsembleData & ensemble_data);
+
+  /* Distill from the teacher ensemble run alongside the training. */
+  void train(Corpus & corpus, EnsembleTeacher & teacher);
 
   float train_full_tree(const InputUnits & input_units,
                         const EnsembleInstance & ensemble_instance,
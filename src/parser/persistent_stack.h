@@ -0,0 +1,130 @@
+#ifndef __TWPIPE_PARSER_PERSISTENT_STACK_H__
+#define __TWPIPE_PARSER_PERSISTENT_STACK_H__
+
+#include <vector>
+#include <memory>
+#include <boost/assert.hpp>
+
+namespace twpipe {
+
+/// A structure-sharing stack. Each node keeps a link to the node below it,
+/// so copying a stack copies a handle and pushing onto a copy doesn't touch
+/// the original. The nodes live in an arena which is reset all at once,
+/// typically when a sentence is finished. A stack must not be used after
+/// its arena is reset. Pushing may move the nodes, so the elements are
+/// returned by value.
+template <class T>
+struct PersistentStack {
+  static const unsigned npos = static_cast<unsigned>(-1);
+
+  struct Node {
+    T value;
+    unsigned below;
+  };
+
+  struct Arena {
+    std::vector<Node> nodes;
+
+    /// Drop all the nodes but keep the memory for the next sentence.
+    void reset() { nodes.clear(); }
+  };
+
+  /// Walk the elements from the top to the bottom.
+  struct const_iterator {
+    const Arena * arena;
+    unsigned node;
+    unsigned rest;
+
+    T operator*() const { return arena->nodes[node].value; }
+
+    const_iterator & operator++() {
+      node = arena->nodes[node].below;
+      --rest;
+      return *this;
+    }
+
+    bool operator!=(const const_iterator & other) const { return rest != other.rest; }
+  };
+
+  Arena * arena;
+  unsigned top_node;
+  unsigned n;
+
+  PersistentStack() : arena(nullptr), top_node(npos), n(0) {}
+
+  explicit PersistentStack(Arena * a) : arena(a), top_node(npos), n(0) {}
+
+  unsigned size() const { return n; }
+
+  const_iterator begin() const { return const_iterator{ arena, top_node, n }; }
+
+  const_iterator end() const { return const_iterator{ arena, npos, 0 }; }
+
+  bool empty() const { return n == 0; }
+
+  void clear() { top_node = npos; n = 0; }
+
+  void push_back(const T & value) {
+    BOOST_ASSERT_MSG(arena != nullptr, "[persistent stack] no arena.");
+    arena->nodes.push_back(Node{ value, top_node });
+    top_node = arena->nodes.size() - 1;
+    ++n;
+  }
+
+  void pop_back() {
+    BOOST_ASSERT_MSG(n > 0, "[persistent stack] pop from empty stack.");
+    top_node = arena->nodes[top_node].below;
+    --n;
+  }
+
+  T back() const {
+    BOOST_ASSERT_MSG(n > 0, "[persistent stack] back of empty stack.");
+    return arena->nodes[top_node].value;
+  }
+
+  /// The k-th element counting from the top, top(0) is back().
+  T top(unsigned k) const {
+    BOOST_ASSERT_MSG(k < n, "[persistent stack] out of range.");
+    unsigned node = top_node;
+    for (unsigned i = 0; i < k; ++i) { node = arena->nodes[node].below; }
+    return arena->nodes[node].value;
+  }
+
+  /// The i-th element counting from the bottom, as std::vector does. It
+  /// walks from the top, so prefer back() and top(k) near the top.
+  T operator[](unsigned i) const {
+    return top(n - 1 - i);
+  }
+
+  /// Copy the elements into a vector, the bottom first.
+  void to_vector(std::vector<T> & output) const {
+    output.resize(n);
+    unsigned node = top_node;
+    for (unsigned i = n; i > 0; --i) {
+      output[i - 1] = arena->nodes[node].value;
+      node = arena->nodes[node].below;
+    }
+  }
+};
+
+/// Hand out objects of type T for the checkpoints of a sentence. The objects
+/// are never released one by one, reset() takes all of them back and keeps
+/// them for reuse, so expanding a beam doesn't go to the heap.
+template <class T>
+struct CheckpointPool {
+  std::vector<std::unique_ptr<T>> items;
+  unsigned n_used;
+
+  CheckpointPool() : n_used(0) {}
+
+  T * allocate() {
+    if (n_used == items.size()) { items.emplace_back(new T()); }
+    return items[n_used++].get();
+  }
+
+  void reset() { n_used = 0; }
+};
+
+}
+
+#endif  //  end for __TWPIPE_PARSER_PERSISTENT_STACK_H__
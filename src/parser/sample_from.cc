@@ -62,14 +62,16 @@ int main(int argc, char* argv[]) {
 
   if (conf.count("embedding")) {
     twpipe::WordEmbedding::get()->load(conf["embedding"].as<std::string>(),
-                                       conf["embedding-dim"].as<unsigned>());
+                                       conf["embedding-dim"].as<unsigned>(),
+                                       conf.count("embedding-fp16") > 0);
   } else {
     twpipe::WordEmbedding::get()->empty(conf["embedding-dim"].as<unsigned>());
   }
 
   if (conf.count("elmo")) {
     twpipe::ELMo::get()->load(conf["elmo"].as<std::string>(),
-                              conf["elmo-dim"].as<unsigned>());
+                              conf["elmo-dim"].as<unsigned>(),
+                              conf.count("elmo-fp16") > 0);
   } else {
     twpipe::ELMo::get()->empty(conf["elmo-dim"].as<unsigned>());
   }
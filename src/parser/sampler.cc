@@ -67,6 +67,7 @@ void VanillaSampler::sample(const std::vector<std::string> &words,
   engine->initialize_state(input, state);
 
   engine->new_graph(cg);
+  engine->reset_checkpoints();
   checkpoint = engine->get_initial_checkpoint();
   engine->initialize_parser(cg, input, checkpoint);
 
@@ -95,11 +96,11 @@ void VanillaSampler::sample(const std::vector<std::string> &words,
     n_actions++;
   }
 
-  delete checkpoint;
+  engine->destropy_checkpoint(checkpoint);
 }
 
 EnsembleSampler::EnsembleSampler(std::vector<ParseModel *> &engines) : engines(engines) {
-
+  ParseModel::prepare_ensemble(engines);
 }
 
 void EnsembleSampler::sample(const std::vector<std::string> &words,
@@ -126,6 +127,7 @@ void EnsembleSampler::sample(const std::vector<std::string> &words,
   engines[0]->initialize_state(input, state);
   for (unsigned i = 0; i < n_engines; ++i) {
     engines[i]->new_graph(cg);
+    engines[i]->reset_checkpoints();
     checkpoints[i] = engines[i]->get_initial_checkpoint();
     engines[i]->initialize_parser(cg, input, checkpoints[i]);
   }
@@ -135,16 +137,8 @@ void EnsembleSampler::sample(const std::vector<std::string> &words,
     std::vector<unsigned> valid_actions;
     system.get_valid_actions(state, valid_actions);
 
-    std::vector<float> ensemble_probs(system.num_actions(), 0.f);
-    for (unsigned i = 0; i < n_engines; ++i) {
-      dynet::Expression score_exprs = engines[i]->get_scores(checkpoints[i]);
-      std::vector<float> ensemble_score = dynet::as_vector(cg.get_value(score_exprs));
-      Math::softmax_inplace(ensemble_score);
-      for (unsigned c = 0; c < ensemble_score.size(); ++c) {
-        ensemble_probs[c] += ensemble_score[c];
-      }
-    }
-    for (auto & p : ensemble_probs) { p /= n_engines; }
+    std::vector<float> ensemble_probs;
+    ParseModel::get_ensemble_probs(cg, engines, checkpoints, ensemble_probs);
 
     std::vector<float> valid_prob;
     for (unsigned act : valid_actions) {
@@ -165,7 +159,7 @@ void EnsembleSampler::sample(const std::vector<std::string> &words,
     n_actions++;
   }
 
-  for (unsigned i = 0; i < n_engines; ++i) { delete checkpoints[i]; }
+  for (unsigned i = 0; i < n_engines; ++i) { engines[i]->destropy_checkpoint(checkpoints[i]); }
 }
 
 }
\ No newline at end of file
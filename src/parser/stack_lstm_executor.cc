@@ -0,0 +1,217 @@
+#include "stack_lstm_executor.h"
+#include "arcstd.h"
+#include "arceager.h"
+#include "archybrid.h"
+#include "swap.h"
+#include "twpipe/math.h"
+#include "twpipe/logging.h"
+#include <cmath>
+#include <algorithm>
+#include <boost/assert.hpp>
+
+namespace twpipe {
+
+void StackLSTMExecutor::LSTM::load(dynet::ComputationGraph & cg, dynet::CoupledLSTMBuilder & builder, bool int8) {
+  cell.load(cg, builder, int8);
+}
+
+void StackLSTMExecutor::LSTM::clear() {
+  parents.clear();
+  states.clear();
+}
+
+int StackLSTMExecutor::LSTM::add_input(int prev, const float * x) {
+  unsigned size = cell.state_size();
+  int node = parents.size();
+  parents.push_back(prev);
+  states.resize(states.size() + size);
+  cell.step(x, (prev < 0 ? nullptr : states.data() + prev * size), states.data() + node * size);
+  return node;
+}
+
+const float * StackLSTMExecutor::LSTM::back(int node) const {
+  return cell.output(states.data() + node * cell.state_size());
+}
+
+StackLSTMExecutor::StackLSTMExecutor(TransitionSystem & sys) :
+  sys(sys), loaded(false), dim_input(0), s_pointer(-1), q_pointer(-1), a_pointer(-1) {
+  std::string system_name = sys.name();
+  if (system_name == "arcstd") {
+    system_kind = kArcStandard;
+  } else if (system_name == "archybrid") {
+    system_kind = kArcHybrid;
+  } else if (system_name == "arceager") {
+    system_kind = kArcEager;
+  } else if (system_name == "swap") {
+    system_kind = kSwap;
+  } else {
+    _ERROR << "[parse|executor] unknown transition system: " << system_name;
+    exit(1);
+  }
+}
+
+void StackLSTMExecutor::load(dynet::ComputationGraph & cg,
+                             dynet::CoupledLSTMBuilder & s_builder,
+                             dynet::CoupledLSTMBuilder & q_builder,
+                             dynet::CoupledLSTMBuilder & a_builder,
+                             SymbolEmbedding & act_emb,
+                             SymbolEmbedding & rel_emb,
+                             Merge3Layer & merge,
+                             Merge3Layer & composer,
+                             DenseLayer & scorer,
+                             const dynet::Expression & action_start_expr,
+                             const dynet::Expression & stack_guard_expr,
+                             unsigned n_actions,
+                             bool int8) {
+  s_lstm.load(cg, s_builder, int8);
+  q_lstm.load(cg, q_builder, int8);
+  a_lstm.load(cg, a_builder, int8);
+  merge_w1.load(cg, merge.W1, int8); merge_w2.load(cg, merge.W2, int8); merge_w3.load(cg, merge.W3, int8);
+  merge_b = dynet::as_vector(cg.get_value(merge.B));
+  composer_w1.load(cg, composer.W1, int8); composer_w2.load(cg, composer.W2, int8); composer_w3.load(cg, composer.W3, int8);
+  composer_b = dynet::as_vector(cg.get_value(composer.B));
+  scorer_w.load(cg, scorer.W, int8);
+  scorer_b = dynet::as_vector(cg.get_value(scorer.B));
+  act_embeddings.resize(n_actions);
+  rel_embeddings.resize(n_actions);
+  for (unsigned a = 0; a < n_actions; ++a) {
+    act_embeddings[a] = dynet::as_vector(cg.get_value(act_emb.embed(a)));
+    rel_embeddings[a] = dynet::as_vector(cg.get_value(rel_emb.embed(a)));
+  }
+  action_start = dynet::as_vector(cg.get_value(action_start_expr));
+  stack_guard = dynet::as_vector(cg.get_value(stack_guard_expr));
+  dim_input = stack_guard.size();
+  hidden.resize(merge_b.size());
+  composition.resize(composer_b.size());
+  loaded = true;
+}
+
+void StackLSTMExecutor::initialize(const std::vector<std::vector<float>> & buffer_inputs) {
+  BOOST_ASSERT_MSG(loaded, "[parse|executor] weights are not loaded.");
+  s_lstm.clear();
+  q_lstm.clear();
+  a_lstm.clear();
+  vectors.clear();
+  stack.clear();
+  buffer.clear();
+  // the words, the guard and at most one composition per word.
+  unsigned len = buffer_inputs.size();
+  vectors.reserve((2 * len + 1) * dim_input);
+  stack.reserve(len + 1);
+  buffer.reserve(len);
+
+  a_pointer = a_lstm.add_input(-1, action_start.data());
+  q_pointer = -1;
+  for (unsigned i = 0; i < buffer_inputs.size(); ++i) {
+    q_pointer = q_lstm.add_input(q_pointer, buffer_inputs[i].data());
+    vectors.insert(vectors.end(), buffer_inputs[i].begin(), buffer_inputs[i].end());
+    buffer.push_back(i);
+  }
+  s_pointer = s_lstm.add_input(-1, stack_guard.data());
+  vectors.insert(vectors.end(), stack_guard.begin(), stack_guard.end());
+  stack.push_back(buffer_inputs.size());
+}
+
+void StackLSTMExecutor::get_scores(std::vector<float> & scores) {
+  hidden = merge_b;
+  merge_w1.multiply_add(s_lstm.back(s_pointer), hidden.data());
+  merge_w2.multiply_add(q_lstm.back(q_pointer), hidden.data());
+  merge_w3.multiply_add(a_lstm.back(a_pointer), hidden.data());
+  for (float & h : hidden) { h = (h > 0.f ? h : 0.f); }
+
+  scores = scorer_b;
+  scorer_w.multiply_add(hidden.data(), scores.data());
+}
+
+unsigned StackLSTMExecutor::compose(unsigned hed, unsigned mod, unsigned action) {
+  std::copy(composer_b.begin(), composer_b.end(), composition.begin());
+  composer_w1.multiply_add(vectors.data() + hed * dim_input, composition.data());
+  composer_w2.multiply_add(vectors.data() + mod * dim_input, composition.data());
+  composer_w3.multiply_add(rel_embeddings[action].data(), composition.data());
+  Activation::tanh_inplace(composition.data(), composition.size());
+  unsigned id = vectors.size() / dim_input;
+  vectors.insert(vectors.end(), composition.begin(), composition.end());
+  return id;
+}
+
+void StackLSTMExecutor::perform_action(unsigned action) {
+  // mirrors the TransitionSystemFunction of Dyer15Model.
+  a_pointer = a_lstm.add_input(a_pointer, act_embeddings[action].data());
+
+  bool shift = ((system_kind == kArcStandard && ArcStandard::is_shift(action)) ||
+                (system_kind == kArcHybrid && ArcHybrid::is_shift(action)) ||
+                (system_kind == kArcEager && ArcEager::is_shift(action)) ||
+                (system_kind == kSwap && Swap::is_shift(action)));
+  if (shift) {
+    unsigned front = buffer.back();
+    buffer.pop_back();
+    q_pointer = q_lstm.get_head(q_pointer);
+    stack.push_back(front);
+    s_pointer = s_lstm.add_input(s_pointer, vectors.data() + front * dim_input);
+    return;
+  }
+
+  if (system_kind == kArcStandard || (system_kind == kSwap && !Swap::is_swap(action))) {
+    // left and right reduce the top two of the stack into one.
+    bool left = (system_kind == kArcStandard ? ArcStandard::is_left(action) : Swap::is_left(action));
+    unsigned s0 = stack.back(), s1 = stack[stack.size() - 2];
+    stack.pop_back(); stack.pop_back();
+    s_pointer = s_lstm.get_head(s_lstm.get_head(s_pointer));
+    unsigned composed = (left ? compose(s0, s1, action) : compose(s1, s0, action));
+    stack.push_back(composed);
+    s_pointer = s_lstm.add_input(s_pointer, vectors.data() + composed * dim_input);
+  } else if (system_kind == kSwap) {
+    unsigned j = stack.back(), i = stack[stack.size() - 2];
+    stack.pop_back(); stack.pop_back();
+    s_pointer = s_lstm.get_head(s_lstm.get_head(s_pointer));
+    stack.push_back(j);
+    s_pointer = s_lstm.add_input(s_pointer, vectors.data() + j * dim_input);
+    buffer.push_back(i);
+    q_pointer = q_lstm.add_input(q_pointer, vectors.data() + i * dim_input);
+  } else if ((system_kind == kArcHybrid && ArcHybrid::is_left(action)) ||
+             (system_kind == kArcEager && ArcEager::is_left(action))) {
+    unsigned hed = buffer.back(), mod = stack.back();
+    stack.pop_back();
+    buffer.pop_back();
+    s_pointer = s_lstm.get_head(s_pointer);
+    q_pointer = q_lstm.get_head(q_pointer);
+    unsigned composed = compose(hed, mod, action);
+    buffer.push_back(composed);
+    q_pointer = q_lstm.add_input(q_pointer, vectors.data() + composed * dim_input);
+  } else if (system_kind == kArcHybrid) {
+    unsigned hed = stack[stack.size() - 2], mod = stack.back();
+    stack.pop_back(); stack.pop_back();
+    s_pointer = s_lstm.get_head(s_lstm.get_head(s_pointer));
+    unsigned composed = compose(hed, mod, action);
+    stack.push_back(composed);
+    s_pointer = s_lstm.add_input(s_pointer, vectors.data() + composed * dim_input);
+  } else if (ArcEager::is_right(action)) {
+    unsigned mod = buffer.back(), hed = stack.back();
+    stack.pop_back();
+    s_pointer = s_lstm.get_head(s_pointer);
+    unsigned composed = compose(hed, mod, action);
+    stack.push_back(composed);
+    s_pointer = s_lstm.add_input(s_pointer, vectors.data() + composed * dim_input);
+    stack.push_back(mod);
+    s_pointer = s_lstm.add_input(s_pointer, vectors.data() + mod * dim_input);
+    buffer.pop_back();
+    q_pointer = q_lstm.get_head(q_pointer);
+  } else {
+    // reduce of arceager.
+    stack.pop_back();
+    s_pointer = s_lstm.get_head(s_pointer);
+  }
+}
+
+void StackLSTMExecutor::predict(State & state) {
+  std::vector<float> scores;
+  while (!state.terminated()) {
+    unsigned mask = sys.get_valid_structure_mask(state);
+    get_scores(scores);
+    unsigned best_a = Math::masked_argmax(scores, sys.get_mask_penalty(mask));
+    sys.perform_action(state, best_a);
+    perform_action(best_a);
+  }
+}
+
+}
@@ -0,0 +1,107 @@
+#ifndef __TWPIPE_PARSER_STACK_LSTM_EXECUTOR_H__
+#define __TWPIPE_PARSER_STACK_LSTM_EXECUTOR_H__
+
+#include "state.h"
+#include "system.h"
+#include "dynet/lstm.h"
+#include "dynet_layer/layer.h"
+#include "twpipe/rnn_kernel.h"
+#include <vector>
+
+namespace twpipe {
+
+/// Greedy decoding for the Stack-LSTM parsers (Dyer15Model and
+/// Ballesteros15Model) without a computation graph. The weights are copied
+/// out of the model once by load(), after that a transition only runs the
+/// LSTM steps, the composition and the output layer over plain float
+/// buffers. It is meant for inference: the copy is not refreshed when the
+/// parameters are updated.
+struct StackLSTMExecutor {
+  /// The states of a stack LSTM form a tree, a node keeps the hidden and the
+  /// memory cell of all the layers and links to its parent. Node -1 is the
+  /// empty state.
+  struct LSTM {
+    FusedLSTMCell cell;
+    std::vector<int> parents;
+    std::vector<float> states;
+
+    void load(dynet::ComputationGraph & cg, dynet::CoupledLSTMBuilder & builder, bool int8);
+
+    void clear();
+
+    int add_input(int prev, const float * x);
+
+    int get_head(int node) const { return parents[node]; }
+
+    /// The hidden of the top layer.
+    const float * back(int node) const;
+  };
+
+  /// The transition system, resolved once from its name.
+  enum SystemKind { kArcStandard, kArcHybrid, kArcEager, kSwap };
+
+  TransitionSystem & sys;
+  SystemKind system_kind;
+  LSTM s_lstm;
+  LSTM q_lstm;
+  LSTM a_lstm;
+  KernelMatrix merge_w1, merge_w2, merge_w3;
+  std::vector<float> merge_b;
+  KernelMatrix composer_w1, composer_w2, composer_w3;
+  std::vector<float> composer_b;
+  KernelMatrix scorer_w;
+  std::vector<float> scorer_b;
+  std::vector<std::vector<float>> act_embeddings;
+  std::vector<std::vector<float>> rel_embeddings;
+  std::vector<float> action_start;
+  std::vector<float> stack_guard;
+  bool loaded;
+
+  /// The representations on the stack and the buffer, the i-th one is at
+  /// vectors[i * dim_input].
+  std::vector<float> vectors;
+  unsigned dim_input;
+  std::vector<unsigned> stack;
+  std::vector<unsigned> buffer;
+  int s_pointer, q_pointer, a_pointer;
+  std::vector<float> hidden;
+  std::vector<float> composition;
+
+  StackLSTMExecutor(TransitionSystem & sys);
+
+  /// Copy the weights out of the model, its new_graph(cg) should be called.
+  /// The matrices of the LSTMs, the merge, the composition and the output
+  /// layer are kept in int8 when int8 is set.
+  void load(dynet::ComputationGraph & cg,
+            dynet::CoupledLSTMBuilder & s_lstm,
+            dynet::CoupledLSTMBuilder & q_lstm,
+            dynet::CoupledLSTMBuilder & a_lstm,
+            SymbolEmbedding & act_emb,
+            SymbolEmbedding & rel_emb,
+            Merge3Layer & merge,
+            Merge3Layer & composer,
+            DenseLayer & scorer,
+            const dynet::Expression & action_start,
+            const dynet::Expression & stack_guard,
+            unsigned n_actions,
+            bool int8);
+
+  /// Start a sentence, buffer[0] is the guard and buffer[len - i] is the
+  /// i-th word, as Dyer15Model::initialize_parser pushes them. The room for
+  /// the composed vectors is reserved here, so the transitions don't allocate.
+  void initialize(const std::vector<std::vector<float>> & buffer);
+
+  void get_scores(std::vector<float> & scores);
+
+  void perform_action(unsigned action);
+
+  /// Parse the sentence greedily, state should be initialized.
+  void predict(State & state);
+
+private:
+  unsigned compose(unsigned hed, unsigned mod, unsigned action);
+};
+
+}
+
+#endif  //  end for __TWPIPE_PARSER_STACK_LSTM_EXECUTOR_H__
@@ -4,15 +4,51 @@
 
 namespace twpipe {
 
-State::State(unsigned n) : heads(n, Corpus::BAD_HED), deprels(n, Corpus::BAD_DEL) {
+State::State(unsigned n) :
+  storage(std::make_shared<Storage>()),
+  tree(std::make_shared<Tree>()),
+  n_words(n) {
+  // the stack and buffer see each word about twice.
+  storage->words.nodes.reserve(4 * n + 4);
+  stack = PersistentStack<unsigned>(&storage->words);
+  buffer = PersistentStack<unsigned>(&storage->words);
+  tree->heads.assign(n, Corpus::BAD_HED);
+  tree->deprels.assign(n, Corpus::BAD_DEL);
+}
+
+unsigned State::size() const {
+  return n_words;
+}
+
+void State::add_arc(unsigned mod, unsigned hed, unsigned deprel) {
+  // copy on write, the other states sharing the index keep theirs.
+  if (tree.use_count() > 1) { tree = std::make_shared<Tree>(*tree); }
+  tree->heads[mod] = hed;
+  tree->deprels[mod] = deprel;
+}
+
+unsigned State::head(unsigned mod) const {
+  return tree->heads[mod];
+}
+
+unsigned State::deprel(unsigned mod) const {
+  return tree->deprels[mod];
+}
+
+void State::get_tree(std::vector<unsigned> & heads,
+                     std::vector<unsigned> & deprels) const {
+  heads = tree->heads;
+  deprels = tree->deprels;
 }
 
 float State::loss(const std::vector<unsigned>& gold_heads,
-                  const std::vector<unsigned>& gold_deprels) {
-  BOOST_ASSERT_MSG(gold_heads.size() == heads.size(),
+                  const std::vector<unsigned>& gold_deprels) const {
+  BOOST_ASSERT_MSG(gold_heads.size() == n_words,
                    "# of heads should be equal to # of gold heads");
-  BOOST_ASSERT_MSG(gold_deprels.size() == deprels.size(),
+  BOOST_ASSERT_MSG(gold_deprels.size() == n_words,
                    "# of deprels should be equal to # of gold deprels");
+  const std::vector<unsigned> & heads = tree->heads;
+  const std::vector<unsigned> & deprels = tree->deprels;
   float n_corr = 0., n_total = 0.;
   for (unsigned i = 0; i < gold_heads.size(); ++i) {
     if (gold_heads[i] == heads[i] && gold_deprels[i] == deprels[i])
@@ -2,23 +2,56 @@
 #define __TWPIPE_PARSER_STATE_H__
 
 #include <vector>
+#include <memory>
+#include "persistent_stack.h"
 
 namespace twpipe {
 
+/// The parsing state. The stack and the buffer are persistent stacks, so
+/// copying a state (which beam search does for every expansion) costs O(1).
+/// The nodes are shared by all the states derived from the same initial
+/// state and released with the last of them. The heads are indexed by word
+/// and shared by the copies until one of them adds an arc, which then copies
+/// the index; greedy decoding never copies it.
 struct State {
   static const unsigned MAX_N_WORDS = 1024;
 
-  std::vector<unsigned> stack;
-  std::vector<unsigned> buffer;
-  std::vector<unsigned> heads;
-  std::vector<unsigned> deprels;
+  struct Storage {
+    PersistentStack<unsigned>::Arena words;
+  };
+
+  struct Tree {
+    std::vector<unsigned> heads;
+    std::vector<unsigned> deprels;
+  };
+
+  std::shared_ptr<Storage> storage;
+  PersistentStack<unsigned> stack;
+  PersistentStack<unsigned> buffer;
+  std::shared_ptr<Tree> tree;
+  unsigned n_words;
   // std::vector<unsigned> aux;
 
   State(unsigned n);
 
+  /// The number of words, including the pseudo root.
+  unsigned size() const;
+
+  void add_arc(unsigned mod, unsigned hed, unsigned deprel);
+
+  /// The head and relation of a word, Corpus::BAD_HED (BAD_DEL) if it has
+  /// none yet.
+  unsigned head(unsigned mod) const;
+
+  unsigned deprel(unsigned mod) const;
+
+  /// Materialize the heads and relations of all the words.
+  void get_tree(std::vector<unsigned> & heads,
+                std::vector<unsigned> & deprels) const;
+
   //! Computing the loss on the current state and reference.
   float loss(const std::vector<unsigned>& gold_heads,
-             const std::vector<unsigned>& gold_deprels);
+             const std::vector<unsigned>& gold_deprels) const;
 
   bool terminated() const;
 };
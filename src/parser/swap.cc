@@ -19,6 +19,7 @@ Swap::Swap() : TransitionSystem() {
   for (const auto& action_name : action_names) {
     _INFO << "- " << action_name;
   }
+  build_mask_cache();
 }
 
 std::string Swap::name() const {
@@ -36,6 +37,8 @@ bool Swap::allow_nonprojective() const {
 
 unsigned Swap::num_actions() const { return n_actions; }
 
+unsigned Swap::num_structure_actions() const { return 4; }
+
 void Swap::get_transition_costs(const State & state,
                                 const std::vector<unsigned>& actions,
                                 const std::vector<unsigned>& ref_heads,
@@ -44,8 +47,8 @@ void Swap::get_transition_costs(const State & state,
   BOOST_ASSERT_MSG(false, "Inefficient to define dynamic oracle for SWAP system");
 }
 
-unsigned Swap::get_structure_action(const unsigned & action) {
-  return (action < 3 ? action : (action % 2 == 1 ? 3 : 4));
+unsigned Swap::get_structure_action(const unsigned & action) const {
+  return (action < 2 ? action : (action % 2 == 0 ? 2 : 3));
 }
 
 void Swap::perform_action(State & state, const unsigned & action) {
@@ -294,16 +297,15 @@ void Swap::swap_unsafe(State & state) const {
 
 void Swap::left_unsafe(State & state, const unsigned & deprel) const {
   unsigned hed = state.stack.back(); state.stack.pop_back();
-  unsigned mod = state.stack.back(); state.stack.back() = hed;
-  state.heads[mod] = hed;
-  state.deprels[mod] = deprel;
+  unsigned mod = state.stack.back(); state.stack.pop_back();
+  state.stack.push_back(hed);
+  state.add_arc(mod, hed, deprel);
 }
 
 void Swap::right_unsafe(State & state, const unsigned & deprel) const {
   unsigned mod = state.stack.back(); state.stack.pop_back();
   unsigned hed = state.stack.back();
-  state.heads[mod] = hed;
-  state.deprels[mod] = deprel;
+  state.add_arc(mod, hed, deprel);
 }
 
 unsigned Swap::get_shift_id() const { return 0; }
@@ -321,32 +323,17 @@ unsigned Swap::parse_label(const unsigned & action) const {
   return (action % 2 == 0 ? (action - 2) / 2 : (action - 3) / 2);
 }
 
-void Swap::get_valid_actions(const State & state,
-                             std::vector<unsigned>& valid_actions) {
-  valid_actions.clear();
-  for (unsigned a = 0; a < n_actions; ++a) {
-    //if (!is_valid_action(state, action_names[a])) { continue; }
-    if (!is_valid_action(state, a)) { continue; }
-    valid_actions.push_back(a);
-  }
-  BOOST_ASSERT_MSG(valid_actions.size() > 0, "There should be one or more valid action.");
-}
-
-bool Swap::is_valid_action(const State& state, const unsigned& act) const {
-  bool is_shift = (act == 0);
-  bool is_swap = (act == 1);
-  bool is_reduce = (!is_shift && !is_swap);
-
-  if (is_shift && state.buffer.size() == 1) { return false; }
-  if (is_swap && (state.stack.size() < 3 || state.buffer.size() == 1)) { return false; }
-  if (is_swap && state.stack[state.stack.size() - 2] > state.stack.back()) { return false; }
-  if (is_reduce) {
-    if (state.stack.size() < 3) { return false; }
-    if (is_left(act) && state.stack[state.stack.size() - 2] == 0) { return false; }
+unsigned Swap::get_valid_structure_mask(const State& state) const {
+  unsigned mask = 0;
+  if (state.buffer.size() != 1) { mask |= (1u << get_shift_id()); }
+  if (state.stack.size() >= 3) {
+    unsigned s0 = state.stack.back(), s1 = state.stack.top(1);
+    if (state.buffer.size() != 1 && s1 <= s0) { mask |= (1u << get_swap_id()); }
+    if (s1 != 0) { mask |= (1u << 2); }
+    mask |= (1u << 3);
   }
-  // if (is_reduce && state.stack.size() < 3) { return false; }
   // if (state.buffer.size() == 1 && !is_right(act)) { return false; }
-  return true;
+  return mask;
 }
 
 }
\ No newline at end of file
@@ -20,25 +20,24 @@ struct Swap : public TransitionSystem {
 
   unsigned num_actions() const override;
 
+  unsigned num_structure_actions() const override;
+
   void get_transition_costs(const State& state,
                             const std::vector<unsigned>& actions,
                             const std::vector<unsigned>& ref_heads,
                             const std::vector<unsigned>& ref_deprels,
                             std::vector<float>& rewards) override;
 
-  unsigned get_structure_action(const unsigned & action) override;
+  unsigned get_structure_action(const unsigned & action) const override;
 
   void perform_action(State& state, const unsigned& action) override;
 
-  void get_valid_actions(const State& state,
-                         std::vector<unsigned>& valid_actions) override;
+  unsigned get_valid_structure_mask(const State& state) const override;
 
   void get_oracle_actions(const std::vector<unsigned>& heads,
                           const std::vector<unsigned>& deprels,
                           std::vector<unsigned>& actions) override;
 
-  bool is_valid_action(const State& state, const unsigned& act) const override;
-
   void get_oracle_actions_calculate_orders(const unsigned & root,
                                            const std::vector<std::vector<unsigned>>& tree,
                                            std::vector<unsigned>& orders,
@@ -1,5 +1,7 @@
 #include "system.h"
 #include "twpipe/alphabet_collection.h"
+#include <limits>
+#include <boost/assert.hpp>
 
 namespace twpipe {
 
@@ -7,4 +9,40 @@ unsigned TransitionSystem::num_deprels() {
   return AlphabetCollection::get()->deprel_map.size();
 }
 
+bool TransitionSystem::is_valid_action(const State & state, const unsigned & act) const {
+  return ((get_valid_structure_mask(state) >> get_structure_action(act)) & 1) != 0;
+}
+
+void TransitionSystem::get_valid_actions(const State & state, std::vector<unsigned>& valid_actions) {
+  valid_actions = get_mask_actions(get_valid_structure_mask(state));
+  BOOST_ASSERT_MSG(valid_actions.size() > 0, "There should be one or more valid action.");
+}
+
+const std::vector<unsigned> & TransitionSystem::get_mask_actions(unsigned mask) const {
+  BOOST_ASSERT_MSG(mask < mask_actions.size(), "[parse|system] the mask cache is not built.");
+  return mask_actions[mask];
+}
+
+const std::vector<float> & TransitionSystem::get_mask_penalty(unsigned mask) const {
+  BOOST_ASSERT_MSG(mask < mask_penalty.size(), "[parse|system] the mask cache is not built.");
+  return mask_penalty[mask];
+}
+
+void TransitionSystem::build_mask_cache() {
+  unsigned n_masks = (1u << num_structure_actions());
+  unsigned n = num_actions();
+  mask_actions.resize(n_masks);
+  mask_penalty.resize(n_masks);
+  for (unsigned mask = 0; mask < n_masks; ++mask) {
+    mask_actions[mask].clear();
+    mask_penalty[mask].assign(n, -std::numeric_limits<float>::infinity());
+    for (unsigned a = 0; a < n; ++a) {
+      if ((mask >> get_structure_action(a)) & 1) {
+        mask_actions[mask].push_back(a);
+        mask_penalty[mask][a] = 0.f;
+      }
+    }
+  }
+}
+
 }
@@ -10,6 +10,8 @@ namespace twpipe {
 struct TransitionSystem {
   TransitionSystem() {}
 
+  virtual ~TransitionSystem() {}
+
   /// Get the name of transition system.
   virtual std::string name() const = 0;
 
@@ -20,6 +22,9 @@ struct TransitionSystem {
 
   virtual unsigned num_actions() const = 0;
 
+  /// The number of structural actions, i.e. the actions without labels.
+  virtual unsigned num_structure_actions() const = 0;
+
   unsigned num_deprels();
 
   virtual void get_transition_costs(const State& state,
@@ -30,15 +35,36 @@ struct TransitionSystem {
 
   virtual void perform_action(State& state, const unsigned& action) = 0;
 
-  virtual bool is_valid_action(const State& state, const unsigned& act) const = 0;
+  /// The validity of an action only depends on its structural action. Bit k
+  /// of the mask is set if the k-th structural action is valid in the state.
+  virtual unsigned get_valid_structure_mask(const State& state) const = 0;
+
+  bool is_valid_action(const State& state, const unsigned& act) const;
+
+  void get_valid_actions(const State& state, std::vector<unsigned>& valid_actions);
 
-  virtual void get_valid_actions(const State& state, std::vector<unsigned>& valid_actions) = 0;
+  /// The valid actions of a structural mask, expanded by build_mask_cache.
+  const std::vector<unsigned> & get_mask_actions(unsigned mask) const;
+
+  /// A num_actions() vector with 0 for the valid actions of the mask and -inf
+  /// for the others. Adding it to the scores masks the invalid actions out.
+  const std::vector<float> & get_mask_penalty(unsigned mask) const;
 
   virtual void get_oracle_actions(const std::vector<unsigned>& heads,
                                   const std::vector<unsigned>& deprels,
                                   std::vector<unsigned>& actions) = 0;
 
-  virtual unsigned get_structure_action(const unsigned & action) = 0;
+  virtual unsigned get_structure_action(const unsigned & action) const = 0;
+
+protected:
+  /// Expand the valid actions of every structural mask. Called at the end of
+  /// the constructor of each system, so the cache is read-only afterwards and
+  /// can be shared by the threads.
+  void build_mask_cache();
+
+private:
+  std::vector<std::vector<unsigned>> mask_actions;
+  std::vector<std::vector<float>> mask_penalty;
 };
 
 }
@@ -21,7 +21,7 @@ void init_command_line(int argc, char* argv[], po::variables_map & conf) {
   po::options_description generic_opts("Generic options");
   generic_opts.add_options()
     ("mod", po::value<std::string>()->default_value("oracle"),
-     "the mod of tester [oracle, vanilla, ensemble]")
+     "the mod of tester [oracle, vanilla, ensemble, graph_free]")
     ("verbose,v", "details logging.")
     ("help,h", "show help information.")
     ("models", po::value<std::string>(), "the path to the models.")
@@ -62,14 +62,16 @@ int main(int argc, char* argv[]) {
 
   if (conf.count("embedding")) {
     twpipe::WordEmbedding::get()->load(conf["embedding"].as<std::string>(),
-                                       conf["embedding-dim"].as<unsigned>());
+                                       conf["embedding-dim"].as<unsigned>(),
+                                       conf.count("embedding-fp16") > 0);
   } else {
     twpipe::WordEmbedding::get()->empty(conf["embedding-dim"].as<unsigned>());
   }
 
   if (conf.count("elmo")) {
     twpipe::ELMo::get()->load(conf["elmo"].as<std::string>(),
-                              conf["elmo-dim"].as<unsigned>());
+                              conf["elmo-dim"].as<unsigned>(),
+                              conf.count("elmo-fp16") > 0);
   } else {
     twpipe::ELMo::get()->empty(conf["elmo-dim"].as<unsigned>());
   }
@@ -102,6 +104,8 @@ int main(int argc, char* argv[]) {
     tester = new twpipe::OracleTester(engines[0]);
   } else if (mod_name == "vanilla") {
     tester = new twpipe::VanillaTester(engines[0]);
+  } else if (mod_name == "graph_free") {
+    tester = new twpipe::GraphFreeTester(engines[0]);
   } else if (mod_name == "ensemble") {
     tester = new twpipe::EnsembleTester(engines);
   } else {
@@ -161,5 +165,6 @@ int main(int argc, char* argv[]) {
     }
   }
   _INFO << "[twpipe|parse|test] test " << sid + 1 << " instances.";
+  delete tester;
   return 0;
 }
@@ -0,0 +1,144 @@
+#include <iostream>
+#include <random>
+#include "dynet/dynet.h"
+#include "twpipe/logging.h"
+#include "twpipe/embedding.h"
+#include "twpipe/alphabet_collection.h"
+#include "twpipe/corpus.h"
+#include "parser/parse_model.h"
+#include "parser/parse_model_builder.h"
+#include <boost/program_options.hpp>
+
+namespace po = boost::program_options;
+
+/// Parse random sentences with randomly initialized Stack-LSTM parsers, once
+/// through the computation graph and once with the graph-free executor, and
+/// fail on the first sentence where the two trees differ.
+
+const unsigned kWords = 50;
+const unsigned kChars = 20;
+const unsigned kPostags = 10;
+const unsigned kDeprels = 8;
+const unsigned kSentences = 200;
+const unsigned kMaxLength = 25;
+
+void build_alphabets() {
+  twpipe::AlphabetCollection * alphabets = twpipe::AlphabetCollection::get();
+  alphabets->word_map.insert(twpipe::Corpus::BAD0);
+  alphabets->word_map.insert(twpipe::Corpus::UNK);
+  alphabets->word_map.insert(twpipe::Corpus::ROOT);
+  alphabets->char_map.insert(twpipe::Corpus::BAD0);
+  alphabets->char_map.insert(twpipe::Corpus::UNK);
+  alphabets->char_map.insert(twpipe::Corpus::ROOT);
+  alphabets->pos_map.insert(twpipe::Corpus::ROOT);
+  for (unsigned i = 0; i < kWords; ++i) { alphabets->word_map.insert("w" + std::to_string(i)); }
+  for (unsigned i = 0; i < kChars; ++i) { alphabets->char_map.insert("c" + std::to_string(i)); }
+  for (unsigned i = 0; i < kPostags; ++i) { alphabets->pos_map.insert("p" + std::to_string(i)); }
+  for (unsigned i = 0; i < kDeprels; ++i) { alphabets->deprel_map.insert("r" + std::to_string(i)); }
+}
+
+void random_sentence(std::mt19937 & rng, twpipe::InputUnits & input) {
+  twpipe::AlphabetCollection * alphabets = twpipe::AlphabetCollection::get();
+  unsigned len = std::uniform_int_distribution<unsigned>(1, kMaxLength)(rng);
+  input.clear();
+
+  twpipe::InputUnit root;
+  root.wid = alphabets->word_map.get(twpipe::Corpus::ROOT);
+  root.aux_wid = root.wid;
+  root.pid = alphabets->pos_map.get(twpipe::Corpus::ROOT);
+  root.cids.push_back(alphabets->char_map.get(twpipe::Corpus::ROOT));
+  root.word = twpipe::Corpus::ROOT;
+  root.postag = twpipe::Corpus::ROOT;
+  input.push_back(root);
+
+  for (unsigned i = 0; i < len; ++i) {
+    twpipe::InputUnit unit;
+    unit.word = "w" + std::to_string(std::uniform_int_distribution<unsigned>(0, kWords - 1)(rng));
+    unit.wid = alphabets->word_map.get(unit.word);
+    unit.aux_wid = unit.wid;
+    unit.postag = "p" + std::to_string(std::uniform_int_distribution<unsigned>(0, kPostags - 1)(rng));
+    unit.pid = alphabets->pos_map.get(unit.postag);
+    unsigned n_chars = std::uniform_int_distribution<unsigned>(1, 6)(rng);
+    for (unsigned j = 0; j < n_chars; ++j) {
+      std::string ch = "c" + std::to_string(std::uniform_int_distribution<unsigned>(0, kChars - 1)(rng));
+      unit.cids.push_back(alphabets->char_map.get(ch));
+    }
+    input.push_back(unit);
+  }
+}
+
+/// Return the number of sentences where the two decodings differ.
+unsigned compare(const po::variables_map & defaults,
+                 const std::string & arch_name,
+                 const std::string & system_name,
+                 std::mt19937 & rng) {
+  po::variables_map conf(defaults);
+  twpipe::ParseModelBuilder builder(conf);
+  builder.arch_name = arch_name;
+  builder.system_name = system_name;
+  builder.embedding_type = twpipe::kStaticEmbeddings;
+  builder.embed_dim = twpipe::WordEmbedding::get()->dim();
+
+  dynet::ParameterCollection model;
+  twpipe::ParseModel * engine = builder.build(model);
+
+  unsigned n_mismatch = 0;
+  for (unsigned n = 0; n < kSentences; ++n) {
+    twpipe::InputUnits input;
+    random_sentence(rng, input);
+
+    twpipe::ParseUnits expected, output;
+    {
+      dynet::ComputationGraph cg;
+      engine->graph_free = false;
+      engine->predict(cg, input, expected);
+    }
+    {
+      dynet::ComputationGraph cg;
+      engine->graph_free = true;
+      engine->predict(cg, input, output);
+    }
+
+    bool same = (expected.size() == output.size());
+    for (unsigned i = 0; same && i < expected.size(); ++i) {
+      same = (expected[i].head == output[i].head && expected[i].deprel == output[i].deprel);
+    }
+    if (!same) {
+      _ERROR << "[test|graph_free] " << arch_name << "/" << system_name
+        << " differs on sentence #" << n << " of length " << input.size() - 1;
+      n_mismatch++;
+    }
+  }
+  _INFO << "[test|graph_free] " << arch_name << "/" << system_name << ": "
+    << kSentences - n_mismatch << "/" << kSentences << " sentences agree.";
+  delete engine;
+  delete builder.system;
+  return n_mismatch;
+}
+
+int main(int argc, char* argv[]) {
+  dynet::initialize(argc, argv);
+  twpipe::init_boost_log(false);
+
+  po::options_description cmd = twpipe::ParseModel::get_options();
+  po::variables_map defaults;
+  const char * no_args[] = { "test_graph_free" };
+  po::store(po::parse_command_line(1, no_args, cmd), defaults);
+  po::notify(defaults);
+
+  build_alphabets();
+  twpipe::WordEmbedding::get()->empty(16);
+
+  std::mt19937 rng(1234);
+  unsigned n_mismatch = 0;
+  for (const char * arch_name : { "dyer15", "ballesteros15" }) {
+    for (const char * system_name : { "arcstd", "archybrid", "arceager", "swap" }) {
+      n_mismatch += compare(defaults, arch_name, system_name, rng);
+    }
+  }
+  if (n_mismatch > 0) {
+    std::cerr << n_mismatch << " sentences differ." << std::endl;
+    return 1;
+  }
+  return 0;
+}
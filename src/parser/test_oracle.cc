@@ -0,0 +1,148 @@
+#include <iostream>
+#include <random>
+#include <functional>
+#include "twpipe/logging.h"
+#include "twpipe/corpus.h"
+#include "twpipe/alphabet_collection.h"
+#include "parser/arcstd.h"
+#include "parser/archybrid.h"
+#include "parser/arceager.h"
+
+/// Walk random configurations of random projective trees and check the
+/// dynamic oracles against their reference cost functions. Some of the
+/// configurations are revisited out of order, as the beam search does.
+
+const unsigned kDeprels = 3;
+const unsigned kTrees = 3000;
+const unsigned kMaxLength = 15;
+
+/// A random projective tree over the words 1..n-1 whose root is attached to
+/// the pseudo root 0.
+void random_tree(std::mt19937 & rng,
+                 unsigned n,
+                 std::vector<unsigned> & heads,
+                 std::vector<unsigned> & deprels) {
+  heads.assign(n, twpipe::Corpus::BAD_HED);
+  deprels.assign(n, twpipe::Corpus::BAD_DEL);
+  std::vector<unsigned> stack;
+  unsigned next = 1;
+  while (next < n || stack.size() > 1) {
+    if (next < n && (stack.size() < 2 || rng() % 2)) { stack.push_back(next++); continue; }
+    unsigned s0 = stack.back(), s1 = stack[stack.size() - 2];
+    if (rng() % 2) {
+      heads[s1] = s0; stack.erase(stack.end() - 2);
+    } else {
+      heads[s0] = s1; stack.pop_back();
+    }
+  }
+  if (!stack.empty()) { heads[stack[0]] = 0; }
+  for (unsigned i = 1; i < n; ++i) { deprels[i] = rng() % kDeprels; }
+}
+
+twpipe::State initial_state(unsigned n) {
+  twpipe::State state(n);
+  state.stack.push_back(twpipe::Corpus::BAD_HED);
+  state.buffer.push_back(twpipe::Corpus::BAD_HED);
+  for (unsigned i = n; i > 0; --i) { state.buffer.push_back(i - 1); }
+  return state;
+}
+
+/// The reference cost of performing the action on the state.
+typedef std::function<float(const twpipe::State &,
+                            unsigned,
+                            const std::vector<unsigned> &,
+                            const std::vector<unsigned> &)> ReferenceFunction;
+
+/// Return the number of actions whose cost differs from the reference.
+unsigned test_system(twpipe::TransitionSystem & system,
+                     const ReferenceFunction & reference_func,
+                     std::mt19937 & rng) {
+  unsigned n_checked = 0, n_errors = 0;
+  for (unsigned t = 0; t < kTrees; ++t) {
+    unsigned n = 2 + rng() % kMaxLength;
+    std::vector<unsigned> heads, deprels;
+    random_tree(rng, n, heads, deprels);
+
+    std::vector<twpipe::State> walk;
+    walk.push_back(initial_state(n));
+    while (!walk.back().terminated()) {
+      // score the current state or, now and then, one visited before it.
+      const twpipe::State & state = walk[rng() % 4 ? walk.size() - 1 : rng() % walk.size()];
+      std::vector<unsigned> actions;
+      std::vector<float> costs;
+      system.get_valid_actions(state, actions);
+      system.get_transition_costs(state, actions, heads, deprels, costs);
+      for (unsigned i = 0; i < actions.size(); ++i) {
+        float reference = reference_func(state, actions[i], heads, deprels);
+        if (costs[i] != reference) {
+          _ERROR << "[test|oracle] " << system.name() << ": cost of " << system.name(actions[i])
+            << " is " << costs[i] << ", the reference is " << reference;
+          n_errors++;
+        }
+      }
+      n_checked += actions.size();
+
+      actions.clear();
+      system.get_valid_actions(walk.back(), actions);
+      twpipe::State next_state(walk.back());
+      system.perform_action(next_state, actions[rng() % actions.size()]);
+      walk.push_back(next_state);
+    }
+  }
+  _INFO << "[test|oracle] " << system.name() << ": " << n_errors << " errors in "
+    << n_checked << " action costs.";
+  return n_errors;
+}
+
+int main(int argc, char* argv[]) {
+  twpipe::init_boost_log(false);
+  twpipe::AlphabetCollection * alphabets = twpipe::AlphabetCollection::get();
+  for (unsigned i = 0; i < kDeprels; ++i) { alphabets->deprel_map.insert("r" + std::to_string(i)); }
+
+  std::mt19937 rng(1234);
+  unsigned n_errors = 0;
+
+  twpipe::ArcStandard arcstd;
+  n_errors += test_system(arcstd, [&arcstd](const twpipe::State & state, unsigned action,
+                                            const std::vector<unsigned> & heads,
+                                            const std::vector<unsigned> & deprels) {
+    twpipe::State next_state(state);
+    arcstd.perform_action(next_state, action);
+    return static_cast<float>(arcstd.reference_cost(state, heads, deprels)) -
+      static_cast<float>(arcstd.reference_cost(next_state, heads, deprels));
+  }, rng);
+
+  twpipe::ArcHybrid archybrid;
+  n_errors += test_system(archybrid, [&archybrid](const twpipe::State & state, unsigned action,
+                                                  const std::vector<unsigned> & heads,
+                                                  const std::vector<unsigned> & deprels) {
+    twpipe::State next_state(state);
+    if (archybrid.is_shift(action)) {
+      return -archybrid.shift_dynamic_loss_unsafe(next_state, heads, deprels);
+    } else if (archybrid.is_left(action)) {
+      return -archybrid.left_dynamic_loss_unsafe(next_state, archybrid.parse_label(action), heads, deprels);
+    }
+    return -archybrid.right_dynamic_loss_unsafe(next_state, archybrid.parse_label(action), heads, deprels);
+  }, rng);
+
+  twpipe::ArcEager arceager;
+  n_errors += test_system(arceager, [&arceager](const twpipe::State & state, unsigned action,
+                                                const std::vector<unsigned> & heads,
+                                                const std::vector<unsigned> & deprels) {
+    twpipe::State next_state(state);
+    if (arceager.is_shift(action)) {
+      return -arceager.shift_dynamic_loss_unsafe(next_state, heads, deprels);
+    } else if (arceager.is_left(action)) {
+      return -arceager.left_dynamic_loss_unsafe(next_state, arceager.parse_label(action), heads, deprels);
+    } else if (arceager.is_right(action)) {
+      return -arceager.right_dynamic_loss_unsafe(next_state, arceager.parse_label(action), heads, deprels);
+    }
+    return -arceager.reduce_dynamic_loss_unsafe(next_state, heads, deprels);
+  }, rng);
+
+  if (n_errors > 0) {
+    std::cerr << n_errors << " action costs differ." << std::endl;
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,226 @@
+#include <iostream>
+#include <random>
+#include <cmath>
+#include <algorithm>
+#include <limits>
+#include "dynet/dynet.h"
+#include "dynet/expr.h"
+#include "twpipe/logging.h"
+#include "twpipe/embedding.h"
+#include "twpipe/alphabet_collection.h"
+#include "twpipe/corpus.h"
+#include "parser/parse_model.h"
+#include "parser/parse_model_builder.h"
+#include "parser/parse_model_kiperwasser16.h"
+#include "parser/arcstd.h"
+#include "parser/archybrid.h"
+#include "parser/arceager.h"
+#include "parser/swap.h"
+#include <boost/program_options.hpp>
+
+namespace po = boost::program_options;
+
+/// Score random sentences with randomly initialized Kiperwasser16 parsers,
+/// once through the computation graph and once with the precomputed slot
+/// projections, and fail where the scores differ by more than a tolerance or
+/// where the greedy or the beam search trees differ.
+
+const unsigned kWords = 50;
+const unsigned kPostags = 10;
+const unsigned kDeprels = 8;
+const unsigned kSentences = 200;
+const unsigned kMaxLength = 25;
+const unsigned kBeamSize = 4;
+const float kTolerance = 1e-4f;
+
+/// The Kiperwasser16 parser whose precomputed scores can be turned off, so
+/// predict and beam_search fall back to the computation graph.
+struct SwitchedKiperwasser16Model : public twpipe::Kiperwasser16Model {
+  using twpipe::Kiperwasser16Model::Kiperwasser16Model;
+
+  bool use_graph = false;
+
+  bool get_precomputed_scores(const std::vector<StateCheckpoint *> & checkpoints,
+                              std::vector<float> & scores) override {
+    if (use_graph) { return false; }
+    return twpipe::Kiperwasser16Model::get_precomputed_scores(checkpoints, scores);
+  }
+};
+
+void build_alphabets() {
+  twpipe::AlphabetCollection * alphabets = twpipe::AlphabetCollection::get();
+  alphabets->word_map.insert(twpipe::Corpus::BAD0);
+  alphabets->word_map.insert(twpipe::Corpus::UNK);
+  alphabets->word_map.insert(twpipe::Corpus::ROOT);
+  alphabets->char_map.insert(twpipe::Corpus::BAD0);
+  alphabets->char_map.insert(twpipe::Corpus::UNK);
+  alphabets->char_map.insert(twpipe::Corpus::ROOT);
+  alphabets->pos_map.insert(twpipe::Corpus::ROOT);
+  for (unsigned i = 0; i < kWords; ++i) { alphabets->word_map.insert("w" + std::to_string(i)); }
+  for (unsigned i = 0; i < kPostags; ++i) { alphabets->pos_map.insert("p" + std::to_string(i)); }
+  for (unsigned i = 0; i < kDeprels; ++i) { alphabets->deprel_map.insert("r" + std::to_string(i)); }
+}
+
+void random_sentence(std::mt19937 & rng, twpipe::InputUnits & input) {
+  twpipe::AlphabetCollection * alphabets = twpipe::AlphabetCollection::get();
+  unsigned len = std::uniform_int_distribution<unsigned>(1, kMaxLength)(rng);
+  input.clear();
+
+  twpipe::InputUnit root;
+  root.wid = alphabets->word_map.get(twpipe::Corpus::ROOT);
+  root.aux_wid = root.wid;
+  root.pid = alphabets->pos_map.get(twpipe::Corpus::ROOT);
+  root.word = twpipe::Corpus::ROOT;
+  root.postag = twpipe::Corpus::ROOT;
+  input.push_back(root);
+
+  for (unsigned i = 0; i < len; ++i) {
+    twpipe::InputUnit unit;
+    unit.word = "w" + std::to_string(std::uniform_int_distribution<unsigned>(0, kWords - 1)(rng));
+    unit.wid = alphabets->word_map.get(unit.word);
+    unit.aux_wid = unit.wid;
+    unit.postag = "p" + std::to_string(std::uniform_int_distribution<unsigned>(0, kPostags - 1)(rng));
+    unit.pid = alphabets->pos_map.get(unit.postag);
+    input.push_back(unit);
+  }
+}
+
+twpipe::TransitionSystem * build_system(const std::string & system_name) {
+  if (system_name == "arcstd") { return new twpipe::ArcStandard(); }
+  if (system_name == "archybrid") { return new twpipe::ArcHybrid(); }
+  if (system_name == "arceager") { return new twpipe::ArcEager(); }
+  return new twpipe::Swap();
+}
+
+bool same_parse(const twpipe::ParseUnits & a, const twpipe::ParseUnits & b) {
+  bool same = (a.size() == b.size());
+  for (unsigned i = 0; same && i < a.size(); ++i) {
+    same = (a[i].head == b[i].head && a[i].deprel == b[i].deprel);
+  }
+  return same;
+}
+
+/// Walk the greedy path of the graph scores, compare the precomputed scores
+/// of the current state and of all the states visited so far in one batch.
+/// Return the largest difference.
+float compare_scores(SwitchedKiperwasser16Model & engine,
+                     const twpipe::InputUnits & input) {
+  dynet::ComputationGraph cg;
+  engine.new_graph(cg);
+  twpipe::TransitionSystem & sys = engine.sys;
+  twpipe::State state(input.size());
+  engine.reset_checkpoints();
+  twpipe::ParseModel::StateCheckpoint * checkpoint = engine.get_initial_checkpoint();
+  engine.initialize(cg, input, state, checkpoint);
+
+  std::vector<twpipe::ParseModel::StateCheckpoint *> visited;
+  float max_diff = 0.f;
+  while (true) {
+    visited.push_back(engine.copy_checkpoint(checkpoint));
+    for (const std::vector<twpipe::ParseModel::StateCheckpoint *> & batch :
+         { std::vector<twpipe::ParseModel::StateCheckpoint *>{ checkpoint }, visited }) {
+      std::vector<float> expected = dynet::as_vector(cg.get_value(engine.get_batch_scores(batch)));
+      std::vector<float> scores;
+      engine.get_precomputed_scores(batch, scores);
+      if (scores.size() != expected.size()) { return std::numeric_limits<float>::infinity(); }
+      for (unsigned i = 0; i < scores.size(); ++i) {
+        max_diff = std::max(max_diff, std::fabs(scores[i] - expected[i]) / std::max(1.f, std::fabs(expected[i])));
+      }
+    }
+    if (state.terminated()) { break; }
+
+    std::vector<float> scores = dynet::as_vector(cg.get_value(engine.get_scores(checkpoint)));
+    unsigned mask = sys.get_valid_structure_mask(state);
+    unsigned best_a = twpipe::ParseModel::get_best_action_masked(scores, sys.get_mask_penalty(mask)).first;
+    sys.perform_action(state, best_a);
+    engine.perform_action(best_a, state, cg, checkpoint);
+  }
+  return max_diff;
+}
+
+/// Return the number of sentences where the two ways of scoring disagree.
+unsigned compare(const po::variables_map & defaults,
+                 const std::string & system_name,
+                 std::mt19937 & rng) {
+  po::variables_map conf(defaults);
+  twpipe::ParseModelBuilder builder(conf);
+  twpipe::TransitionSystem * system = build_system(system_name);
+  unsigned embed_dim = twpipe::WordEmbedding::get()->dim();
+
+  dynet::ParameterCollection model;
+  SwitchedKiperwasser16Model engine(model, builder.word_size, builder.word_dim,
+                                    builder.pos_size, builder.pos_dim, embed_dim,
+                                    system->num_actions(), builder.n_layers,
+                                    builder.lstm_input_dim, builder.hidden_dim,
+                                    false, *system, twpipe::kStaticEmbeddings);
+
+  unsigned n_mismatch = 0;
+  for (unsigned n = 0; n < kSentences; ++n) {
+    twpipe::InputUnits input;
+    random_sentence(rng, input);
+
+    bool same = true;
+    float diff = compare_scores(engine, input);
+    if (!(diff <= kTolerance)) {
+      _ERROR << "[test|precompute] k16/" << system_name << " scores differ by " << diff
+        << " on sentence #" << n;
+      same = false;
+    }
+
+    twpipe::ParseUnits expected, output;
+    std::vector<twpipe::ParseUnits> expected_beam, output_beam;
+    for (bool use_graph : { true, false }) {
+      engine.use_graph = use_graph;
+      {
+        dynet::ComputationGraph cg;
+        engine.predict(cg, input, (use_graph ? expected : output));
+      }
+      {
+        dynet::ComputationGraph cg;
+        engine.beam_search(cg, input, kBeamSize, false, (use_graph ? expected_beam : output_beam));
+      }
+    }
+    if (!same_parse(expected, output)) {
+      _ERROR << "[test|precompute] k16/" << system_name << " greedy trees differ on sentence #" << n;
+      same = false;
+    }
+    bool same_beam = (expected_beam.size() == output_beam.size());
+    for (unsigned i = 0; same_beam && i < expected_beam.size(); ++i) {
+      same_beam = same_parse(expected_beam[i], output_beam[i]);
+    }
+    if (!same_beam) {
+      _ERROR << "[test|precompute] k16/" << system_name << " beam trees differ on sentence #" << n;
+      same = false;
+    }
+    if (!same) { n_mismatch++; }
+  }
+  _INFO << "[test|precompute] k16/" << system_name << ": "
+    << kSentences - n_mismatch << "/" << kSentences << " sentences agree.";
+  delete system;
+  return n_mismatch;
+}
+
+int main(int argc, char* argv[]) {
+  dynet::initialize(argc, argv);
+  twpipe::init_boost_log(false);
+
+  po::options_description cmd = twpipe::ParseModel::get_options();
+  po::variables_map defaults;
+  const char * no_args[] = { "test_precompute" };
+  po::store(po::parse_command_line(1, no_args, cmd), defaults);
+  po::notify(defaults);
+
+  build_alphabets();
+  twpipe::WordEmbedding::get()->empty(16);
+
+  std::mt19937 rng(1234);
+  unsigned n_mismatch = 0;
+  for (const char * system_name : { "arcstd", "archybrid", "arceager", "swap" }) {
+    n_mismatch += compare(defaults, system_name, rng);
+  }
+  if (n_mismatch > 0) {
+    std::cerr << n_mismatch << " sentences differ." << std::endl;
+    return 1;
+  }
+  return 0;
+}
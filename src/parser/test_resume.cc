@@ -0,0 +1,282 @@
+#include <iostream>
+#include <random>
+#include <cmath>
+#include <algorithm>
+#include <cstdio>
+#include "dynet/dynet.h"
+#include "twpipe/logging.h"
+#include "twpipe/embedding.h"
+#include "twpipe/alphabet_collection.h"
+#include "twpipe/corpus.h"
+#include "twpipe/model.h"
+#include "twpipe/trainer.h"
+#include "twpipe/checkpoint.h"
+#include "twpipe/optimizer_builder.h"
+#include "parser/parse_model.h"
+#include "parser/parse_model_builder.h"
+#include "parser/parser_trainer.h"
+#include <boost/program_options.hpp>
+
+namespace po = boost::program_options;
+
+/// Train a small parser with resumable checkpoints, interrupt it once at an
+/// iteration boundary and once in the middle of an iteration, resume it and
+/// check that the batches, their losses and the final parameters are those of
+/// the run that was not interrupted.
+
+const unsigned kWords = 30;
+const unsigned kChars = 10;
+const unsigned kPostags = 6;
+const unsigned kDeprels = 4;
+const unsigned kSentences = 12;
+const unsigned kMaxLength = 10;
+const unsigned kSeed = 1234;
+const char * kPrefix = "test_resume";
+const float kTolerance = 1e-5f;
+
+struct Interrupted {};
+
+struct Batch {
+  unsigned iter;
+  std::vector<unsigned> sids;
+  float loss;
+};
+
+/// Record the batches it trains, and stop the training by throwing before the
+/// interrupt_at-th batch (counted from 0, never if 0).
+struct RecordingTrainer : public twpipe::SupervisedTrainer {
+  std::vector<Batch> batches;
+  unsigned interrupt_at;
+
+  RecordingTrainer(twpipe::ParseModel & engine,
+                   twpipe::OptimizerBuilder & opt_builder,
+                   const po::variables_map & conf,
+                   unsigned interrupt_at) :
+    twpipe::SupervisedTrainer(engine, opt_builder, conf),
+    interrupt_at(interrupt_at) {
+  }
+
+  float train_batch(twpipe::Corpus & corpus,
+                    const std::vector<unsigned> & order,
+                    unsigned begin,
+                    unsigned end,
+                    twpipe::Noisifier & noisifier,
+                    dynet::Trainer * trainer,
+                    unsigned iter) override {
+    if (interrupt_at > 0 && batches.size() == interrupt_at) { throw Interrupted(); }
+    Batch batch;
+    batch.iter = iter;
+    batch.sids.assign(order.begin() + begin, order.begin() + end);
+    batch.loss = twpipe::SupervisedTrainer::train_batch(corpus, order, begin, end, noisifier, trainer, iter);
+    batches.push_back(batch);
+    return batch.loss;
+  }
+};
+
+void build_alphabets() {
+  twpipe::AlphabetCollection * alphabets = twpipe::AlphabetCollection::get();
+  alphabets->word_map.insert(twpipe::Corpus::BAD0);
+  alphabets->word_map.insert(twpipe::Corpus::UNK);
+  alphabets->word_map.insert(twpipe::Corpus::ROOT);
+  alphabets->char_map.insert(twpipe::Corpus::BAD0);
+  alphabets->char_map.insert(twpipe::Corpus::UNK);
+  alphabets->char_map.insert(twpipe::Corpus::ROOT);
+  alphabets->pos_map.insert(twpipe::Corpus::ROOT);
+  for (unsigned i = 0; i < kWords; ++i) { alphabets->word_map.insert("w" + std::to_string(i)); }
+  for (unsigned i = 0; i < kChars; ++i) { alphabets->char_map.insert("c" + std::to_string(i)); }
+  for (unsigned i = 0; i < kPostags; ++i) { alphabets->pos_map.insert("p" + std::to_string(i)); }
+  for (unsigned i = 0; i < kDeprels; ++i) { alphabets->deprel_map.insert("r" + std::to_string(i)); }
+}
+
+/// A random sentence of n - 1 words with a random projective tree whose root
+/// is attached to the pseudo root 0.
+void random_instance(std::mt19937 & rng, unsigned n, twpipe::Instance & inst) {
+  twpipe::AlphabetCollection * alphabets = twpipe::AlphabetCollection::get();
+  inst.input_units.clear();
+
+  twpipe::InputUnit root;
+  root.wid = alphabets->word_map.get(twpipe::Corpus::ROOT);
+  root.aux_wid = root.wid;
+  root.pid = alphabets->pos_map.get(twpipe::Corpus::ROOT);
+  root.cids.push_back(alphabets->char_map.get(twpipe::Corpus::ROOT));
+  root.word = twpipe::Corpus::ROOT;
+  root.postag = twpipe::Corpus::ROOT;
+  inst.input_units.push_back(root);
+
+  for (unsigned i = 1; i < n; ++i) {
+    twpipe::InputUnit unit;
+    unit.word = "w" + std::to_string(rng() % kWords);
+    unit.wid = alphabets->word_map.get(unit.word);
+    unit.aux_wid = unit.wid;
+    unit.postag = "p" + std::to_string(rng() % kPostags);
+    unit.pid = alphabets->pos_map.get(unit.postag);
+    unsigned n_chars = 1 + rng() % 4;
+    for (unsigned j = 0; j < n_chars; ++j) {
+      unit.cids.push_back(alphabets->char_map.get("c" + std::to_string(rng() % kChars)));
+    }
+    inst.input_units.push_back(unit);
+  }
+
+  std::vector<unsigned> heads(n, twpipe::Corpus::BAD_HED);
+  std::vector<unsigned> deprels(n, twpipe::Corpus::BAD_DEL);
+  std::vector<unsigned> stack;
+  unsigned next = 1;
+  while (next < n || stack.size() > 1) {
+    if (next < n && (stack.size() < 2 || rng() % 2)) { stack.push_back(next++); continue; }
+    unsigned s0 = stack.back(), s1 = stack[stack.size() - 2];
+    if (rng() % 2) {
+      heads[s1] = s0; stack.erase(stack.end() - 2);
+    } else {
+      heads[s0] = s1; stack.pop_back();
+    }
+  }
+  heads[stack[0]] = 0;
+  for (unsigned i = 1; i < n; ++i) { deprels[i] = rng() % kDeprels; }
+  twpipe::Corpus::vector_to_parse_units(heads, deprels, inst.parse_units);
+}
+
+po::variables_map parse_conf(const po::options_description & cmd, bool resume) {
+  std::vector<std::string> args = {
+    "--max-iter", "3",
+    "--batch-size", "2",
+    "--checkpoint-stops", "6",
+    "--parse-arch", "dyer15",
+    "--parse-system", "arcstd"
+  };
+  if (resume) { args.push_back("--resume"); }
+  po::variables_map conf;
+  po::store(po::command_line_parser(args).options(cmd).run(), conf);
+  po::notify(conf);
+  return conf;
+}
+
+/// Train from the initial parameters, or resume from the checkpoint when
+/// resume is set, and return the trained batches.
+std::vector<Batch> run(const po::options_description & cmd,
+                       twpipe::ParseModel & engine,
+                       const twpipe::ParameterSnapshot & initial,
+                       twpipe::Corpus & corpus,
+                       bool resume,
+                       unsigned interrupt_at) {
+  po::variables_map conf = parse_conf(cmd, resume);
+  if (!resume) {
+    initial.restore(engine.model);
+    dynet::rndeng->seed(kSeed);
+  }
+  twpipe::OptimizerBuilder opt_builder(conf);
+  RecordingTrainer trainer(engine, opt_builder, conf, interrupt_at);
+  try {
+    trainer.train(corpus);
+  } catch (const Interrupted &) {
+    _INFO << "[test|resume] interrupted after " << interrupt_at << " batches.";
+  }
+  twpipe::Model::get()->get_writer()->flush();
+  return trainer.batches;
+}
+
+bool close_enough(float a, float b) {
+  return std::fabs(a - b) <= kTolerance * std::max(1.f, std::fabs(a));
+}
+
+/// Return the number of batches where the resumed run differs from the
+/// expected one, and check the final parameters.
+unsigned compare(const std::vector<Batch> & expected,
+                 const std::vector<Batch> & interrupted,
+                 const std::vector<Batch> & resumed,
+                 const twpipe::ParameterSnapshot & expected_params,
+                 dynet::ParameterCollection & model,
+                 const std::string & name) {
+  std::vector<Batch> batches(interrupted);
+  batches.insert(batches.end(), resumed.begin(), resumed.end());
+  if (batches.size() != expected.size()) {
+    _ERROR << "[test|resume] " << name << ": " << batches.size() << " batches trained, "
+      << expected.size() << " expected.";
+    return 1;
+  }
+
+  unsigned n_errors = 0;
+  for (unsigned i = 0; i < batches.size(); ++i) {
+    if (batches[i].iter != expected[i].iter || batches[i].sids != expected[i].sids) {
+      _ERROR << "[test|resume] " << name << ": batch #" << i << " differs in its sentences.";
+      n_errors++;
+    } else if (!close_enough(batches[i].loss, expected[i].loss)) {
+      _ERROR << "[test|resume] " << name << ": loss of batch #" << i << " is " << batches[i].loss
+        << ", expected " << expected[i].loss;
+      n_errors++;
+    }
+  }
+
+  twpipe::ParameterSnapshot params;
+  params.take(model);
+  for (unsigned i = 0; i < params.values.size(); ++i) {
+    for (unsigned j = 0; j < params.values[i].size(); ++j) {
+      if (!close_enough(params.values[i][j], expected_params.values[i][j])) {
+        _ERROR << "[test|resume] " << name << ": parameter " << params.names[i] << " differs.";
+        n_errors++;
+        break;
+      }
+    }
+  }
+  _INFO << "[test|resume] " << name << ": " << batches.size() - n_errors << "/"
+    << batches.size() << " batches agree.";
+  return n_errors;
+}
+
+int main(int argc, char* argv[]) {
+  dynet::initialize(argc, argv);
+  twpipe::init_boost_log(false);
+
+  po::options_description cmd;
+  cmd.add(twpipe::Trainer::get_options())
+    .add(twpipe::ParseModel::get_options())
+    .add(twpipe::ParserTrainer::get_options())
+    .add(twpipe::SupervisedTrainer::get_options())
+    .add(twpipe::OptimizerBuilder::get_options());
+  po::variables_map defaults = parse_conf(cmd, false);
+
+  build_alphabets();
+  twpipe::WordEmbedding::get()->empty(16);
+
+  std::mt19937 rng(kSeed);
+  twpipe::Corpus corpus;
+  for (unsigned i = 0; i < kSentences; ++i) {
+    random_instance(rng, 2 + rng() % kMaxLength, corpus.training_data[i]);
+  }
+  corpus.n_train = kSentences;
+  corpus.n_devel = 0;
+
+  twpipe::ParseModelBuilder builder(defaults);
+  builder.embedding_type = twpipe::kStaticEmbeddings;
+  builder.embed_dim = twpipe::WordEmbedding::get()->dim();
+  dynet::ParameterCollection model;
+  twpipe::ParseModel * engine = builder.build(model);
+
+  twpipe::Model::get()->enable_checkpoint(kPrefix);
+  std::string resume_path = twpipe::Model::get()->resume_path(twpipe::Model::kParserName);
+
+  twpipe::ParameterSnapshot initial, expected_params;
+  initial.take(model);
+  std::vector<Batch> expected = run(cmd, *engine, initial, corpus, false, 0);
+  expected_params.take(model);
+
+  // with 12 sentences in batches of 2 and a checkpoint every 6 sentences, the
+  // 6th batch starts the second iteration and the 9th is in its middle.
+  unsigned n_errors = 0;
+  for (unsigned interrupt_at : { 6u, 9u }) {
+    std::remove(resume_path.c_str());
+    std::vector<Batch> interrupted = run(cmd, *engine, initial, corpus, false, interrupt_at);
+    std::vector<Batch> resumed = run(cmd, *engine, initial, corpus, true, 0);
+    n_errors += compare(expected, interrupted, resumed, expected_params, model,
+                        (interrupt_at == 6 ? "iteration boundary" : "middle of an iteration"));
+  }
+
+  std::remove(resume_path.c_str());
+  std::remove(twpipe::Model::get()->checkpoint_path(twpipe::Model::kParserName).c_str());
+  delete engine;
+  delete builder.system;
+  if (n_errors > 0) {
+    std::cerr << n_errors << " differences after resuming." << std::endl;
+    return 1;
+  }
+  return 0;
+}
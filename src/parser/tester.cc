@@ -2,6 +2,7 @@
 #include "twpipe/corpus.h"
 #include "twpipe/math.h"
 #include "twpipe/alphabet_collection.h"
+#include "twpipe/logging.h"
 
 namespace twpipe {
 
@@ -80,6 +81,7 @@ void VanillaTester::test(const std::vector<std::string> &words,
   engine->initialize_state(input, state);
 
   engine->new_graph(cg);
+  engine->reset_checkpoints();
   checkpoint = engine->get_initial_checkpoint();
   engine->initialize_parser(cg, input, checkpoint);
 
@@ -101,11 +103,45 @@ void VanillaTester::test(const std::vector<std::string> &words,
     n_actions++;
   }
 
-  delete checkpoint;
+  engine->destropy_checkpoint(checkpoint);
 }
 
-EnsembleTester::EnsembleTester(std::vector<ParseModel *> &engines) : engines(engines) {
+GraphFreeTester::GraphFreeTester(ParseModel *engine) :
+  engine(engine), n_sentences(0), n_mismatches(0) {
+
+}
+
+GraphFreeTester::~GraphFreeTester() {
+  _INFO << "[twpipe|parse|tester] graph-free output differs in " << n_mismatches
+    << " of " << n_sentences << " sentences.";
+}
+
+void GraphFreeTester::test(const std::vector<std::string> &words,
+                           const std::vector<std::string> &postags,
+                           const std::vector<unsigned> &heads,
+                           const std::vector<std::string> &deprels,
+                           const std::vector<unsigned> &actions,
+                           std::vector<std::vector<float>> &probs) {
+  probs.clear();
 
+  std::vector<unsigned> graph_heads, free_heads;
+  std::vector<std::string> graph_deprels, free_deprels;
+  bool graph_free = engine->graph_free;
+  engine->graph_free = false;
+  engine->predict(words, postags, graph_heads, graph_deprels);
+  engine->graph_free = true;
+  engine->predict(words, postags, free_heads, free_deprels);
+  engine->graph_free = graph_free;
+
+  if (graph_heads != free_heads || graph_deprels != free_deprels) {
+    _WARN << "[twpipe|parse|tester] graph-free output differs in sentence #" << n_sentences;
+    n_mismatches++;
+  }
+  n_sentences++;
+}
+
+EnsembleTester::EnsembleTester(std::vector<ParseModel *> &engines) : engines(engines) {
+  ParseModel::prepare_ensemble(engines);
 }
 
 void EnsembleTester::test(const std::vector<std::string> &words,
@@ -126,6 +162,7 @@ void EnsembleTester::test(const std::vector<std::string> &words,
   engines[0]->initialize_state(input, state);
   for (unsigned i = 0; i < n_engines; ++i) {
     engines[i]->new_graph(cg);
+    engines[i]->reset_checkpoints();
     checkpoints[i] = engines[i]->get_initial_checkpoint();
     engines[i]->initialize_parser(cg, input, checkpoints[i]);
   }
@@ -135,16 +172,8 @@ void EnsembleTester::test(const std::vector<std::string> &words,
 
   unsigned n_actions = 0;
   while (!state.terminated()) {
-    std::vector<float> ensemble_probs(system.num_actions(), 0.f);
-    for (unsigned i = 0; i < n_engines; ++i) {
-      dynet::Expression score_exprs = engines[i]->get_scores(checkpoints[i]);
-      std::vector<float> ensemble_score = dynet::as_vector(cg.get_value(score_exprs));
-      Math::softmax_inplace(ensemble_score);
-      for (unsigned c = 0; c < ensemble_score.size(); ++c) {
-        ensemble_probs[c] += ensemble_score[c];
-      }
-    }
-    for (auto & p : ensemble_probs) { p /= n_engines; }
+    std::vector<float> ensemble_probs;
+    ParseModel::get_ensemble_probs(cg, engines, checkpoints, ensemble_probs);
 
     unsigned action = actions[n_actions];
 
@@ -157,7 +186,7 @@ void EnsembleTester::test(const std::vector<std::string> &words,
     n_actions++;
   }
 
-  for (unsigned i = 0; i < n_engines; ++i) { delete checkpoints[i]; }
+  for (unsigned i = 0; i < n_engines; ++i) { engines[i]->destropy_checkpoint(checkpoints[i]); }
 }
 
 }
\ No newline at end of file
@@ -10,6 +10,8 @@ namespace po = boost::program_options;
 namespace twpipe {
 
 struct Tester {
+  virtual ~Tester() {}
+
   virtual void test(const std::vector<std::string> & words,
                     const std::vector<std::string> & postags,
                     const std::vector<unsigned> & heads,
@@ -44,6 +46,25 @@ struct VanillaTester: public Tester {
             std::vector<std::vector<float>> & prob) override ;
 };
 
+/// Parse with and without the computation graph and report the sentences
+/// where the two greedy outputs differ. No probabilities are produced.
+struct GraphFreeTester: public Tester {
+  ParseModel * engine;
+  unsigned n_sentences;
+  unsigned n_mismatches;
+
+  GraphFreeTester(ParseModel * engine);
+
+  ~GraphFreeTester();
+
+  void test(const std::vector<std::string> & words,
+            const std::vector<std::string> & postags,
+            const std::vector<unsigned> & heads,
+            const std::vector<std::string> & deprels,
+            const std::vector<unsigned> & actions,
+            std::vector<std::vector<float>> & prob) override ;
+};
+
 struct EnsembleTester: public Tester {
   std::vector<ParseModel *>& engines;
 
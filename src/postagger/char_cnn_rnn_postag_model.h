@@ -6,6 +6,7 @@
 #include "twpipe/alphabet_collection.h"
 #include "twpipe/embedding.h"
 #include "twpipe/elmo.h"
+#include "twpipe/rnn_kernel.h"
 #include "dynet/gru.h"
 #include "dynet/lstm.h"
 #include "dynet_layer/layer.h"
@@ -17,6 +18,7 @@ struct CharacterCNNRNNPostagModel : public PostagModel {
   const static char* name;
   Conv1dLayer char_cnn;
   BiRNNLayer<RNNBuilderType> word_rnn;
+  FusedBiRNN<RNNBuilderType> fused_word_rnn;
   SymbolEmbedding char_embed;
   SymbolEmbedding pos_embed;
   InputLayer embed_input;
@@ -110,7 +112,11 @@ struct CharacterCNNRNNPostagModel : public PostagModel {
         embed_input.get_output(embeddings[i]) });
     }
 
-    word_rnn.add_inputs(word_reprs);
+    if (fused_rnn) {
+      fused_word_rnn.add_inputs(word_rnn, word_reprs, int8_kernels);
+    } else {
+      word_rnn.add_inputs(word_reprs);
+    }
   }
 
   dynet::Expression get_emit_score(dynet::Expression & word_repr) override {
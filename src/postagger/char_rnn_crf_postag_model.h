@@ -9,6 +9,7 @@
 #include "dynet/gru.h"
 #include "dynet/lstm.h"
 #include "dynet_layer/layer.h"
+#include "twpipe/rnn_kernel.h"
 
 namespace twpipe {
 
@@ -17,7 +18,9 @@ struct CharacterRNNCRFPostagModel : public PostagModel {
   typedef std::vector<dynet::Expression> ExpressionRow;
   const static char* name;
   BiRNNLayer<RNNBuilderType> char_rnn;
+  FusedBiRNN<RNNBuilderType> fused_char_rnn;
   BiRNNLayer<RNNBuilderType> word_rnn;
+  FusedBiRNN<RNNBuilderType> fused_word_rnn;
   SymbolEmbedding char_embed;
   SymbolEmbedding pos_embed;
   SymbolEmbedding tran_embed;
@@ -114,12 +117,20 @@ struct CharacterRNNCRFPostagModel : public PostagModel {
       for (unsigned j = 0; j < n_chars; ++j) {
         char_exprs[j] = char_embed.embed(cids[j]);
       }
-      char_rnn.add_inputs(char_exprs);
+      if (fused_rnn) {
+        fused_char_rnn.add_inputs(char_rnn, char_exprs, int8_kernels);
+      } else {
+        char_rnn.add_inputs(char_exprs);
+      }
       auto payload = char_rnn.get_final();
       word_reprs[i] = dynet::concatenate({ payload.first, payload.second, embed_input.get_output(embeddings[i]) });
     }
 
-    word_rnn.add_inputs(word_reprs);
+    if (fused_rnn) {
+      fused_word_rnn.add_inputs(word_rnn, word_reprs, int8_kernels);
+    } else {
+      word_rnn.add_inputs(word_reprs);
+    }
   }
 
   dynet::Expression get_emit_score(dynet::Expression & word_repr) override {
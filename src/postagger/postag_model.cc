@@ -17,6 +17,7 @@ po::options_description PostagModel::get_options() {
     ("pos-cluster-n-layer", po::value<unsigned>()->default_value(1), "the number of layers for cluster-rnn.")
     ("pos-cluster-hidden-dim", po::value<unsigned>()->default_value(8), "the hidden dimension of cluster-nn.")
     ("pos-pos-dim", po::value<unsigned>()->default_value(16), "the dimension of postag.")
+    ("pos-fused-rnn", "Run the rnns with the fused inference kernels, for a loaded model.")
     ;
   return model_opts;
 }
@@ -25,7 +26,9 @@ PostagModel::PostagModel(dynet::ParameterCollection & model,
   EmbeddingType embedding_type) :
   model(model),
   pos_size(AlphabetCollection::get()->pos_map.size()),
-  embedding_type_(embedding_type) {
+  embedding_type_(embedding_type),
+  fused_rnn(false),
+  int8_kernels(false) {
 }
 
 void PostagModel::postag(const std::vector<std::string>& words) {
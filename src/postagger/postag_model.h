@@ -15,10 +15,19 @@ struct PostagModel {
   dynet::ParameterCollection & model;
   unsigned pos_size;
   EmbeddingType embedding_type_;
+  /// Run the bi-rnns with the fused cells of twpipe/rnn_kernel.h instead of
+  /// the computation graph. The weights are copied out on the first use, so
+  /// it is only for inference.
+  bool fused_rnn;
+  /// Keep the weights of the fused kernels in int8, set when the model file
+  /// is int8.
+  bool int8_kernels;
 
   PostagModel(dynet::ParameterCollection & model,
               EmbeddingType embedding_type = kStaticEmbeddings);
 
+  virtual ~PostagModel() {}
+
   virtual void new_graph(dynet::ComputationGraph & cg) = 0;
 
   virtual void decode(const std::vector<std::string> & words,
@@ -52,6 +52,7 @@ PostagModelBuilder::PostagModelBuilder(po::variables_map & conf) {
   cluster_hidden_dim = (conf.count("pos-cluster-hidden-dim") ? conf["pos-cluster-hidden-dim"].as<unsigned>() : 0);
   cluster_n_layers = (conf.count("pos-cluster-n-layer") ? conf["pos-cluster-n-layer"].as<unsigned>() : 0);
   pos_dim = (conf.count("pos-pos-dim") ? conf["pos-pos-dim"].as<unsigned>() : 0);
+  fused_rnn = (conf.count("pos-fused-rnn") > 0);
 }
 
 PostagModel * PostagModelBuilder::build(dynet::ParameterCollection & model) {
@@ -275,6 +276,9 @@ PostagModel * PostagModelBuilder::from_json(dynet::ParameterCollection & model)
 
   engine = build(model);
   globals->from_json(Model::kPostaggerName, model);
+  // the weights are final once loaded, so the fused kernels are safe.
+  engine->fused_rnn = fused_rnn;
+  engine->int8_kernels = (globals->get_precision() == "int8");
   
   return engine;
 }
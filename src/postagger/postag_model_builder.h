@@ -41,6 +41,7 @@ struct PostagModelBuilder {
   unsigned pos_size;
   unsigned pos_dim;
   unsigned embed_dim;
+  bool fused_rnn;
 
   PostagModelBuilder(po::variables_map & conf);
 
@@ -4,6 +4,12 @@
 #include "twpipe/alphabet_collection.h"
 #include "twpipe/embedding.h"
 #include "twpipe/elmo.h"
+#include "twpipe/parallel.h"
+#include "twpipe/checkpoint.h"
+#include <sstream>
+#ifndef _MSC_VER
+#include <unistd.h>
+#endif
 
 namespace twpipe {
 
@@ -25,45 +31,42 @@ void PostaggerTrainer::train(const Corpus & corpus) {
   _INFO << "[postag|train] size of dataset = " << corpus.n_train;
 
   std::vector<unsigned> order(corpus.n_train);
-  for (unsigned i = 0; i < corpus.n_train; ++i) { order[i] = i; }
+  std::vector<unsigned> lengths(corpus.n_train);
+  for (unsigned i = 0; i < corpus.n_train; ++i) {
+    order[i] = i;
+    lengths[i] = corpus.training_data.at(i).input_units.size();
+  }
 
   _INFO << "[postag|train] going to train " << max_iter << " iterations";
+  _INFO << "[postag|train] batch size = " << batch_size;
 
   dynet::Trainer * trainer = opt_builder.build(engine.model);
+  if (train_threads > 1) {
+    _INFO << "[postag|train] data-parallel training with " << train_threads
+      << " workers, averaging the parameters every " << sync_batches << " batches.";
+  }
   float best_acc = 0.f;
+  float best_acc_sample = 0.f;
   unsigned n_processed = 0;
 
   for (unsigned iter = 1; iter <= max_iter; ++iter) {
-    std::shuffle(order.begin(), order.end(), *dynet::rndeng);
+    shuffle(order, lengths);
     _INFO << "[postag|train] start training at " << iter << "-th iteration.";
 
     float loss = 0.f;
-    for (unsigned sid : order) {
-      const Instance & inst = corpus.training_data.at(sid);
+    if (train_threads > 1) {
+      loss = train_workers(corpus, order, iter, n_processed, best_acc, best_acc_sample, trainer);
+    } else {
+      unsigned cursor = 0;
+      while (cursor < order.size()) {
+        // train until the next evaluation stop or the end of the iteration.
+        unsigned n = n_until_evaluate(order.size() - cursor, n_processed);
+        loss += train_instances(corpus, order, cursor, cursor + n, trainer);
+        cursor += n;
+        n_processed += n;
 
-      {
-        dynet::ComputationGraph cg;
-        engine.new_graph(cg);
-        dynet::Expression loss_expr = engine.objective(inst);
-        if (lambda_ > 0) {
-          loss_expr = loss_expr + (0.5f * lambda_ * inst.input_units.size()) * engine.l2();
-        }
-        float l = dynet::as_scalar(cg.forward(loss_expr));
-        cg.backward(loss_expr);
-        loss += l;
-        trainer->update();
-        n_processed++;
-      }
-      if (need_evaluate(iter, n_processed)) {
-        float acc = evaluate(corpus);
-        float prop = static_cast<float>(n_processed) / order.size();
-        if (acc > best_acc) {
-          _INFO << "[postag|train] " << prop << "% trained, ACC on heldout = " << acc
-              << ", new best achieved, saved.";
-          best_acc = acc;
-          Model::get()->to_json(Model::kPostaggerName, engine.model);
-        } else {
-          _INFO << "[postag|train] " << prop << "% trained, ACC on heldout = " << acc;
+        if (need_evaluate(iter, n_processed)) {
+          evaluate_stop(corpus, static_cast<float>(cursor) / order.size(), best_acc, best_acc_sample);
         }
       }
     }
@@ -74,7 +77,7 @@ void PostaggerTrainer::train(const Corpus & corpus) {
         best_acc = acc;
         _INFO << "[postag|train] end of iter #" << iter << ", ACC on heldout = " << acc
           << ", new best achieved, saved.";
-        Model::get()->to_json(Model::kPostaggerName, engine.model);
+        Model::get()->snapshot(Model::kPostaggerName, engine.model);
       } else {
         _INFO << "[postag|train] end of iter #" << iter << ", ACC on heldout = " << acc;
       }
@@ -86,9 +89,234 @@ void PostaggerTrainer::train(const Corpus & corpus) {
   delete trainer;
 }
 
-float PostaggerTrainer::evaluate(const Corpus & corpus) {
-  float n_recall = 0, n_total = 0;
-  for (unsigned sid = 0; sid < corpus.n_devel; ++sid) {
+void PostaggerTrainer::evaluate_stop(const Corpus & corpus,
+                                     float prop,
+                                     float & best_acc,
+                                     float & best_acc_sample) {
+  float acc = evaluate(corpus, false);
+  if (is_sampled(corpus.n_devel)) {
+    // scores on the subsample are not comparable with those of the full
+    // evaluations, track their best apart and leave the snapshot to the latter.
+    if (acc > best_acc_sample) {
+      best_acc_sample = acc;
+      _INFO << "[postag|train] " << prop << "% trained, ACC on heldout sample = " << acc
+        << ", new best on the sample.";
+    } else {
+      _INFO << "[postag|train] " << prop << "% trained, ACC on heldout sample = " << acc;
+    }
+  } else if (acc > best_acc) {
+    _INFO << "[postag|train] " << prop << "% trained, ACC on heldout = " << acc
+        << ", new best achieved, saved.";
+    best_acc = acc;
+    Model::get()->snapshot(Model::kPostaggerName, engine.model);
+  } else {
+    _INFO << "[postag|train] " << prop << "% trained, ACC on heldout = " << acc;
+  }
+}
+
+float PostaggerTrainer::train_instances(const Corpus & corpus,
+                                        const std::vector<unsigned> & order,
+                                        unsigned begin,
+                                        unsigned end,
+                                        dynet::Trainer * trainer) {
+  float loss = 0.f;
+  for (unsigned i = begin; i < end; i += batch_size) {
+    loss += backward_batch(corpus, order, i, std::min(i + batch_size, end));
+    trainer->update();
+  }
+  return loss;
+}
+
+static bool send_parameters(int fd, const ParameterSnapshot & params) {
+  for (const std::vector<float> & values : params.values) {
+    if (!Parallel::write_all(fd, values.data(), values.size() * sizeof(float))) { return false; }
+  }
+  return true;
+}
+
+/// params should already hold the layout of the collection, see take().
+static bool receive_parameters(int fd, ParameterSnapshot & params) {
+  for (std::vector<float> & values : params.values) {
+    if (!Parallel::read_all(fd, values.data(), values.size() * sizeof(float))) { return false; }
+  }
+  return true;
+}
+
+float PostaggerTrainer::train_workers(const Corpus & corpus,
+                                      const std::vector<unsigned> & order,
+                                      unsigned iter,
+                                      unsigned & n_processed,
+                                      float & best_acc,
+                                      float & best_acc_sample,
+                                      dynet::Trainer * trainer) {
+  const unsigned kStop = 0, kContinue = 1;
+  // Seeds are drawn in the parent so the run is reproducible under --dynet-seed.
+  std::vector<unsigned> seeds(train_threads);
+  for (unsigned wid = 0; wid < train_threads; ++wid) { seeds[wid] = (*dynet::rndeng)(); }
+
+  std::vector<int> pids, in_fds, out_fds;
+  Parallel::spawn(train_threads, [&](unsigned wid, int in_fd, int out_fd) {
+    dynet::rndeng->seed(seeds[wid]);
+    std::pair<unsigned, unsigned> range = Parallel::shard(order.size(), train_threads, wid);
+    ParameterSnapshot params;
+    params.take(engine.model);
+
+    unsigned cursor = range.first;
+    while (true) {
+      unsigned n = 0;
+      float loss = 0.f;
+      for (unsigned b = 0; b < sync_batches && cursor < range.second; ++b) {
+        unsigned end = std::min(cursor + batch_size, range.second);
+        loss += backward_batch(corpus, order, cursor, end);
+        trainer->update();
+        n += end - cursor;
+        cursor = end;
+      }
+      if (!Parallel::write_all(out_fd, &n, sizeof(unsigned)) ||
+          !Parallel::write_all(out_fd, &loss, sizeof(float))) { return false; }
+      if (n > 0) {
+        params.take(engine.model);
+        if (!send_parameters(out_fd, params)) { return false; }
+      }
+
+      unsigned command = kStop;
+      if (!Parallel::read_all(in_fd, &command, sizeof(unsigned))) { return false; }
+      if (command == kStop) { break; }
+      if (!receive_parameters(in_fd, params)) { return false; }
+      params.restore(engine.model);
+    }
+
+    if (wid == 0) {
+      // hand the optimizer state over to the parent, the workers of the next
+      // iteration start from it.
+      std::ostringstream oss;
+      trainer->save(oss);
+      std::string state = oss.str();
+      unsigned len = state.size();
+      if (!Parallel::write_all(out_fd, &len, sizeof(unsigned)) ||
+          !Parallel::write_all(out_fd, state.data(), len)) { return false; }
+    }
+    return true;
+  }, pids, in_fds, out_fds);
+
+  std::vector<unsigned> n_rest(train_threads);
+  for (unsigned wid = 0; wid < train_threads; ++wid) {
+    std::pair<unsigned, unsigned> range = Parallel::shard(order.size(), train_threads, wid);
+    n_rest[wid] = range.second - range.first;
+  }
+
+  ParameterSnapshot average, received;
+  average.take(engine.model);
+  received.take(engine.model);
+
+  float loss = 0.f;
+  unsigned n_trained = 0;
+  bool failed = false;
+  while (!failed) {
+    // the parameters of the workers that trained in this round are averaged,
+    // those which are done only wait for the others.
+    unsigned n_before = n_processed;
+    unsigned n_averaged = 0;
+    for (unsigned wid = 0; wid < train_threads && !failed; ++wid) {
+      unsigned n = 0;
+      float l = 0.f;
+      if (!Parallel::read_all(out_fds[wid], &n, sizeof(unsigned)) ||
+          !Parallel::read_all(out_fds[wid], &l, sizeof(float)) ||
+          n > n_rest[wid] ||
+          (n > 0 && !receive_parameters(out_fds[wid], received))) {
+        _ERROR << "[postag|train] training worker #" << wid << " failed.";
+        failed = true;
+        break;
+      }
+      loss += l;
+      n_rest[wid] -= n;
+      n_processed += n;
+      n_trained += n;
+      if (n == 0) { continue; }
+      for (unsigned i = 0; i < average.values.size(); ++i) {
+        std::vector<float> & dst = average.values[i];
+        const std::vector<float> & src = received.values[i];
+        if (n_averaged == 0) {
+          dst = src;
+        } else {
+          for (unsigned j = 0; j < dst.size(); ++j) { dst[j] += src[j]; }
+        }
+      }
+      ++n_averaged;
+    }
+    if (failed) { break; }
+
+    if (n_averaged > 1) {
+      for (std::vector<float> & values : average.values) {
+        for (float & v : values) { v /= n_averaged; }
+      }
+    }
+    if (n_averaged > 0) { average.restore(engine.model); }
+
+    bool done = (n_trained == order.size());
+    unsigned command = (done ? kStop : kContinue);
+    for (unsigned wid = 0; wid < train_threads; ++wid) {
+      if (!Parallel::write_all(in_fds[wid], &command, sizeof(unsigned)) ||
+          (!done && !send_parameters(in_fds[wid], average))) {
+        _ERROR << "[postag|train] training worker #" << wid << " failed.";
+        failed = true;
+        break;
+      }
+    }
+    // the workers go on with the next round while the parent evaluates.
+    if (!failed && need_evaluate(iter, n_before, n_processed)) {
+      evaluate_stop(corpus, static_cast<float>(n_trained) / order.size(), best_acc, best_acc_sample);
+    }
+    if (done) { break; }
+  }
+
+  if (!failed) {
+    unsigned len = 0;
+    std::string state;
+    if (Parallel::read_all(out_fds[0], &len, sizeof(unsigned))) {
+      state.resize(len);
+      if (len > 0 && !Parallel::read_all(out_fds[0], &state[0], len)) { failed = true; }
+    } else {
+      failed = true;
+    }
+    if (!failed) {
+      std::istringstream iss(state);
+      trainer->populate(iss);
+    }
+  }
+  for (int fd : in_fds) { close(fd); }
+  for (int fd : out_fds) { close(fd); }
+  if (!Parallel::join(pids) || failed) {
+    _ERROR << "[postag|train] training worker failed.";
+    exit(1);
+  }
+  return loss;
+}
+
+float PostaggerTrainer::backward_batch(const Corpus & corpus,
+                                       const std::vector<unsigned> & order,
+                                       unsigned begin,
+                                       unsigned end) {
+  dynet::ComputationGraph cg;
+  engine.new_graph(cg);
+  std::vector<dynet::Expression> losses;
+  unsigned n_units = 0;
+  for (unsigned j = begin; j < end; ++j) {
+    const Instance & inst = corpus.training_data.at(order[j]);
+    losses.push_back(engine.objective(inst));
+    n_units += inst.input_units.size();
+  }
+  dynet::Expression loss_expr = dynet::sum(losses);
+  if (lambda_ > 0) {
+    loss_expr = loss_expr + (0.5f * lambda_ * n_units) * engine.l2();
+  }
+  float l = dynet::as_scalar(cg.forward(loss_expr));
+  cg.backward(loss_expr);
+  return l;
+}
+
+float PostaggerTrainer::evaluate(const Corpus & corpus, bool full) {
+  std::vector<float> counts = evaluate_counts(corpus.n_devel, full, [&](unsigned sid) {
     const Instance & inst = corpus.devel_data.at(sid);
 
     dynet::ComputationGraph cg;
@@ -97,19 +325,16 @@ float PostaggerTrainer::evaluate(const Corpus & corpus) {
     unsigned len = inst.input_units.size();
     std::vector<std::string> words(len - 1);
     std::vector<std::string> gold_postags(len - 1), pred_postags;
-    std::vector<std::vector<float>> values;
     for (unsigned i = 1; i < inst.input_units.size(); ++i) {
       words[i - 1] = inst.input_units[i].word;
       gold_postags[i - 1] = inst.input_units[i].postag;
     }
     engine.decode(words, pred_postags);
     auto payload = engine.evaluate(gold_postags, pred_postags);
+    return std::vector<float>{ payload.first, payload.second };
+  });
 
-    n_recall += payload.first;
-    n_total += payload.second;
-  }
-
-  return n_recall / n_total;
+  return (counts.size() < 2 ? 0.f : counts[0] / counts[1]);
 }
 
 PostaggerEnsembleTrainer::PostaggerEnsembleTrainer(PostagModel & engine, 
@@ -127,21 +352,22 @@ po::options_description PostaggerEnsembleTrainer::get_options() {
 }
 
 void PostaggerEnsembleTrainer::train(Corpus & corpus,
-                                     EnsembleInstances & ensemble_instances) {
+                                     EnsembleData & ensemble_data) {
   _INFO << "[postag|ensemble|train] start postagger supervised training.";
 
   dynet::ParameterCollection & model = engine.model;
   dynet::Trainer * trainer = opt_builder.build(model);
 
   std::vector<unsigned> order;
-  for (unsigned i = 0; i < ensemble_instances.size(); ++i) {
-    unsigned id = ensemble_instances[i].id;
+  for (unsigned i = 0; i < ensemble_data.size(); ++i) {
+    unsigned id = ensemble_data.id(i);
     if (corpus.training_data.count(id) == 0) { continue; }
     order.push_back(i);
   }
 
   float llh = 0.f;
   float best_acc = -1.f;
+  float best_acc_sample = -1.f;
   unsigned n_processed = 0;
 
   _INFO << "[postag|ensemble|train] will stop after " << max_iter << " iterations.";
@@ -150,7 +376,7 @@ void PostaggerEnsembleTrainer::train(Corpus & corpus,
     std::shuffle(order.begin(), order.end(), (*dynet::rndeng));
 
     for (unsigned id : order) {
-      const EnsembleInstance & inst = ensemble_instances.at(id);
+      const EnsembleInstance & inst = ensemble_data.get(id);
       unsigned sid = inst.id;
       InputUnits & units = corpus.training_data.at(sid).input_units;
 
@@ -196,13 +422,23 @@ void PostaggerEnsembleTrainer::train(Corpus & corpus,
       }
 
       if (need_evaluate(iter, n_processed)) {
-        float acc = evaluate(corpus);
+        float acc = evaluate(corpus, false);
         float prop = static_cast<float>(n_processed) / order.size();
-        if (acc > best_acc) {
+        if (is_sampled(corpus.n_devel)) {
+          // scores on the subsample are not comparable with those of the full
+          // evaluations, track their best apart and leave the snapshot to the latter.
+          if (acc > best_acc_sample) {
+            best_acc_sample = acc;
+            _INFO << "[postag|ensemble|train] " << prop << "% trained, ACC on heldout sample = " << acc
+              << ", new best on the sample.";
+          } else {
+            _INFO << "[postag|ensemble|train] " << prop << "% trained, ACC on heldout sample = " << acc;
+          }
+        } else if (acc > best_acc) {
           _INFO << "[postag|ensemble|train] " << prop << "% trained, ACC on heldout = " << acc
             << ", new best achieved, saved.";
           best_acc = acc;
-          Model::get()->to_json(Model::kPostaggerName, engine.model);
+          Model::get()->snapshot(Model::kPostaggerName, engine.model);
         } else {
           _INFO << "[postag|ensemble|train] " << prop << "% trained, ACC on heldout = " << acc;
         }
@@ -215,7 +451,7 @@ void PostaggerEnsembleTrainer::train(Corpus & corpus,
         best_acc = acc;
         _INFO << "[postag|train] end of iter #" << iter << ", ACC on heldout = " << acc <<
           ", new best achieved, saved.";
-        Model::get()->to_json(Model::kPostaggerName, engine.model);
+        Model::get()->snapshot(Model::kPostaggerName, engine.model);
       } else {
         _INFO << "[postag|train] end of iter #" << iter << ", ACC on heldout = " << acc;
       }
@@ -24,7 +24,43 @@ struct PostaggerTrainer : public Trainer {
 
   void train(const Corpus & corpus);
 
-  float evaluate(const Corpus & corpus);
+  /// Train on order[begin, end) in this process, return the summed loss.
+  float train_instances(const Corpus & corpus,
+                        const std::vector<unsigned> & order,
+                        unsigned begin,
+                        unsigned end,
+                        dynet::Trainer * trainer);
+
+  /// Train one iteration over order with train_threads workers. The workers
+  /// are forked once per iteration, each trains a contiguous shard of the
+  /// order with its own seed and its own copy of the parameters and the
+  /// optimizer, and every sync_batches batches the parameters of the workers
+  /// are averaged here and sent back. The evaluation stops fall on these
+  /// averagings. Return the summed loss.
+  float train_workers(const Corpus & corpus,
+                      const std::vector<unsigned> & order,
+                      unsigned iter,
+                      unsigned & n_processed,
+                      float & best_acc,
+                      float & best_acc_sample,
+                      dynet::Trainer * trainer);
+
+  /// Evaluate on the heldout subsample at an evaluation stop, prop of the
+  /// iteration trained, and save the model on a new best full evaluation.
+  void evaluate_stop(const Corpus & corpus,
+                     float prop,
+                     float & best_acc,
+                     float & best_acc_sample);
+
+  /// Forward and backward order[begin, end) in one graph, return the loss.
+  float backward_batch(const Corpus & corpus,
+                       const std::vector<unsigned> & order,
+                       unsigned begin,
+                       unsigned end);
+
+  /// Return the tagging accuracy on the heldout data, or on its subsample
+  /// when full is not set.
+  float evaluate(const Corpus & corpus, bool full = true);
 };
 
 struct PostaggerEnsembleTrainer : public PostaggerTrainer {
@@ -34,7 +70,7 @@ struct PostaggerEnsembleTrainer : public PostaggerTrainer {
 
   static po::options_description get_options();
 
-  void train(Corpus & corpus, EnsembleInstances & ensemble_instances);
+  void train(Corpus & corpus, EnsembleData & ensemble_data);
 };
 
 }
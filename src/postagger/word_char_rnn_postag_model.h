@@ -6,6 +6,7 @@
 #include "twpipe/alphabet_collection.h"
 #include "twpipe/embedding.h"
 #include "twpipe/elmo.h"
+#include "twpipe/rnn_kernel.h"
 #include "dynet/gru.h"
 #include "dynet/lstm.h"
 #include "dynet_layer/layer.h"
@@ -16,7 +17,9 @@ template <class RNNBuilderType>
 struct WordCharacterRNNPostagModel : public PostagModel {
   const static char* name;
   BiRNNLayer<RNNBuilderType> char_rnn;
+  FusedBiRNN<RNNBuilderType> fused_char_rnn;
   BiRNNLayer<RNNBuilderType> word_rnn;
+  FusedBiRNN<RNNBuilderType> fused_word_rnn;
   SymbolEmbedding char_embed;
   SymbolEmbedding word_embed;
   SymbolEmbedding pos_embed;
@@ -125,7 +128,11 @@ struct WordCharacterRNNPostagModel : public PostagModel {
       for (unsigned j = 0; j < n_chars; ++j) {
         char_exprs[j] = char_embed.embed(cids[j]);
       }
-      char_rnn.add_inputs(char_exprs);
+      if (fused_rnn) {
+        fused_char_rnn.add_inputs(char_rnn, char_exprs, int8_kernels);
+      } else {
+        char_rnn.add_inputs(char_exprs);
+      }
       auto payload = char_rnn.get_final();
       word_reprs[i] = dynet::concatenate({
         payload.first,
@@ -135,7 +142,11 @@ struct WordCharacterRNNPostagModel : public PostagModel {
       });
     }
 
-    word_rnn.add_inputs(word_reprs);
+    if (fused_rnn) {
+      fused_word_rnn.add_inputs(word_rnn, word_reprs, int8_kernels);
+    } else {
+      word_rnn.add_inputs(word_reprs);
+    }
   }
   
   dynet::Expression get_emit_score(dynet::Expression & feature) override {
@@ -6,6 +6,7 @@
 #include "twpipe/alphabet_collection.h"
 #include "twpipe/embedding.h"
 #include "twpipe/elmo.h"
+#include "twpipe/rnn_kernel.h"
 #include "dynet/gru.h"
 #include "dynet/lstm.h"
 #include "dynet_layer/layer.h"
@@ -16,6 +17,7 @@ template <class RNNBuilderType>
 struct WordRNNPostagModel : public PostagModel {
   const static char* name;
   BiRNNLayer<RNNBuilderType> word_rnn;
+  FusedBiRNN<RNNBuilderType> fused_word_rnn;
   SymbolEmbedding word_embed;
   SymbolEmbedding pos_embed;
   InputLayer embed_input;
@@ -91,7 +93,11 @@ struct WordRNNPostagModel : public PostagModel {
       });
     }
 
-    word_rnn.add_inputs(word_reprs);
+    if (fused_rnn) {
+      fused_word_rnn.add_inputs(word_rnn, word_reprs, int8_kernels);
+    } else {
+      word_rnn.add_inputs(word_reprs);
+    }
   }
   
   dynet::Expression get_emit_score(dynet::Expression & feature) override {
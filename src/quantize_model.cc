@@ -0,0 +1,218 @@
+#include <iostream>
+#include <fstream>
+#include <map>
+#include <boost/program_options.hpp>
+#include "tokenizer/tokenize_model.h"
+#include "tokenizer/tokenize_model_builder.h"
+#include "postagger/postag_model.h"
+#include "postagger/postag_model_builder.h"
+#include "parser/parse_model.h"
+#include "parser/parse_model_builder.h"
+#include "twpipe/logging.h"
+#include "twpipe/alphabet_collection.h"
+#include "twpipe/corpus.h"
+#include "twpipe/model.h"
+#include "twpipe/elmo.h"
+#include "twpipe/embedding.h"
+
+namespace po = boost::program_options;
+
+void init_command_line(int argc, char* argv[], po::variables_map& conf) {
+  po::options_description generic_opts("Generic options");
+  generic_opts.add_options()
+    ("verbose,v", "Details logging.")
+    ("help,h", "show help information.")
+    ("output", po::value<std::string>(), "the path to the quantized model.")
+    ("precision", po::value<std::string>()->default_value("int8"), "the precision of the weights [int8|fp16].")
+    ("heldout", po::value<std::string>(), "the path to the heldout data, used to report the loss of accuracy.")
+    ;
+
+  po::options_description model_opts = twpipe::Model::get_options();
+  po::options_description embed_opts = twpipe::WordEmbedding::get_options();
+  po::options_description elmo_opts = twpipe::ELMo::get_options();
+  po::options_description tokenizer_opts = twpipe::AbstractTokenizeModel::get_options();
+  po::options_description postagger_opts = twpipe::PostagModel::get_options();
+  po::options_description parser_opts = twpipe::ParseModel::get_options();
+
+  po::options_description cmd("Usage: ./quantize_model --model [model] --output [output] [--heldout heldout]");
+  cmd.add(generic_opts)
+    .add(model_opts)
+    .add(elmo_opts)
+    .add(embed_opts)
+    .add(tokenizer_opts)
+    .add(postagger_opts)
+    .add(parser_opts)
+    ;
+
+  po::store(po::parse_command_line(argc, argv, cmd), conf);
+  po::notify(conf);
+
+  if (conf.count("help")) {
+    std::cerr << cmd << std::endl;
+    exit(1);
+  }
+  twpipe::init_boost_log(conf.count("verbose") > 0);
+
+  if (!conf.count("model") || !conf.count("output")) {
+    std::cerr << "Please specify the model and the output." << std::endl;
+    exit(1);
+  }
+}
+
+float evaluate_tokenizer(twpipe::AbstractTokenizeModel * engine,
+                         const twpipe::Corpus & corpus) {
+  float n_recall = 0.f, n_pred = 0.f, n_gold = 0.f;
+  for (unsigned sid = 0; sid < corpus.n_devel; ++sid) {
+    auto payload = engine->evaluate(corpus.devel_data.at(sid));
+    n_recall += std::get<0>(payload);
+    n_pred += std::get<1>(payload);
+    n_gold += std::get<2>(payload);
+  }
+  float p = n_recall / n_gold;
+  float r = n_recall / n_pred;
+  return 2 * p * r / (p + r);
+}
+
+float evaluate_postagger(twpipe::PostagModel * engine,
+                         const twpipe::Corpus & corpus) {
+  float n_recall = 0.f, n_total = 0.f;
+  for (unsigned sid = 0; sid < corpus.n_devel; ++sid) {
+    const twpipe::Instance & inst = corpus.devel_data.at(sid);
+    unsigned len = inst.input_units.size();
+    std::vector<std::string> words(len - 1), gold_postags(len - 1), pred_postags;
+    for (unsigned i = 1; i < len; ++i) {
+      words[i - 1] = inst.input_units[i].word;
+      gold_postags[i - 1] = inst.input_units[i].postag;
+    }
+    engine->postag(words, pred_postags);
+    auto payload = engine->evaluate(gold_postags, pred_postags);
+    n_recall += payload.first;
+    n_total += payload.second;
+  }
+  return n_recall / n_total;
+}
+
+float evaluate_parser(twpipe::ParseModel * engine,
+                      const twpipe::Corpus & corpus) {
+  float n_recall = 0.f, n_total = 0.f;
+  for (unsigned sid = 0; sid < corpus.n_devel; ++sid) {
+    const twpipe::Instance & inst = corpus.devel_data.at(sid);
+    unsigned len = inst.input_units.size();
+    std::vector<std::string> words(len - 1), postags(len - 1), pred_deprels;
+    std::vector<unsigned> pred_heads;
+    for (unsigned i = 1; i < len; ++i) {
+      words[i - 1] = inst.input_units[i].word;
+      postags[i - 1] = inst.input_units[i].postag;
+    }
+    engine->predict(words, postags, pred_heads, pred_deprels);
+    for (unsigned i = 1; i < len; ++i) {
+      if (pred_heads[i - 1] == inst.parse_units[i].head &&
+          pred_deprels[i - 1] == twpipe::AlphabetCollection::get()->deprel_map.get(inst.parse_units[i].deprel)) {
+        n_recall += 1.f;
+      }
+      n_total += 1.f;
+    }
+  }
+  return n_recall / n_total;
+}
+
+/// Load each phase in the model file, evaluate it on the heldout data and
+/// quantize it if quantize is set. The scores are keyed by the phase name.
+void process(po::variables_map & conf,
+             const twpipe::Corpus & corpus,
+             bool quantize,
+             const std::string & precision,
+             std::map<std::string, float> & scores) {
+  twpipe::Model * globals = twpipe::Model::get();
+  bool has_heldout = (corpus.n_devel > 0);
+
+  if (globals->has_tokenizer_model()) {
+    dynet::ParameterCollection model;
+    twpipe::TokenizeModelBuilder builder(conf);
+    twpipe::TokenizeModel * engine = builder.from_json(model);
+    if (has_heldout) { scores[twpipe::Model::kTokenizerName] = evaluate_tokenizer(engine, corpus); }
+    if (quantize) { globals->quantize(twpipe::Model::kTokenizerName, model, precision); }
+    delete engine;
+  }
+  if (globals->has_segmentor_and_tokenizer_model()) {
+    dynet::ParameterCollection model;
+    twpipe::SentenceSegmentAndTokenizeModelBuilder builder(conf);
+    twpipe::SentenceSegmentAndTokenizeModel * engine = builder.from_json(model);
+    if (has_heldout) { scores[twpipe::Model::kSentenceSegmentAndTokenizeName] = evaluate_tokenizer(engine, corpus); }
+    if (quantize) { globals->quantize(twpipe::Model::kSentenceSegmentAndTokenizeName, model, precision); }
+    delete engine;
+  }
+  if (globals->has_postagger_model()) {
+    dynet::ParameterCollection model;
+    twpipe::PostagModelBuilder builder(conf);
+    twpipe::PostagModel * engine = builder.from_json(model);
+    if (has_heldout) { scores[twpipe::Model::kPostaggerName] = evaluate_postagger(engine, corpus); }
+    if (quantize) { globals->quantize(twpipe::Model::kPostaggerName, model, precision); }
+    delete engine;
+  }
+  if (globals->has_parser_model()) {
+    dynet::ParameterCollection model;
+    twpipe::ParseModelBuilder builder(conf);
+    twpipe::ParseModel * engine = builder.from_json(model);
+    if (has_heldout) { scores[twpipe::Model::kParserName] = evaluate_parser(engine, corpus); }
+    if (quantize) { globals->quantize(twpipe::Model::kParserName, model, precision); }
+    delete engine;
+    delete builder.system;
+  }
+}
+
+int main(int argc, char* argv[]) {
+  dynet::initialize(argc, argv);
+
+  po::variables_map conf;
+  init_command_line(argc, argv, conf);
+
+  if (conf.count("embedding")) {
+    twpipe::WordEmbedding::get()->load(conf["embedding"].as<std::string>(),
+                                       conf["embedding-dim"].as<unsigned>(),
+                                       conf.count("embedding-fp16") > 0);
+  } else {
+    twpipe::WordEmbedding::get()->empty(conf["embedding-dim"].as<unsigned>());
+  }
+
+  if (conf.count("elmo")) {
+    twpipe::ELMo::get()->load(conf["elmo"].as<std::string>(),
+                              conf["elmo-dim"].as<unsigned>(),
+                              conf.count("elmo-fp16") > 0);
+  } else {
+    twpipe::ELMo::get()->empty(conf["elmo-dim"].as<unsigned>());
+  }
+
+  std::string precision = conf["precision"].as<std::string>();
+  if (precision != "int8" && precision != "fp16") {
+    _ERROR << "[quantize] unknown precision: " << precision;
+    exit(1);
+  }
+
+  twpipe::Model::get()->load(conf["model"].as<std::string>());
+  twpipe::AlphabetCollection::get()->from_json();
+
+  twpipe::Corpus corpus;
+  if (conf.count("heldout")) {
+    corpus.load_devel_data(conf["heldout"].as<std::string>());
+  }
+
+  std::map<std::string, float> before, after;
+  process(conf, corpus, true, precision, before);
+  _INFO << "[quantize] weights are stored in " << precision;
+  if (corpus.n_devel > 0) {
+    // load the phases again, this time from the quantized weights.
+    process(conf, corpus, false, precision, after);
+    for (auto & it : before) {
+      float score = after[it.first];
+      _INFO << "[quantize] " << it.first << " ("
+        << (it.first == twpipe::Model::kPostaggerName ? "UPOS" :
+            (it.first == twpipe::Model::kParserName ? "LAS" : "token F1"))
+        << "): " << it.second << " -> " << score << ", delta = " << score - it.second;
+    }
+  }
+
+  twpipe::Model::get()->save(conf["output"].as<std::string>());
+  _INFO << "[quantize] model saved to " << conf["output"].as<std::string>();
+  return 0;
+}
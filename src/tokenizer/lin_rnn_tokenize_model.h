@@ -7,6 +7,7 @@
 #include "dynet_layer/layer.h"
 #include "twpipe/logging.h"
 #include "twpipe/alphabet_collection.h"
+#include "twpipe/rnn_kernel.h"
 #include "tokenize_model.h"
 
 namespace twpipe {
@@ -40,6 +41,7 @@ struct LinearRNNTokenizeModel : public LinearTokenizeModel {
   const static char* name;
 
   BiRNNLayer<RNNBuilderType> bi_rnn;
+  FusedBiRNN<RNNBuilderType> fused_bi_rnn;
   SymbolEmbedding char_embed;
   SymbolEmbedding char_category_embed;
   Merge2Layer merge;
@@ -88,7 +90,11 @@ struct LinearRNNTokenizeModel : public LinearTokenizeModel {
     for (unsigned i = 0; i < n_chars; ++i) {
       ch_exprs[i] = dynet::concatenate({char_embed.embed(cids[i]), char_category_embed.embed(ctids[i])});
     }
-    bi_rnn.add_inputs(ch_exprs);
+    if (fused_rnn) {
+      fused_bi_rnn.add_inputs(bi_rnn, ch_exprs, int8_kernels);
+    } else {
+      bi_rnn.add_inputs(ch_exprs);
+    }
     output.resize(n_chars);
     for (unsigned i = 0; i < n_chars; ++i) {
       auto payload = bi_rnn.get_output(i);
@@ -187,6 +193,7 @@ struct LinearRNNSentenceSegmentAndTokenizeModel : public LinearSentenceSegmentAn
   const static char* name;
 
   BiRNNLayer<RNNBuilderType> bi_rnn;
+  FusedBiRNN<RNNBuilderType> fused_bi_rnn;
   SymbolEmbedding char_embed;
   SymbolEmbedding char_category_embed;
   Merge2Layer merge;
@@ -235,7 +242,11 @@ struct LinearRNNSentenceSegmentAndTokenizeModel : public LinearSentenceSegmentAn
     for (unsigned i = 0; i < n_chars; ++i) {
       ch_exprs[i] = dynet::concatenate({char_embed.embed(cids[i]), char_category_embed.embed(ctids[i])});
     }
-    bi_rnn.add_inputs(ch_exprs);
+    if (fused_rnn) {
+      fused_bi_rnn.add_inputs(bi_rnn, ch_exprs, int8_kernels);
+    } else {
+      bi_rnn.add_inputs(ch_exprs);
+    }
     output.resize(n_chars);
     for (unsigned i = 0; i < n_chars; ++i) {
       auto payload = bi_rnn.get_output(i);
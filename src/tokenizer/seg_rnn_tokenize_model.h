@@ -4,6 +4,7 @@
 #include <regex>
 #include "tokenize_model.h"
 #include "twpipe/alphabet_collection.h"
+#include "twpipe/rnn_kernel.h"
 
 namespace twpipe {
 
@@ -11,6 +12,7 @@ template <class RNNBuilderType>
 struct SegmentalRNNTokenizeModel : public TokenizeModel {
   const static char* name;
   BiRNNLayer<RNNBuilderType> bi_rnn;
+  FusedBiRNN<RNNBuilderType> fused_bi_rnn;
   SegBiRNN<RNNBuilderType> seg_rnn;
   BinnedDurationEmbedding dur_embed;
   SymbolEmbedding char_embed;
@@ -87,7 +89,11 @@ struct SegmentalRNNTokenizeModel : public TokenizeModel {
     for (unsigned i = 0; i < n_chars; ++i) {
       ch_exprs[i] = char_embed.embed(cids[i]);
     }
-    bi_rnn.add_inputs(ch_exprs);
+    if (fused_rnn) {
+      fused_bi_rnn.add_inputs(bi_rnn, ch_exprs, int8_kernels);
+    } else {
+      bi_rnn.add_inputs(ch_exprs);
+    }
 
     std::vector<BiRNNOutput> hiddens1;
     bi_rnn.get_outputs(hiddens1);
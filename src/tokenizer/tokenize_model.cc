@@ -10,13 +10,16 @@ po::options_description twpipe::AbstractTokenizeModel::get_options() {
     ("tok-hidden-dim", po::value<unsigned>()->default_value(64), "the hidden dimension of rnn.")
     ("tok-n-layer", po::value<unsigned>()->default_value(1), "the number of layers.")
     ("tok-seg-dim", po::value<unsigned>()->default_value(64), "the dimension of segment (only used in seg-rnn).")
+    ("tok-fused-rnn", "Run the rnn with the fused inference kernels, for a loaded model.")
     ;
   return model_opts;
 }
 
 twpipe::AbstractTokenizeModel::AbstractTokenizeModel(dynet::ParameterCollection & model) :
   model(model),
-  space_cid(AlphabetCollection::get()->char_map.get(Corpus::SPACE)) {
+  space_cid(AlphabetCollection::get()->char_map.get(Corpus::SPACE)),
+  fused_rnn(false),
+  int8_kernels(false) {
 }
 
 std::tuple<float, float, float> twpipe::AbstractTokenizeModel::fscore(const std::vector<std::string>& gold,
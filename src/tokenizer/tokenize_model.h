@@ -16,9 +16,18 @@ struct AbstractTokenizeModel {
 
   dynet::ParameterCollection & model;
   unsigned space_cid;
+  /// Run the bi-rnn with the fused cells of twpipe/rnn_kernel.h when
+  /// decoding. The weights are copied out on the first use, so it is only
+  /// for inference.
+  bool fused_rnn;
+  /// Keep the weights of the fused kernels in int8, set when the model file
+  /// is int8.
+  bool int8_kernels;
 
   AbstractTokenizeModel(dynet::ParameterCollection & model);
 
+  virtual ~AbstractTokenizeModel() {}
+
   virtual void new_graph(dynet::ComputationGraph & cg) = 0;
 
   virtual dynet::Expression objective(const Instance & inst) = 0;
@@ -43,6 +43,7 @@ TokenizeModelBuilder::TokenizeModelBuilder(po::variables_map & conf) {
   char_dim = (conf.count("tok-char-dim") ? conf["tok-char-dim"].as<unsigned>() : 0);
   hidden_dim = (conf.count("tok-hidden-dim") ? conf["tok-hidden-dim"].as<unsigned>() : 0);
   n_layers = (conf.count("tok-n-layer") ? conf["tok-n-layer"].as<unsigned>() : 0);
+  fused_rnn = (conf.count("tok-fused-rnn") > 0);
   seg_dim = (conf.count("tok-seg-dim") ? conf["tok-seg-dim"].as<unsigned>() : 0);
   dur_dim = (conf.count("tok-dur-dim") ? conf["tok-dur-dim"].as<unsigned>() : 0);
 }
@@ -122,6 +123,9 @@ TokenizeModel * TokenizeModelBuilder::from_json(dynet::ParameterCollection & mod
   }
 
   globals->from_json(Model::kTokenizerName, model);
+  // the weights are final once loaded, so the fused kernels are safe.
+  engine->fused_rnn = fused_rnn;
+  engine->int8_kernels = (globals->get_precision() == "int8");
   return engine;
 }
 
@@ -140,6 +144,7 @@ SentenceSegmentAndTokenizeModelBuilder::SentenceSegmentAndTokenizeModelBuilder(p
   char_dim = (conf.count("tok-char-dim") ? conf["tok-char-dim"].as<unsigned>() : 0);
   hidden_dim = (conf.count("tok-hidden-dim") ? conf["tok-hidden-dim"].as<unsigned>() : 0);
   n_layers = (conf.count("tok-n-layer") ? conf["tok-n-layer"].as<unsigned>() : 0);
+  fused_rnn = (conf.count("tok-fused-rnn") > 0);
 }
 
 SentenceSegmentAndTokenizeModel * SentenceSegmentAndTokenizeModelBuilder::build(dynet::ParameterCollection & model) {
@@ -197,6 +202,9 @@ SentenceSegmentAndTokenizeModel * SentenceSegmentAndTokenizeModelBuilder::from_j
   }
 
   globals->from_json(Model::kSentenceSegmentAndTokenizeName, model);
+  // the weights are final once loaded, so the fused kernels are safe.
+  engine->fused_rnn = fused_rnn;
+  engine->int8_kernels = (globals->get_precision() == "int8");
   return engine;
 }
 
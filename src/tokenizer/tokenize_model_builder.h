@@ -22,6 +22,7 @@ struct TokenizeModelBuilder {
   unsigned char_dim;
   unsigned hidden_dim;
   unsigned n_layers;
+  bool fused_rnn;
   unsigned seg_dim;
   unsigned dur_dim;
 
@@ -46,6 +47,7 @@ struct SentenceSegmentAndTokenizeModelBuilder {
   unsigned char_dim;
   unsigned hidden_dim;
   unsigned n_layers;
+  bool fused_rnn;
 
   explicit SentenceSegmentAndTokenizeModelBuilder(po::variables_map & conf);
 
@@ -1,4 +1,5 @@
 #include <fstream>
+#include <algorithm>
 #include "tokenizer_trainer.h"
 #include "twpipe/logging.h"
 
@@ -17,16 +18,16 @@ TokenizerTrainer::TokenizerTrainer(AbstractTokenizeModel & engine,
   }
 }
 
-float twpipe::TokenizerTrainer::evaluate(const Corpus & corpus) {
-  float n_recall = 0, n_pred = 0, n_gold = 0;
-  for (unsigned sid = 0; sid < corpus.n_devel; ++sid) {
+float twpipe::TokenizerTrainer::evaluate(const Corpus & corpus, bool full) {
+  std::vector<float> counts = evaluate_counts(corpus.n_devel, full, [&](unsigned sid) {
     const Instance & inst = corpus.devel_data.at(sid);
 
     auto payload = engine.evaluate(inst);
-    n_recall += std::get<0>(payload);
-    n_pred += std::get<1>(payload);
-    n_gold += std::get<2>(payload);
-  }
+    return std::vector<float>{ std::get<0>(payload), std::get<1>(payload), std::get<2>(payload) };
+  });
+  if (counts.size() < 3) { return 0.f; }
+
+  float n_recall = counts[0], n_pred = counts[1], n_gold = counts[2];
   float p = n_recall / n_gold;
   float r = n_recall / n_pred;
   float f = 2 * p * r / (p + r);
@@ -38,44 +39,72 @@ void twpipe::TokenizerTrainer::train(const Corpus & corpus) {
   _INFO << "[tokenize|train] size of dataset = " << corpus.n_train;
 
   std::vector<unsigned> order(corpus.n_train);
-  for (unsigned i = 0; i < corpus.n_train; ++i) { order[i] = i; }
+  std::vector<unsigned> lengths(corpus.n_train);
+  for (unsigned i = 0; i < corpus.n_train; ++i) {
+    order[i] = i;
+    lengths[i] = corpus.training_data.at(i).raw_sentence.size();
+  }
 
   _INFO << "[tokenize|train] going to train " << max_iter << " iterations";
+  _INFO << "[tokenize|train] batch size = " << batch_size;
 
   dynet::Trainer * trainer = opt_builder.build(engine.model);
 
   float best_f = 0.f;
+  float best_f_sample = 0.f;
   unsigned n_processed = 0;
 
   for (unsigned iter = 1; iter <= max_iter; ++iter) {
-    std::shuffle(order.begin(), order.end(), *dynet::rndeng);
+    shuffle(order, lengths);
     _INFO << "[tokenize|train] start training at " << iter << "-th iteration.";
 
     float loss = 0;
-    for (unsigned sid = 0; sid < corpus.n_train; ++sid) {
-      const Instance & inst = corpus.training_data.at(order[sid]);
-      {
+    unsigned cursor = 0;
+    while (cursor < order.size()) {
+      unsigned end = cursor + n_until_evaluate(order.size() - cursor, n_processed);
+      for (; cursor < end; cursor += batch_size) {
+        unsigned batch_end = std::min(cursor + batch_size, end);
+
         dynet::ComputationGraph cg;
         engine.new_graph(cg);
-        dynet::Expression loss_expr = engine.objective(inst);
+        std::vector<dynet::Expression> losses;
+        unsigned n_units = 0;
+        for (unsigned i = cursor; i < batch_end; ++i) {
+          const Instance & inst = corpus.training_data.at(order[i]);
+          losses.push_back(engine.objective(inst));
+          n_units += inst.input_units.size();
+        }
+        dynet::Expression loss_expr = dynet::sum(losses);
         if (lambda_ > 0) {
-          loss_expr = loss_expr + (0.5f * lambda_ * inst.input_units.size()) * engine.l2();
+          loss_expr = loss_expr + (0.5f * lambda_ * n_units) * engine.l2();
         }
         float l = dynet::as_scalar(cg.forward(loss_expr));
         cg.backward(loss_expr);
         loss += l;
 
         trainer->update();
-        n_processed++;
+        n_processed += (batch_end - cursor);
       }
+      cursor = end;
+
       if (need_evaluate(iter, n_processed)) {
-        float f = evaluate(corpus);
-        float prop = static_cast<float>(n_processed) / order.size();
-        if (f > best_f) {
+        float f = evaluate(corpus, false);
+        float prop = static_cast<float>(cursor) / order.size();
+        if (is_sampled(corpus.n_devel)) {
+          // scores on the subsample are not comparable with those of the full
+          // evaluations, track their best apart and leave the snapshot to the latter.
+          if (f > best_f_sample) {
+            best_f_sample = f;
+            _INFO << "[tokenize|train] " << prop << "% trained, fscore on heldout sample = " << f
+              << ", new best on the sample.";
+          } else {
+            _INFO << "[tokenize|train] " << prop << "% trained, fscore on heldout sample = " << f;
+          }
+        } else if (f > best_f) {
           _INFO << "[tokenize|train] " << prop << "% trained, fscore on heldout = " << f
                 << ", new best achieved, saved.";
           best_f = f;
-          Model::get()->to_json(phase_name, engine.model);
+          Model::get()->snapshot(phase_name, engine.model);
         } else {
           _INFO << "[tokenize|train] " << prop << "% trained, fscore on heldout = " << f;
         }
@@ -88,7 +117,7 @@ void twpipe::TokenizerTrainer::train(const Corpus & corpus) {
         _INFO << "[tokenize|train] end of iter #" << iter << ", fscore on heldout = " << f
               << ", new best achieved, saved.";
         best_f = f;
-        Model::get()->to_json(phase_name, engine.model);
+        Model::get()->snapshot(phase_name, engine.model);
       } else {
         _INFO << "[tokenize|train] end of iter #" << iter << ", fscore on heldout = " << f;
       }
@@ -23,7 +23,9 @@ struct TokenizerTrainer : public Trainer {
 
   void train(const Corpus & corpus);
 
-  float evaluate(const Corpus & corpus);
+  /// Return the token F-score on the heldout data, or on its subsample
+  /// when full is not set.
+  float evaluate(const Corpus & corpus, bool full = true);
 };
 
 
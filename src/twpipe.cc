@@ -11,6 +11,7 @@
 #include "parser/parse_model.h"
 #include "parser/parse_model_builder.h"
 #include "parser/parser_trainer.h"
+#include "parser/ensemble_parser.h"
 #include "twpipe/logging.h"
 #include "twpipe/alphabet_collection.h"
 #include "twpipe/corpus.h"
@@ -38,6 +39,7 @@ void init_command_line(int argc, char* argv[], po::variables_map& conf) {
     ("tokenize", "perform tokenization")
     ("postag", "perform tagging")
     ("parse", "perform parsing")
+    ("parse-ensemble", po::value<std::string>(), "parse with the ensemble of the parsers in these models, separated by comma.")
     ("format", po::value<std::string>()->default_value("plain"), "the format of input data [plain|conll].")
     ;
 
@@ -52,6 +54,7 @@ void init_command_line(int argc, char* argv[], po::variables_map& conf) {
   po::options_description parser_train_opts = twpipe::ParserTrainer::get_options();
   po::options_description parser_supervised_train_opts = twpipe::SupervisedTrainer::get_options();
   po::options_description parser_ensemble_train_opts = twpipe::SupervisedEnsembleTrainer::get_options();
+  po::options_description parser_ensemble_teacher_opts = twpipe::EnsembleTeacher::get_options();
   po::options_description optimizer_opts = twpipe::OptimizerBuilder::get_options();
 
   po::positional_options_description input_opts;
@@ -71,6 +74,7 @@ void init_command_line(int argc, char* argv[], po::variables_map& conf) {
     .add(parser_opts)
     .add(parser_supervised_train_opts)
     .add(parser_ensemble_train_opts)
+    .add(parser_ensemble_teacher_opts)
     .add(parser_train_opts)
     .add(optimizer_opts)
     ;
@@ -92,21 +96,25 @@ void init_command_line(int argc, char* argv[], po::variables_map& conf) {
 }
 
 int main(int argc, char* argv[]) {
-  dynet::initialize(argc, argv);
+  dynet::DynetParams dynet_params = dynet::extract_dynet_params(argc, argv);
 
   po::variables_map conf;
   init_command_line(argc, argv, conf);
 
+  dynet::initialize(dynet_params);
+
   if (conf.count("embedding")) {
     twpipe::WordEmbedding::get()->load(conf["embedding"].as<std::string>(),
-                                       conf["embedding-dim"].as<unsigned>());
+                                       conf["embedding-dim"].as<unsigned>(),
+                                       conf.count("embedding-fp16") > 0);
   } else {
     twpipe::WordEmbedding::get()->empty(conf["embedding-dim"].as<unsigned>());
   }
 
   if (conf.count("elmo")) {
     twpipe::ELMo::get()->load(conf["elmo"].as<std::string>(),
-                              conf["elmo-dim"].as<unsigned>());
+                              conf["elmo-dim"].as<unsigned>(),
+                              conf.count("elmo-fp16") > 0);
   } else {
     twpipe::ELMo::get()->empty(conf["elmo-dim"].as<unsigned>());
   }
@@ -119,6 +127,7 @@ int main(int argc, char* argv[]) {
       corpus.load_devel_data(conf["heldout"].as<std::string>());
     }
     twpipe::AlphabetCollection::get()->to_json();
+    twpipe::Model::get()->enable_checkpoint(conf["model"].as<std::string>());
 
     twpipe::OptimizerBuilder opt_builder(conf);
 
@@ -157,12 +166,10 @@ int main(int argc, char* argv[]) {
         twpipe::PostaggerTrainer trainer(*engine, opt_builder, conf);
         trainer.train(corpus);
       } else {
-        twpipe::EnsembleInstances instances;
-        twpipe::EnsembleUtils::load_ensemble_instances(
-          conf["pos-ensemble-data"].as<std::string>(),
-          instances);
+        twpipe::EnsembleData data;
+        data.load(conf["pos-ensemble-data"].as<std::string>());
         twpipe::PostaggerEnsembleTrainer trainer((*engine), opt_builder, conf);
-        trainer.train(corpus, instances);
+        trainer.train(corpus, data);
       }
     }
     if (conf["train-parser"].as<bool>()) {
@@ -176,13 +183,16 @@ int main(int argc, char* argv[]) {
       if (!conf["train-distill-parser"].as<bool>()) {
         twpipe::SupervisedTrainer trainer((*engine), opt_builder, conf);
         trainer.train(corpus);
+      } else if (conf.count("parse-ensemble-models")) {
+        twpipe::EnsembleTeacher teacher(conf);
+        twpipe::SupervisedEnsembleTrainer trainer((*engine), opt_builder, conf);
+        trainer.train(corpus, teacher);
       } else {
-        twpipe::EnsembleInstances instances;
-        twpipe::EnsembleUtils::load_ensemble_instances(
-          conf["parse-ensemble-data"].as<std::string>(),
-          instances);
+        twpipe::EnsembleData data;
+        data.load(conf["parse-ensemble-data"].as<std::string>(),
+                  !conf["parse-ensemble-streaming"].as<bool>());
         twpipe::SupervisedEnsembleTrainer trainer((*engine), opt_builder, conf);
-        trainer.train(corpus, instances);
+        trainer.train(corpus, data);
       }
     }
 
@@ -198,6 +208,7 @@ int main(int argc, char* argv[]) {
       twpipe::SentenceSegmentAndTokenizeModel * seg_tok_engine = nullptr;
       twpipe::PostagModel * pos_engine = nullptr;
       twpipe::ParseModel * par_engine = nullptr;
+      twpipe::EnsembleParser * par_ensemble = nullptr;
         
       dynet::ParameterCollection tok_model;
       dynet::ParameterCollection seg_tok_model;
@@ -234,7 +245,13 @@ int main(int argc, char* argv[]) {
         twpipe::PostagModelBuilder pos_builder(conf);
         pos_engine = pos_builder.from_json(pos_model);
       }
-      if (load_parse_model) {
+      if (load_parse_model && conf.count("parse-ensemble")) {
+        // the parsers of the ensemble are loaded the last, as they replace the loaded model.
+        std::string payload = conf["parse-ensemble"].as<std::string>();
+        std::vector<std::string> model_names;
+        boost::split(model_names, payload, boost::is_any_of(","));
+        par_ensemble = new twpipe::EnsembleParser(model_names, conf);
+      } else if (load_parse_model) {
         if (!twpipe::Model::get()->has_parser_model()) {
           _ERROR << "[twpipe] doesn't have parser model";
           exit(1);
@@ -261,7 +278,9 @@ int main(int argc, char* argv[]) {
             if (pos_engine != nullptr) {
               pos_engine->postag(tokens, postags);
             }
-            if (par_engine != nullptr) {
+            if (par_ensemble != nullptr) {
+              par_ensemble->predict(tokens, postags, heads, deprels);
+            } else if (par_engine != nullptr) {
               par_engine->predict(tokens, postags, heads, deprels);
             }
             if (s == 0) {
@@ -271,8 +290,8 @@ int main(int argc, char* argv[]) {
             for (unsigned i = 0; i < tokens.size(); ++i) {
               std::cout << i + 1 << "\t" << tokens[i] << "\t_\t"
                         << (pos_engine != nullptr ? postags[i] : "_") << "\t_\t_\t"
-                        << (par_engine != nullptr ? std::to_string(heads[i]) : "_") << "\t"
-                        << (par_engine != nullptr ? deprels[i] : "_") << "\t_\t_\n";
+                        << (load_parse_model ? std::to_string(heads[i]) : "_") << "\t"
+                        << (load_parse_model ? deprels[i] : "_") << "\t_\t_\n";
             }
             std::cout << "\n";
           }
@@ -287,10 +306,12 @@ int main(int argc, char* argv[]) {
           std::cout << "\n";
         }
       }
+      delete par_ensemble;
     } else {
       // for conll format, tokenization is impossible.
       twpipe::PostagModel * pos_engine = nullptr;
       twpipe::ParseModel * par_engine = nullptr;
+      twpipe::EnsembleParser * par_ensemble = nullptr;
 
       dynet::ParameterCollection pos_model;
       dynet::ParameterCollection par_model;
@@ -307,7 +328,13 @@ int main(int argc, char* argv[]) {
         pos_engine = pos_builder.from_json(pos_model);
       }
 
-      if (load_parse_model) {
+      if (load_parse_model && conf.count("parse-ensemble")) {
+        // the parsers of the ensemble are loaded the last, as they replace the loaded model.
+        std::string payload = conf["parse-ensemble"].as<std::string>();
+        std::vector<std::string> model_names;
+        boost::split(model_names, payload, boost::is_any_of(","));
+        par_ensemble = new twpipe::EnsembleParser(model_names, conf);
+      } else if (load_parse_model) {
         if (!twpipe::Model::get()->has_parser_model()) {
           _ERROR << "[twpipe] doesn't have parser model!";
           exit(1);
@@ -339,7 +366,9 @@ int main(int argc, char* argv[]) {
               postags[i] = gold_postags[i];
             }
           }
-          if (par_engine != nullptr) {
+          if (par_ensemble != nullptr) {
+            par_ensemble->predict(tokens, postags, heads, deprels);
+          } else if (par_engine != nullptr) {
             par_engine->predict(tokens, postags, heads, deprels);
           }
 
@@ -354,7 +383,7 @@ int main(int argc, char* argv[]) {
             } else {
               std::cout << postags[i] << "\t_\tGoldPOS=" << gold_postags[i] << "\t";
             }
-            if (par_engine == nullptr) {
+            if (!load_parse_model) {
               std::cout << "_\t_\t_\t_\n";
             } else {
               std::cout << heads[i] << "\t" << deprels[i] << "\t_\t_\n";
@@ -401,6 +430,7 @@ int main(int argc, char* argv[]) {
         _INFO << "[evaluate] UAS accuracy: " << n_uas_corr / n_total;
         _INFO << "[evaluate] LAS accuracy: " << n_las_corr / n_total;
       }
+      delete par_ensemble;
     }
   }
   return 0;
@@ -0,0 +1,195 @@
+#include "checkpoint.h"
+#include "logging.h"
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <boost/assert.hpp>
+#include "dynet/tensor.h"
+
+namespace twpipe {
+
+const char* ParameterSnapshot::magic = "TWPIPE.SNAPSHOT.1";
+
+void ParameterSnapshot::take(dynet::ParameterCollection & model) {
+  const dynet::ParameterCollectionStorage & storage = model.get_storage();
+  names.clear();
+  values.clear();
+  for (auto & p : storage.params) {
+    names.push_back(p->name);
+    values.push_back(dynet::as_vector(p->values));
+  }
+  for (auto & p : storage.lookup_params) {
+    names.push_back(p->name);
+    values.push_back(dynet::as_vector(p->all_values));
+  }
+}
+
+void ParameterSnapshot::restore(dynet::ParameterCollection & model) const {
+  std::map<std::string, unsigned> index;
+  for (unsigned i = 0; i < names.size(); ++i) { index[names[i]] = i; }
+
+  const dynet::ParameterCollectionStorage & storage = model.get_storage();
+  for (auto & p : storage.params) {
+    auto it = index.find(p->name);
+    BOOST_ASSERT_MSG(it != index.end(), "[snapshot] parameter not found.");
+    BOOST_ASSERT_MSG(p->dim.size() == values[it->second].size(), "[snapshot] mismatch dimension.");
+    dynet::TensorTools::set_elements(p->values, values[it->second]);
+  }
+  for (auto & p : storage.lookup_params) {
+    auto it = index.find(p->name);
+    BOOST_ASSERT_MSG(it != index.end(), "[snapshot] parameter not found.");
+    BOOST_ASSERT_MSG(p->all_dim.size() == values[it->second].size(), "[snapshot] mismatch dimension.");
+    dynet::TensorTools::set_elements(p->all_values, values[it->second]);
+  }
+}
+
+void ParameterSnapshot::write(std::ostream & os) const {
+  os.write(magic, strlen(magic));
+  unsigned n = names.size();
+  os.write(reinterpret_cast<const char *>(&n), sizeof(unsigned));
+  for (unsigned i = 0; i < n; ++i) {
+    unsigned len = names[i].size();
+    os.write(reinterpret_cast<const char *>(&len), sizeof(unsigned));
+    os.write(names[i].data(), len);
+    unsigned size = values[i].size();
+    os.write(reinterpret_cast<const char *>(&size), sizeof(unsigned));
+    os.write(reinterpret_cast<const char *>(values[i].data()), size * sizeof(float));
+  }
+}
+
+bool ParameterSnapshot::read(std::istream & is) {
+  std::string buffer(strlen(magic), '\0');
+  is.read(&buffer[0], buffer.size());
+  if (!is || buffer != magic) { return false; }
+
+  unsigned n = 0;
+  is.read(reinterpret_cast<char *>(&n), sizeof(unsigned));
+  names.resize(n);
+  values.resize(n);
+  for (unsigned i = 0; i < n && is; ++i) {
+    unsigned len = 0;
+    is.read(reinterpret_cast<char *>(&len), sizeof(unsigned));
+    names[i].resize(len);
+    is.read(&names[i][0], len);
+    unsigned size = 0;
+    is.read(reinterpret_cast<char *>(&size), sizeof(unsigned));
+    values[i].resize(size);
+    is.read(reinterpret_cast<char *>(values[i].data()), size * sizeof(float));
+  }
+  return static_cast<bool>(is);
+}
+
+const char* TrainingCheckpoint::magic = "TWPIPE.TRAINING.1";
+
+static void write_string(std::ostream & os, const std::string & str) {
+  unsigned len = str.size();
+  os.write(reinterpret_cast<const char *>(&len), sizeof(unsigned));
+  os.write(str.data(), len);
+}
+
+static void read_string(std::istream & is, std::string & str) {
+  unsigned len = 0;
+  is.read(reinterpret_cast<char *>(&len), sizeof(unsigned));
+  str.resize(len);
+  if (len > 0) { is.read(&str[0], len); }
+}
+
+void TrainingCheckpoint::write(std::ostream & os) const {
+  os.write(magic, strlen(magic));
+  os.write(reinterpret_cast<const char *>(&iter), sizeof(unsigned));
+  os.write(reinterpret_cast<const char *>(&cursor), sizeof(unsigned));
+  os.write(reinterpret_cast<const char *>(&n_processed), sizeof(unsigned));
+  os.write(reinterpret_cast<const char *>(&best_score), sizeof(float));
+  os.write(reinterpret_cast<const char *>(&loss), sizeof(float));
+  unsigned n = order.size();
+  os.write(reinterpret_cast<const char *>(&n), sizeof(unsigned));
+  os.write(reinterpret_cast<const char *>(order.data()), n * sizeof(unsigned));
+  write_string(os, rng_state);
+  write_string(os, optimizer_state);
+  parameters.write(os);
+}
+
+bool TrainingCheckpoint::read(std::istream & is) {
+  std::string buffer(strlen(magic), '\0');
+  is.read(&buffer[0], buffer.size());
+  if (!is || buffer != magic) { return false; }
+
+  is.read(reinterpret_cast<char *>(&iter), sizeof(unsigned));
+  is.read(reinterpret_cast<char *>(&cursor), sizeof(unsigned));
+  is.read(reinterpret_cast<char *>(&n_processed), sizeof(unsigned));
+  is.read(reinterpret_cast<char *>(&best_score), sizeof(float));
+  is.read(reinterpret_cast<char *>(&loss), sizeof(float));
+  unsigned n = 0;
+  is.read(reinterpret_cast<char *>(&n), sizeof(unsigned));
+  order.resize(n);
+  is.read(reinterpret_cast<char *>(order.data()), n * sizeof(unsigned));
+  read_string(is, rng_state);
+  read_string(is, optimizer_state);
+  if (!is) { return false; }
+  return parameters.read(is);
+}
+
+CheckpointWriter::CheckpointWriter() : busy(false), stop(false) {
+  worker = std::thread(&CheckpointWriter::loop, this);
+}
+
+CheckpointWriter::~CheckpointWriter() {
+  flush();
+  {
+    std::lock_guard<std::mutex> lock(mtx);
+    stop = true;
+  }
+  cv.notify_all();
+  worker.join();
+}
+
+void CheckpointWriter::submit(const std::string & path, const SerializeFunction & func) {
+  {
+    std::lock_guard<std::mutex> lock(mtx);
+    pending[path] = func;
+  }
+  cv.notify_all();
+}
+
+void CheckpointWriter::flush() {
+  std::unique_lock<std::mutex> lock(mtx);
+  cv.wait(lock, [this]() { return pending.empty() && !busy; });
+}
+
+bool CheckpointWriter::write_atomic(const std::string & path, const SerializeFunction & func) {
+  std::string tmp_path = path + ".tmp";
+  {
+    std::ofstream ofs(tmp_path, std::ios::binary);
+    if (!ofs) { return false; }
+    func(ofs);
+    ofs.flush();
+    if (!ofs) { return false; }
+  }
+  return std::rename(tmp_path.c_str(), path.c_str()) == 0;
+}
+
+void CheckpointWriter::loop() {
+  std::unique_lock<std::mutex> lock(mtx);
+  while (true) {
+    cv.wait(lock, [this]() { return stop || !pending.empty(); });
+    if (pending.empty()) { break; }
+
+    std::string path = pending.begin()->first;
+    SerializeFunction func = pending.begin()->second;
+    pending.erase(pending.begin());
+    busy = true;
+    lock.unlock();
+
+    if (!write_atomic(path, func)) {
+      _WARN << "[checkpoint] failed to write " << path;
+    } else {
+      _TRACE << "[checkpoint] " << path << " written.";
+    }
+
+    lock.lock();
+    busy = false;
+    cv.notify_all();
+  }
+}
+
+}
\ No newline at end of file
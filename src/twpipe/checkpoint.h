@@ -0,0 +1,89 @@
+#ifndef __TWPIPE_CHECKPOINT_H__
+#define __TWPIPE_CHECKPOINT_H__
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <functional>
+#include <condition_variable>
+#include "dynet/model.h"
+
+namespace twpipe {
+
+/// The values of all the parameters in a collection, copied out so they can
+/// be serialized while the training goes on. The binary format is
+///   magic, #parameters, [name length, name, #values, values]*
+/// with native endianness.
+struct ParameterSnapshot {
+  static const char* magic;
+
+  std::vector<std::string> names;
+  std::vector<std::vector<float>> values;
+
+  void take(dynet::ParameterCollection & model);
+
+  void restore(dynet::ParameterCollection & model) const;
+
+  void write(std::ostream & os) const;
+
+  bool read(std::istream & is);
+};
+
+/// Everything needed to continue a training run: the parameters, the
+/// optimizer state, the position in the shuffled order, the random engine
+/// and the best heldout score so far.
+struct TrainingCheckpoint {
+  static const char* magic;
+
+  unsigned iter;
+  unsigned cursor;
+  unsigned n_processed;
+  float best_score;
+  float loss;
+  std::vector<unsigned> order;
+  std::string rng_state;
+  std::string optimizer_state;
+  ParameterSnapshot parameters;
+
+  void write(std::ostream & os) const;
+
+  bool read(std::istream & is);
+};
+
+/// Write files in a background thread. A file is first written to a
+/// temporary path and then renamed, so the file on disk is always complete.
+/// When a file is submitted again before the previous version is written,
+/// only the latest version is kept.
+class CheckpointWriter {
+public:
+  typedef std::function<void(std::ostream &)> SerializeFunction;
+
+  CheckpointWriter();
+
+  ~CheckpointWriter();
+
+  void submit(const std::string & path, const SerializeFunction & func);
+
+  /// Block until all the submitted files are written.
+  void flush();
+
+  static bool write_atomic(const std::string & path, const SerializeFunction & func);
+
+private:
+  std::map<std::string, SerializeFunction> pending;
+  std::mutex mtx;
+  std::condition_variable cv;
+  std::thread worker;
+  bool busy;
+  bool stop;
+
+  void loop();
+};
+
+}
+
+#endif  //  end for __TWPIPE_CHECKPOINT_H__
\ No newline at end of file
@@ -1,14 +1,17 @@
 #include "elmo.h"
 #include "logging.h"
 #include "normalizer.h"
+#include "half.h"
 #include <fstream>
+#include <cmath>
+#include <algorithm>
 #include <boost/algorithm/string.hpp>
 
 namespace twpipe {
 
 ELMo * ELMo::instance = nullptr;
 
-ELMo::ELMo(): dim_(0) {
+ELMo::ELMo(): dim_(0), half_(false) {
 }
 
 po::options_description ELMo::get_options() {
@@ -16,6 +19,7 @@ po::options_description ELMo::get_options() {
   embed_opts.add_options()
     ("elmo", po::value<std::string>(), "the path to the embedding file.")
     ("elmo-dim", po::value<unsigned>()->default_value(1024), "the dimension of embedding.")
+    ("elmo-fp16", "store the embeddings in fp16 to save memory.")
     ;
   return embed_opts;
 }
@@ -27,15 +31,19 @@ ELMo * ELMo::get() {
   return instance;
 }
 
-void ELMo::load(const std::string & embedding_file, unsigned dim) {
+void ELMo::load(const std::string & embedding_file, unsigned dim, bool half) {
   dim_ = dim;
-  _INFO << "[elmo] loading from " << embedding_file << " with " << dim << " dimensions.";
+  half_ = half;
+  _INFO << "[elmo] loading from " << embedding_file << " with " << dim << " dimensions"
+    << (half_ ? " in fp16." : ".");
   std::ifstream ifs(embedding_file);
   BOOST_ASSERT_MSG(ifs, "Failed to load embedding file.");
   std::string line;
   std::string word;
 
   int cnt = 0;
+  unsigned n_rows = 0;
+  float max_error = 0.f;
   while (true) {
     std::getline(ifs, line);
     std::string key = line;
@@ -44,8 +52,9 @@ void ELMo::load(const std::string & embedding_file, unsigned dim) {
       break;
     }
 
-    auto & values = pretrained[key];
-    values.clear();
+    // a repeated sentence takes the new rows.
+    auto & entry = pretrained[key];
+    entry = std::make_pair(n_rows, 0u);
     std::vector<float> v(dim, 0.f);
     while (true) {
       std::getline(ifs, line);
@@ -56,7 +65,18 @@ void ELMo::load(const std::string & embedding_file, unsigned dim) {
       std::istringstream iss(line);
       // actually, there should be a checking about the embedding dimension.
       for (unsigned i = 0; i < dim; ++i) { iss >> v[i]; }
-      values.push_back(v);
+      if (half_) {
+        half_values_.resize((n_rows + 1) * dim);
+        uint16_t * h = half_values_.data() + n_rows * dim;
+        Half::narrow(v.data(), dim, h);
+        for (unsigned i = 0; i < dim; ++i) {
+          max_error = std::max(max_error, std::fabs(Half::to_float(h[i]) - v[i]));
+        }
+      } else {
+        values_.insert(values_.end(), v.begin(), v.end());
+      }
+      n_rows++;
+      entry.second++;
     }
     cnt ++;
     if (cnt % 1000 == 0) {
@@ -64,8 +84,11 @@ void ELMo::load(const std::string & embedding_file, unsigned dim) {
       << " sentences, " << pretrained.size() << " entries.";
     }
   }
+  values_.shrink_to_fit();
+  half_values_.shrink_to_fit();
   _INFO << "[elmo] loaded " << cnt
         << " sentences, " << pretrained.size() << " entries.";
+  if (half_) { _INFO << "[elmo] largest fp16 rounding error: " << max_error; }
 }
 
 void ELMo::empty(unsigned dim) {
@@ -93,8 +116,15 @@ void ELMo::render(const std::vector<std::string>& words,
       values.emplace_back(std::vector<float>(dim_, 0.f));
     }
   } else {
-    for (const auto & val : it->second) {
-      values.push_back(val);
+    unsigned row = it->second.first;
+    for (unsigned i = 0; i < it->second.second; ++i, ++row) {
+      values.push_back(std::vector<float>(dim_));
+      if (half_) {
+        Half::widen(half_values_.data() + row * dim_, dim_, values.back().data());
+      } else {
+        std::copy(values_.begin() + row * dim_, values_.begin() + (row + 1) * dim_,
+                  values.back().begin());
+      }
     }
   }
 }
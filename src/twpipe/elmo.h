@@ -2,6 +2,7 @@
 #define __TWPIPE_ELMO_H__
 
 #include <vector>
+#include <cstdint>
 #include <unordered_map>
 #include <boost/program_options.hpp>
 #include "alphabet.h"
@@ -13,8 +14,14 @@ namespace twpipe {
 struct ELMo {
 protected:
   static ELMo * instance;
-  std::unordered_map<std::string, std::vector<std::vector<float>>> pretrained;
+  /// The first row and the number of rows of each sentence, the vectors are
+  /// stored row by row in values_, or in half_values_ as fp16 when half_ is
+  /// set.
+  std::unordered_map<std::string, std::pair<unsigned, unsigned>> pretrained;
+  std::vector<float> values_;
+  std::vector<uint16_t> half_values_;
   unsigned dim_;
+  bool half_;
 
   ELMo();
 
@@ -23,7 +30,9 @@ public:
 
   static ELMo* get();
 
-  void load(const std::string& embedding_file, unsigned dim);
+  /// Load the embeddings, store them in fp16 if half is set. A rendered
+  /// vector is widened to float only when it is looked up.
+  void load(const std::string& embedding_file, unsigned dim, bool half = false);
 
   void empty(unsigned dim);
 
@@ -2,13 +2,16 @@
 #include "logging.h"
 #include "corpus.h"
 #include "normalizer.h"
+#include "half.h"
 #include <fstream>
+#include <cmath>
+#include <algorithm>
 
 namespace twpipe {
 
 WordEmbedding * WordEmbedding::instance = nullptr;
 
-WordEmbedding::WordEmbedding() {
+WordEmbedding::WordEmbedding() : half_(false), half_error_(0.f) {
 }
 
 po::options_description WordEmbedding::get_options() {
@@ -16,6 +19,7 @@ po::options_description WordEmbedding::get_options() {
   embed_opts.add_options()
     ("embedding", po::value<std::string>(), "the path to the embedding file.")
     ("embedding-dim", po::value<unsigned>()->default_value(100), "the dimension of embedding.")
+    ("embedding-fp16", "store the embeddings in fp16 to save memory.")
     ;
   return embed_opts;
 }
@@ -27,15 +31,35 @@ WordEmbedding * WordEmbedding::get() {
   return instance;
 }
 
-void WordEmbedding::load(const std::string & embedding_file, unsigned dim) {
+void WordEmbedding::add(const std::string & word, const std::vector<float> & value) {
+  auto it = pretrained.find(word);
+  unsigned row = (it == pretrained.end() ? pretrained.size() : it->second);
+  if (it == pretrained.end()) {
+    pretrained[word] = row;
+    if (half_) { half_values_.resize((row + 1) * dim_); } else { values_.resize((row + 1) * dim_); }
+  }
+  if (half_) {
+    uint16_t * h = half_values_.data() + row * dim_;
+    Half::narrow(value.data(), dim_, h);
+    for (unsigned i = 0; i < dim_; ++i) {
+      half_error_ = std::max(half_error_, std::fabs(Half::to_float(h[i]) - value[i]));
+    }
+  } else {
+    std::copy(value.begin(), value.end(), values_.begin() + row * dim_);
+  }
+}
+
+void WordEmbedding::load(const std::string & embedding_file, unsigned dim, bool half) {
   dim_ = dim;
+  half_ = half;
   size_t found = embedding_file.find("glove");
   normalizer_type = kNone;
   if (found != std::string::npos) { normalizer_type = kGlove; }
-  pretrained[Corpus::BAD0] = std::vector<float>(dim, 0.f);
-  pretrained[Corpus::UNK] = std::vector<float>(dim, 0.f);
-  pretrained[Corpus::ROOT] = std::vector<float>(dim, 0.f);
-  _INFO << "[embedding] loading from " << embedding_file << " with " << dim << " dimensions.";
+  add(Corpus::BAD0, std::vector<float>(dim, 0.f));
+  add(Corpus::UNK, std::vector<float>(dim, 0.f));
+  add(Corpus::ROOT, std::vector<float>(dim, 0.f));
+  _INFO << "[embedding] loading from " << embedding_file << " with " << dim << " dimensions"
+    << (half_ ? " in fp16." : ".");
   std::ifstream ifs(embedding_file);
   BOOST_ASSERT_MSG(ifs, "Failed to load embedding file.");
   std::string line;
@@ -48,20 +72,23 @@ void WordEmbedding::load(const std::string & embedding_file, unsigned dim) {
     iss >> word;
     // actually, there should be a checking about the embedding dimension.
     for (unsigned i = 0; i < dim; ++i) { iss >> v[i]; }
-    pretrained[word] = v;
+    add(word, v);
   }
   std::string normalizer_type_name = "none";
   if (normalizer_type == kGlove) { normalizer_type_name = "glove"; }
+  values_.shrink_to_fit();
+  half_values_.shrink_to_fit();
   _INFO << "[embedding] normalizer type: " << normalizer_type_name;
   _INFO << "[embedding] loaded embedding " << pretrained.size() << " entries.";
+  if (half_) { _INFO << "[embedding] largest fp16 rounding error: " << half_error_; }
 }
 
 void WordEmbedding::empty(unsigned dim) {
   dim_ = dim;
   normalizer_type = kNone;
-  pretrained[Corpus::BAD0] = std::vector<float>(dim, 0.f);
-  pretrained[Corpus::UNK] = std::vector<float>(dim, 0.f);
-  pretrained[Corpus::ROOT] = std::vector<float>(dim, 0.f);
+  add(Corpus::BAD0, std::vector<float>(dim, 0.f));
+  add(Corpus::UNK, std::vector<float>(dim, 0.f));
+  add(Corpus::ROOT, std::vector<float>(dim, 0.f));
   _INFO << "[embedding] loaded embedding " << pretrained.size() << " entries.";
 }
 
@@ -74,9 +101,14 @@ void WordEmbedding::render(const std::vector<std::string>& words,
       normalized_word = GloveNormalizer::normalize(normalized_word);
     }
     auto it = pretrained.find(normalized_word);
-    values.push_back(it == pretrained.end() ?
-                     std::vector<float>(dim_, 0.f) :
-                     it->second);
+    values.push_back(std::vector<float>(dim_, 0.f));
+    if (it == pretrained.end()) { continue; }
+    if (half_) {
+      Half::widen(half_values_.data() + it->second * dim_, dim_, values.back().data());
+    } else {
+      std::copy(values_.begin() + it->second * dim_, values_.begin() + (it->second + 1) * dim_,
+                values.back().begin());
+    }
   }
 }
 
@@ -2,6 +2,7 @@
 #define __TWPIPE_EMBEDDING_H__
 
 #include <vector>
+#include <cstdint>
 #include <unordered_map>
 #include <boost/program_options.hpp>
 #include "alphabet.h"
@@ -14,18 +15,29 @@ struct WordEmbedding {
 protected:
   enum NORMALIZER_TYPE { kNone, kGlove };
   static WordEmbedding * instance;
-  std::unordered_map<std::string, std::vector<float>> pretrained;
+  /// The row of each word, the vectors are stored row by row in values_,
+  /// or in half_values_ as fp16 when half_ is set.
+  std::unordered_map<std::string, unsigned> pretrained;
+  std::vector<float> values_;
+  std::vector<uint16_t> half_values_;
   NORMALIZER_TYPE normalizer_type;
   unsigned dim_;
+  bool half_;
+  /// The largest error of rounding the values to fp16.
+  float half_error_;
 
   WordEmbedding();
 
+  void add(const std::string & word, const std::vector<float> & value);
+
 public:
   static po::options_description get_options();
 
   static WordEmbedding* get();
 
-  void load(const std::string& embedding_file, unsigned dim);
+  /// Load the embeddings, store them in fp16 if half is set. A rendered
+  /// vector is widened to float only when it is looked up.
+  void load(const std::string& embedding_file, unsigned dim, bool half = false);
 
   void empty(unsigned dim);
 
@@ -1,7 +1,13 @@
 #include "ensemble.h"
 #include "json.hpp"
+#include "half.h"
+#include "logging.h"
 #include <iostream>
 #include <fstream>
+#include <cstring>
+#include <cstdio>
+#include <numeric>
+#include <algorithm>
 
 namespace twpipe {
 
@@ -9,6 +15,9 @@ const char* EnsembleInstance::id_name = "id";
 const char* EnsembleInstance::category_name = "category";
 const char* EnsembleInstance::prob_name = "prob";
 
+EnsembleInstance::EnsembleInstance() : id(0) {
+}
+
 EnsembleInstance::EnsembleInstance(unsigned id,
                                    std::vector<unsigned>& categories,
                                    std::vector<std::vector<float>>& probs) :
@@ -32,4 +41,297 @@ void EnsembleUtils::load_ensemble_instances(const std::string & path,
   }
 }
 
+const char* EnsembleDataWriter::magic = "TWPIPE.ENSEMBLE.1";
+
+EnsembleDataWriter::EnsembleDataWriter() : n_probs(0), top_k(0) {
+}
+
+bool EnsembleDataWriter::open(const std::string & output, unsigned n, unsigned k) {
+  path = output;
+  n_probs = n;
+  top_k = (k < n ? k : 0);
+  ids.clear();
+  offsets.clear();
+  ofs.open(path + ".tmp", std::ios::binary);
+  if (!ofs) { return false; }
+  ofs.write(magic, strlen(magic));
+  ofs.write(reinterpret_cast<const char *>(&n_probs), sizeof(unsigned));
+  ofs.write(reinterpret_cast<const char *>(&top_k), sizeof(unsigned));
+  return static_cast<bool>(ofs);
+}
+
+void EnsembleDataWriter::write(const EnsembleInstance & instance) {
+  ids.push_back(instance.id);
+  offsets.push_back(static_cast<uint64_t>(ofs.tellp()));
+
+  unsigned n_steps = instance.categories.size();
+  ofs.write(reinterpret_cast<const char *>(&n_steps), sizeof(unsigned));
+  ofs.write(reinterpret_cast<const char *>(instance.categories.data()), n_steps * sizeof(unsigned));
+  for (unsigned i = 0; i < n_steps; ++i) {
+    const std::vector<float> & prob = instance.probs[i];
+    if (prob.size() != n_probs) {
+      _ERROR << "[ensemble] instance #" << instance.id << " has " << prob.size()
+        << " probabilities, expected " << n_probs;
+      exit(1);
+    }
+    if (top_k == 0) {
+      buffer.resize(n_probs);
+      Half::narrow(prob.data(), n_probs, buffer.data());
+    } else {
+      std::vector<unsigned> index(n_probs);
+      std::iota(index.begin(), index.end(), 0);
+      std::partial_sort(index.begin(), index.begin() + top_k, index.end(),
+                        [&prob](unsigned a, unsigned b) { return prob[a] > prob[b]; });
+      buffer.resize(2 * top_k);
+      for (unsigned j = 0; j < top_k; ++j) {
+        buffer[j] = static_cast<uint16_t>(index[j]);
+        buffer[top_k + j] = Half::from_float(prob[index[j]]);
+      }
+    }
+    ofs.write(reinterpret_cast<const char *>(buffer.data()), buffer.size() * sizeof(uint16_t));
+  }
+}
+
+bool EnsembleDataWriter::close() {
+  uint64_t index_offset = static_cast<uint64_t>(ofs.tellp());
+  for (unsigned i = 0; i < ids.size(); ++i) {
+    ofs.write(reinterpret_cast<const char *>(&ids[i]), sizeof(unsigned));
+    ofs.write(reinterpret_cast<const char *>(&offsets[i]), sizeof(uint64_t));
+  }
+  unsigned n = ids.size();
+  ofs.write(reinterpret_cast<const char *>(&index_offset), sizeof(uint64_t));
+  ofs.write(reinterpret_cast<const char *>(&n), sizeof(unsigned));
+  ofs.close();
+  std::string tmp_path = path + ".tmp";
+  if (ofs.fail() || std::rename(tmp_path.c_str(), path.c_str()) != 0) {
+    std::remove(tmp_path.c_str());
+    return false;
+  }
+  return true;
+}
+
+EnsembleData::EnsembleData() : binary(false), in_memory(true), n_probs(0), top_k(0) {
+}
+
+bool EnsembleData::is_binary(const std::string & path) {
+  std::ifstream is(path, std::ios::binary);
+  std::string buffer(strlen(EnsembleDataWriter::magic), '\0');
+  is.read(&buffer[0], buffer.size());
+  return is && buffer == EnsembleDataWriter::magic;
+}
+
+void EnsembleData::load(const std::string & path, bool memory) {
+  binary = is_binary(path);
+  in_memory = (memory && !binary);
+  if (in_memory) {
+    EnsembleUtils::load_ensemble_instances(path, instances);
+    _INFO << "[ensemble] " << instances.size() << " instances loaded from " << path;
+    return;
+  }
+
+  if (!binary) {
+    // index the lines, only the id of each instance is kept.
+    ifs.open(path, std::ios::binary);
+    std::string buffer;
+    uint64_t offset = 0;
+    while (std::getline(ifs, buffer)) {
+      if (!buffer.empty()) {
+        nlohmann::json payload = nlohmann::json::parse(buffer);
+        ids.push_back(payload.at(EnsembleInstance::id_name).get<unsigned>());
+        offsets.push_back(offset);
+      }
+      offset += buffer.size() + 1;
+    }
+    ifs.clear();
+    _INFO << "[ensemble] index of " << ids.size() << " instances loaded from " << path;
+    return;
+  }
+
+  ifs.open(path, std::ios::binary);
+  ifs.seekg(0, std::ios::end);
+  uint64_t file_size = static_cast<uint64_t>(ifs.tellg());
+  uint64_t header_size = strlen(EnsembleDataWriter::magic) + 2 * sizeof(unsigned);
+  uint64_t trailer_size = sizeof(uint64_t) + sizeof(unsigned);
+  uint64_t entry_size = sizeof(unsigned) + sizeof(uint64_t);
+  if (!ifs || file_size < header_size + trailer_size) {
+    _ERROR << "[ensemble] broken ensemble data: " << path;
+    exit(1);
+  }
+  ifs.seekg(strlen(EnsembleDataWriter::magic));
+  ifs.read(reinterpret_cast<char *>(&n_probs), sizeof(unsigned));
+  ifs.read(reinterpret_cast<char *>(&top_k), sizeof(unsigned));
+
+  uint64_t index_offset = 0;
+  unsigned n = 0;
+  ifs.seekg(-static_cast<std::streamoff>(trailer_size), std::ios::end);
+  ifs.read(reinterpret_cast<char *>(&index_offset), sizeof(uint64_t));
+  ifs.read(reinterpret_cast<char *>(&n), sizeof(unsigned));
+  // the index sits between the instances and the trailer, check that the
+  // trailer agrees with the file before trusting its count.
+  if (!ifs || index_offset < header_size ||
+      index_offset > file_size - trailer_size ||
+      (file_size - trailer_size - index_offset) != static_cast<uint64_t>(n) * entry_size) {
+    _ERROR << "[ensemble] broken ensemble data, the index doesn't match the size of " << path;
+    exit(1);
+  }
+  ids.resize(n);
+  offsets.resize(n);
+  ifs.seekg(static_cast<std::streamoff>(index_offset));
+  for (unsigned i = 0; i < n; ++i) {
+    ifs.read(reinterpret_cast<char *>(&ids[i]), sizeof(unsigned));
+    ifs.read(reinterpret_cast<char *>(&offsets[i]), sizeof(uint64_t));
+    if (offsets[i] < header_size || offsets[i] >= index_offset) { ifs.setstate(std::ios::failbit); }
+  }
+  if (!ifs) {
+    _ERROR << "[ensemble] broken ensemble data: " << path;
+    exit(1);
+  }
+  _INFO << "[ensemble] index of " << n << " instances loaded from " << path
+    << (top_k == 0 ? ", dense" : ", top-" + std::to_string(top_k)) << " probabilities.";
+}
+
+unsigned EnsembleData::size() const {
+  return (in_memory ? instances.size() : ids.size());
+}
+
+unsigned EnsembleData::id(unsigned i) const {
+  return (in_memory ? instances[i].id : ids[i]);
+}
+
+const EnsembleInstance & EnsembleData::get(unsigned i) {
+  if (in_memory) { return instances.at(i); }
+
+  if (!binary) {
+    std::string buffer;
+    ifs.seekg(static_cast<std::streamoff>(offsets.at(i)));
+    std::getline(ifs, buffer);
+    nlohmann::json payload = nlohmann::json::parse(buffer);
+    current.id = payload.at(EnsembleInstance::id_name).get<unsigned>();
+    current.categories = payload.at(EnsembleInstance::category_name).get<std::vector<unsigned>>();
+    current.probs = payload.at(EnsembleInstance::prob_name).get<std::vector<std::vector<float>>>();
+    return current;
+  }
+
+  ifs.seekg(static_cast<std::streamoff>(offsets.at(i)));
+  unsigned n_steps = 0;
+  ifs.read(reinterpret_cast<char *>(&n_steps), sizeof(unsigned));
+  current.id = ids[i];
+  current.categories.resize(n_steps);
+  ifs.read(reinterpret_cast<char *>(current.categories.data()), n_steps * sizeof(unsigned));
+
+  unsigned n_values = (top_k == 0 ? n_probs : 2 * top_k);
+  buffer.resize(static_cast<size_t>(n_steps) * n_values);
+  ifs.read(reinterpret_cast<char *>(buffer.data()), buffer.size() * sizeof(uint16_t));
+  if (!ifs) {
+    _ERROR << "[ensemble] failed to read instance #" << current.id;
+    exit(1);
+  }
+
+  current.probs.resize(n_steps);
+  for (unsigned s = 0; s < n_steps; ++s) {
+    std::vector<float> & prob = current.probs[s];
+    const uint16_t * values = buffer.data() + static_cast<size_t>(s) * n_values;
+    if (top_k == 0) {
+      prob.resize(n_probs);
+      Half::widen(values, n_probs, prob.data());
+    } else {
+      prob.assign(n_probs, 0.f);
+      float sum = 0.f;
+      for (unsigned j = 0; j < top_k; ++j) {
+        float p = Half::to_float(values[top_k + j]);
+        prob[values[j]] = p;
+        sum += p;
+      }
+      if (sum > 0.f) {
+        for (unsigned j = 0; j < top_k; ++j) { prob[values[j]] /= sum; }
+      }
+    }
+  }
+  return current;
+}
+
+EnsembleStream::EnsembleStream(EnsembleData & data,
+                               const std::vector<unsigned> & order,
+                               unsigned chunk_size,
+                               unsigned window_size) :
+  data(data),
+  n_instances(order.size()),
+  window_size(std::max(1u, window_size)),
+  queue_size(std::max(1u, chunk_size)),
+  finished(true),
+  stopped(false) {
+  // the chunks follow the file order, so a chunk is read sequentially.
+  std::vector<unsigned> sorted(order);
+  std::sort(sorted.begin(), sorted.end());
+  for (unsigned i = 0; i < sorted.size(); i += queue_size) {
+    unsigned end = std::min<unsigned>(sorted.size(), i + queue_size);
+    chunks.push_back(std::vector<unsigned>(sorted.begin() + i, sorted.begin() + end));
+  }
+}
+
+EnsembleStream::~EnsembleStream() {
+  stop();
+}
+
+void EnsembleStream::start(unsigned seed) {
+  stop();
+  rng.seed(seed);
+  std::vector<unsigned> chunk_order(chunks.size());
+  std::iota(chunk_order.begin(), chunk_order.end(), 0);
+  std::shuffle(chunk_order.begin(), chunk_order.end(), rng);
+
+  window.clear();
+  queue.clear();
+  finished = false;
+  stopped = false;
+  worker = std::thread(&EnsembleStream::read_chunks, this, chunk_order);
+}
+
+void EnsembleStream::read_chunks(std::vector<unsigned> chunk_order) {
+  for (unsigned c : chunk_order) {
+    for (unsigned i : chunks[c]) {
+      const EnsembleInstance & instance = data.get(i);
+      std::unique_lock<std::mutex> lock(mtx);
+      not_full.wait(lock, [this]() { return stopped || queue.size() < queue_size; });
+      if (stopped) { return; }
+      queue.push_back(instance);
+      not_empty.notify_one();
+    }
+  }
+  std::lock_guard<std::mutex> lock(mtx);
+  finished = true;
+  not_empty.notify_one();
+}
+
+const EnsembleInstance & EnsembleStream::next() {
+  {
+    std::unique_lock<std::mutex> lock(mtx);
+    while (window.size() < window_size) {
+      not_empty.wait(lock, [this]() { return finished || !queue.empty(); });
+      if (queue.empty()) { break; }
+      window.push_back(std::move(queue.front()));
+      queue.pop_front();
+      not_full.notify_one();
+    }
+  }
+  if (window.empty()) {
+    _ERROR << "[ensemble] the stream is asked for more than " << n_instances << " instances.";
+    exit(1);
+  }
+  std::uniform_int_distribution<unsigned> distribution(0, window.size() - 1);
+  std::swap(window[distribution(rng)], window.back());
+  current = std::move(window.back());
+  window.pop_back();
+  return current;
+}
+
+void EnsembleStream::stop() {
+  {
+    std::lock_guard<std::mutex> lock(mtx);
+    stopped = true;
+    not_full.notify_one();
+  }
+  if (worker.joinable()) { worker.join(); }
+}
+
 }
@@ -3,7 +3,14 @@
 
 #include <string>
 #include <vector>
+#include <fstream>
+#include <cstdint>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 #include <unordered_map>
+#include <random>
 
 namespace twpipe {
 
@@ -16,6 +23,8 @@ struct EnsembleInstance {
   std::vector<unsigned> categories;
   std::vector<std::vector<float>> probs;
 
+  EnsembleInstance();
+
   EnsembleInstance(unsigned id,
                    std::vector<unsigned> & categories,
                    std::vector<std::vector<float>> & probs);
@@ -28,6 +37,116 @@ struct EnsembleUtils {
                                       EnsembleInstances & instances);
 };
 
+/// Write ensemble instances in the binary format, which is
+///   magic, #probs, top-k, [instance]*, [id, offset]*, index offset, #instances
+/// with native endianness. An instance is
+///   #steps, categories, probs
+/// where the probs of a step are #probs fp16 values when top-k is 0, or the
+/// top-k (uint16 index, fp16 value) pairs otherwise. The index at the end
+/// holds the id and the file offset of each instance.
+struct EnsembleDataWriter {
+  static const char* magic;
+
+  std::string path;
+  std::ofstream ofs;
+  unsigned n_probs;
+  unsigned top_k;
+  std::vector<unsigned> ids;
+  std::vector<uint64_t> offsets;
+  std::vector<uint16_t> buffer;
+
+  EnsembleDataWriter();
+
+  bool open(const std::string & path, unsigned n_probs, unsigned top_k);
+
+  void write(const EnsembleInstance & instance);
+
+  /// Write the index. The data is written to a temporary file which is
+  /// renamed to the path once complete, so a failed conversion never leaves
+  /// a truncated file behind, nor clobbers its input.
+  bool close();
+};
+
+/// The ensemble data used by the distillation trainers. The json lines are
+/// loaded into memory unless in_memory is off. The binary format, and the
+/// json lines not in memory, only have their index loaded, the instances
+/// are decoded from the file when they are asked for, so the memory doesn't
+/// grow with the size of the data. A top-k instance is decoded into dense
+/// vectors renormalized to one.
+struct EnsembleData {
+  bool binary;
+  bool in_memory;
+  EnsembleInstances instances;
+
+  std::ifstream ifs;
+  unsigned n_probs;
+  unsigned top_k;
+  std::vector<unsigned> ids;
+  std::vector<uint64_t> offsets;
+  std::vector<uint16_t> buffer;
+  EnsembleInstance current;
+
+  EnsembleData();
+
+  /// Load the file, its format is told by its first bytes.
+  void load(const std::string & path, bool in_memory = true);
+
+  static bool is_binary(const std::string & path);
+
+  unsigned size() const;
+
+  /// The sentence id of the i-th instance, without decoding the instance.
+  unsigned id(unsigned i) const;
+
+  /// The i-th instance. For the binary format, the returned instance is
+  /// overwritten by the next call.
+  const EnsembleInstance & get(unsigned i);
+};
+
+/// Hand out the instances of the ensemble data in a shuffled order within a
+/// bounded memory. Each epoch, a background thread reads the instances in
+/// chunks of consecutive instances, visiting the chunks in a shuffled order,
+/// and the instances it prefetched are drawn at random from a window of
+/// window_size instances. Only the thread reads the data during an epoch.
+struct EnsembleStream {
+  EnsembleData & data;
+  std::vector<std::vector<unsigned>> chunks;
+  unsigned n_instances;
+  unsigned window_size;
+  unsigned queue_size;
+
+  std::thread worker;
+  std::mutex mtx;
+  std::condition_variable not_empty;
+  std::condition_variable not_full;
+  std::deque<EnsembleInstance> queue;
+  bool finished;
+  bool stopped;
+
+  std::mt19937 rng;
+  std::vector<EnsembleInstance> window;
+  EnsembleInstance current;
+
+  /// order holds the indices of the instances to visit in each epoch.
+  EnsembleStream(EnsembleData & data,
+                 const std::vector<unsigned> & order,
+                 unsigned chunk_size,
+                 unsigned window_size);
+
+  ~EnsembleStream();
+
+  /// Start an epoch, the chunk order and the window are shuffled with seed.
+  void start(unsigned seed);
+
+  /// The next instance of the epoch, overwritten by the next call. There
+  /// are order.size() instances in an epoch.
+  const EnsembleInstance & next();
+
+  void stop();
+
+  void read_chunks(std::vector<unsigned> chunk_order);
+};
+
 }
 
 #endif  //  end for __TWPIPE_ENSEMBLE_H__
\ No newline at end of file
@@ -0,0 +1,85 @@
+#include "half.h"
+#include <cstring>
+#if defined(__F16C__)
+#include <immintrin.h>
+#endif
+
+namespace twpipe {
+
+uint16_t Half::from_float(float f) {
+  uint32_t x;
+  std::memcpy(&x, &f, sizeof(float));
+  uint32_t sign = (x >> 16) & 0x8000;
+  uint32_t mant = x & 0x007fffff;
+  uint32_t raw_exp = (x >> 23) & 0xff;
+  if (raw_exp == 0xff) {
+    // inf stays inf, nan stays a quiet nan.
+    return static_cast<uint16_t>(sign | 0x7c00 | (mant ? 0x200 : 0));
+  }
+  int exp = static_cast<int>(raw_exp) - 127 + 15;
+  if (exp >= 31) { return static_cast<uint16_t>(sign | 0x7c00); }
+  if (exp <= 0) {
+    // subnormal in half, or too small to be kept.
+    if (exp < -10) { return static_cast<uint16_t>(sign); }
+    mant |= 0x00800000;
+    uint32_t shift = 14 - exp;
+    uint32_t half = mant >> shift;
+    uint32_t rest = mant & ((1u << shift) - 1);
+    uint32_t halfway = 1u << (shift - 1);
+    if (rest > halfway || (rest == halfway && (half & 1))) { ++half; }
+    return static_cast<uint16_t>(sign | half);
+  }
+  uint32_t half = sign | (static_cast<uint32_t>(exp) << 10) | (mant >> 13);
+  uint32_t rest = mant & 0x1fff;
+  // a carry out of the mantissa correctly bumps the exponent.
+  if (rest > 0x1000 || (rest == 0x1000 && (half & 1))) { ++half; }
+  return static_cast<uint16_t>(half);
+}
+
+float Half::to_float(uint16_t h) {
+  uint32_t sign = static_cast<uint32_t>(h & 0x8000) << 16;
+  uint32_t exp = (h >> 10) & 0x1f;
+  uint32_t mant = h & 0x3ff;
+  uint32_t x;
+  if (exp == 0) {
+    if (mant == 0) {
+      x = sign;
+    } else {
+      // normalize the subnormal.
+      exp = 127 - 15 + 1;
+      while (!(mant & 0x400)) { mant <<= 1; --exp; }
+      x = sign | (exp << 23) | ((mant & 0x3ff) << 13);
+    }
+  } else if (exp == 31) {
+    x = sign | 0x7f800000 | (mant << 13);
+  } else {
+    x = sign | ((exp + 127 - 15) << 23) | (mant << 13);
+  }
+  float f;
+  std::memcpy(&f, &x, sizeof(float));
+  return f;
+}
+
+void Half::narrow(const float * x, unsigned n, uint16_t * h) {
+  unsigned i = 0;
+#if defined(__F16C__)
+  for (; i + 8 <= n; i += 8) {
+    __m128i v = _mm256_cvtps_ph(_mm256_loadu_ps(x + i), _MM_FROUND_TO_NEAREST_INT);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(h + i), v);
+  }
+#endif
+  for (; i < n; ++i) { h[i] = from_float(x[i]); }
+}
+
+void Half::widen(const uint16_t * h, unsigned n, float * x) {
+  unsigned i = 0;
+#if defined(__F16C__)
+  for (; i + 8 <= n; i += 8) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(h + i));
+    _mm256_storeu_ps(x + i, _mm256_cvtph_ps(v));
+  }
+#endif
+  for (; i < n; ++i) { x[i] = to_float(h[i]); }
+}
+
+}
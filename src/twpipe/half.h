@@ -0,0 +1,22 @@
+#ifndef __TWPIPE_HALF_H__
+#define __TWPIPE_HALF_H__
+
+#include <cstdint>
+
+namespace twpipe {
+
+/// IEEE 754 half precision, used to store the embedding tables. Rounding is
+/// to the nearest even. F16C is used when the compiler targets it.
+struct Half {
+  static uint16_t from_float(float x);
+
+  static float to_float(uint16_t h);
+
+  static void narrow(const float * x, unsigned n, uint16_t * h);
+
+  static void widen(const uint16_t * h, unsigned n, float * x);
+};
+
+}
+
+#endif  //  end for __TWPIPE_HALF_H__
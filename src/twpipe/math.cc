@@ -1,4 +1,8 @@
 #include "math.h"
+#include <limits>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 void twpipe::Math::softmax_inplace(std::vector<float>& x) {
   float m = x[0];
@@ -11,8 +15,66 @@ void twpipe::Math::softmax_inplace(std::vector<float>& x) {
   for (unsigned i = 0; i < x.size(); ++i) { x[i] /= s; }
 }
 
+void twpipe::Math::log_softmax_inplace(float * x, unsigned n) {
+  float m = x[0];
+  for (unsigned i = 1; i < n; ++i) { m = (x[i] > m ? x[i] : m); }
+  float s = 0.;
+  for (unsigned i = 0; i < n; ++i) { s += exp(x[i] - m); }
+  float z = m + log(s);
+  for (unsigned i = 0; i < n; ++i) { x[i] -= z; }
+}
+
 unsigned twpipe::Math::distribution_sample(const std::vector<float>& prob,
                                            std::mt19937 & gen) {
   std::discrete_distribution<unsigned> distrib(prob.begin(), prob.end());
   return distrib(gen);
 }
+
+unsigned twpipe::Math::masked_argmax(const std::vector<float>& x,
+                                     const std::vector<float>& penalty) {
+  const float * a = x.data();
+  const float * b = penalty.data();
+  unsigned n = x.size();
+  unsigned i = 0;
+  float best = -std::numeric_limits<float>::infinity();
+  unsigned best_i = 0;
+#ifdef __SSE2__
+  // one pass with four lanes, each keeping its max and the first index where
+  // it is reached, then the lanes are merged preferring the lower index.
+  if (n >= 4) {
+    __m128 lane_max = _mm_set1_ps(-std::numeric_limits<float>::infinity());
+    __m128i lane_idx = _mm_setzero_si128();
+    __m128i idx = _mm_setr_epi32(0, 1, 2, 3);
+    const __m128i step = _mm_set1_epi32(4);
+    for (; i + 4 <= n; i += 4) {
+      __m128 v = _mm_add_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i));
+      __m128 gt = _mm_cmpgt_ps(v, lane_max);
+      lane_max = _mm_or_ps(_mm_and_ps(gt, v), _mm_andnot_ps(gt, lane_max));
+      __m128i gti = _mm_castps_si128(gt);
+      lane_idx = _mm_or_si128(_mm_and_si128(gti, idx), _mm_andnot_si128(gti, lane_idx));
+      idx = _mm_add_epi32(idx, step);
+    }
+    float values[4];
+    unsigned indices[4];
+    _mm_storeu_ps(values, lane_max);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(indices), lane_idx);
+    for (unsigned j = 0; j < 4; ++j) {
+      if (values[j] > best || (values[j] == best && indices[j] < best_i)) {
+        best = values[j];
+        best_i = indices[j];
+      }
+    }
+  }
+#endif
+  for (; i < n; ++i) {
+    float v = a[i] + b[i];
+    if (v > best) { best = v; best_i = i; }
+  }
+  if (best == -std::numeric_limits<float>::infinity()) {
+    // no kept element scores above -inf (e.g. they are -inf or NaN), fall
+    // back to the first one kept rather than to a masked one.
+    for (best_i = 0; best_i < n && b[best_i] != 0.f; ++best_i) {}
+    if (best_i == n) { best_i = 0; }
+  }
+  return best_i;
+}
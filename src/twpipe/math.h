@@ -9,8 +9,16 @@ namespace twpipe {
 struct Math {
   static void softmax_inplace(std::vector<float>& x);
 
+  static void log_softmax_inplace(float * x, unsigned n);
+
   static unsigned distribution_sample(const std::vector<float>& prob,
                                       std::mt19937& gen);
+
+  /// The index of the max of x + penalty, where the penalty is 0 to keep an
+  /// element and -inf to mask it out. Return the first index on a tie, and
+  /// the first element kept when none of them scores above -inf.
+  static unsigned masked_argmax(const std::vector<float>& x,
+                                const std::vector<float>& penalty);
 };
 
 }
@@ -1,5 +1,8 @@
 #include "model.h"
+#include "quantize.h"
+#include "half.h"
 #include <fstream>
+#include <algorithm>
 #include <boost/algorithm/string.hpp>
 
 namespace twpipe {
@@ -12,7 +15,7 @@ const char* Model::kParserName = "parser";
 
 Model* Model::instance = nullptr;
 
-Model::Model() {
+Model::Model() : writer(nullptr) {
   payload[kSentenceSegmentAndTokenizeName] = nullptr;
   payload[kTokenizerName] = nullptr;
   payload[kPostaggerName] = nullptr;
@@ -34,10 +37,25 @@ Model * Model::get() {
   return instance;
 }
 
+Model::~Model() {
+  close_writer();
+}
+
+void Model::close_writer() {
+  if (writer != nullptr) {
+    // the destructor flushes the pending files and joins the thread.
+    delete writer;
+    writer = nullptr;
+  }
+}
+
 void Model::save(const std::string & filename) {
-  std::ofstream ofs(filename);
-  BOOST_ASSERT_MSG(ofs, "[model] failed to open file.");
-  ofs << payload;
+  for (auto & it : snapshots) { to_json(it.first, *(it.second)); }
+  snapshots.clear();
+  close_writer();
+
+  bool ok = CheckpointWriter::write_atomic(filename, [this](std::ostream & os) { os << payload; });
+  BOOST_ASSERT_MSG(ok, "[model] failed to open file.");
 }
 
 void Model::load(const std::string & filename) {
@@ -83,6 +101,62 @@ void Model::to_json(const std::string & phase_name,
   }
 }
 
+void Model::to_json(const std::string & phase_name,
+                    const ParameterSnapshot & snapshot) {
+  if (!valid_phase_name(phase_name)) {
+    BOOST_ASSERT_MSG(false, "[model] invalid phase name.");
+  }
+
+  auto & json = payload[phase_name]["model"];
+  for (unsigned i = 0; i < snapshot.names.size(); ++i) {
+    json[snapshot.names[i]]["dim"] = snapshot.values[i].size();
+    json[snapshot.names[i]]["value"] = snapshot.values[i];
+  }
+}
+
+void Model::snapshot(const std::string & phase_name,
+                     dynet::ParameterCollection & model) {
+  if (!valid_phase_name(phase_name)) {
+    BOOST_ASSERT_MSG(false, "[model] invalid phase name.");
+  }
+
+  std::shared_ptr<ParameterSnapshot> snapshot(new ParameterSnapshot);
+  snapshot->take(model);
+  snapshots[phase_name] = snapshot;
+
+  if (!checkpoint_prefix.empty()) {
+    get_writer()->submit(checkpoint_path(phase_name),
+                         [snapshot](std::ostream & os) { snapshot->write(os); });
+  }
+}
+
+void Model::enable_checkpoint(const std::string & prefix) {
+  checkpoint_prefix = prefix;
+}
+
+std::string Model::checkpoint_path(const std::string & phase_name) const {
+  return checkpoint_prefix + "." + phase_name + ".ckpt";
+}
+
+std::string Model::resume_path(const std::string & phase_name) const {
+  return checkpoint_prefix + "." + phase_name + ".resume";
+}
+
+bool Model::load_snapshot(const std::string & phase_name) {
+  std::ifstream ifs(checkpoint_path(phase_name), std::ios::binary);
+  if (!ifs) { return false; }
+
+  std::shared_ptr<ParameterSnapshot> snapshot(new ParameterSnapshot);
+  if (!snapshot->read(ifs)) { return false; }
+  snapshots[phase_name] = snapshot;
+  return true;
+}
+
+CheckpointWriter * Model::get_writer() {
+  if (writer == nullptr) { writer = new CheckpointWriter; }
+  return writer;
+}
+
 std::string Model::from_json(const std::string & phase_name,
                              const std::string & key) {
   if (!valid_phase_name(phase_name)) {
@@ -93,6 +167,102 @@ std::string Model::from_json(const std::string & phase_name,
   return json.value(key, "__empty__");
 }
 
+static const char * kBase64 = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+// the int8 and fp16 values are stored as the base64 of their bytes, which is
+// several times smaller than a json array of numbers.
+static std::string encode_base64(const std::vector<uint8_t> & bytes) {
+  std::string text;
+  text.reserve((bytes.size() + 2) / 3 * 4);
+  for (size_t i = 0; i < bytes.size(); i += 3) {
+    uint32_t n = bytes[i] << 16;
+    if (i + 1 < bytes.size()) { n |= bytes[i + 1] << 8; }
+    if (i + 2 < bytes.size()) { n |= bytes[i + 2]; }
+    text.push_back(kBase64[(n >> 18) & 63]);
+    text.push_back(kBase64[(n >> 12) & 63]);
+    text.push_back(i + 1 < bytes.size() ? kBase64[(n >> 6) & 63] : '=');
+    text.push_back(i + 2 < bytes.size() ? kBase64[n & 63] : '=');
+  }
+  return text;
+}
+
+static void decode_base64(const std::string & text, std::vector<uint8_t> & bytes) {
+  BOOST_ASSERT_MSG(text.size() % 4 == 0, "[model] broken base64 value.");
+  int index[256];
+  std::fill(index, index + 256, -1);
+  for (int i = 0; i < 64; ++i) { index[static_cast<unsigned char>(kBase64[i])] = i; }
+  bytes.clear();
+  bytes.reserve(text.size() / 4 * 3);
+  for (size_t i = 0; i < text.size(); i += 4) {
+    uint32_t n = 0;
+    unsigned n_pads = 0;
+    for (size_t j = i; j < i + 4; ++j) {
+      unsigned char ch = static_cast<unsigned char>(text[j]);
+      if (ch == '=') { n_pads++; n <<= 6; continue; }
+      BOOST_ASSERT_MSG(index[ch] >= 0 && n_pads == 0, "[model] broken base64 value.");
+      n = (n << 6) | index[ch];
+    }
+    bytes.push_back((n >> 16) & 0xff);
+    if (n_pads < 2) { bytes.push_back((n >> 8) & 0xff); }
+    if (n_pads < 1) { bytes.push_back(n & 0xff); }
+  }
+}
+
+static void to_json_int8(nlohmann::json & json,
+                         const std::vector<float> & values,
+                         unsigned rows,
+                         unsigned cols,
+                         bool column_major) {
+  Int8Matrix matrix;
+  matrix.quantize(values.data(), rows, cols, column_major);
+  json.erase("value");
+  json["dim"] = values.size();
+  json["rows"] = rows;
+  json["cols"] = cols;
+  json["layout"] = (column_major ? "column" : "row");
+  json["int8"] = encode_base64(std::vector<uint8_t>(matrix.values.begin(), matrix.values.end()));
+  json["scale"] = matrix.scales;
+}
+
+static void to_json_fp16(nlohmann::json & json, const std::vector<float> & values) {
+  std::vector<uint16_t> half(values.size());
+  Half::narrow(values.data(), values.size(), half.data());
+  // little endian, whatever the host is.
+  std::vector<uint8_t> bytes(half.size() * 2);
+  for (size_t i = 0; i < half.size(); ++i) {
+    bytes[2 * i] = half[i] & 0xff;
+    bytes[2 * i + 1] = half[i] >> 8;
+  }
+  json.erase("value");
+  json["dim"] = values.size();
+  json["fp16"] = encode_base64(bytes);
+}
+
+static void from_json_values(const nlohmann::json & json, std::vector<float> & values) {
+  if (json.count("fp16")) {
+    std::vector<uint8_t> bytes;
+    decode_base64(json["fp16"].get<std::string>(), bytes);
+    std::vector<uint16_t> half(bytes.size() / 2);
+    for (size_t i = 0; i < half.size(); ++i) {
+      half[i] = static_cast<uint16_t>(bytes[2 * i] | (bytes[2 * i + 1] << 8));
+    }
+    values.resize(half.size());
+    Half::widen(half.data(), half.size(), values.data());
+  } else if (json.count("int8")) {
+    Int8Matrix matrix;
+    matrix.rows = json["rows"];
+    matrix.cols = json["cols"];
+    std::vector<uint8_t> bytes;
+    decode_base64(json["int8"].get<std::string>(), bytes);
+    matrix.values.assign(bytes.begin(), bytes.end());
+    matrix.scales = json["scale"].get<std::vector<float>>();
+    values.resize(matrix.rows * matrix.cols);
+    matrix.dequantize(values.data(), json["layout"] == "column");
+  } else {
+    values = json["value"].get<std::vector<float>>();
+  }
+}
+
 void Model::from_json(const std::string & name, Alphabet & alphabet) {
   auto & json = payload[kGeneral][name];
   for (auto it = json.begin(); it != json.end(); ++it) {
@@ -111,19 +281,54 @@ void Model::from_json(const std::string & phase_name,
   for (auto & p : storage.params) {
     unsigned dim = json[p->name]["dim"];
     BOOST_ASSERT_MSG(p->dim.size() == dim, "[model] mismatch dimension when loading.");
-    std::vector<float> values(dim);
-    values = json[p->name]["value"].get<std::vector<float>>();
+    std::vector<float> values;
+    from_json_values(json[p->name], values);
     dynet::TensorTools::set_elements(p->values, values);
   }
   for (auto & p : storage.lookup_params) {
     unsigned dim = json[p->name]["dim"];
     BOOST_ASSERT_MSG(p->all_dim.size() == dim, "[model] mismatch dimension when loading.");
-    std::vector<float> values(dim);
-    values = json[p->name]["value"].get<std::vector<float>>();
+    std::vector<float> values;
+    from_json_values(json[p->name], values);
     dynet::TensorTools::set_elements(p->all_values, values);
   }
 }
 
+void Model::quantize(const std::string & phase_name,
+                     dynet::ParameterCollection & model,
+                     const std::string & precision) {
+  if (!valid_phase_name(phase_name)) {
+    BOOST_ASSERT_MSG(false, "[model] invalid phase name.");
+  }
+
+  const dynet::ParameterCollectionStorage & storage = model.get_storage();
+  auto & json = payload[phase_name]["model"];
+  payload[kGeneral]["precision"] = precision;
+  if (precision == "fp16") {
+    for (auto & p : storage.lookup_params) {
+      to_json_fp16(json[p->name], dynet::as_vector(p->all_values));
+    }
+    return;
+  }
+
+  for (auto & p : storage.params) {
+    if (p->dim.nd < 2) { continue; }
+    unsigned rows = p->dim.rows();
+    to_json_int8(json[p->name], dynet::as_vector(p->values), rows, p->dim.size() / rows, true);
+  }
+  for (auto & p : storage.lookup_params) {
+    // entries are contiguous, each of them is a row.
+    unsigned dim = p->dim.size();
+    to_json_int8(json[p->name], dynet::as_vector(p->all_values), p->all_dim.size() / dim, dim, false);
+  }
+}
+
+std::string Model::get_precision() const {
+  auto it = payload.find(kGeneral);
+  if (it == payload.end() || !it->is_object()) { return "float32"; }
+  return it->value("precision", "float32");
+}
+
 bool Model::has_segmentor_and_tokenizer_model() const {
   return !payload[kSentenceSegmentAndTokenizeName].is_null();
 }
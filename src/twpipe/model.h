@@ -2,9 +2,12 @@
 #define __TWPIPE_MODEL_H__
 
 #include <iostream>
+#include <map>
+#include <memory>
 #include <boost/program_options.hpp>
 #include "dynet/model.h"
 #include "alphabet.h"
+#include "checkpoint.h"
 #include "json.hpp"
 
 namespace po = boost::program_options;
@@ -19,8 +22,16 @@ protected:
   nlohmann::json payload;
   static Model * instance;
 
+  /// The latest snapshot of each phase, converted to json when saving.
+  std::map<std::string, std::shared_ptr<ParameterSnapshot>> snapshots;
+  CheckpointWriter * writer;
+  std::string checkpoint_prefix;
+
   Model();
 
+  /// Write what is left in the background writer and join its thread.
+  void close_writer();
+
 public:
   static const char* kGeneral;
   static const char* kTokenizerName;
@@ -32,6 +43,10 @@ public:
 
   static Model * get();
 
+  ~Model();
+
+  /// Save the model, the pending checkpoints are written and the background
+  /// writer is stopped before. A later checkpoint starts a new one.
   void save(const std::string & filename);
 
   void load(const std::string & filename);
@@ -45,6 +60,30 @@ public:
   void to_json(const std::string & phase_name,
                dynet::ParameterCollection & model);
 
+  void to_json(const std::string & phase_name,
+               const ParameterSnapshot & snapshot);
+
+  /// Copy the parameters of the phase into a snapshot which is used when
+  /// saving the model. When checkpointing is enabled, the snapshot is also
+  /// written into the phase's checkpoint file by a background thread.
+  void snapshot(const std::string & phase_name,
+                dynet::ParameterCollection & model);
+
+  /// Write the snapshots into [prefix].[phase_name].ckpt
+  void enable_checkpoint(const std::string & prefix);
+
+  std::string checkpoint_path(const std::string & phase_name) const;
+
+  /// The path of the checkpoint to resume the training of the phase from.
+  std::string resume_path(const std::string & phase_name) const;
+
+  /// Load the snapshot of the phase from its checkpoint file, used when
+  /// resuming a training. Return false if there is no checkpoint.
+  bool load_snapshot(const std::string & phase_name);
+
+  /// Get the background writer, which is created on the first call.
+  CheckpointWriter * get_writer();
+
   std::string from_json(const std::string & phase_name, const std::string & key);
 
   void from_json(const std::string & name,
@@ -53,6 +92,17 @@ public:
   void from_json(const std::string & phase_name,
                  dynet::ParameterCollection & model);
 
+  /// With int8, store the matrices of the phase as int8 with a scale per
+  /// row, and the lookup tables with a scale per entry. The vectors (e.g.
+  /// the biases) are kept in float. With fp16, only the lookup tables are
+  /// stored in half precision. from_json turns them back into float.
+  void quantize(const std::string & phase_name,
+                dynet::ParameterCollection & model,
+                const std::string & precision);
+
+  /// The precision of the weights in the model file, float32, int8 or fp16.
+  std::string get_precision() const;
+
   bool has_segmentor_and_tokenizer_model() const;
 
   bool has_tokenizer_model() const;
@@ -0,0 +1,211 @@
+#include "parallel.h"
+#include "logging.h"
+#include <cstdlib>
+#ifndef _MSC_VER
+#include <unistd.h>
+#include <sys/wait.h>
+#endif
+
+namespace twpipe {
+
+bool Parallel::write_all(int fd, const void * data, size_t n) {
+#ifndef _MSC_VER
+  const char * p = static_cast<const char *>(data);
+  while (n > 0) {
+    ssize_t w = write(fd, p, n);
+    if (w <= 0) { return false; }
+    p += w; n -= w;
+  }
+  return true;
+#else
+  return false;
+#endif
+}
+
+bool Parallel::read_all(int fd, void * data, size_t n) {
+#ifndef _MSC_VER
+  char * p = static_cast<char *>(data);
+  while (n > 0) {
+    ssize_t r = read(fd, p, n);
+    if (r <= 0) { return false; }
+    p += r; n -= r;
+  }
+  return true;
+#else
+  return false;
+#endif
+}
+
+void Parallel::run(unsigned n_workers,
+                   const WorkerFunction & func,
+                   std::vector<std::vector<float>> & results) {
+  results.clear();
+  results.resize(n_workers);
+#ifndef _MSC_VER
+  if (n_workers > 1) {
+    std::vector<pid_t> pids(n_workers);
+    std::vector<int> fds(n_workers);
+    for (unsigned wid = 0; wid < n_workers; ++wid) {
+      int pipefd[2];
+      if (pipe(pipefd) != 0) {
+        _ERROR << "[parallel] failed to create pipe.";
+        exit(1);
+      }
+      pid_t pid = fork();
+      if (pid < 0) {
+        _ERROR << "[parallel] failed to fork worker #" << wid;
+        exit(1);
+      }
+      if (pid == 0) {
+        close(pipefd[0]);
+        std::vector<float> ret = func(wid);
+        unsigned n = ret.size();
+        bool ok = (write_all(pipefd[1], &n, sizeof(unsigned)) &&
+                   write_all(pipefd[1], ret.data(), n * sizeof(float)));
+        close(pipefd[1]);
+        // skip the destructors and atexit handlers, they belong to the parent.
+        _exit(ok ? 0 : 1);
+      }
+      close(pipefd[1]);
+      pids[wid] = pid;
+      fds[wid] = pipefd[0];
+    }
+
+    bool failed = false;
+    for (unsigned wid = 0; wid < n_workers; ++wid) {
+      unsigned n = 0;
+      if (!read_all(fds[wid], &n, sizeof(unsigned))) {
+        failed = true;
+      } else {
+        results[wid].resize(n);
+        if (!read_all(fds[wid], results[wid].data(), n * sizeof(float))) { failed = true; }
+      }
+      close(fds[wid]);
+      int status = 0;
+      waitpid(pids[wid], &status, 0);
+      if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) { failed = true; }
+    }
+    if (failed) {
+      _ERROR << "[parallel] worker process failed.";
+      exit(1);
+    }
+    return;
+  }
+#endif
+  for (unsigned wid = 0; wid < n_workers; ++wid) {
+    results[wid] = func(wid);
+  }
+}
+
+void Parallel::spawn(unsigned n_workers,
+                     const StreamFunction & func,
+                     std::vector<int> & pids,
+                     std::vector<int> & fds) {
+  pids.clear();
+  fds.clear();
+#ifndef _MSC_VER
+  for (unsigned wid = 0; wid < n_workers; ++wid) {
+    int pipefd[2];
+    if (pipe(pipefd) != 0) {
+      _ERROR << "[parallel] failed to create pipe.";
+      exit(1);
+    }
+    pid_t pid = fork();
+    if (pid < 0) {
+      _ERROR << "[parallel] failed to fork worker #" << wid;
+      exit(1);
+    }
+    if (pid == 0) {
+      close(pipefd[0]);
+      for (int fd : fds) { close(fd); }
+      bool ok = func(wid, pipefd[1]);
+      close(pipefd[1]);
+      _exit(ok ? 0 : 1);
+    }
+    close(pipefd[1]);
+    pids.push_back(pid);
+    fds.push_back(pipefd[0]);
+  }
+#else
+  _ERROR << "[parallel] spawning workers requires fork.";
+  exit(1);
+#endif
+}
+
+void Parallel::spawn(unsigned n_workers,
+                     const DuplexFunction & func,
+                     std::vector<int> & pids,
+                     std::vector<int> & in_fds,
+                     std::vector<int> & out_fds) {
+  pids.clear();
+  in_fds.clear();
+  out_fds.clear();
+#ifndef _MSC_VER
+  for (unsigned wid = 0; wid < n_workers; ++wid) {
+    int inpipe[2], outpipe[2];
+    if (pipe(inpipe) != 0 || pipe(outpipe) != 0) {
+      _ERROR << "[parallel] failed to create pipe.";
+      exit(1);
+    }
+    pid_t pid = fork();
+    if (pid < 0) {
+      _ERROR << "[parallel] failed to fork worker #" << wid;
+      exit(1);
+    }
+    if (pid == 0) {
+      close(inpipe[1]);
+      close(outpipe[0]);
+      for (int fd : in_fds) { close(fd); }
+      for (int fd : out_fds) { close(fd); }
+      bool ok = func(wid, inpipe[0], outpipe[1]);
+      close(inpipe[0]);
+      close(outpipe[1]);
+      _exit(ok ? 0 : 1);
+    }
+    close(inpipe[0]);
+    close(outpipe[1]);
+    pids.push_back(pid);
+    in_fds.push_back(inpipe[1]);
+    out_fds.push_back(outpipe[0]);
+  }
+#else
+  _ERROR << "[parallel] spawning workers requires fork.";
+  exit(1);
+#endif
+}
+
+bool Parallel::join(const std::vector<int> & pids) {
+  bool ok = true;
+#ifndef _MSC_VER
+  for (int pid : pids) {
+    if (pid < 0) { continue; }
+    int status = 0;
+    waitpid(pid, &status, 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) { ok = false; }
+  }
+#endif
+  return ok;
+}
+
+bool Parallel::exited(int pid, bool & ok) {
+#ifndef _MSC_VER
+  int status = 0;
+  if (waitpid(pid, &status, WNOHANG) != pid) { return false; }
+  ok = (WIFEXITED(status) && WEXITSTATUS(status) == 0);
+  return true;
+#else
+  return false;
+#endif
+}
+
+std::pair<unsigned, unsigned> Parallel::shard(unsigned n,
+                                              unsigned n_workers,
+                                              unsigned worker_id) {
+  unsigned size = n / n_workers;
+  unsigned rest = n % n_workers;
+  unsigned begin = worker_id * size + (worker_id < rest ? worker_id : rest);
+  unsigned end = begin + size + (worker_id < rest ? 1 : 0);
+  return std::make_pair(begin, end);
+}
+
+}
\ No newline at end of file
@@ -0,0 +1,67 @@
+#ifndef __TWPIPE_PARALLEL_H__
+#define __TWPIPE_PARALLEL_H__
+
+#include <vector>
+#include <utility>
+#include <functional>
+#include <cstddef>
+
+namespace twpipe {
+
+struct Parallel {
+  typedef std::function<std::vector<float>(unsigned)> WorkerFunction;
+  typedef std::function<bool(unsigned, int)> StreamFunction;
+  typedef std::function<bool(unsigned, int, int)> DuplexFunction;
+
+  /// Run func(worker_id) in n_workers forked processes and collect what each
+  /// worker returns, ordered by worker id. Dynet allows a single live
+  /// computation graph per process, so the workers are processes rather than
+  /// threads. The memory of the workers, parameters included, is
+  /// copy-on-write, so nothing but the returned vectors reaches the caller.
+  /// Fall back to running the workers sequentially in the current process
+  /// when fork is not available.
+  static void run(unsigned n_workers,
+                  const WorkerFunction & func,
+                  std::vector<std::vector<float>> & results);
+
+  /// Fork n_workers processes running func(worker_id, fd), where fd is the
+  /// write end of a pipe whose read end is returned in fds, so the caller
+  /// reads what the workers produce while they are running. A worker exits
+  /// with failure if func returns false. Not available without fork.
+  static void spawn(unsigned n_workers,
+                    const StreamFunction & func,
+                    std::vector<int> & pids,
+                    std::vector<int> & fds);
+
+  /// Like the above, but each worker also reads from a second pipe whose
+  /// write end is returned in in_fds, so the caller can talk to the workers
+  /// while they are running. The workers run func(worker_id, in_fd, out_fd)
+  /// and the read ends of their output pipes are returned in out_fds.
+  static void spawn(unsigned n_workers,
+                    const DuplexFunction & func,
+                    std::vector<int> & pids,
+                    std::vector<int> & in_fds,
+                    std::vector<int> & out_fds);
+
+  /// Wait for the spawned workers, return false if any of them failed. The
+  /// workers already reaped by exited() are marked by a negative pid.
+  static bool join(const std::vector<int> & pids);
+
+  /// Check whether a spawned worker has exited without waiting for it. If it
+  /// has, it is reaped and ok tells whether it succeeded.
+  static bool exited(int pid, bool & ok);
+
+  /// Write or read n bytes on a pipe, return false if it is closed.
+  static bool write_all(int fd, const void * data, size_t n);
+  static bool read_all(int fd, void * data, size_t n);
+
+  /// Split [0, n) into n_workers contiguous shards, return the [begin, end)
+  /// of the worker_id-th shard.
+  static std::pair<unsigned, unsigned> shard(unsigned n,
+                                             unsigned n_workers,
+                                             unsigned worker_id);
+};
+
+}
+
+#endif  //  end for __TWPIPE_PARALLEL_H__
\ No newline at end of file
@@ -0,0 +1,75 @@
+#include "quantize.h"
+#include <cmath>
+#include <algorithm>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+namespace twpipe {
+
+static float quantize_row(const float * x, unsigned n, unsigned stride, int8_t * q) {
+  float max_abs = 0.f;
+  for (unsigned i = 0; i < n; ++i) { max_abs = std::max(max_abs, std::fabs(x[i * stride])); }
+  if (max_abs == 0.f) {
+    std::fill(q, q + n, 0);
+    return 0.f;
+  }
+  float inv = 127.f / max_abs;
+  for (unsigned i = 0; i < n; ++i) {
+    long v = std::lround(x[i * stride] * inv);
+    q[i] = static_cast<int8_t>(std::max(-127L, std::min(127L, v)));
+  }
+  return max_abs / 127.f;
+}
+
+static int32_t dot(const int8_t * a, const int8_t * b, unsigned n) {
+  unsigned i = 0;
+  int32_t sum = 0;
+#if defined(__AVX2__)
+  __m256i acc = _mm256_setzero_si256();
+  for (; i + 16 <= n; i += 16) {
+    __m256i va = _mm256_cvtepi8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i *>(a + i)));
+    __m256i vb = _mm256_cvtepi8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i *>(b + i)));
+    acc = _mm256_add_epi32(acc, _mm256_madd_epi16(va, vb));
+  }
+  __m128i s = _mm_add_epi32(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+  s = _mm_hadd_epi32(s, s);
+  s = _mm_hadd_epi32(s, s);
+  sum = _mm_cvtsi128_si32(s);
+#endif
+  for (; i < n; ++i) { sum += static_cast<int32_t>(a[i]) * static_cast<int32_t>(b[i]); }
+  return sum;
+}
+
+void Int8Matrix::quantize(const float * data, unsigned r, unsigned c, bool column_major) {
+  rows = r;
+  cols = c;
+  values.resize(rows * cols);
+  scales.resize(rows);
+  for (unsigned i = 0; i < rows; ++i) {
+    scales[i] = (column_major ?
+                 quantize_row(data + i, cols, rows, values.data() + i * cols) :
+                 quantize_row(data + i * cols, cols, 1, values.data() + i * cols));
+  }
+}
+
+void Int8Matrix::dequantize(float * data, bool column_major) const {
+  for (unsigned i = 0; i < rows; ++i) {
+    for (unsigned j = 0; j < cols; ++j) {
+      float v = scales[i] * values[i * cols + j];
+      if (column_major) { data[j * rows + i] = v; } else { data[i * cols + j] = v; }
+    }
+  }
+}
+
+void Int8Matrix::multiply_add(const float * x, float * y) const {
+  buffer.resize(cols);
+  float scale = quantize_row(x, cols, 1, buffer.data());
+  if (scale == 0.f) { return; }
+  const int8_t * row = values.data();
+  for (unsigned r = 0; r < rows; ++r, row += cols) {
+    y[r] += scales[r] * scale * static_cast<float>(dot(row, buffer.data(), cols));
+  }
+}
+
+}
@@ -0,0 +1,35 @@
+#ifndef __TWPIPE_QUANTIZE_H__
+#define __TWPIPE_QUANTIZE_H__
+
+#include <vector>
+#include <cstdint>
+
+namespace twpipe {
+
+/// A matrix stored as int8 with a float scale for each row, the value at
+/// (r, c) is scales[r] * values[r * cols + c]. The scale of a row is its
+/// largest magnitude over 127.
+struct Int8Matrix {
+  unsigned rows;
+  unsigned cols;
+  std::vector<int8_t> values;
+  std::vector<float> scales;
+  /// The quantized input of multiply_add.
+  mutable std::vector<int8_t> buffer;
+
+  Int8Matrix() : rows(0), cols(0) {}
+
+  /// Quantize a rows x cols matrix, which is column major as dynet stores
+  /// it unless column_major is false.
+  void quantize(const float * data, unsigned rows, unsigned cols, bool column_major = true);
+
+  void dequantize(float * data, bool column_major = true) const;
+
+  /// y += W x. The input is quantized with a single scale and the dot
+  /// products are accumulated in int32, with AVX2 when it is available.
+  void multiply_add(const float * x, float * y) const;
+};
+
+}
+
+#endif  //  end for __TWPIPE_QUANTIZE_H__
@@ -0,0 +1,254 @@
+#include "rnn_kernel.h"
+#include <cmath>
+#include <algorithm>
+#if (defined(__AVX2__) && defined(__FMA__)) || defined(__AVX512F__)
+#include <immintrin.h>
+#endif
+
+namespace twpipe {
+
+// exp by range reduction and a degree-5 polynomial (as in Cephes), the
+// relative error is about 1e-7 in the clamped range.
+#define TWPIPE_EXP_CONSTANTS \
+  const float kHi = 88.3762626647949f; \
+  const float kLo = -88.3762626647949f; \
+  const float kLog2e = 1.44269504088896341f; \
+  const float kC1 = 0.693359375f; \
+  const float kC2 = -2.12194440e-4f; \
+  const float kP0 = 1.9875691500E-4f; \
+  const float kP1 = 1.3981999507E-3f; \
+  const float kP2 = 8.3334519073E-3f; \
+  const float kP3 = 4.1665795894E-2f; \
+  const float kP4 = 1.6666665459E-1f; \
+  const float kP5 = 5.0000001201E-1f;
+
+#if defined(__AVX512F__)
+static inline __m512 exp_ps(__m512 x) {
+  TWPIPE_EXP_CONSTANTS
+  x = _mm512_min_ps(_mm512_max_ps(x, _mm512_set1_ps(kLo)), _mm512_set1_ps(kHi));
+  __m512 fx = _mm512_roundscale_ps(_mm512_fmadd_ps(x, _mm512_set1_ps(kLog2e), _mm512_set1_ps(0.5f)),
+                                   _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC);
+  x = _mm512_fnmadd_ps(fx, _mm512_set1_ps(kC1), x);
+  x = _mm512_fnmadd_ps(fx, _mm512_set1_ps(kC2), x);
+  __m512 y = _mm512_set1_ps(kP0);
+  y = _mm512_fmadd_ps(y, x, _mm512_set1_ps(kP1));
+  y = _mm512_fmadd_ps(y, x, _mm512_set1_ps(kP2));
+  y = _mm512_fmadd_ps(y, x, _mm512_set1_ps(kP3));
+  y = _mm512_fmadd_ps(y, x, _mm512_set1_ps(kP4));
+  y = _mm512_fmadd_ps(y, x, _mm512_set1_ps(kP5));
+  y = _mm512_fmadd_ps(y, _mm512_mul_ps(x, x), _mm512_add_ps(x, _mm512_set1_ps(1.f)));
+  __m512i n = _mm512_slli_epi32(_mm512_add_epi32(_mm512_cvttps_epi32(fx), _mm512_set1_epi32(127)), 23);
+  return _mm512_mul_ps(y, _mm512_castsi512_ps(n));
+}
+
+static inline __m512 sigmoid_ps(__m512 x) {
+  __m512 one = _mm512_set1_ps(1.f);
+  return _mm512_div_ps(one, _mm512_add_ps(one, exp_ps(_mm512_sub_ps(_mm512_setzero_ps(), x))));
+}
+#elif defined(__AVX2__) && defined(__FMA__)
+static inline __m256 exp_ps(__m256 x) {
+  TWPIPE_EXP_CONSTANTS
+  x = _mm256_min_ps(_mm256_max_ps(x, _mm256_set1_ps(kLo)), _mm256_set1_ps(kHi));
+  __m256 fx = _mm256_floor_ps(_mm256_fmadd_ps(x, _mm256_set1_ps(kLog2e), _mm256_set1_ps(0.5f)));
+  x = _mm256_fnmadd_ps(fx, _mm256_set1_ps(kC1), x);
+  x = _mm256_fnmadd_ps(fx, _mm256_set1_ps(kC2), x);
+  __m256 y = _mm256_set1_ps(kP0);
+  y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(kP1));
+  y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(kP2));
+  y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(kP3));
+  y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(kP4));
+  y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(kP5));
+  y = _mm256_fmadd_ps(y, _mm256_mul_ps(x, x), _mm256_add_ps(x, _mm256_set1_ps(1.f)));
+  __m256i n = _mm256_slli_epi32(_mm256_add_epi32(_mm256_cvttps_epi32(fx), _mm256_set1_epi32(127)), 23);
+  return _mm256_mul_ps(y, _mm256_castsi256_ps(n));
+}
+
+static inline __m256 sigmoid_ps(__m256 x) {
+  __m256 one = _mm256_set1_ps(1.f);
+  return _mm256_div_ps(one, _mm256_add_ps(one, exp_ps(_mm256_sub_ps(_mm256_setzero_ps(), x))));
+}
+#endif
+
+void Activation::sigmoid_inplace(float * x, unsigned n) {
+  unsigned i = 0;
+#if defined(__AVX512F__)
+  for (; i + 16 <= n; i += 16) { _mm512_storeu_ps(x + i, sigmoid_ps(_mm512_loadu_ps(x + i))); }
+#elif defined(__AVX2__) && defined(__FMA__)
+  for (; i + 8 <= n; i += 8) { _mm256_storeu_ps(x + i, sigmoid_ps(_mm256_loadu_ps(x + i))); }
+#endif
+  for (; i < n; ++i) { x[i] = 1.f / (1.f + std::exp(-x[i])); }
+}
+
+void Activation::tanh_inplace(float * x, unsigned n) {
+  // tanh(x) = 2 * sigmoid(2x) - 1
+  unsigned i = 0;
+#if defined(__AVX512F__)
+  __m512 two = _mm512_set1_ps(2.f), one = _mm512_set1_ps(1.f);
+  for (; i + 16 <= n; i += 16) {
+    __m512 s = sigmoid_ps(_mm512_mul_ps(two, _mm512_loadu_ps(x + i)));
+    _mm512_storeu_ps(x + i, _mm512_fmsub_ps(two, s, one));
+  }
+#elif defined(__AVX2__) && defined(__FMA__)
+  __m256 two = _mm256_set1_ps(2.f), one = _mm256_set1_ps(1.f);
+  for (; i + 8 <= n; i += 8) {
+    __m256 s = sigmoid_ps(_mm256_mul_ps(two, _mm256_loadu_ps(x + i)));
+    _mm256_storeu_ps(x + i, _mm256_fmsub_ps(two, s, one));
+  }
+#endif
+  for (; i < n; ++i) { x[i] = std::tanh(x[i]); }
+}
+
+void KernelMatrix::load(std::vector<float> & values, unsigned r, unsigned c, bool quantize) {
+  rows = r;
+  cols = c;
+  int8 = quantize;
+  if (int8) {
+    int8_weight.quantize(values.data(), rows, cols);
+    std::vector<float>().swap(weight);
+  } else {
+    weight.swap(values);
+  }
+  std::vector<float>().swap(values);
+}
+
+void KernelMatrix::load(dynet::ComputationGraph & cg, const dynet::Expression & expr, bool quantize) {
+  const dynet::Tensor & tensor = cg.get_value(expr);
+  std::vector<float> values = dynet::as_vector(tensor);
+  load(values, tensor.d.rows(), tensor.d.cols(), quantize);
+}
+
+void KernelMatrix::multiply_add(const float * x, float * y) const {
+  if (int8) {
+    int8_weight.multiply_add(x, y);
+    return;
+  }
+  const float * w = weight.data();
+  for (unsigned c = 0; c < cols; ++c, w += rows) {
+    float v = x[c];
+    for (unsigned r = 0; r < rows; ++r) { y[r] += w[r] * v; }
+  }
+}
+
+void PackedAffine::load(dynet::ComputationGraph & cg,
+                        const std::vector<std::vector<dynet::Expression>> & gates,
+                        bool int8) {
+  unsigned n_gates = gates.size();
+  std::vector<std::vector<float>> b(n_gates), wx(n_gates), wh(n_gates);
+  for (unsigned g = 0; g < n_gates; ++g) {
+    b[g] = dynet::as_vector(cg.get_value(gates[g][0]));
+    wx[g] = dynet::as_vector(cg.get_value(gates[g][1]));
+    wh[g] = dynet::as_vector(cg.get_value(gates[g][2]));
+  }
+  unsigned dim_gate = b[0].size();
+  rows = n_gates * dim_gate;
+  dim_x = wx[0].size() / dim_gate;
+  dim_h = wh[0].size() / dim_gate;
+
+  bias.resize(rows);
+  std::vector<float> packed(rows * (dim_x + dim_h));
+  for (unsigned g = 0; g < n_gates; ++g) {
+    std::copy(b[g].begin(), b[g].end(), bias.begin() + g * dim_gate);
+    for (unsigned c = 0; c < dim_x; ++c) {
+      std::copy(wx[g].begin() + c * dim_gate, wx[g].begin() + (c + 1) * dim_gate,
+                packed.begin() + c * rows + g * dim_gate);
+    }
+    for (unsigned c = 0; c < dim_h; ++c) {
+      std::copy(wh[g].begin() + c * dim_gate, wh[g].begin() + (c + 1) * dim_gate,
+                packed.begin() + (dim_x + c) * rows + g * dim_gate);
+    }
+  }
+  weight.load(packed, rows, dim_x + dim_h, int8);
+  input.resize(dim_x + dim_h);
+}
+
+void PackedAffine::apply(const float * x, const float * h, float * y) {
+  std::copy(bias.begin(), bias.end(), y);
+  std::copy(x, x + dim_x, input.begin());
+  std::copy(h, h + dim_h, input.begin() + dim_x);
+  weight.multiply_add(input.data(), y);
+}
+
+void FusedLSTMCell::load(dynet::ComputationGraph & cg, dynet::CoupledLSTMBuilder & builder, bool int8) {
+  layers.resize(builder.param_vars.size());
+  for (unsigned l = 0; l < layers.size(); ++l) {
+    std::vector<dynet::Expression> & vars = builder.param_vars[l];
+    layers[l].gates.load(cg, {
+      { vars[BI], vars[X2I], vars[H2I] },
+      { vars[BC], vars[X2C], vars[H2C] },
+      { vars[BO], vars[X2O], vars[H2O] }
+    }, int8);
+    layers[l].c2i.load(cg, vars[C2I], int8);
+    layers[l].c2o.load(cg, vars[C2O], int8);
+  }
+  dim_hidden = layers[0].gates.rows / 3;
+  zeros.assign(state_size(), 0.f);
+  buffer.resize(3 * dim_hidden);
+}
+
+void FusedLSTMCell::step(const float * x, const float * prev_state, float * state) {
+  // CoupledLSTMBuilder without a previous state is the same as with a zero
+  // one.
+  if (prev_state == nullptr) { prev_state = zeros.data(); }
+  unsigned dim = dim_hidden;
+  float * gate_i = buffer.data();
+  float * gate_w = gate_i + dim;
+  float * gate_o = gate_w + dim;
+  for (unsigned l = 0; l < layers.size(); ++l) {
+    const Layer & layer = layers[l];
+    const float * prev_h = prev_state + l * 2 * dim;
+    const float * prev_c = prev_h + dim;
+    float * h = state + l * 2 * dim;
+    float * c = h + dim;
+    const float * in = (l == 0 ? x : h - 2 * dim);
+
+    layer.gates.apply(in, prev_h, gate_i);
+    layer.c2i.multiply_add(prev_c, gate_i);
+    Activation::sigmoid_inplace(gate_i, dim);
+    Activation::tanh_inplace(gate_w, dim);
+    for (unsigned r = 0; r < dim; ++r) { c[r] = prev_c[r] + gate_i[r] * (gate_w[r] - prev_c[r]); }
+
+    layer.c2o.multiply_add(c, gate_o);
+    Activation::sigmoid_inplace(gate_o, dim);
+    for (unsigned r = 0; r < dim; ++r) { h[r] = c[r]; }
+    Activation::tanh_inplace(h, dim);
+    for (unsigned r = 0; r < dim; ++r) { h[r] *= gate_o[r]; }
+  }
+}
+
+void FusedGRUCell::load(dynet::ComputationGraph & cg, dynet::GRUBuilder & builder, bool int8) {
+  layers.resize(builder.param_vars.size());
+  for (unsigned l = 0; l < layers.size(); ++l) {
+    std::vector<dynet::Expression> & vars = builder.param_vars[l];
+    layers[l].gates.load(cg, {
+      { vars[BZ], vars[X2Z], vars[H2Z] },
+      { vars[BR], vars[X2R], vars[H2R] }
+    }, int8);
+    layers[l].candidate.load(cg, { { vars[BH], vars[X2H], vars[H2H] } }, int8);
+  }
+  dim_hidden = layers[0].candidate.rows;
+  zeros.assign(state_size(), 0.f);
+  buffer.resize(2 * dim_hidden);
+  reset_hidden.resize(dim_hidden);
+}
+
+void FusedGRUCell::step(const float * x, const float * prev_state, float * state) {
+  if (prev_state == nullptr) { prev_state = zeros.data(); }
+  unsigned dim = dim_hidden;
+  float * gate_z = buffer.data();
+  float * gate_r = gate_z + dim;
+  for (unsigned l = 0; l < layers.size(); ++l) {
+    const Layer & layer = layers[l];
+    const float * prev_h = prev_state + l * dim;
+    float * h = state + l * dim;
+    const float * in = (l == 0 ? x : h - dim);
+
+    layer.gates.apply(in, prev_h, gate_z);
+    Activation::sigmoid_inplace(gate_z, 2 * dim);
+    for (unsigned r = 0; r < dim; ++r) { reset_hidden[r] = gate_r[r] * prev_h[r]; }
+    layer.candidate.apply(in, reset_hidden.data(), h);
+    Activation::tanh_inplace(h, dim);
+    for (unsigned r = 0; r < dim; ++r) { h[r] = prev_h[r] + gate_z[r] * (h[r] - prev_h[r]); }
+  }
+}
+
+}
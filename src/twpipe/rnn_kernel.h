@@ -0,0 +1,197 @@
+#ifndef __TWPIPE_RNN_KERNEL_H__
+#define __TWPIPE_RNN_KERNEL_H__
+
+#include <vector>
+#include "dynet/lstm.h"
+#include "dynet/gru.h"
+#include "dynet_layer/layer.h"
+#include "quantize.h"
+
+namespace twpipe {
+
+/// Element-wise activations over float buffers. They use AVX-512 or AVX2
+/// when the compiler targets them and fall back to std::exp otherwise.
+struct Activation {
+  static void sigmoid_inplace(float * x, unsigned n);
+
+  static void tanh_inplace(float * x, unsigned n);
+};
+
+/// y += W x with W column major, as dynet keeps it. With int8, W is only
+/// kept in int8 with a scale per row and the float copy is released.
+struct KernelMatrix {
+  unsigned rows;
+  unsigned cols;
+  bool int8;
+  std::vector<float> weight;
+  Int8Matrix int8_weight;
+
+  KernelMatrix() : rows(0), cols(0), int8(false) {}
+
+  /// Take the values of a rows x cols matrix, values is left empty.
+  void load(std::vector<float> & values, unsigned rows, unsigned cols, bool int8);
+
+  void load(dynet::ComputationGraph & cg, const dynet::Expression & expr, bool int8);
+
+  void multiply_add(const float * x, float * y) const;
+};
+
+/// y = b + W [x; h] with W packed column major, so all the gates of a cell
+/// come out of a single GEMV.
+struct PackedAffine {
+  unsigned rows;
+  unsigned dim_x;
+  unsigned dim_h;
+  KernelMatrix weight;
+  std::vector<float> bias;
+  std::vector<float> input;
+
+  /// Pack the gates, each of them is (b, W_x, W_h), stacked by rows. W is
+  /// kept in int8 when int8 is set.
+  void load(dynet::ComputationGraph & cg,
+            const std::vector<std::vector<dynet::Expression>> & gates,
+            bool int8);
+
+  void apply(const float * x, const float * h, float * y);
+};
+
+/// The inference step of dynet::CoupledLSTMBuilder. A state holds the hidden
+/// and the memory cell of every layer, [h_0, c_0, h_1, c_1, ...].
+struct FusedLSTMCell {
+  enum { X2I, H2I, C2I, BI, X2O, H2O, C2O, BO, X2C, H2C, BC };
+
+  struct Layer {
+    PackedAffine gates;  // input, write and output gates
+    KernelMatrix c2i;
+    KernelMatrix c2o;
+  };
+
+  std::vector<Layer> layers;
+  unsigned dim_hidden;
+  std::vector<float> zeros;
+  std::vector<float> buffer;
+
+  /// Copy the weights out, the builder should be on the graph. The matrices
+  /// are kept in int8 when int8 is set.
+  void load(dynet::ComputationGraph & cg, dynet::CoupledLSTMBuilder & builder, bool int8);
+
+  unsigned state_size() const { return layers.size() * 2 * dim_hidden; }
+
+  /// prev_state is nullptr at the start of a sequence.
+  void step(const float * x, const float * prev_state, float * state);
+
+  const float * output(const float * state) const {
+    return state + (layers.size() - 1) * 2 * dim_hidden;
+  }
+};
+
+/// The inference step of dynet::GRUBuilder. A state holds the hidden of
+/// every layer.
+struct FusedGRUCell {
+  enum { X2Z, H2Z, BZ, X2R, H2R, BR, X2H, H2H, BH };
+
+  struct Layer {
+    PackedAffine gates;  // update and reset gates
+    PackedAffine candidate;
+  };
+
+  std::vector<Layer> layers;
+  unsigned dim_hidden;
+  std::vector<float> zeros;
+  std::vector<float> buffer;
+  std::vector<float> reset_hidden;
+
+  void load(dynet::ComputationGraph & cg, dynet::GRUBuilder & builder, bool int8);
+
+  unsigned state_size() const { return layers.size() * dim_hidden; }
+
+  void step(const float * x, const float * prev_state, float * state);
+
+  const float * output(const float * state) const {
+    return state + (layers.size() - 1) * dim_hidden;
+  }
+};
+
+template <class RNNBuilderType> struct FusedCell;
+template <> struct FusedCell<dynet::CoupledLSTMBuilder> { typedef FusedLSTMCell type; };
+template <> struct FusedCell<dynet::GRUBuilder> { typedef FusedGRUCell type; };
+
+/// Run a BiRNNLayer with the fused cells. The outputs are put back into the
+/// layer as input expressions, so get_output and get_final work as usual,
+/// but nothing flows back into the RNN. The weights are copied on the first
+/// use, in int8 if int8 is set, so it is only for inference.
+template <class RNNBuilderType>
+struct FusedBiRNN {
+  typedef typename FusedCell<RNNBuilderType>::type CellType;
+
+  CellType fw_cell;
+  CellType bw_cell;
+  std::vector<float> fw_guard;
+  std::vector<float> bw_guard;
+  bool loaded;
+
+  FusedBiRNN() : loaded(false) {}
+
+  void add_inputs(BiRNNLayer<RNNBuilderType> & layer,
+                  const std::vector<dynet::Expression> & inputs,
+                  bool int8) {
+    unsigned n = inputs.size();
+    layer.n_items = n;
+    layer.fw_hidden.resize(n);
+    layer.bw_hidden.resize(n);
+    if (n == 0) { return; }
+
+    dynet::ComputationGraph & cg = *inputs[0].pg;
+    if (!loaded) {
+      fw_cell.load(cg, layer.fw_rnn, int8);
+      bw_cell.load(cg, layer.bw_rnn, int8);
+      if (layer.have_guard) {
+        fw_guard = dynet::as_vector(cg.get_value(layer.fw_guard));
+        bw_guard = dynet::as_vector(cg.get_value(layer.bw_guard));
+      }
+      loaded = true;
+    }
+
+    unsigned dim_input = 0;
+    std::vector<float> values;
+    for (unsigned i = 0; i < n; ++i) {
+      std::vector<float> v = dynet::as_vector(cg.get_value(inputs[i]));
+      dim_input = v.size();
+      values.insert(values.end(), v.begin(), v.end());
+    }
+
+    run(cg, fw_cell, fw_guard, values, dim_input, false, layer.fw_hidden);
+    run(cg, bw_cell, bw_guard, values, dim_input, true, layer.bw_hidden);
+  }
+
+private:
+  void run(dynet::ComputationGraph & cg,
+           CellType & cell,
+           const std::vector<float> & guard,
+           const std::vector<float> & values,
+           unsigned dim_input,
+           bool reverse,
+           std::vector<dynet::Expression> & hidden) {
+    unsigned n = hidden.size();
+    unsigned size = cell.state_size();
+    unsigned dim_hidden = cell.dim_hidden;
+    std::vector<float> prev(size), curr(size);
+    const float * prev_state = nullptr;
+    if (!guard.empty()) {
+      cell.step(guard.data(), nullptr, prev.data());
+      prev_state = prev.data();
+    }
+    for (unsigned k = 0; k < n; ++k) {
+      unsigned i = (reverse ? n - 1 - k : k);
+      cell.step(values.data() + i * dim_input, prev_state, curr.data());
+      const float * h = cell.output(curr.data());
+      hidden[i] = dynet::input(cg, { dim_hidden }, std::vector<float>(h, h + dim_hidden));
+      prev.swap(curr);
+      prev_state = prev.data();
+    }
+  }
+};
+
+}
+
+#endif  //  end for __TWPIPE_RNN_KERNEL_H__
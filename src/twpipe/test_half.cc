@@ -0,0 +1,84 @@
+#include <iostream>
+#include <fstream>
+#include <random>
+#include <cmath>
+#include <cstdio>
+#include "half.h"
+#include "embedding.h"
+
+/// Check the fp16 storage against fp32: the conversions round within half
+/// an fp16 ulp, and the embeddings rendered from an fp16 table are within
+/// that error of the ones rendered from an fp32 table.
+
+struct TestEmbedding : public twpipe::WordEmbedding {
+  TestEmbedding() : WordEmbedding() {}
+};
+
+// half an ulp of fp16 relative to the value, for normal numbers.
+const float kRelativeError = 1.f / 2048.f;
+
+bool test_conversion(std::mt19937 & rng) {
+  std::uniform_real_distribution<float> uniform(-8.f, 8.f);
+  const unsigned n = 100000;
+  std::vector<float> x(n), y(n);
+  std::vector<uint16_t> h(n);
+  for (unsigned i = 0; i < n; ++i) { x[i] = uniform(rng); }
+  twpipe::Half::narrow(x.data(), n, h.data());
+  twpipe::Half::widen(h.data(), n, y.data());
+
+  unsigned n_errors = 0;
+  for (unsigned i = 0; i < n; ++i) {
+    if (h[i] != twpipe::Half::from_float(x[i]) || y[i] != twpipe::Half::to_float(h[i])) { n_errors++; }
+    // below 2^-14 the values are subnormal in fp16 and the error is absolute.
+    float bound = std::max(std::fabs(x[i]) * kRelativeError, 1.f / (1 << 25));
+    if (std::fabs(y[i] - x[i]) > bound) { n_errors++; }
+  }
+  std::cerr << "[test|half] conversion: " << n_errors << " errors in " << n << " values." << std::endl;
+  return n_errors == 0;
+}
+
+bool test_embedding(std::mt19937 & rng) {
+  const unsigned n_words = 1000, dim = 50;
+  std::normal_distribution<float> normal(0.f, 0.5f);
+  std::string path = "test_half.embedding";
+  std::vector<std::string> words(n_words);
+  {
+    std::ofstream ofs(path);
+    ofs << n_words << " " << dim << "\n";
+    for (unsigned i = 0; i < n_words; ++i) {
+      words[i] = "w" + std::to_string(i);
+      ofs << words[i];
+      for (unsigned j = 0; j < dim; ++j) { ofs << " " << normal(rng); }
+      ofs << "\n";
+    }
+  }
+
+  TestEmbedding full, half;
+  full.load(path, dim, false);
+  half.load(path, dim, true);
+  std::remove(path.c_str());
+
+  std::vector<std::vector<float>> expected, output;
+  full.render(words, expected);
+  half.render(words, output);
+
+  float max_error = 0.f;
+  unsigned n_errors = 0;
+  for (unsigned i = 0; i < n_words; ++i) {
+    for (unsigned j = 0; j < dim; ++j) {
+      float error = std::fabs(output[i][j] - expected[i][j]);
+      max_error = std::max(max_error, error);
+      if (error > std::max(std::fabs(expected[i][j]) * kRelativeError, 1.f / (1 << 25))) { n_errors++; }
+    }
+  }
+  std::cerr << "[test|half] embedding: largest error against fp32 " << max_error << ", "
+    << n_errors << " errors in " << n_words * dim << " values." << std::endl;
+  return n_errors == 0;
+}
+
+int main(int argc, char* argv[]) {
+  std::mt19937 rng(1234);
+  bool ok = test_conversion(rng);
+  ok = test_embedding(rng) && ok;
+  return ok ? 0 : 1;
+}
@@ -1,7 +1,13 @@
 #include "trainer.h"
 #include <fstream>
+#include <sstream>
+#include <algorithm>
 #include <boost/algorithm/string.hpp>
 #include <boost/assert.hpp>
+#include "dynet/dynet.h"
+#include "parallel.h"
+#include "model.h"
+#include "logging.h"
 
 namespace twpipe {
 
@@ -19,6 +25,13 @@ po::options_description Trainer::get_options() {
     ("max-iter", po::value<unsigned>()->default_value(100), "the maximum number of training.")
     ("evaluate-stops", po::value<unsigned>()->default_value(0), "perform early stopping.")
     ("evaluate-skips", po::value<unsigned>()->default_value(0), "skip the first n evaluation.")
+    ("batch-size", po::value<unsigned>()->default_value(1), "the number of instances summed before one update.")
+    ("train-threads", po::value<unsigned>()->default_value(1), "the number of data-parallel training workers (postagger).")
+    ("sync-batches", po::value<unsigned>()->default_value(16), "the number of batches a training worker runs between two parameter averagings (postagger).")
+    ("evaluate-threads", po::value<unsigned>()->default_value(1), "the number of workers evaluating the heldout data.")
+    ("checkpoint-stops", po::value<unsigned>()->default_value(0), "save a resumable checkpoint every n instances, 0 for every iteration.")
+    ("resume", "resume the training from the last checkpoint.")
+    ("evaluate-sample", po::value<unsigned>()->default_value(0), "evaluate on n heldout instances within an iteration, 0 for all. Only full evaluations save the model.")
     ;
   return training_opts;
 }
@@ -27,6 +40,17 @@ Trainer::Trainer(const po::variables_map & conf) {
   max_iter = conf["max-iter"].as<unsigned>();
   evaluate_stops = conf["evaluate-stops"].as<unsigned>();
   evaluate_skips = conf["evaluate-skips"].as<unsigned>();
+  train_threads = conf["train-threads"].as<unsigned>();
+  if (train_threads == 0) { train_threads = 1; }
+  sync_batches = conf["sync-batches"].as<unsigned>();
+  if (sync_batches == 0) { sync_batches = 1; }
+  batch_size = conf["batch-size"].as<unsigned>();
+  if (batch_size == 0) { batch_size = 1; }
+  evaluate_threads = conf["evaluate-threads"].as<unsigned>();
+  if (evaluate_threads == 0) { evaluate_threads = 1; }
+  evaluate_sample = conf["evaluate-sample"].as<unsigned>();
+  checkpoint_stops = conf["checkpoint-stops"].as<unsigned>();
+  resume = (conf.count("resume") > 0);
   lambda_ = conf["lambda"].as<float>();
 }
 
@@ -38,4 +62,138 @@ bool Trainer::need_evaluate(unsigned iter, unsigned n_trained) {
   return ((iter > evaluate_skips) && evaluate_stops > 0 && (n_trained % evaluate_stops == 0));
 }
 
+bool Trainer::need_evaluate(unsigned iter, unsigned n_before, unsigned n_after) {
+  return ((iter > evaluate_skips) && evaluate_stops > 0 &&
+          (n_before / evaluate_stops != n_after / evaluate_stops));
+}
+
+unsigned Trainer::n_until_evaluate(unsigned n_rest, unsigned n_trained) {
+  if (evaluate_stops == 0) { return n_rest; }
+  unsigned n = evaluate_stops - n_trained % evaluate_stops;
+  return (n < n_rest ? n : n_rest);
+}
+
+unsigned Trainer::n_until_checkpoint(unsigned n_rest, unsigned n_trained) {
+  if (checkpoint_stops == 0) { return n_rest; }
+  unsigned n = checkpoint_stops - n_trained % checkpoint_stops;
+  return (n < n_rest ? n : n_rest);
+}
+
+bool Trainer::need_checkpoint(unsigned n_trained) {
+  return (checkpoint_stops > 0 && n_trained % checkpoint_stops == 0);
+}
+
+void Trainer::save_training_checkpoint(const std::string & phase_name,
+                                       dynet::ParameterCollection & model,
+                                       dynet::Trainer * trainer,
+                                       const TrainingCheckpoint & state) {
+  std::shared_ptr<TrainingCheckpoint> ckpt(new TrainingCheckpoint(state));
+  std::ostringstream rng_state;
+  rng_state << (*dynet::rndeng);
+  ckpt->rng_state = rng_state.str();
+  std::ostringstream optimizer_state;
+  trainer->save(optimizer_state);
+  ckpt->optimizer_state = optimizer_state.str();
+  ckpt->parameters.take(model);
+
+  Model::get()->get_writer()->submit(Model::get()->resume_path(phase_name),
+                                     [ckpt](std::ostream & os) { ckpt->write(os); });
+}
+
+bool Trainer::load_training_checkpoint(const std::string & phase_name,
+                                       dynet::ParameterCollection & model,
+                                       dynet::Trainer * trainer,
+                                       TrainingCheckpoint & ckpt) {
+  std::string path = Model::get()->resume_path(phase_name);
+  std::ifstream ifs(path, std::ios::binary);
+  if (!ifs) {
+    _WARN << "[train] checkpoint " << path << " not found.";
+    return false;
+  }
+  if (!ckpt.read(ifs)) {
+    _ERROR << "[train] checkpoint " << path << " is broken.";
+    exit(1);
+  }
+
+  ckpt.parameters.restore(model);
+  std::istringstream optimizer_state(ckpt.optimizer_state);
+  trainer->populate(optimizer_state);
+  std::istringstream rng_state(ckpt.rng_state);
+  rng_state >> (*dynet::rndeng);
+  Model::get()->load_snapshot(phase_name);
+  _INFO << "[train] resume from " << path << ": iteration #" << ckpt.iter
+    << ", " << ckpt.cursor << " instances trained, best score = " << ckpt.best_score;
+  return true;
+}
+
+void Trainer::shuffle(std::vector<unsigned> & order,
+                      const std::vector<unsigned> & lengths) {
+  std::shuffle(order.begin(), order.end(), *dynet::rndeng);
+  if (batch_size == 1) { return; }
+
+  // sort by length inside pools of 50 batches, so the batches are still
+  // different between iterations.
+  const unsigned pool_size = batch_size * 50;
+  for (unsigned begin = 0; begin < order.size(); begin += pool_size) {
+    unsigned end = std::min<unsigned>(begin + pool_size, order.size());
+    std::stable_sort(order.begin() + begin, order.begin() + end,
+                     [&lengths](unsigned a, unsigned b) { return lengths[a] < lengths[b]; });
+  }
+
+  // the last (incomplete) batch stays at the end to keep the batch boundaries.
+  std::vector<unsigned> batches;
+  for (unsigned begin = 0; begin + batch_size <= order.size(); begin += batch_size) {
+    batches.push_back(begin);
+  }
+  std::shuffle(batches.begin(), batches.end(), *dynet::rndeng);
+  if (order.size() % batch_size != 0) { batches.push_back(order.size() - order.size() % batch_size); }
+
+  std::vector<unsigned> shuffled;
+  shuffled.reserve(order.size());
+  for (unsigned begin : batches) {
+    unsigned end = std::min<unsigned>(begin + batch_size, order.size());
+    shuffled.insert(shuffled.end(), order.begin() + begin, order.begin() + end);
+  }
+  order.swap(shuffled);
+}
+
+bool Trainer::is_sampled(unsigned n_devel) {
+  return (evaluate_sample > 0 && evaluate_sample < n_devel);
+}
+
+std::vector<float> Trainer::evaluate_counts(unsigned n_devel,
+                                            bool full,
+                                            const EvaluateFunction & func) {
+  std::vector<unsigned> ids;
+  if (full || !is_sampled(n_devel)) {
+    for (unsigned sid = 0; sid < n_devel; ++sid) { ids.push_back(sid); }
+  } else {
+    // evenly spaced, so the subsample is the same for all the evaluations.
+    for (unsigned i = 0; i < evaluate_sample; ++i) {
+      ids.push_back(static_cast<unsigned>(static_cast<double>(i) * n_devel / evaluate_sample));
+    }
+  }
+
+  unsigned n_workers = std::min<unsigned>(evaluate_threads, ids.size());
+  if (n_workers == 0) { n_workers = 1; }
+  std::vector<std::vector<float>> results;
+  Parallel::run(n_workers, [&](unsigned wid) {
+    std::pair<unsigned, unsigned> range = Parallel::shard(ids.size(), n_workers, wid);
+    std::vector<float> counts;
+    for (unsigned i = range.first; i < range.second; ++i) {
+      std::vector<float> payload = func(ids[i]);
+      if (counts.size() < payload.size()) { counts.resize(payload.size(), 0.f); }
+      for (unsigned k = 0; k < payload.size(); ++k) { counts[k] += payload[k]; }
+    }
+    return counts;
+  }, results);
+
+  std::vector<float> ret;
+  for (const std::vector<float> & counts : results) {
+    if (ret.size() < counts.size()) { ret.resize(counts.size(), 0.f); }
+    for (unsigned k = 0; k < counts.size(); ++k) { ret[k] += counts[k]; }
+  }
+  return ret;
+}
+
 }
\ No newline at end of file
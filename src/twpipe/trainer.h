@@ -2,7 +2,12 @@
 #define __TWPIPE_TRAINER_H__
 
 #include <iostream>
+#include <vector>
+#include <functional>
 #include <boost/program_options.hpp>
+#include "dynet/model.h"
+#include "dynet/training.h"
+#include "checkpoint.h"
 
 namespace po = boost::program_options;
 
@@ -13,6 +18,13 @@ struct Trainer {
   unsigned max_iter;
   unsigned evaluate_stops;
   unsigned evaluate_skips;
+  unsigned train_threads;
+  unsigned sync_batches;
+  unsigned batch_size;
+  unsigned evaluate_threads;
+  unsigned evaluate_sample;
+  unsigned checkpoint_stops;
+  bool resume;
   float lambda_;
 
   static po::options_description get_options();
@@ -22,6 +34,56 @@ struct Trainer {
   bool need_evaluate(unsigned iter);
   
   bool need_evaluate(unsigned iter, unsigned n_trained);
+
+  /// Whether an evaluation stop falls in (n_before, n_after], used when the
+  /// training advances by more than one instance between two checks.
+  bool need_evaluate(unsigned iter, unsigned n_before, unsigned n_after);
+
+  /// The number of instances (at most n_rest) to train before reaching the
+  /// next evaluation stop.
+  unsigned n_until_evaluate(unsigned n_rest, unsigned n_trained);
+
+  /// The number of instances (at most n_rest) to train before the next
+  /// resumable checkpoint, and whether one should be saved now.
+  unsigned n_until_checkpoint(unsigned n_rest, unsigned n_trained);
+
+  bool need_checkpoint(unsigned n_trained);
+
+  /// Save the state of the training into the phase's resume file. The file
+  /// is written by the background writer.
+  void save_training_checkpoint(const std::string & phase_name,
+                                dynet::ParameterCollection & model,
+                                dynet::Trainer * trainer,
+                                const TrainingCheckpoint & state);
+
+  /// Restore the parameters, the optimizer and the random engine from the
+  /// phase's resume file, fill the rest of the state into ckpt. Return false
+  /// if there is nothing to resume from.
+  bool load_training_checkpoint(const std::string & phase_name,
+                                dynet::ParameterCollection & model,
+                                dynet::Trainer * trainer,
+                                TrainingCheckpoint & ckpt);
+
+  /// Shuffle the training order. When training with mini-batches, instances
+  /// of similar length (lengths is indexed by the instance id) are grouped
+  /// into consecutive batches and then the batches are shuffled.
+  void shuffle(std::vector<unsigned> & order,
+               const std::vector<unsigned> & lengths);
+
+  /// Whether the intermediate evaluations on n_devel heldout instances only
+  /// use a subsample of them.
+  bool is_sampled(unsigned n_devel);
+
+  typedef std::function<std::vector<float>(unsigned)> EvaluateFunction;
+
+  /// Sum the counts func(sid) returns over the heldout instances. Intermediate
+  /// evaluations (full = false) only use an evenly spaced subsample of
+  /// evaluate_sample instances. The instances are split into contiguous shards
+  /// evaluated by evaluate_threads workers and the counts are summed in the
+  /// order of the shards, so the result doesn't depend on the scheduling.
+  std::vector<float> evaluate_counts(unsigned n_devel,
+                                     bool full,
+                                     const EvaluateFunction & func);
 };
 
 }